@@ -0,0 +1,151 @@
+// Compares decoding a FuturesOrder from a TcpCode package and from a binary frame, and
+// decoding bursts of binary frames on the heap and into a DecodeArena.
+// Run: bench/bin/bench_decode [--benchmark_filter=...]
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include "tcp_code.h"
+#include "decode_arena.h"
+#include "logger.h"
+#include "futures_order.pb.h"
+
+namespace {
+
+cs_proto::FuturesOrder make_order() {
+    cs_proto::FuturesOrder order;
+    order.set_order_id("ord12345-17");
+    order.set_user_id("user12345");
+    order.set_symbol("BTCUSD");
+    order.set_side(cs_proto::OrderSide::BUY);
+    order.set_type(cs_proto::OrderType(1));
+    order.set_quantity(3.0);
+    order.set_price(51234.0);
+    order.set_status(cs_proto::OrderStatus::PENDING);
+    order.set_timestamp(1790000000);
+    order.set_client_id(12345);
+    order.set_client_seq(17);
+    return order;
+}
+
+std::string make_package(const cs_proto::FuturesOrder& order) {
+    return TcpCode::encode(order);
+}
+
+std::string make_binary_frame(const cs_proto::FuturesOrder& order) {
+    std::string frame(TcpCode::binary_encoded_size(order), '\0');
+    TcpCode::encode_binary_to(order, MsgRegistry::id_of(order), 0, 1, &frame[0], static_cast<int>(frame.size()));
+    return frame;
+}
+
+void BM_DecodeTcpCode(benchmark::State& state) {
+    std::string package = make_package(make_order());
+    for (auto _ : state) {
+        MsgId id = MSG_NONE;
+        MsgPtr message(TcpCode::decode(package.data(), static_cast<int>(package.size()), &id));
+        benchmark::DoNotOptimize(message.get());
+    }
+}
+
+void BM_DecodeBinary(benchmark::State& state) {
+    std::string frame = make_binary_frame(make_order());
+    for (auto _ : state) {
+        MsgId id = MSG_NONE;
+        MsgPtr message(TcpCode::decode_binary(frame.data(), static_cast<int>(frame.size()), &id));
+        benchmark::DoNotOptimize(message.get());
+    }
+}
+
+// Frames in one burst, a read of a busy connection
+const int BURST_FRAMES = 1000;
+size_t g_allocations = 0;
+
+// Decodes a burst of binary frames, keeping every message alive until the burst is done as
+// the gateway does, then drops them. Returns how many were decoded
+int decode_burst(const std::string& frame, DecodeArena* arena) {
+    google::protobuf::Arena* on = arena != nullptr ? arena->get() : nullptr;
+    static MsgPtr messages[BURST_FRAMES];
+    int decoded = 0;
+    for (int i = 0; i < BURST_FRAMES; ++i) {
+        messages[i].reset(TcpCode::decode_binary(frame.data(), static_cast<int>(frame.size()), nullptr, on));
+        decoded += messages[i] != nullptr;
+    }
+    for (MsgPtr& message : messages) {
+        message.reset();
+    }
+    if (arena != nullptr) {
+        arena->reset();
+    }
+    return decoded;
+}
+
+void BM_DecodeBurstHeap(benchmark::State& state) {
+    std::string frame = make_binary_frame(make_order());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(decode_burst(frame, nullptr));
+    }
+    state.SetItemsProcessed(state.iterations() * BURST_FRAMES);
+}
+
+void BM_DecodeBurstArena(benchmark::State& state) {
+    std::string frame = make_binary_frame(make_order());
+    DecodeArena arena;
+    arena.init(DECODE_ARENA_BLOCK_SIZE);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(decode_burst(frame, &arena));
+    }
+    state.SetItemsProcessed(state.iterations() * BURST_FRAMES);
+}
+
+// Heap allocations per decoded order, counted through the global operator new below
+void print_burst_allocations(const char* name, const std::string& frame, DecodeArena* arena) {
+    decode_burst(frame, arena);
+    size_t before = g_allocations;
+    uint64_t blocks = DecodeArena::blocks_allocated();
+    decode_burst(frame, arena);
+    printf("%-24s %.2f allocations per order, %lu arena blocks per burst\n", name,
+           static_cast<double>(g_allocations - before) / BURST_FRAMES,
+           static_cast<unsigned long>(DecodeArena::blocks_allocated() - blocks));
+}
+
+}  // namespace
+
+BENCHMARK(BM_DecodeTcpCode);
+BENCHMARK(BM_DecodeBinary);
+BENCHMARK(BM_DecodeBurstHeap);
+BENCHMARK(BM_DecodeBurstArena);
+
+void* operator new(size_t size) {
+    ++g_allocations;
+    void* p = ::malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    ::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    ::free(p);
+}
+
+int main(int argc, char** argv) {
+    Logger::init("bench_decode.log");
+    Logger::set_level(INFO);
+
+    cs_proto::FuturesOrder order = make_order();
+    printf("FuturesOrder body %zu bytes, TcpCode package %zu bytes, binary frame %zu bytes\n",
+           order.ByteSizeLong(), make_package(order).size(), make_binary_frame(order).size());
+    DecodeArena arena;
+    arena.init(DECODE_ARENA_BLOCK_SIZE);
+    print_burst_allocations("burst on the heap", make_binary_frame(order), nullptr);
+    print_burst_allocations("burst into the arena", make_binary_frame(order), &arena);
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Compares the TcpCode encode paths against copies of the implementation they replaced.
+// Run: bench/bin/bench_encode [--benchmark_filter=...]
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include "tcp_code.h"
+#include "tcp_comm.h"
+#include "logger.h"
+#include "futures_order.pb.h"
+
+namespace {
+
+// TcpCode::encode() before the change: appends to a growing string and logs at INFO
+std::string old_encode(const google::protobuf::Message& message) {
+    std::string result;
+    result.resize(PKGHEAD_FIELD_SIZE);
+    const std::string& type_name = message.GetTypeName();
+    int name_len = static_cast<int>(type_name.size() + 1);
+    int be32 = ::htonl(name_len);
+    result.append(reinterpret_cast<char*>(&be32), sizeof(be32));
+    result.append(type_name.c_str(), name_len);
+    if (message.AppendToString(&result)) {
+        int len = ::htonl(result.size());
+        std::copy(reinterpret_cast<char*>(&len), reinterpret_cast<char*>(&len) + sizeof(len), result.begin());
+        LOG(INFO, "Encoded message successfully, name={0:s}", type_name);
+    } else {
+        result.clear();
+    }
+    return result;
+}
+
+// TcpCode::encoded_size() before the change
+int old_encoded_size(const google::protobuf::Message& message) {
+    int name_len = static_cast<int>(message.GetTypeName().size() + 1);
+    return 2*PKGHEAD_FIELD_SIZE + name_len + static_cast<int>(message.ByteSizeLong());
+}
+
+// TcpCode::encode_to() before the change: measures the message again and copies the type name
+int old_encode_to(const google::protobuf::Message& message, char* buffer, int capacity) {
+    const std::string& type_name = message.GetTypeName();
+    int name_len = static_cast<int>(type_name.size() + 1);
+    int body_len = static_cast<int>(message.ByteSizeLong());
+    int total_len = 2*PKGHEAD_FIELD_SIZE + name_len + body_len;
+    if (total_len > capacity) {
+        return -1;
+    }
+    int be32 = ::htonl(total_len);
+    ::memcpy(buffer, &be32, sizeof(be32));
+    be32 = ::htonl(name_len);
+    ::memcpy(buffer + PKGHEAD_FIELD_SIZE, &be32, sizeof(be32));
+    ::memcpy(buffer + 2*PKGHEAD_FIELD_SIZE, type_name.c_str(), name_len);
+    if (!message.SerializeToArray(buffer + 2*PKGHEAD_FIELD_SIZE + name_len, body_len)) {
+        return -1;
+    }
+    return total_len;
+}
+
+cs_proto::OrderResponse make_response() {
+    cs_proto::OrderResponse response;
+    response.set_order_id("ORD-20261017-000123456");
+    response.set_status(cs_proto::ACCEPTED);
+    response.set_message("Order accepted by matching engine");
+    response.set_client_id(0x12345);
+    response.set_client_seq(987654321);
+    return response;
+}
+
+cs_proto::OrderResponseBatch make_batch() {
+    cs_proto::OrderResponseBatch batch;
+    for (int i = 0; i < 16; ++i) {
+        *batch.add_responses() = make_response();
+    }
+    batch.set_client_id(7);
+    return batch;
+}
+
+char g_buffer[64 * 1024];
+size_t g_allocations = 0;
+
+template <class M>
+void BM_OldEncodeString(benchmark::State& state, M message) {
+    for (auto _ : state) {
+        std::string package = old_encode(message);
+        benchmark::DoNotOptimize(package.data());
+    }
+}
+
+template <class M>
+void BM_NewEncodeString(benchmark::State& state, M message) {
+    for (auto _ : state) {
+        std::string package = TcpCode::encode(message);
+        benchmark::DoNotOptimize(package.data());
+    }
+}
+
+// The send path: measure to reserve queue space, then encode into it
+template <class M>
+void BM_OldSizeThenEncodeTo(benchmark::State& state, M message) {
+    for (auto _ : state) {
+        int len = old_encoded_size(message);
+        benchmark::DoNotOptimize(old_encode_to(message, g_buffer, len));
+    }
+}
+
+template <class M>
+void BM_NewSizeThenEncodeSizedTo(benchmark::State& state, M message) {
+    for (auto _ : state) {
+        int len = TcpCode::encoded_size(message);
+        benchmark::DoNotOptimize(TcpCode::encode_sized_to(message, g_buffer, len));
+    }
+}
+
+template <class M>
+void BM_NewEncodeTo(benchmark::State& state, M message) {
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(TcpCode::encode_to(message, g_buffer, sizeof(g_buffer)));
+    }
+}
+
+// Heap allocations per call, counted through the global operator new below
+template <class F>
+void print_allocations(const char* name, F fn) {
+    fn();
+    size_t before = g_allocations;
+    for (int i = 0; i < 1000; ++i) {
+        fn();
+    }
+    printf("%-36s %.2f allocations per call\n", name, (g_allocations - before) / 1000.0);
+}
+
+}  // namespace
+
+BENCHMARK_CAPTURE(BM_OldEncodeString, response, make_response());
+BENCHMARK_CAPTURE(BM_NewEncodeString, response, make_response());
+BENCHMARK_CAPTURE(BM_OldSizeThenEncodeTo, response, make_response());
+BENCHMARK_CAPTURE(BM_NewSizeThenEncodeSizedTo, response, make_response());
+BENCHMARK_CAPTURE(BM_NewEncodeTo, response, make_response());
+BENCHMARK_CAPTURE(BM_OldSizeThenEncodeTo, batch16, make_batch());
+BENCHMARK_CAPTURE(BM_NewSizeThenEncodeSizedTo, batch16, make_batch());
+
+void* operator new(size_t size) {
+    ++g_allocations;
+    void* p = ::malloc(size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    ::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    ::free(p);
+}
+
+int main(int argc, char** argv) {
+    Logger::init("bench_encode.log");
+
+    cs_proto::OrderResponse response = make_response();
+    printf("OrderResponse package: %d bytes\n", TcpCode::encoded_size(response));
+    print_allocations("old encode (string)", [&] { std::string s = old_encode(response); });
+    print_allocations("new encode (string)", [&] { std::string s = TcpCode::encode(response); });
+    print_allocations("old encoded_size + encode_to",
+                      [&] { old_encode_to(response, g_buffer, old_encoded_size(response)); });
+    print_allocations("new encoded_size + encode_sized_to",
+                      [&] { TcpCode::encode_sized_to(response, g_buffer, TcpCode::encoded_size(response)); });
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
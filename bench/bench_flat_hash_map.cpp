@@ -0,0 +1,103 @@
+// Compares FlatHashMap lookups with std::unordered_map, after checking both agree on a random workload.
+// Run: bench/bin/bench_flat_hash_map [--benchmark_filter=...]
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "flat_hash_map.h"
+
+namespace {
+
+// Random keys, like the account ids the gateway routes by
+std::vector<uint32_t> make_keys(size_t count) {
+    std::mt19937 gen(static_cast<uint32_t>(count));
+    std::vector<uint32_t> keys(count);
+    for (uint32_t& key : keys) {
+        key = gen();
+    }
+    return keys;
+}
+
+// Runs the same random insert/erase/find sequence on both maps, returns 0 if they always agree
+int check_against_unordered_map() {
+    FlatHashMap<uint32_t, int> flat;
+    std::unordered_map<uint32_t, int> reference;
+    std::mt19937 gen(1);
+    for (int i = 0; i < 2000000; ++i) {
+        uint32_t key = gen() % 5000;
+        switch (gen() % 3) {
+        case 0:
+            flat.insert_or_assign(key, i);
+            reference[key] = i;
+            break;
+        case 1:
+            if (flat.erase(key) != (reference.erase(key) != 0)) {
+                printf("erase mismatch at operation %d\n", i);
+                return -1;
+            }
+            break;
+        default: {
+            int* value = flat.find(key);
+            auto it = reference.find(key);
+            if ((value == nullptr) != (it == reference.end()) || (value != nullptr && *value != it->second)) {
+                printf("find mismatch at operation %d\n", i);
+                return -1;
+            }
+            break;
+        }
+        }
+        if (flat.size() != reference.size()) {
+            printf("size mismatch at operation %d\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void BM_FlatHashMapFind(benchmark::State& state) {
+    size_t count = static_cast<size_t>(state.range(0));
+    std::vector<uint32_t> keys = make_keys(count);
+    FlatHashMap<uint32_t, uint32_t> map;
+    map.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        map.insert_or_assign(keys[i], static_cast<uint32_t>(i));
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(*map.find(keys[i]));
+        i = i + 1 == count ? 0 : i + 1;
+    }
+}
+
+void BM_UnorderedMapFind(benchmark::State& state) {
+    size_t count = static_cast<size_t>(state.range(0));
+    std::vector<uint32_t> keys = make_keys(count);
+    std::unordered_map<uint32_t, uint32_t> map;
+    map.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        map[keys[i]] = static_cast<uint32_t>(i);
+    }
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.find(keys[i])->second);
+        i = i + 1 == count ? 0 : i + 1;
+    }
+}
+
+}  // namespace
+
+BENCHMARK(BM_FlatHashMapFind)->Arg(10000)->Arg(100000);
+BENCHMARK(BM_UnorderedMapFind)->Arg(10000)->Arg(100000);
+
+int main(int argc, char** argv) {
+    if (check_against_unordered_map() != 0) {
+        return 1;
+    }
+    printf("2M random insert/erase/find operations match std::unordered_map\n");
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
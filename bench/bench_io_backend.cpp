@@ -0,0 +1,397 @@
+// Echo benchmark of the two gateway IO backends on a libuv loop: libuv reads and uv_write,
+// against UringIo multishot receives and sendmsg submitted from the check phase.
+// Run: bench/bin/bench_io_backend <connections> <rounds> libuv|uring
+// A forked client keeps one 64-byte message in flight per connection for the given rounds.
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <uv.h>
+#include "uring_io.h"
+#include "logger.h"
+
+namespace {
+
+const int MSG_SIZE = 64;
+const uint64_t OP_RECV = 1;
+const uint64_t OP_SEND = 2;
+
+// Syscalls made by the server while measuring. libuv calls these through the PLT, so the
+// definitions below see every read, write and poll it makes
+bool g_count_syscalls = false;
+uint64_t g_syscalls = 0;
+
+inline void count_syscall() {
+    if (g_count_syscalls) {
+        ++g_syscalls;
+    }
+}
+
+}  // namespace
+
+extern "C" ssize_t read(int fd, void* buf, size_t count) {
+    count_syscall();
+    return syscall(SYS_read, fd, buf, count);
+}
+
+extern "C" ssize_t write(int fd, const void* buf, size_t count) {
+    count_syscall();
+    return syscall(SYS_write, fd, buf, count);
+}
+
+extern "C" ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+    count_syscall();
+    return syscall(SYS_writev, fd, iov, iovcnt);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event* events, int maxevents, int timeout) {
+    count_syscall();
+    return static_cast<int>(syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout, nullptr, 8));
+}
+
+extern "C" int epoll_pwait(int epfd, struct epoll_event* events, int maxevents, int timeout, const sigset_t* sigmask) {
+    count_syscall();
+    return static_cast<int>(syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout, sigmask, 8));
+}
+
+namespace {
+
+struct Conn {
+    uv_tcp_t handle;
+    uv_write_t write_req;
+    int fd = -1;
+    std::string out;       // Echo bytes received since the last send
+    std::string inflight;  // Bytes of the send in flight
+    struct msghdr msg;
+    struct iovec iov;
+    bool busy = false;
+    bool pending = false;
+};
+
+struct Server {
+    uv_loop_t* loop = nullptr;
+    uv_check_t check;
+    uv_poll_t uring_poll;
+    UringIo* uring = nullptr;
+    std::vector<Conn> conns;
+    std::vector<int> pending;
+    uint64_t target_bytes = 0;
+    uint64_t received_bytes = 0;
+    int busy = 0;
+    char read_buf[65536];
+};
+
+Server g_server;
+int g_port = 0;
+
+double cpu_seconds() {
+    struct rusage usage;
+    ::getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+void set_nodelay(int fd) {
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int listen_socket(int backlog) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), len) != 0 || ::listen(fd, backlog) != 0 ||
+        ::getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &len) != 0) {
+        perror("listen");
+        exit(1);
+    }
+    g_port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// Connects every client, sends one message each and answers every echo with the next one
+void run_client(int count, int rounds) {
+    struct sockaddr_in addr;
+    ::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    std::vector<int> fds(count);
+    for (int i = 0; i < count; ++i) {
+        fds[i] = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (::connect(fds[i], reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+            perror("connect");
+            exit(1);
+        }
+        set_nodelay(fds[i]);
+        ::fcntl(fds[i], F_SETFL, ::fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    int ep = ::epoll_create1(0);
+    char msg[MSG_SIZE];
+    ::memset(msg, 'x', sizeof(msg));
+    std::vector<int> sent(count, 1);
+    std::vector<int> received(count, 0);
+    for (int i = 0; i < count; ++i) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        ::epoll_ctl(ep, EPOLL_CTL_ADD, fds[i], &ev);
+        ::send(fds[i], msg, sizeof(msg), 0);
+    }
+
+    int64_t done = 0;
+    int64_t total = static_cast<int64_t>(count) * rounds;
+    std::vector<struct epoll_event> events(4096);
+    char buf[65536];
+    while (done < total) {
+        int n = ::epoll_wait(ep, events.data(), static_cast<int>(events.size()), 1000);
+        for (int e = 0; e < n; ++e) {
+            int i = events[e].data.u32;
+            ssize_t r = ::recv(fds[i], buf, sizeof(buf), 0);
+            if (r < 0 && errno == EAGAIN) {
+                continue;
+            }
+            if (r <= 0) {
+                fprintf(stderr, "Connection %d closed by the server after %ld echoes\n", i, static_cast<long>(done));
+                exit(1);
+            }
+            received[i] += static_cast<int>(r);
+            for (; received[i] >= MSG_SIZE; received[i] -= MSG_SIZE) {
+                ++done;
+                if (sent[i] < rounds) {
+                    ::send(fds[i], msg, sizeof(msg), 0);
+                    ++sent[i];
+                }
+            }
+        }
+    }
+    for (int fd : fds) {
+        ::close(fd);
+    }
+}
+
+void queue_echo(int index) {
+    Conn& conn = g_server.conns[index];
+    if (!conn.pending) {
+        conn.pending = true;
+        g_server.pending.push_back(index);
+    }
+}
+
+// libuv backend: the same calls the gateway makes on its default path
+
+void on_alloc(uv_handle_t*, size_t, uv_buf_t* buf) {
+    *buf = uv_buf_init(g_server.read_buf, sizeof(g_server.read_buf));
+}
+
+void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+    if (nread <= 0) {
+        return;
+    }
+    int index = static_cast<int>(reinterpret_cast<intptr_t>(stream->data));
+    g_server.conns[index].out.append(buf->base, nread);
+    g_server.received_bytes += nread;
+    queue_echo(index);
+}
+
+void on_write(uv_write_t* req, int) {
+    int index = static_cast<int>(reinterpret_cast<intptr_t>(req->data));
+    Conn& conn = g_server.conns[index];
+    conn.busy = false;
+    conn.inflight.clear();
+    --g_server.busy;
+    if (!conn.out.empty()) {
+        queue_echo(index);
+    }
+}
+
+void send_libuv(int index) {
+    Conn& conn = g_server.conns[index];
+    conn.inflight.swap(conn.out);
+    uv_buf_t buf = uv_buf_init(&conn.inflight[0], static_cast<unsigned>(conn.inflight.size()));
+    conn.write_req.data = reinterpret_cast<void*>(static_cast<intptr_t>(index));
+    uv_write(&conn.write_req, reinterpret_cast<uv_stream_t*>(&conn.handle), &buf, 1, on_write);
+}
+
+// io_uring backend: UringIo driven from the loop as the gateway does with GATEWAY_IO_BACKEND=io_uring
+
+void on_uring_ready(uv_poll_t*, int, int) {
+    UringIo* uring = g_server.uring;
+    uring->reap([&](const struct io_uring_cqe& cqe) {
+        int index = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+        Conn& conn = g_server.conns[index];
+        if ((cqe.user_data >> 32) == OP_RECV) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                if (cqe.res > 0) {
+                    conn.out.append(uring->recv_buf(bid), cqe.res);
+                    g_server.received_bytes += cqe.res;
+                    queue_echo(index);
+                }
+                uring->recycle_recv_buf(bid);
+            }
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                uring->queue_recv_multishot(conn.fd, (OP_RECV << 32) | index);
+            }
+        } else {
+            conn.busy = false;
+            conn.inflight.clear();
+            --g_server.busy;
+            if (!conn.out.empty()) {
+                queue_echo(index);
+            }
+        }
+    });
+}
+
+void send_uring(int index) {
+    Conn& conn = g_server.conns[index];
+    conn.inflight.swap(conn.out);
+    conn.iov.iov_base = &conn.inflight[0];
+    conn.iov.iov_len = conn.inflight.size();
+    ::memset(&conn.msg, 0, sizeof(conn.msg));
+    conn.msg.msg_iov = &conn.iov;
+    conn.msg.msg_iovlen = 1;
+    g_server.uring->queue_sendmsg(conn.fd, &conn.msg, (OP_SEND << 32) | index);
+}
+
+// Check phase: one send per connection with echo bytes queued, then one submit for the ring
+void on_check(uv_check_t*) {
+    for (int index : g_server.pending) {
+        Conn& conn = g_server.conns[index];
+        conn.pending = false;
+        if (conn.busy) {
+            continue;  // Queued again by its completion
+        }
+        conn.busy = true;
+        ++g_server.busy;
+        if (g_server.uring != nullptr) {
+            send_uring(index);
+        } else {
+            send_libuv(index);
+        }
+    }
+    g_server.pending.clear();
+    if (g_server.uring != nullptr) {
+        g_server.uring->submit();
+    }
+    if (g_server.received_bytes >= g_server.target_bytes && g_server.busy == 0) {
+        uv_stop(g_server.loop);
+    }
+}
+
+void run_server(int listen_fd, int count, int rounds, bool use_uring) {
+    Server& server = g_server;
+    server.loop = uv_default_loop();
+    server.conns.resize(count);
+    server.target_bytes = static_cast<uint64_t>(count) * rounds * MSG_SIZE;
+    for (int i = 0; i < count; ++i) {
+        Conn& conn = server.conns[i];
+        conn.fd = ::accept(listen_fd, nullptr, nullptr);
+        if (conn.fd < 0) {
+            perror("accept");
+            exit(1);
+        }
+        set_nodelay(conn.fd);
+    }
+
+    UringIo uring;
+    if (use_uring) {
+        if (uring.init(URING_ENTRIES, URING_RECV_BUF_NUM, URING_RECV_BUF_SIZE) != 0) {
+            fprintf(stderr, "io_uring setup failed\n");
+            exit(1);
+        }
+        server.uring = &uring;
+        for (int i = 0; i < count; ++i) {
+            ::fcntl(server.conns[i].fd, F_SETFL, ::fcntl(server.conns[i].fd, F_GETFL) | O_NONBLOCK);
+            uring.queue_recv_multishot(server.conns[i].fd, (OP_RECV << 32) | i);
+        }
+        uring.submit();
+        uv_poll_init(server.loop, &server.uring_poll, uring.fd());
+        uv_poll_start(&server.uring_poll, UV_READABLE, on_uring_ready);
+    } else {
+        for (int i = 0; i < count; ++i) {
+            Conn& conn = server.conns[i];
+            uv_tcp_init(server.loop, &conn.handle);
+            uv_tcp_open(&conn.handle, conn.fd);
+            conn.handle.data = reinterpret_cast<void*>(static_cast<intptr_t>(i));
+            uv_read_start(reinterpret_cast<uv_stream_t*>(&conn.handle), on_alloc, on_read);
+        }
+    }
+    uv_check_init(server.loop, &server.check);
+    uv_check_start(&server.check, on_check);
+
+    uint64_t enter_calls = uring.enter_calls();
+    g_count_syscalls = true;
+    double cpu_start = cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+    uv_run(server.loop, UV_RUN_DEFAULT);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu = cpu_seconds() - cpu_start;
+    g_count_syscalls = false;
+
+    double msgs = static_cast<double>(count) * rounds;
+    uint64_t syscalls = g_syscalls + uring.enter_calls() - enter_calls;
+    printf("%-5s conns=%-6d msgs=%-9.0f %8.0f msg/s  server cpu %6.2f us/msg  server syscalls %.3f/msg\n",
+           use_uring ? "uring" : "libuv", count, msgs, msgs / secs, cpu * 1e6 / msgs, syscalls / msgs);
+    for (Conn& conn : server.conns) {
+        ::close(conn.fd);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        fprintf(stderr, "usage: %s <connections> <rounds> libuv|uring\n", argv[0]);
+        return 1;
+    }
+    int count = atoi(argv[1]);
+    int rounds = atoi(argv[2]);
+    bool use_uring = std::string(argv[3]) == "uring";
+
+    // Each connection takes a descriptor in the server and one in the client
+    struct rlimit limit;
+    ::getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < static_cast<rlim_t>(count) * 2 + 64) {
+        fprintf(stderr, "%d connections need %d descriptors, the hard limit is %lu\n",
+                count, count * 2 + 64, static_cast<unsigned long>(limit.rlim_max));
+        return 1;
+    }
+
+    Logger::init("bench_io_backend.log");
+    Logger::set_level(INFO);
+    printf("libuv %s\n", uv_version_string());
+
+    int listen_fd = listen_socket(65535);
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        run_client(count, rounds);
+        _exit(0);
+    }
+    run_server(listen_fd, count, rounds, use_uring);
+    ::waitpid(pid, nullptr, 0);
+    return 0;
+}
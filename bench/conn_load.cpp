@@ -0,0 +1,401 @@
+// Connection capacity load generator for the gateway, see "Connection capacity load test" in README.md.
+// Opens idle connections that never send, and active ones that log in and send FuturesOrders at a
+// fixed rate. Prints one line per second with the connection counts, order and response rates, and
+// the gateway RSS and descriptor count when its pid is given.
+// Run: bench/bin/conn_load <host> <port> <idle> <active> [orders/s per active] [seconds] [gateway pid]
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "tcp_code.h"
+#include "tcp_comm.h"
+#include "logger.h"
+#include "role.pb.h"
+#include "futures_order.pb.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Connects started per second, so the listen backlog is not overrun
+const int CONNECT_RATE = 5000;
+// Order send times kept per connection for response latency, by client_seq
+const int SEND_TIME_SLOTS = 64;
+// Accounts of the active connections start here
+const uint32_t ACCOUNT_BASE = 100000;
+
+enum ConnState {
+    CONN_CONNECTING,
+    CONN_IDLE,
+    CONN_LOGIN_SENT,
+    CONN_ACTIVE,
+    CONN_CLOSED
+};
+
+struct Conn {
+    int fd = -1;
+    ConnState state = CONN_CLOSED;
+    bool active = false;
+    uint32_t account = 0;
+    uint64_t next_seq = 1;
+    std::string recv_buf;
+    Clock::time_point send_times[SEND_TIME_SLOTS];
+};
+
+struct Counters {
+    uint64_t connected = 0;
+    uint64_t connect_failed = 0;
+    uint64_t logged_in = 0;
+    uint64_t closed = 0;
+    uint64_t orders_sent = 0;
+    uint64_t send_failed = 0;
+    uint64_t responses = 0;
+    double latency_ms = 0;  // Sum over the responses of the current second
+    uint64_t latency_count = 0;
+};
+
+struct LoadGen {
+    struct sockaddr_in addr;
+    int ep = -1;
+    std::vector<Conn> conns;
+    Counters counters;
+    pid_t gateway_pid = 0;
+};
+
+LoadGen g_load;
+
+double since_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void close_conn(int index) {
+    Conn& conn = g_load.conns[index];
+    if (conn.state == CONN_CLOSED) {
+        return;
+    }
+    if (conn.state == CONN_CONNECTING) {
+        ++g_load.counters.connect_failed;
+    } else {
+        ++g_load.counters.closed;
+    }
+    ::close(conn.fd);
+    conn.fd = -1;
+    conn.state = CONN_CLOSED;
+    conn.recv_buf.clear();
+}
+
+int send_package(int index, const google::protobuf::Message& message) {
+    Conn& conn = g_load.conns[index];
+    std::string pkg = TcpCode::encode(message);
+    ssize_t sent = ::send(conn.fd, pkg.data(), pkg.size(), MSG_NOSIGNAL);
+    if (sent != static_cast<ssize_t>(pkg.size())) {
+        // A partial send would break the framing, the gateway is not keeping up
+        ++g_load.counters.send_failed;
+        close_conn(index);
+        return -1;
+    }
+    return 0;
+}
+
+int start_connect(int index, bool active) {
+    Conn& conn = g_load.conns[index];
+    conn.fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (conn.fd < 0) {
+        ++g_load.counters.connect_failed;
+        return -1;
+    }
+    int one = 1;
+    ::setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    conn.active = active;
+    conn.account = active ? ACCOUNT_BASE + index : 0;
+    conn.state = CONN_CONNECTING;
+    int result = ::connect(conn.fd, reinterpret_cast<struct sockaddr*>(&g_load.addr), sizeof(g_load.addr));
+    if (result != 0 && errno != EINPROGRESS) {
+        close_conn(index);
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.u32 = index;
+    ::epoll_ctl(g_load.ep, EPOLL_CTL_ADD, conn.fd, &ev);
+    return 0;
+}
+
+void on_connected(int index) {
+    Conn& conn = g_load.conns[index];
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (::getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &error, &len) != 0 || error != 0) {
+        close_conn(index);
+        return;
+    }
+    ++g_load.counters.connected;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u32 = index;
+    ::epoll_ctl(g_load.ep, EPOLL_CTL_MOD, conn.fd, &ev);
+    if (!conn.active) {
+        conn.state = CONN_IDLE;
+        return;
+    }
+
+    cspkg::AccountLoginReq login_req;
+    login_req.set_account(conn.account);
+    login_req.set_session_key("Session key for client " + std::to_string(conn.account));
+    if (send_package(index, login_req) == 0) {
+        conn.state = CONN_LOGIN_SENT;
+    }
+}
+
+void on_response(Conn& conn, const cs_proto::OrderResponse& response) {
+    ++g_load.counters.responses;
+    uint64_t seq = response.client_seq();
+    if (seq != 0 && seq < conn.next_seq && conn.next_seq - seq <= SEND_TIME_SLOTS) {
+        g_load.counters.latency_ms += since_ms(conn.send_times[seq % SEND_TIME_SLOTS]);
+        ++g_load.counters.latency_count;
+    }
+}
+
+void on_package(int index, const char* data, int len) {
+    Conn& conn = g_load.conns[index];
+    MsgId id = MSG_NONE;
+    MsgPtr message(TcpCode::decode(data, len, &id));
+    if (message == nullptr) {
+        return;
+    }
+    if (id == MSG_ACCOUNT_LOGIN_RES && conn.state == CONN_LOGIN_SENT) {
+        const cspkg::AccountLoginRes& login_res = static_cast<const cspkg::AccountLoginRes&>(*message);
+        if (login_res.result() == 0) {
+            conn.state = CONN_ACTIVE;
+            ++g_load.counters.logged_in;
+        } else {
+            LOG(ERROR, "Login failed for account {}, result {}", conn.account, login_res.result());
+        }
+    } else if (id == MSG_ORDER_RESPONSE) {
+        on_response(conn, static_cast<const cs_proto::OrderResponse&>(*message));
+    } else if (id == MSG_ORDER_RESPONSE_BATCH) {
+        for (const cs_proto::OrderResponse& response :
+             static_cast<const cs_proto::OrderResponseBatch&>(*message).responses()) {
+            on_response(conn, response);
+        }
+    }
+}
+
+void on_readable(int index) {
+    Conn& conn = g_load.conns[index];
+    char buf[65536];
+    for (;;) {
+        ssize_t nread = ::recv(conn.fd, buf, sizeof(buf), 0);
+        if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (nread <= 0) {
+            close_conn(index);
+            return;
+        }
+        if (!conn.active) {
+            continue;  // Idle connections only notice the close
+        }
+        conn.recv_buf.append(buf, nread);
+    }
+
+    size_t offset = 0;
+    while (conn.recv_buf.size() - offset >= static_cast<size_t>(PKGHEAD_FIELD_SIZE)) {
+        int len = TcpCode::convert_int32(conn.recv_buf.data() + offset);
+        if (len < 2*PKGHEAD_FIELD_SIZE || len > MAX_CSPKG_LEN) {
+            LOG(ERROR, "Invalid package length {} from the gateway, account {}", len, conn.account);
+            close_conn(index);
+            return;
+        }
+        if (conn.recv_buf.size() - offset < static_cast<size_t>(len)) {
+            break;
+        }
+        on_package(index, conn.recv_buf.data() + offset, len);
+        offset += len;
+    }
+    conn.recv_buf.erase(0, offset);
+}
+
+void send_order(int index) {
+    Conn& conn = g_load.conns[index];
+    uint64_t seq = conn.next_seq++;
+    cs_proto::FuturesOrder order;
+    order.set_order_id("ord" + std::to_string(conn.account) + "-" + std::to_string(seq));
+    order.set_user_id("user" + std::to_string(conn.account));
+    order.set_symbol("BTCUSD");
+    order.set_side(seq % 2 == 0 ? cs_proto::OrderSide::BUY : cs_proto::OrderSide::SELL);
+    order.set_type(cs_proto::OrderType(1));
+    order.set_quantity(1.0 + seq % 10);
+    order.set_price(45000.0 + seq % 10000);
+    order.set_status(cs_proto::OrderStatus::PENDING);
+    order.set_timestamp(std::time(nullptr));
+    order.set_client_id(conn.account);
+    order.set_client_seq(seq);
+    conn.send_times[seq % SEND_TIME_SLOTS] = Clock::now();
+    if (send_package(index, order) == 0) {
+        ++g_load.counters.orders_sent;
+    }
+}
+
+long read_rss_kb(pid_t pid) {
+    std::string path = "/proc/" + std::to_string(pid) + "/status";
+    FILE* file = ::fopen(path.c_str(), "r");
+    if (file == nullptr) {
+        return -1;
+    }
+    long rss = -1;
+    char line[256];
+    while (::fgets(line, sizeof(line), file) != nullptr) {
+        if (::sscanf(line, "VmRSS: %ld", &rss) == 1) {
+            break;
+        }
+    }
+    ::fclose(file);
+    return rss;
+}
+
+long count_fds(pid_t pid) {
+    std::string path = "/proc/" + std::to_string(pid) + "/fd";
+    DIR* dir = ::opendir(path.c_str());
+    if (dir == nullptr) {
+        return -1;
+    }
+    long count = 0;
+    while (struct dirent* entry = ::readdir(dir)) {
+        count += entry->d_name[0] != '.';
+    }
+    ::closedir(dir);
+    return count;
+}
+
+void report(int second, int idle, int active) {
+    static Counters last;
+    Counters& now = g_load.counters;
+    int idle_open = 0;
+    int active_open = 0;
+    for (const Conn& conn : g_load.conns) {
+        idle_open += conn.state == CONN_IDLE;
+        active_open += conn.state == CONN_ACTIVE;
+    }
+    double latency = now.latency_count > 0 ? now.latency_ms / now.latency_count : 0;
+    printf("%4ds idle %d/%d active %d/%d orders %lu/s responses %lu/s latency %.2f ms"
+           " closed %lu failed %lu send_failed %lu",
+           second, idle_open, idle, active_open, active,
+           static_cast<unsigned long>(now.orders_sent - last.orders_sent),
+           static_cast<unsigned long>(now.responses - last.responses), latency,
+           static_cast<unsigned long>(now.closed), static_cast<unsigned long>(now.connect_failed),
+           static_cast<unsigned long>(now.send_failed));
+    if (g_load.gateway_pid > 0) {
+        printf(" gateway rss %ld KB fds %ld", read_rss_kb(g_load.gateway_pid), count_fds(g_load.gateway_pid));
+    }
+    printf("\n");
+    fflush(stdout);
+    now.latency_ms = 0;
+    now.latency_count = 0;
+    last = now;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 5) {
+        fprintf(stderr, "usage: %s <host> <port> <idle> <active> [orders/s per active] [seconds] [gateway pid]\n",
+                argv[0]);
+        return 1;
+    }
+    int idle = atoi(argv[3]);
+    int active = atoi(argv[4]);
+    double order_rate = argc > 5 ? atof(argv[5]) : 1.0;
+    int duration = argc > 6 ? atoi(argv[6]) : 60;
+    g_load.gateway_pid = argc > 7 ? atoi(argv[7]) : 0;
+
+    ::memset(&g_load.addr, 0, sizeof(g_load.addr));
+    g_load.addr.sin_family = AF_INET;
+    g_load.addr.sin_port = htons(static_cast<uint16_t>(atoi(argv[2])));
+    if (::inet_pton(AF_INET, argv[1], &g_load.addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid IPv4 address %s\n", argv[1]);
+        return 1;
+    }
+
+    int total = idle + active;
+    struct rlimit limit;
+    ::getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    ::setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < static_cast<rlim_t>(total) + 64) {
+        fprintf(stderr, "%d connections need %d descriptors, the hard limit is %lu\n",
+                total, total + 64, static_cast<unsigned long>(limit.rlim_max));
+        return 1;
+    }
+
+    Logger::init("conn_load.log");
+    Logger::set_level(INFO);
+    g_load.ep = ::epoll_create1(0);
+    g_load.conns.resize(total);
+
+    // Active connections go first so the order load starts while the idle ones are still opening
+    Clock::time_point start = Clock::now();
+    Clock::time_point next_report = start + std::chrono::seconds(1);
+    int started = 0;
+    int second = 0;
+    double order_credit = 0;
+    int order_cursor = 0;
+    Clock::time_point last_tick = start;
+    std::vector<struct epoll_event> events(4096);
+    while (second < duration) {
+        double elapsed_ms = since_ms(start);
+        int connect_due = std::min(total, static_cast<int>(elapsed_ms * CONNECT_RATE / 1000) + 1);
+        for (; started < connect_due; ++started) {
+            start_connect(started, started < active);
+        }
+
+        int n = ::epoll_wait(g_load.ep, events.data(), static_cast<int>(events.size()), 1);
+        for (int e = 0; e < n; ++e) {
+            int index = static_cast<int>(events[e].data.u32);
+            Conn& conn = g_load.conns[index];
+            if (conn.state == CONN_CONNECTING) {
+                on_connected(index);
+            } else if (conn.state != CONN_CLOSED) {
+                on_readable(index);
+            }
+        }
+
+        // Orders are spread over the logged-in connections in turn, at order_rate each on average
+        Clock::time_point now = Clock::now();
+        order_credit += std::chrono::duration<double>(now - last_tick).count() * order_rate * active;
+        last_tick = now;
+        for (int scanned = 0; order_credit >= 1 && active > 0 && scanned < active; ++scanned) {
+            int index = order_cursor;
+            order_cursor = order_cursor + 1 == active ? 0 : order_cursor + 1;
+            if (g_load.conns[index].state == CONN_ACTIVE) {
+                send_order(index);
+                order_credit -= 1;
+            }
+        }
+        // Credit does not pile up while no connection is logged in
+        order_credit = std::min(order_credit, order_rate * active);
+
+        if (now >= next_report) {
+            report(++second, idle, active);
+            next_report += std::chrono::seconds(1);
+        }
+    }
+
+    for (int i = 0; i < total; ++i) {
+        close_conn(i);
+    }
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "tcp_client.h"
+#include <algorithm>
 #include <cstring>
 #include "tcp_code.h"
 #include "logger.h"
@@ -23,6 +24,10 @@ int TcpClient::init() {
     struct sockaddr_in dest;
     uv_ip4_addr(server_ip_.c_str(), server_port_, &dest);
 
+    if (decode_arena_.init(CLIENT_DECODE_ARENA_BLOCK_SIZE) != 0) {
+        return -1;
+    }
+
     connect_req_ = std::make_unique<uv_connect_t>();
     connect_req_->data = this;
 
@@ -60,20 +65,9 @@ void TcpClient::on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
     TcpClient* client = static_cast<TcpClient*>(stream->data);
 
     if (nread > 0) {
-        std::string received_data(buf->base, nread);
-        std::unique_ptr<google::protobuf::Message> msg(TcpCode::decode(received_data));
-        
-        if (msg) {
-            if (dynamic_cast<cspkg::AccountLoginRes*>(msg.get())) {
-                client->process_account_login_res(buf->base, nread);
-            } else if (dynamic_cast<cs_proto::OrderResponse*>(msg.get())) {
-                client->process_order_response(buf->base, nread);
-            } else {
-                LOG(ERROR, "Unknown message type received for client {}", client->uin_);
-            }
-        } else {
-            LOG(ERROR, "Failed to decode message for client {}", client->uin_);
-        }
+        // A read may end inside a package or hold several, with pipelining it usually does
+        client->recv_buf_.append(buf->base, nread);
+        client->process_packages();
     } else if (nread < 0) {
         if (nread != UV_EOF) {
             LOG(ERROR, "Read error for client {}: {}", client->uin_, uv_strerror(nread));
@@ -82,14 +76,67 @@ void TcpClient::on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf)
     }
 }
 
+void TcpClient::process_packages() {
+    // Responses of the previous read were handled by now
+    decode_arena_.reset();
+    size_t offset = 0;
+    bool binary = wire_format_ == WIRE_FORMAT_BINARY;
+    size_t head_size = binary ? BIN_HEAD_SIZE : PKGHEAD_FIELD_SIZE;
+    int min_len = binary ? BIN_HEAD_SIZE : MIN_CSPKG_LEN;
+    while (recv_buf_.size() - offset >= head_size) {
+        const char* pkg = recv_buf_.data() + offset;
+        int pkg_len = binary ? TcpCode::convert_uint16(pkg) : TcpCode::convert_int32(pkg);
+        if (pkg_len < min_len || pkg_len > MAX_CSPKG_LEN) {
+            LOG(ERROR, "Invalid package length {} for client {}", pkg_len, uin_);
+            recv_buf_.clear();
+            uv_close((uv_handle_t*)&client_, nullptr);
+            return;
+        }
+        if (recv_buf_.size() - offset < static_cast<size_t>(pkg_len)) {
+            break;
+        }
+
+        MsgId msg_id = MSG_NONE;
+        MsgPtr msg(binary ? TcpCode::decode_binary(pkg, pkg_len, &msg_id, decode_arena_.get()) :
+                            TcpCode::decode(pkg, pkg_len, &msg_id, decode_arena_.get()));
+        offset += pkg_len;
+        if (!msg) {
+            LOG(ERROR, "Failed to decode message for client {}", uin_);
+            continue;
+        }
+
+        switch (msg_id) {
+            case MSG_ACCOUNT_LOGIN_RES:
+                process_account_login_res(static_cast<const cspkg::AccountLoginRes&>(*msg));
+                break;
+            case MSG_ORDER_RESPONSE:
+                process_order_response(static_cast<const cs_proto::OrderResponse&>(*msg));
+                break;
+            case MSG_ORDER_RESPONSE_BATCH:
+                for (const cs_proto::OrderResponse& order_res :
+                     static_cast<const cs_proto::OrderResponseBatch&>(*msg).responses()) {
+                    process_order_response(order_res);
+                }
+                break;
+            default:
+                LOG(ERROR, "Unknown message type {} received for client {}", msg->GetTypeName(), uin_);
+                break;
+        }
+    }
+    recv_buf_.erase(0, offset);
+
+    // Answers free pipeline slots, refill them once per read instead of once per answer
+    fill_pipeline();
+}
+
 void TcpClient::on_write(uv_write_t* req, int status) {
-    TcpClient* client = static_cast<TcpClient*>(req->data);
+    TcpClient* client = static_cast<WriteReq*>(req->data)->client;
     if (client == nullptr || status < 0) {
         LOG(ERROR, "Write error for client {}: {}", client ? client->uin_ : 0, uv_strerror(status));
     } else {
-        LOG(INFO, "Data sent successfully for client {}", client->uin_);
+        LOG(DEBUG, "Data sent successfully for client {}", client->uin_);
     }
-    delete req;
+    delete static_cast<WriteReq*>(req->data);
 }
 
 void TcpClient::alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
@@ -100,25 +147,51 @@ void TcpClient::alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_
 }
 
 int TcpClient::send_data(const char* data, size_t len) {
-    uv_buf_t buf = uv_buf_init(const_cast<char*>(data), len);
-    uv_write_t* req = new uv_write_t;
-    req->data = this;
-
-    int result = uv_write(req, (uv_stream_t*)&client_, &buf, 1, on_write);
+    // libuv writes from the caller's memory after this returns, so the request owns a copy
+    WriteReq* write = new WriteReq;
+    write->client = this;
+    write->data.assign(data, len);
+    write->req.data = write;
+    uv_buf_t buf = uv_buf_init(&write->data[0], len);
+
+    int result = uv_write(&write->req, (uv_stream_t*)&client_, &buf, 1, on_write);
     if (result < 0) {
         LOG(ERROR, "Failed to send data for client {}: {}", uin_, uv_strerror(result));
-        delete req;
+        delete write;
         return result;
     }
     return 0;
 }
 
+std::string TcpClient::encode_package(const google::protobuf::Message& message) {
+    if (wire_format_ != WIRE_FORMAT_BINARY) {
+        return TcpCode::encode(message);
+    }
+
+    int len = TcpCode::binary_encoded_size(message);
+    if (len > MAX_CSPKG_LEN) {
+        return std::string();
+    }
+    std::string pkg(len, '\0');
+    uint16_t seq = send_seq_ == 0xFFFF ? 1 : send_seq_ + 1;
+    if (TcpCode::encode_binary_sized_to(message, MsgRegistry::id_of(message), 0, seq, &pkg[0], len) != len) {
+        return std::string();
+    }
+    send_seq_ = seq;
+    return pkg;
+}
+
 int TcpClient::send_account_login_req() {
     cspkg::AccountLoginReq acc_login_req;
     acc_login_req.set_account(uin_);
     std::string session = "Session key for client " + std::to_string(uin_);
     acc_login_req.set_session_key(session);
+    acc_login_req.set_binary_frames(binary_frames_);
 
+    // The login request itself is always TcpCode framed, a reconnect starts over
+    wire_format_ = WIRE_FORMAT_TCPCODE;
+    send_seq_ = 0;
+    recv_buf_.clear();
     std::string pkg = TcpCode::encode(acc_login_req);
     if (pkg.empty()) {
         return -1;
@@ -126,6 +199,10 @@ int TcpClient::send_account_login_req() {
 
     int result = send_data(pkg.c_str(), pkg.size());
     if (result == 0) {
+        // The gateway answers the login and reads every later package in binary frames
+        if (binary_frames_) {
+            wire_format_ = WIRE_FORMAT_BINARY;
+        }
         requests_sent_++;
         LOG(INFO, "Sending account login request ok: account={}, seq={}", uin_, requests_sent_);
     } else {
@@ -135,32 +212,19 @@ int TcpClient::send_account_login_req() {
     return result;
 }
 
-void TcpClient::process_account_login_res(const char* data, size_t len) {
-    std::string buf(data, len);
-    std::unique_ptr<google::protobuf::Message> msg(TcpCode::decode(buf));
-    if (!msg) {
-        LOG(ERROR, "Failed to decode login response for client {}", uin_);
-        return;
-    }
-
-    const cspkg::AccountLoginRes* acc_login_res = dynamic_cast<const cspkg::AccountLoginRes*>(msg.get());
-    if (!acc_login_res) {
-        LOG(ERROR, "Message is not AccountLoginRes for client {}", uin_);
-        return;
-    }
-
+void TcpClient::process_account_login_res(const cspkg::AccountLoginRes& acc_login_res) {
     auto end_time = std::chrono::steady_clock::now();
     double login_time = std::chrono::duration<double, std::milli>(end_time - login_request_time_).count();
     login_time_ = login_time;  // Store the login time
     LOG(INFO, "Received account login response: account={}, result={}, time={:.2f}ms", 
-                acc_login_res->account(), acc_login_res->result(), login_time);
+                acc_login_res.account(), acc_login_res.result(), login_time);
 
     login_response_received_ = true;
 
-    if (acc_login_res->result() == 0) {  // Assuming 0 means success
+    if (acc_login_res.result() == 0) {  // Assuming 0 means success
         is_logged_in_ = true;
-        LOG(INFO, "Login successful for client {}, sending futures order", uin_);
-        send_futures_order();
+        LOG(INFO, "Login successful for client {}, sending up to {} futures orders", uin_, pipeline_depth_);
+        fill_pipeline();
     } else {
         LOG(ERROR, "Login failed for client {}", uin_);
     }
@@ -174,40 +238,57 @@ int TcpClient::send_futures_order() {
     }
 
     cs_proto::FuturesOrder order = generate_random_order();
-    std::string pkg = TcpCode::encode(order);
+    uint64_t client_seq = next_client_seq_++;
+    order.set_client_seq(client_seq);
+    order.set_order_id("ord" + std::to_string(uin_) + "-" + std::to_string(client_seq));
+    std::string pkg = encode_package(order);
     if (pkg.empty()) {
         return -1;
     }
 
     order_request_time_ = std::chrono::steady_clock::now();
+    order_send_times_[client_seq % order_send_times_.size()] = order_request_time_;
     int result = send_data(pkg.c_str(), pkg.size());
     if (result == 0) {
         requests_sent_++;
+        orders_sent_++;
+        orders_in_flight_++;
     }
     return result;
 }
 
-void TcpClient::process_order_response(const char* data, size_t len) {
-    std::string buf(data, len);
-    std::unique_ptr<google::protobuf::Message> msg(TcpCode::decode(buf));
-    if (!msg) {
-        LOG(ERROR, "Failed to decode order response for client {}", uin_);
-        return;
-    }
+void TcpClient::set_pipeline(int depth, int orders) {
+    pipeline_depth_ = std::max(depth, 1);
+    orders_to_send_ = std::max(orders, 0);
+    order_send_times_.assign(pipeline_depth_, std::chrono::steady_clock::time_point());
+}
 
-    const cs_proto::OrderResponse* order_res = dynamic_cast<const cs_proto::OrderResponse*>(msg.get());
-    if (!order_res) {
-        LOG(ERROR, "Message is not OrderResponse for client {}", uin_);
-        return;
+void TcpClient::fill_pipeline() {
+    if (order_send_times_.empty()) {
+        set_pipeline(pipeline_depth_, orders_to_send_);
     }
+    while (is_logged_in_ && orders_in_flight_ < pipeline_depth_ && orders_sent_ < orders_to_send_) {
+        if (send_futures_order() != 0) {
+            break;
+        }
+    }
+}
 
+void TcpClient::process_order_response(const cs_proto::OrderResponse& order_res) {
     responses_received_++;
+    if (orders_in_flight_ > 0) {
+        orders_in_flight_--;
+    }
 
+    // At most pipeline_depth_ orders are in flight, so their send times never share a slot
     auto end_time = std::chrono::steady_clock::now();
-    double order_time = std::chrono::duration<double, std::milli>(end_time - order_request_time_).count();
+    auto send_time = order_res.client_seq() != 0 ?
+        order_send_times_[order_res.client_seq() % order_send_times_.size()] : order_request_time_;
+    double order_time = std::chrono::duration<double, std::milli>(end_time - send_time).count();
     order_time_ = order_time;  // Store the order time
-    LOG(INFO, "Received order response for client {}: order_id={}, status={}, message={}, time={:.2f}ms", 
-                uin_, order_res->order_id(), cs_proto::OrderStatus_Name(order_res->status()), order_res->message(), order_time);
+    LOG(INFO, "Received order response for client {}: order_id={}, seq={}, status={}, message={}, time={:.2f}ms",
+                uin_, order_res.order_id(), order_res.client_seq(), cs_proto::OrderStatus_Name(order_res.status()),
+                order_res.message(), order_time);
 }
 
 cs_proto::FuturesOrder TcpClient::generate_random_order() {
@@ -245,6 +326,8 @@ MultiUserSimulator::MultiUserSimulator(uv_loop_t* loop, const std::string& confi
     for (int i = 0; i < num_users_; ++i) {
         uint32_t uin = dis_(gen_);
         clients_.push_back(std::make_unique<TcpClient>(loop, server_ip_.c_str(), server_port_, uin));
+        clients_.back()->set_pipeline(pipeline_depth_, orders_per_user_);
+        clients_.back()->set_binary_frames(binary_frames_);
     }
     current_instance = this;
 
@@ -320,6 +403,9 @@ void MultiUserSimulator::load_config(const std::string& config_file) {
     num_users_ = config["simulation"]["num_users"];
     max_retry_attempts_ = config["simulation"]["max_retry_attempts"];
     retry_delay_ms_ = config["simulation"]["retry_delay_ms"];
+    pipeline_depth_ = config["simulation"].value("pipeline_depth", 1);
+    orders_per_user_ = config["simulation"].value("orders_per_user", 1);
+    binary_frames_ = config["simulation"].value("binary_frames", false);
 
     // Set logging level and file
     std::string log_level = config["logging"]["level"];
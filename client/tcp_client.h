@@ -12,12 +12,15 @@
 #include <csignal>
 #include <nlohmann/json.hpp>
 #include "tcp_comm.h"
+#include "decode_arena.h"
 #include "role.pb.h"
 #include "futures_order.pb.h"
 
 // Connection IP and Port
 const char CONNECT_IP[] = "140.238.154.0";
 const int CONNECT_PORT = 9218;
+// First decode arena block of each simulated user, responses of one read fit it
+const size_t CLIENT_DECODE_ARENA_BLOCK_SIZE = 4 * 1024;
 
 class TcpClient {
 public:
@@ -43,6 +46,12 @@ public:
     // Automatic retry
     void retry_connect();
 
+    // Keep up to depth orders in flight after login, orders in total
+    void set_pipeline(int depth, int orders);
+
+    // Ask for binary frames at login
+    void set_binary_frames(bool binary) { binary_frames_ = binary; }
+
     // Add getters for request and response counters
     size_t get_requests_sent() const { return requests_sent_; }
     size_t get_responses_received() const { return responses_received_; }
@@ -75,26 +84,44 @@ private:
     // Callback for allocating buffer
     static void alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
 
+    // Decode and handle every complete package in recv_buf_
+    void process_packages();
+
+    // Encode a package in the framing of the connection, empty on failure
+    std::string encode_package(const google::protobuf::Message& message);
+
     // Send account login request
     int send_account_login_req();
 
     // Process account login response
-    void process_account_login_res(const char* data, size_t len);
+    void process_account_login_res(const cspkg::AccountLoginRes& acc_login_res);
 
     // Send futures order
     int send_futures_order();
 
+    // Send orders until the pipeline is full or every order was sent
+    void fill_pipeline();
+
     // Process order response
-    void process_order_response(const char* data, size_t len);
+    void process_order_response(const cs_proto::OrderResponse& order_res);
 
     static constexpr int MAX_RETRY_ATTEMPTS = 3;
 
+    // Write request owning the bytes it writes
+    struct WriteReq {
+        uv_write_t req;
+        TcpClient* client;
+        std::string data;
+    };
+
     uv_loop_t* loop_;
     uv_tcp_t client_;
     std::unique_ptr<uv_connect_t> connect_req_;
     std::string server_ip_;
     int server_port_;
     char read_buf_[MAX_BUFFER_SIZE];
+    std::string recv_buf_;  // Received bytes of packages not handled yet
+    DecodeArena decode_arena_;  // Responses decoded from one read
     std::vector<std::unique_ptr<uv_write_t>> write_reqs_;
     bool is_logged_in_;
     bool login_response_received_;
@@ -106,6 +133,20 @@ private:
     // Add counters for requests and responses
     size_t requests_sent_ = 0;
     size_t responses_received_ = 0;
+
+    // Pipelined order entry: orders carry increasing client_seq and are not waited for one by one
+    int pipeline_depth_ = 1;
+    int orders_to_send_ = 1;
+    int orders_sent_ = 0;
+    int orders_in_flight_ = 0;
+    uint64_t next_client_seq_ = 1;
+    // Send time of each order in flight, by client_seq modulo the pipeline depth
+    std::vector<std::chrono::steady_clock::time_point> order_send_times_;
+
+    // Framing: TcpCode until the login request with binary_frames was sent, binary after it
+    bool binary_frames_ = false;
+    WireFormat wire_format_ = WIRE_FORMAT_TCPCODE;
+    uint16_t send_seq_ = 0;
 };
 
 // New class to manage multiple TcpClient instances
@@ -149,6 +190,9 @@ private:
     std::string server_ip_;
     int server_port_;
     int num_users_;
+    int pipeline_depth_;
+    int orders_per_user_;
+    bool binary_frames_;
     std::vector<std::unique_ptr<TcpClient>> clients_;
     std::random_device rd_;
     std::mt19937 gen_;
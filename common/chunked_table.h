@@ -0,0 +1,53 @@
+/*************************************************************************
+ * @file    chunked_table.h
+ * @brief   Index-addressed table that grows in fixed-size chunks without moving entries
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_CHUNKED_TABLE_H_
+#define _TRADING_PLATFORM_COMMON_CHUNKED_TABLE_H_
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Entries live in chunks of 2^CHUNK_SHIFT elements. Growing appends a chunk,
+// so references to existing entries stay valid while connections are live.
+template <typename T, int CHUNK_SHIFT = 12>
+class ChunkedTable {
+public:
+    static const size_t CHUNK_SIZE = static_cast<size_t>(1) << CHUNK_SHIFT;
+
+    ChunkedTable() : size_(0) {}
+
+    // Append one value-initialized chunk, returns the new size
+    size_t grow() {
+        chunks_.emplace_back(new T[CHUNK_SIZE]());
+        size_ += CHUNK_SIZE;
+        return size_;
+    }
+
+    // Release every chunk
+    void clear() {
+        chunks_.clear();
+        size_ = 0;
+    }
+
+    T& operator[](size_t index) {
+        return chunks_[index >> CHUNK_SHIFT][index & (CHUNK_SIZE - 1)];
+    }
+
+    const T& operator[](size_t index) const {
+        return chunks_[index >> CHUNK_SHIFT][index & (CHUNK_SIZE - 1)];
+    }
+
+    size_t size() const { return size_; }
+
+private:
+    std::vector<std::unique_ptr<T[]>> chunks_;
+    size_t size_;
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_CHUNKED_TABLE_H_
@@ -0,0 +1,60 @@
+/*************************************************************************
+ * @file    conn_state_table.cpp
+ * @brief   Connection state table in shared memory
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#include "conn_state_table.h"
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <cstring>
+#include "shm_mgr.h"
+#include "logger.h"
+
+namespace {
+
+const uint32_t CONN_STATE_MAGIC = 0x43535442;  // "CSTB"
+const uint32_t CONN_STATE_VERSION = 3;
+
+}  // namespace
+
+int ConnStateTable::init(int shm_key, int shard_id, int capacity, bool resume) {
+    int size = static_cast<int>(sizeof(ConnStateHeader) + sizeof(ConnStateRecord) * capacity);
+    void* mem = ShmMgr::instance().create_shm(shm_key, size, size);
+    if (mem == nullptr && !resume) {
+        // A segment left by a gateway with another capacity can't be attached at this size
+        int shm_id = shmget(shm_key, 0, 0666);
+        if (shm_id >= 0 && shmctl(shm_id, IPC_RMID, nullptr) == 0) {
+            LOG(INFO, "Removed stale connection state segment, key={}", shm_key);
+            mem = ShmMgr::instance().create_shm(shm_key, size, size);
+        }
+    }
+    if (mem == nullptr) {
+        LOG(ERROR, "Failed to attach connection state table of shard {}, key={}, size={}", shard_id, shm_key, size);
+        return -1;
+    }
+
+    header_ = static_cast<ConnStateHeader*>(mem);
+    records_ = reinterpret_cast<ConnStateRecord*>(header_ + 1);
+
+    if (resume) {
+        if (ShmMgr::instance().get_shm_mode(shm_key) != MODE_RESUME || header_->magic != CONN_STATE_MAGIC ||
+            header_->version != CONN_STATE_VERSION || header_->shard_id != shard_id || header_->capacity != capacity) {
+            LOG(ERROR, "Connection state table of shard {} does not match, can't resume", shard_id);
+            header_ = nullptr;
+            records_ = nullptr;
+            return -1;
+        }
+        LOG(INFO, "Resumed connection state table of shard {}, capacity {}", shard_id, capacity);
+        return 0;
+    }
+
+    memset(mem, 0, size);
+    header_->magic = CONN_STATE_MAGIC;
+    header_->version = CONN_STATE_VERSION;
+    header_->shard_id = shard_id;
+    header_->capacity = capacity;
+    return 0;
+}
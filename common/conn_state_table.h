@@ -0,0 +1,55 @@
+/*************************************************************************
+ * @file    conn_state_table.h
+ * @brief   Connection state of a reactor shard kept in shared memory across gateway restarts
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_CONN_STATE_TABLE_H_
+#define _TRADING_PLATFORM_COMMON_CONN_STATE_TABLE_H_
+
+#include <cstdint>
+
+// Identity of one connection slot. Records hold no pointers, so any process can map the
+// segment at any address and read them, which is how a new gateway restores handed over clients
+struct ConnStateRecord {
+    int32_t client_id;       // Client id of the occupant, 0 while the slot is free
+    uint8_t generation;      // Generation of the slot, kept while it is free
+    uint8_t wire_format;     // Framing chosen at login
+    uint16_t send_seq;       // Sequence of the last binary frame sent, written when the connection is handed over
+    uint64_t uin;            // Logged in account, 0 before login
+    uint64_t client_ip;      // Client IP address
+    int64_t create_time;     // Accept time
+    int64_t recv_data_time;  // Last receive time, written when the connection is handed over
+    uint64_t max_client_seq; // Highest order sequence accepted, written when the connection is handed over
+};
+
+struct ConnStateHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t shard_id;
+    int32_t capacity;  // Number of records after the header
+};
+
+// Table indexed by slot index, sized to the shard's connection capacity
+class ConnStateTable {
+public:
+    ConnStateTable() : header_(nullptr), records_(nullptr) {}
+
+    // Attach the segment of a shard. With resume the records of the previous process are
+    // kept and must match shard and capacity, otherwise the table starts empty
+    int init(int shm_key, int shard_id, int capacity, bool resume);
+
+    ConnStateRecord& operator[](int index) { return records_[index]; }
+    const ConnStateRecord& operator[](int index) const { return records_[index]; }
+
+    int capacity() const { return header_ != nullptr ? header_->capacity : 0; }
+    bool valid() const { return header_ != nullptr; }
+
+private:
+    ConnStateHeader* header_;
+    ConnStateRecord* records_;
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_CONN_STATE_TABLE_H_
@@ -0,0 +1,59 @@
+#include "decode_arena.h"
+#include <algorithm>
+#include <new>
+#include "logger.h"
+
+std::atomic<uint64_t> DecodeArena::blocks_allocated_(0);
+
+DecodeArena::DecodeArena() : first_block_size_(0), resets_(0), used_bytes_(0), overflow_bytes_(0) {}
+
+int DecodeArena::init(size_t block_size) {
+    arena_.reset();
+    first_block_.reset();
+    first_block_size_ = block_size;
+    if (block_size == 0) {
+        return 0;
+    }
+
+    first_block_.reset(new (std::nothrow) char[block_size]);
+    if (first_block_ == nullptr) {
+        LOG(ERROR, "Failed to allocate a decode arena block of {} bytes", block_size);
+        return -1;
+    }
+    google::protobuf::ArenaOptions options;
+    options.initial_block = first_block_.get();
+    options.initial_block_size = block_size;
+    options.start_block_size = block_size;
+    options.max_block_size = std::max(block_size, DECODE_ARENA_MAX_BLOCK_SIZE);
+    options.block_alloc = alloc_block;
+    options.block_dealloc = free_block;
+    arena_.reset(new google::protobuf::Arena(options));
+    return 0;
+}
+
+void DecodeArena::reset() {
+    if (arena_ == nullptr) {
+        return;
+    }
+    uint64_t used = arena_->SpaceUsed();
+    if (used == 0) {
+        return;
+    }
+    // Blocks beyond the first go back to the heap, the first one is kept for the next batch
+    uint64_t allocated = arena_->Reset();
+    resets_.store(resets_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    used_bytes_.store(used_bytes_.load(std::memory_order_relaxed) + used, std::memory_order_relaxed);
+    if (allocated > first_block_size_) {
+        overflow_bytes_.store(overflow_bytes_.load(std::memory_order_relaxed) + allocated - first_block_size_,
+                              std::memory_order_relaxed);
+    }
+}
+
+void* DecodeArena::alloc_block(size_t size) {
+    blocks_allocated_.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(size);
+}
+
+void DecodeArena::free_block(void* block, size_t size) {
+    ::operator delete(block, size);
+}
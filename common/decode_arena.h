@@ -0,0 +1,66 @@
+/*************************************************************************
+ * @file    decode_arena.h
+ * @brief   Protobuf arena holding the messages decoded from one batch of input
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_DECODE_ARENA_H_
+#define _TRADING_PLATFORM_COMMON_DECODE_ARENA_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <google/protobuf/arena.h>
+
+// Default size of the first block of a decode arena, kept across resets
+const size_t DECODE_ARENA_BLOCK_SIZE = 64 * 1024;
+// Largest block taken when a batch outgrows the first one
+const size_t DECODE_ARENA_MAX_BLOCK_SIZE = 1024 * 1024;
+
+// Messages decoded from a batch, a read of a connection or a poll of Kafka, are created on
+// the arena and released together by reset() before the next batch. The first block is owned
+// here and reused, so a batch that fits it costs no allocation at all and a larger burst
+// takes a few growing blocks until the reset. Counters are written by the decoding thread
+// and readable from any thread
+class DecodeArena {
+public:
+    DecodeArena();
+
+    // Create the arena with a first block of block_size bytes, 0 leaves decoded messages on the heap
+    int init(size_t block_size);
+
+    // Arena to decode into, nullptr while disabled
+    google::protobuf::Arena* get() { return arena_.get(); }
+
+    // Release every message decoded since the last reset
+    void reset();
+
+    // Resets that released messages, bytes handed out to them, and bytes of the blocks
+    // taken beyond the first one, since init
+    uint64_t resets() const { return resets_.load(std::memory_order_relaxed); }
+    uint64_t used_bytes() const { return used_bytes_.load(std::memory_order_relaxed); }
+    uint64_t overflow_bytes() const { return overflow_bytes_.load(std::memory_order_relaxed); }
+
+    // Blocks every decode arena of the process took from the heap, the first blocks excluded
+    static uint64_t blocks_allocated() { return blocks_allocated_.load(std::memory_order_relaxed); }
+
+private:
+    DecodeArena(const DecodeArena&) = delete;
+    DecodeArena& operator=(const DecodeArena&) = delete;
+
+    static void* alloc_block(size_t size);
+    static void free_block(void* block, size_t size);
+
+    std::unique_ptr<char[]> first_block_;
+    size_t first_block_size_;
+    std::unique_ptr<google::protobuf::Arena> arena_;
+    std::atomic<uint64_t> resets_;
+    std::atomic<uint64_t> used_bytes_;
+    std::atomic<uint64_t> overflow_bytes_;
+
+    static std::atomic<uint64_t> blocks_allocated_;
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_DECODE_ARENA_H_
@@ -0,0 +1,331 @@
+/*************************************************************************
+ * @file    fd_handover.cpp
+ * @brief   Handover protocol over a SOCK_SEQPACKET Unix socket with SCM_RIGHTS
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#include "fd_handover.h"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+#include "config_manager.h"
+#include "logger.h"
+
+namespace {
+
+const size_t HANDOVER_MAX_PAYLOAD = std::max(HANDOVER_MAX_FDS * sizeof(int32_t), HANDOVER_DATA_CHUNK);
+
+}  // namespace
+
+std::string FdHandover::socket_path() {
+    return ConfigManager::instance().get_string("GATEWAY_UPGRADE_SOCKET", "");
+}
+
+void FdHandover::set_io_timeout(int sock) {
+    struct timeval tv = {HANDOVER_IO_TIMEOUT, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int FdHandover::send_msg(int sock, uint16_t type, int shard_id, int count, int index,
+                         const void* payload, size_t len, const int* fds, int fd_num) {
+    HandoverHead head = {HANDOVER_MAGIC, HANDOVER_VERSION, type, shard_id, count, index, static_cast<uint32_t>(len)};
+    struct iovec iov[2];
+    iov[0].iov_base = &head;
+    iov[0].iov_len = sizeof(head);
+    iov[1].iov_base = const_cast<void*>(payload);
+    iov[1].iov_len = len;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+
+    char control[CMSG_SPACE(sizeof(int) * HANDOVER_MAX_FDS)];
+    if (fd_num > 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_num);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_num);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_num);
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent != static_cast<ssize_t>(sizeof(head) + len)) {
+        LOG(ERROR, "Failed to send handover message type {}: {}", type, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int FdHandover::recv_msg(int sock, HandoverHead& head, std::string& payload, std::vector<int>& fds) {
+    payload.resize(HANDOVER_MAX_PAYLOAD);
+    struct iovec iov[2];
+    iov[0].iov_base = &head;
+    iov[0].iov_len = sizeof(head);
+    iov[1].iov_base = &payload[0];
+    iov[1].iov_len = payload.size();
+
+    char control[CMSG_SPACE(sizeof(int) * HANDOVER_MAX_FDS)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+
+    // Descriptors are taken over first, so they are closed by the caller even on a bad message
+    fds.clear();
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            size_t fd_num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+            fds.insert(fds.end(), data, data + fd_num);
+        }
+    }
+
+    if (received < static_cast<ssize_t>(sizeof(head))) {
+        LOG(ERROR, "Failed to receive handover message: {}", received < 0 ? strerror(errno) : "connection closed");
+        return -1;
+    }
+    if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) != 0 || head.magic != HANDOVER_MAGIC ||
+        head.version != HANDOVER_VERSION || head.len != static_cast<size_t>(received) - sizeof(head)) {
+        LOG(ERROR, "Malformed handover message type {}, {} bytes", head.type, received);
+        return -1;
+    }
+    payload.resize(head.len);
+    return 0;
+}
+
+int FdHandover::recv_request(int sock, int& reactor_num, int& max_connections) {
+    set_io_timeout(sock);
+    HandoverHead head;
+    std::string payload;
+    std::vector<int> fds;
+    int ret = recv_msg(sock, head, payload, fds);
+    for (int fd : fds) {
+        close(fd);
+    }
+    if (ret != 0 || head.type != HANDOVER_REQUEST) {
+        return -1;
+    }
+    reactor_num = head.count;
+    max_connections = head.index;
+    return 0;
+}
+
+int FdHandover::send_reject(int sock) {
+    return send_msg(sock, HANDOVER_REJECT, -1, 0, 0, nullptr, 0, nullptr, 0);
+}
+
+int FdHandover::send(int sock, const std::vector<HandoverShard>& shards) {
+    std::vector<int32_t> indexes;
+    std::vector<int> fds;
+    for (const HandoverShard& shard : shards) {
+        int data_msgs = 0;
+        for (const HandoverConn& conn : shard.conns) {
+            data_msgs += (conn.recv_data.size() + HANDOVER_DATA_CHUNK - 1) / HANDOVER_DATA_CHUNK;
+            data_msgs += (conn.send_data.size() + HANDOVER_DATA_CHUNK - 1) / HANDOVER_DATA_CHUNK;
+            data_msgs += (conn.md_symbols.size() + HANDOVER_DATA_CHUNK - 1) / HANDOVER_DATA_CHUNK;
+        }
+        if (send_msg(sock, HANDOVER_SHARD, shard.shard_id, static_cast<int>(shard.conns.size()), data_msgs,
+                     nullptr, 0, &shard.listen_fd, 1) != 0) {
+            return -1;
+        }
+
+        for (size_t begin = 0; begin < shard.conns.size(); begin += HANDOVER_MAX_FDS) {
+            size_t end = std::min(begin + HANDOVER_MAX_FDS, shard.conns.size());
+            indexes.clear();
+            fds.clear();
+            for (size_t i = begin; i < end; ++i) {
+                indexes.push_back(shard.conns[i].index);
+                fds.push_back(shard.conns[i].fd);
+            }
+            if (send_msg(sock, HANDOVER_FDS, shard.shard_id, static_cast<int>(fds.size()), 0, indexes.data(),
+                         indexes.size() * sizeof(int32_t), fds.data(), static_cast<int>(fds.size())) != 0) {
+                return -1;
+            }
+        }
+
+        for (const HandoverConn& conn : shard.conns) {
+            const std::string* data[3] = {&conn.recv_data, &conn.send_data, &conn.md_symbols};
+            for (int kind = 0; kind < 3; ++kind) {
+                for (size_t offset = 0; offset < data[kind]->size(); offset += HANDOVER_DATA_CHUNK) {
+                    size_t len = std::min(HANDOVER_DATA_CHUNK, data[kind]->size() - offset);
+                    if (send_msg(sock, HANDOVER_DATA, shard.shard_id, kind, conn.index,
+                                 data[kind]->data() + offset, len, nullptr, 0) != 0) {
+                        return -1;
+                    }
+                }
+            }
+        }
+        LOG(INFO, "Handed over shard {}: {} connections, {} data messages",
+            shard.shard_id, shard.conns.size(), data_msgs);
+    }
+    return send_msg(sock, HANDOVER_DONE, -1, static_cast<int>(shards.size()), 0, nullptr, 0, nullptr, 0);
+}
+
+int FdHandover::recv_shard(int sock, HandoverShard& shard) {
+    HandoverHead head;
+    std::string payload;
+    std::vector<int> fds;
+    if (recv_msg(sock, head, payload, fds) != 0 || head.type != HANDOVER_SHARD || fds.size() != 1) {
+        for (int fd : fds) {
+            close(fd);
+        }
+        return -1;
+    }
+    shard.shard_id = head.shard_id;
+    shard.listen_fd = fds[0];
+    int conn_num = head.count;
+    int data_msgs = head.index;
+
+    std::unordered_map<int, size_t> positions;
+    while (static_cast<int>(shard.conns.size()) < conn_num) {
+        if (recv_msg(sock, head, payload, fds) != 0 || head.type != HANDOVER_FDS ||
+            payload.size() != fds.size() * sizeof(int32_t) || static_cast<int>(fds.size()) != head.count) {
+            for (int fd : fds) {
+                close(fd);
+            }
+            return -1;
+        }
+        for (size_t i = 0; i < fds.size(); ++i) {
+            int32_t index;
+            memcpy(&index, payload.data() + i * sizeof(int32_t), sizeof(index));
+            positions[index] = shard.conns.size();
+            shard.conns.push_back(HandoverConn{index, fds[i], std::string(), std::string(), std::string()});
+        }
+    }
+
+    for (int i = 0; i < data_msgs; ++i) {
+        if (recv_msg(sock, head, payload, fds) != 0 || head.type != HANDOVER_DATA || !fds.empty()) {
+            for (int fd : fds) {
+                close(fd);
+            }
+            return -1;
+        }
+        auto it = positions.find(head.index);
+        if (it == positions.end()) {
+            LOG(ERROR, "Handover data for unknown slot {} of shard {}", head.index, shard.shard_id);
+            return -1;
+        }
+        HandoverConn& conn = shard.conns[it->second];
+        std::string* data[3] = {&conn.recv_data, &conn.send_data, &conn.md_symbols};
+        if (head.count < 0 || head.count > 2) {
+            LOG(ERROR, "Handover data of unknown kind {} for slot {}", head.count, head.index);
+            return -1;
+        }
+        data[head.count]->append(payload);
+    }
+    return 0;
+}
+
+int FdHandover::receive(const std::string& path, int reactor_num, int max_connections,
+                        std::vector<HandoverShard>& shards) {
+    shards.clear();
+    if (path.empty()) {
+        return 0;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        LOG(ERROR, "Upgrade socket path too long: {}", path);
+        return -1;
+    }
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        LOG(ERROR, "Failed to create upgrade socket: {}", strerror(errno));
+        return -1;
+    }
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        // No gateway to take over from, this is a cold start
+        LOG(INFO, "No running gateway on {}: {}", path, strerror(errno));
+        close(sock);
+        return 0;
+    }
+    set_io_timeout(sock);
+
+    if (send_msg(sock, HANDOVER_REQUEST, -1, reactor_num, max_connections, nullptr, 0, nullptr, 0) != 0) {
+        close(sock);
+        return -1;
+    }
+
+    LOG(INFO, "Requested handover from the running gateway on {}", path);
+    int ret = 0;
+    for (;;) {
+        HandoverHead head;
+        std::string payload;
+        std::vector<int> fds;
+        // Peek at the next message type, shards are read by recv_shard()
+        ssize_t peeked = recv(sock, &head, sizeof(head), MSG_PEEK);
+        if (peeked != static_cast<ssize_t>(sizeof(head))) {
+            LOG(ERROR, "Handover connection lost: {}", peeked < 0 ? strerror(errno) : "connection closed");
+            ret = -1;
+            break;
+        }
+        if (head.type == HANDOVER_REJECT) {
+            // The old process keeps serving, starting cold would clobber its shared state
+            LOG(ERROR, "Running gateway rejected the handover, reactor number and capacity must match");
+            recv_msg(sock, head, payload, fds);
+            ret = -1;
+            break;
+        }
+        if (head.type == HANDOVER_DONE) {
+            recv_msg(sock, head, payload, fds);
+            ret = static_cast<int>(shards.size()) == reactor_num ? 1 : -1;
+            break;
+        }
+
+        HandoverShard shard;
+        int shard_ret = recv_shard(sock, shard);
+        shards.push_back(std::move(shard));
+        if (shard_ret != 0) {
+            ret = -1;
+            break;
+        }
+        LOG(INFO, "Received shard {} with {} connections", shards.back().shard_id, shards.back().conns.size());
+    }
+    close(sock);
+
+    if (ret != 1) {
+        close_fds(shards);
+        shards.clear();
+    }
+    return ret;
+}
+
+void FdHandover::close_fds(std::vector<HandoverShard>& shards) {
+    for (HandoverShard& shard : shards) {
+        if (shard.listen_fd >= 0) {
+            close(shard.listen_fd);
+            shard.listen_fd = -1;
+        }
+        for (HandoverConn& conn : shard.conns) {
+            if (conn.fd >= 0) {
+                close(conn.fd);
+                conn.fd = -1;
+            }
+        }
+    }
+}
@@ -0,0 +1,92 @@
+/*************************************************************************
+ * @file    fd_handover.h
+ * @brief   Passing listener and client sockets to a new gateway process over a Unix socket
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_FD_HANDOVER_H_
+#define _TRADING_PLATFORM_COMMON_FD_HANDOVER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+const uint32_t HANDOVER_MAGIC = 0x47575550;  // "GWUP"
+const uint16_t HANDOVER_VERSION = 2;
+
+// File descriptors per message, below the kernel limit SCM_MAX_FD of 253
+const int HANDOVER_MAX_FDS = 250;
+// Pending bytes per data message, well below the default socket send buffer
+const size_t HANDOVER_DATA_CHUNK = 60 * 1024;
+// Send and receive timeout of the handover socket in seconds
+const int HANDOVER_IO_TIMEOUT = 10;
+
+// Messages exchanged over the SOCK_SEQPACKET handover socket
+enum HandoverMsgType : uint16_t {
+    HANDOVER_REQUEST = 1,  // New to old: count = reactor number, index = connection capacity
+    HANDOVER_REJECT = 2,   // Old to new: the configurations do not match, the old process keeps serving
+    HANDOVER_SHARD = 3,    // Old to new: listener fd attached, count = connections, index = data messages
+    HANDOVER_FDS = 4,      // Old to new: count client fds attached, payload = their slot indexes
+    HANDOVER_DATA = 5,     // Old to new: bytes of slot index, count = 0 received, 1 unsent, 2 subscriptions
+    HANDOVER_DONE = 6,     // Old to new: every shard was sent
+};
+
+struct HandoverHead {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t type;
+    int32_t shard_id;
+    int32_t count;
+    int32_t index;
+    uint32_t len;  // Payload bytes after the head
+};
+
+// One client socket and the bytes the old process had not processed or sent yet
+struct HandoverConn {
+    int index;              // Slot index, its record in the connection state table has the rest
+    int fd;
+    std::string recv_data;  // Received bytes of an incomplete request package
+    std::string send_data;  // Encoded packages not written to the socket yet
+    std::string md_symbols; // Market data subscriptions, one symbol per line
+};
+
+struct HandoverShard {
+    int shard_id;
+    int listen_fd;
+    std::vector<HandoverConn> conns;
+
+    HandoverShard() : shard_id(-1), listen_fd(-1) {}
+};
+
+class FdHandover {
+public:
+    // Unix socket path of the running gateway, empty if hot upgrade is disabled
+    static std::string socket_path();
+
+    // Connect to the running gateway and receive all of its shards. Returns 1 when shards
+    // were received, 0 when no gateway is listening, -1 when it rejected the request or on error
+    static int receive(const std::string& path, int reactor_num, int max_connections,
+                       std::vector<HandoverShard>& shards);
+
+    // Send the shards to the new gateway in the order they are given
+    static int send(int sock, const std::vector<HandoverShard>& shards);
+
+    // Read and check the request of a new gateway
+    static int recv_request(int sock, int& reactor_num, int& max_connections);
+
+    static int send_reject(int sock);
+
+    // Close every descriptor still held by the shards
+    static void close_fds(std::vector<HandoverShard>& shards);
+
+private:
+    static int send_msg(int sock, uint16_t type, int shard_id, int count, int index,
+                        const void* payload, size_t len, const int* fds, int fd_num);
+    static int recv_msg(int sock, HandoverHead& head, std::string& payload, std::vector<int>& fds);
+    static int recv_shard(int sock, HandoverShard& shard);
+    static void set_io_timeout(int sock);
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_FD_HANDOVER_H_
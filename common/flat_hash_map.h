@@ -0,0 +1,153 @@
+/*************************************************************************
+ * @file    flat_hash_map.h
+ * @brief   Open-addressing hash map for integer keys
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_FLAT_HASH_MAP_H_
+#define _TRADING_PLATFORM_COMMON_FLAT_HASH_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Entries live inline in one power-of-two array and collisions probe linearly, so a
+// lookup touches one or two cache lines and inserts never allocate below the reserved
+// size. Erase shifts the following entries of the cluster back instead of leaving
+// tombstones, so lookups stay short however often keys come and go.
+template <typename K, typename V>
+class FlatHashMap {
+    static_assert(std::is_integral<K>::value, "FlatHashMap keys must be integers");
+
+public:
+    FlatHashMap() : size_(0), mask_(0) {}
+
+    // Make room for n entries without rehashing
+    void reserve(size_t n) {
+        size_t capacity = MIN_CAPACITY;
+        while (capacity * MAX_LOAD_NUM / MAX_LOAD_DEN < n) {
+            capacity <<= 1;
+        }
+        if (capacity > slots_.size()) {
+            rehash(capacity);
+        }
+    }
+
+    // Pointer to the value of key, nullptr if absent. Invalidated by insert and erase
+    V* find(K key) {
+        if (size_ == 0) {
+            return nullptr;
+        }
+        for (size_t i = home(key);; i = (i + 1) & mask_) {
+            Slot& slot = slots_[i];
+            if (!slot.used) {
+                return nullptr;
+            }
+            if (slot.key == key) {
+                return &slot.value;
+            }
+        }
+    }
+
+    const V* find(K key) const {
+        return const_cast<FlatHashMap*>(this)->find(key);
+    }
+
+    // Insert key or overwrite its value
+    void insert_or_assign(K key, const V& value) {
+        if ((size_ + 1) * MAX_LOAD_DEN > slots_.size() * MAX_LOAD_NUM) {
+            rehash(slots_.empty() ? MIN_CAPACITY : slots_.size() * 2);
+        }
+        for (size_t i = home(key);; i = (i + 1) & mask_) {
+            Slot& slot = slots_[i];
+            if (!slot.used) {
+                slot.key = key;
+                slot.value = value;
+                slot.used = true;
+                ++size_;
+                return;
+            }
+            if (slot.key == key) {
+                slot.value = value;
+                return;
+            }
+        }
+    }
+
+    // Remove key, returns whether it was present
+    bool erase(K key) {
+        if (size_ == 0) {
+            return false;
+        }
+        size_t hole = home(key);
+        for (;; hole = (hole + 1) & mask_) {
+            if (!slots_[hole].used) {
+                return false;
+            }
+            if (slots_[hole].key == key) {
+                break;
+            }
+        }
+
+        // Move back every later entry of the cluster whose home is not between the hole and itself
+        for (size_t i = (hole + 1) & mask_; slots_[i].used; i = (i + 1) & mask_) {
+            size_t entry_home = home(slots_[i].key);
+            if (((i - entry_home) & mask_) >= ((i - hole) & mask_)) {
+                slots_[hole] = slots_[i];
+                hole = i;
+            }
+        }
+        slots_[hole].used = false;
+        --size_;
+        return true;
+    }
+
+    void clear() {
+        for (Slot& slot : slots_) {
+            slot.used = false;
+        }
+        size_ = 0;
+    }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    size_t capacity() const { return slots_.size(); }
+
+private:
+    static const size_t MIN_CAPACITY = 16;
+    // Rehash above a load factor of 3/4
+    static const size_t MAX_LOAD_NUM = 3;
+    static const size_t MAX_LOAD_DEN = 4;
+
+    struct Slot {
+        K key;
+        V value;
+        bool used;
+    };
+
+    // Fibonacci hashing spreads sequential account numbers over the table
+    size_t home(K key) const {
+        return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ULL) >> 32) & mask_;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old_slots(capacity, Slot{K(), V(), false});
+        old_slots.swap(slots_);
+        mask_ = capacity - 1;
+        size_ = 0;
+        for (const Slot& slot : old_slots) {
+            if (slot.used) {
+                insert_or_assign(slot.key, slot.value);
+            }
+        }
+    }
+
+    std::vector<Slot> slots_;
+    size_t size_;
+    size_t mask_;
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_FLAT_HASH_MAP_H_
@@ -0,0 +1,98 @@
+#include "inflight_orders.h"
+#include <functional>
+#include "tcp_comm.h"
+#include "logger.h"
+
+InflightOrders::InflightOrders() : free_head_(-1), capacity_(0), timeout_ms_(0) {}
+
+int InflightOrders::init(int capacity, uint64_t timeout_ms, uint64_t now_ms) {
+    timeout_ms_ = timeout_ms;
+    if (timeout_ms_ == 0) {
+        return 0;
+    }
+    if (capacity <= 0) {
+        LOG(ERROR, "Invalid in-flight order capacity {}", capacity);
+        return -1;
+    }
+    capacity_ = capacity;
+    // Entries are created on demand, the wheel grows with them
+    return wheel_.init(1, ORDER_TIMEOUT_SLOTS, now_ms / ORDER_TIMEOUT_TICK_MS);
+}
+
+uint64_t InflightOrders::make_key(int client_id, const std::string& order_id) {
+    uint64_t hash = std::hash<std::string>()(order_id);
+    return hash ^ (static_cast<uint64_t>(static_cast<uint32_t>(client_id)) * 0x9E3779B97F4A7C15ULL);
+}
+
+int InflightOrders::find(int client_id, const std::string& order_id, uint64_t key) const {
+    const int* entry = index_.find(key);
+    if (entry == nullptr) {
+        return -1;
+    }
+    const InflightOrder& order = entries_[*entry];
+    return order.client_id == client_id && order.order_id == order_id ? *entry : -1;
+}
+
+bool InflightOrders::add(int client_id, const std::string& order_id, uint64_t client_seq,
+                         uint64_t submit_ns, uint64_t now_ms) {
+    uint64_t key = make_key(client_id, order_id);
+    // A resent order keeps the entry of the first copy, a hash collision is left untracked
+    if (index_.find(key) != nullptr) {
+        return false;
+    }
+
+    int entry = free_head_;
+    if (entry >= 0) {
+        free_head_ = entries_[entry].next_free;
+    } else if (static_cast<int>(entries_.size()) < capacity_) {
+        entry = static_cast<int>(entries_.size());
+        entries_.emplace_back();
+        wheel_.resize(entry + 1);
+    } else {
+        return false;
+    }
+
+    InflightOrder& order = entries_[entry];
+    order.client_id = client_id;
+    order.client_seq = client_seq;
+    order.submit_ns = submit_ns;
+    order.key = key;
+    order.order_id = order_id;
+    order.next_free = -1;
+    index_.insert_or_assign(key, entry);
+    // Rounded up so an order never expires before its full timeout
+    wheel_.schedule(entry, (now_ms + timeout_ms_ + ORDER_TIMEOUT_TICK_MS - 1) / ORDER_TIMEOUT_TICK_MS);
+    return true;
+}
+
+bool InflightOrders::complete(int client_id, const std::string& order_id, uint64_t& submit_ns) {
+    if (index_.empty()) {
+        return false;
+    }
+    int entry = find(client_id, order_id, make_key(client_id, order_id));
+    if (entry < 0) {
+        return false;
+    }
+    submit_ns = entries_[entry].submit_ns;
+    wheel_.cancel(entry);
+    release(entry);
+    return true;
+}
+
+void InflightOrders::expire(uint64_t now_ms, const ExpireCallback& callback) {
+    if (timeout_ms_ == 0) {
+        return;
+    }
+    wheel_.advance(now_ms / ORDER_TIMEOUT_TICK_MS, [this, &callback](int entry) {
+        callback(entries_[entry]);
+        release(entry);
+    });
+}
+
+void InflightOrders::release(int entry) {
+    InflightOrder& order = entries_[entry];
+    index_.erase(order.key);
+    order.order_id.clear();
+    order.next_free = free_head_;
+    free_head_ = entry;
+}
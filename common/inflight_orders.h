@@ -0,0 +1,71 @@
+/*************************************************************************
+ * @file    inflight_orders.h
+ * @brief   Orders forwarded to the order server and still waiting for their response
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_INFLIGHT_ORDERS_H_
+#define _TRADING_PLATFORM_COMMON_INFLIGHT_ORDERS_H_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "flat_hash_map.h"
+#include "timer_wheel.h"
+
+// One order waiting for its response
+struct InflightOrder {
+    int client_id;         // Connection the order came from, its slot may have been reused since
+    uint64_t client_seq;   // Sequence the client gave the order, echoed in a synthetic response
+    uint64_t submit_ns;    // Decode time, the start of the order's end-to-end latency
+    uint64_t key;          // Hash of client id and order id, its entry in the index
+    std::string order_id;
+    int next_free;         // Next free entry while unused
+};
+
+// Entries live in a pool indexed by small integers, which also key their timers in a
+// TimerWheel ticking every ORDER_TIMEOUT_TICK_MS. A flat map from the 64-bit hash of
+// (client id, order id) finds them again, the entry itself confirms the match
+class InflightOrders {
+public:
+    typedef std::function<void(const InflightOrder& order)> ExpireCallback;
+
+    InflightOrders();
+
+    // Track at most capacity orders for timeout_ms each, a timeout of 0 disables tracking
+    int init(int capacity, uint64_t timeout_ms, uint64_t now_ms);
+
+    bool enabled() const { return timeout_ms_ > 0; }
+
+    // Start tracking an order. Fails when the table is full or the same order is already in flight
+    bool add(int client_id, const std::string& order_id, uint64_t client_seq, uint64_t submit_ns, uint64_t now_ms);
+
+    // Stop tracking an order on its response. Returns false if it was not in flight,
+    // otherwise submit_ns is set to the time it was added with
+    bool complete(int client_id, const std::string& order_id, uint64_t& submit_ns);
+
+    // Remove every order whose timeout elapsed by now_ms and pass it to the callback
+    void expire(uint64_t now_ms, const ExpireCallback& callback);
+
+    size_t size() const { return index_.size(); }
+
+private:
+    static uint64_t make_key(int client_id, const std::string& order_id);
+
+    // Entry of an order, -1 if it is not in flight
+    int find(int client_id, const std::string& order_id, uint64_t key) const;
+
+    void release(int entry);
+
+    std::vector<InflightOrder> entries_;
+    int free_head_;                       // First free entry, -1 when every created entry is used
+    int capacity_;                        // Upper bound of entries_
+    FlatHashMap<uint64_t, int> index_;    // Key to entry
+    TimerWheel wheel_;                    // Timeout of each entry
+    uint64_t timeout_ms_;
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_INFLIGHT_ORDERS_H_
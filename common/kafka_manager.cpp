@@ -1,27 +1,78 @@
 #include "kafka_manager.h"
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 #include <chrono>
+#include <algorithm>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 
 using namespace cs_proto;
 
+namespace {
+
+void put_u16(char* dst, uint16_t value) {
+    value = htons(value);
+    memcpy(dst, &value, sizeof(value));
+}
+
+void put_u32(char* dst, uint32_t value) {
+    value = htonl(value);
+    memcpy(dst, &value, sizeof(value));
+}
+
+uint16_t get_u16(const char* src) {
+    uint16_t value;
+    memcpy(&value, src, sizeof(value));
+    return ntohs(value);
+}
+
+uint32_t get_u32(const char* src) {
+    uint32_t value;
+    memcpy(&value, src, sizeof(value));
+    return ntohl(value);
+}
+
+// Parse one message body straight from its slice of the payload, on the arena if there is one
+MsgPtr parse_body(uint16_t id, const char* data, size_t len, google::protobuf::Arena* arena) {
+    if (!MsgRegistry::is_valid(id)) {
+        LOG(ERROR, "Unknown message id: {}", id);
+        return nullptr;
+    }
+    MsgPtr message(MsgRegistry::create_message(static_cast<MsgId>(id), arena));
+    if (!message->ParseFromArray(data, static_cast<int>(len))) {
+        LOG(ERROR, "Failed to parse {} message", message->GetTypeName());
+        return nullptr;
+    }
+    return message;
+}
+
+}  // namespace
+
 // Singleton instance
 KafkaManager& KafkaManager::instance() {
     static KafkaManager instance;
     return instance;
 }
 
-KafkaManager::KafkaManager() : running_(false) {}
+KafkaManager::KafkaManager() : consumer_queue_(nullptr), queue_event_fds_{-1, -1}, running_(false), produce_failures_(0) {}
 
 KafkaManager::~KafkaManager() {
     stop_consuming();
-    if (producer_) {
-        producer_->flush(1000);  // Flush with 1s timeout before destroying
+    for (size_t shard = 0; shard < batches_.size(); ++shard) {
+        flush_batches(static_cast<int>(shard));
     }
+    for (auto& producer : producers_) {
+        producer->flush(1000);  // Flush with 1s timeout before destroying
+    }
+    producers_.clear();  // Before the delivery report callbacks they use
 }
 
 // Initialize Kafka manager with Oracle Cloud Streaming settings
 bool KafkaManager::init(const std::string& bootstrap_servers,
                         const std::string& username,
-                        const std::string& password) {
+                        const std::string& password,
+                        int producer_num) {
     bootstrap_servers_ = bootstrap_servers;
     username_ = username;
     password_ = password;
@@ -43,94 +94,231 @@ bool KafkaManager::init(const std::string& bootstrap_servers,
         return false;
     }
 
-    // Set delivery report callback
-    if (conf->set("dr_cb", &delivery_cb_, errstr) != RdKafka::Conf::CONF_OK) {
-        LOG(ERROR, "Failed to set delivery report callback: {}", errstr);
-        delete conf;
-        return false;
+    // Create Kafka producers, the conf is copied by each producer together with its own delivery report callback
+    producers_.clear();
+    delivery_cbs_.clear();
+    for (int i = 0; i < std::max(producer_num, 1); ++i) {
+        std::unique_ptr<DeliveryReportCb> delivery_cb(new DeliveryReportCb());
+        if (conf->set("dr_cb", delivery_cb.get(), errstr) != RdKafka::Conf::CONF_OK) {
+            LOG(ERROR, "Failed to set delivery report callback: {}", errstr);
+            producers_.clear();
+            delete conf;
+            return false;
+        }
+        std::unique_ptr<RdKafka::Producer> producer(RdKafka::Producer::create(conf, errstr));
+        if (!producer) {
+            LOG(ERROR, "Failed to create Kafka producer {}: {}", i, errstr);
+            producers_.clear();
+            delete conf;
+            return false;
+        }
+        producers_.push_back(std::move(producer));
+        delivery_cbs_.push_back(std::move(delivery_cb));
     }
 
-    // Create Kafka producer
-    producer_.reset(RdKafka::Producer::create(conf, errstr));
-    if (!producer_) {
-        LOG(ERROR, "Failed to create Kafka producer: {}", errstr);
-        delete conf;
+    delete conf;
+    batches_.assign(producers_.size(), std::vector<PendingBatch>());
+    pending_entries_.reset(new std::atomic<int64_t>[producers_.size()]());
+
+    LOG(INFO, "KafkaManager initialized successfully, producers: {}", producers_.size());
+    return true;
+}
+
+// Serialize a message with its client_id set, without copying the caller's message
+bool KafkaManager::serialize_message(const google::protobuf::Message& message, int client_id, std::string& out) {
+    using google::protobuf::FieldDescriptor;
+    using google::protobuf::internal::WireFormatLite;
+    using google::protobuf::io::CodedOutputStream;
+
+    const FieldDescriptor* client_id_field = message.GetDescriptor()->FindFieldByName("client_id");
+    if (client_id_field == nullptr || client_id_field->type() != FieldDescriptor::TYPE_INT32 ||
+        client_id_field->is_repeated()) {
+        LOG(ERROR, "Message type {} does not have a client_id field. Client ID: {} will not be set.",
+            message.GetTypeName(), client_id);
         return false;
     }
 
-    delete conf;  // Producer has taken ownership of conf
+    // The client id is written as one more occurrence of the field after the body.
+    // The parser keeps the last value of a singular scalar field, so it overrides any earlier one
+    uint32_t field_tag = WireFormatLite::MakeTag(client_id_field->number(), WireFormatLite::WIRETYPE_VARINT);
+    size_t body_len = message.ByteSizeLong();
+    size_t field_len = CodedOutputStream::VarintSize32(field_tag) + CodedOutputStream::VarintSize32SignExtended(client_id);
+
+    size_t offset = out.size();
+    out.resize(offset + body_len + field_len);
+    uint8_t* target = reinterpret_cast<uint8_t*>(&out[offset]);
+    target = message.SerializeWithCachedSizesToArray(target);
+    target = CodedOutputStream::WriteTagToArray(field_tag, target);
+    CodedOutputStream::WriteVarint32SignExtendedToArray(client_id, target);
+    return true;
+}
 
-    LOG(INFO, "KafkaManager initialized successfully");
+// Produce one record on the producer of a shard. Without RK_MSG_BLOCK a full producer
+// queue fails the call with ERR__QUEUE_FULL instead of stalling the caller's loop
+bool KafkaManager::produce_payload(const std::string& topic, const std::string& payload, int entries, int shard_id) {
+    size_t producer_index = shard_id % producers_.size();
+    RdKafka::Producer* producer = producers_[producer_index].get();
+    RdKafka::ErrorCode err = producer->produce(
+        topic,
+        RdKafka::Topic::PARTITION_UA,
+        RdKafka::Producer::RK_MSG_COPY,
+        const_cast<char*>(payload.data()),
+        payload.size(),
+        nullptr,  // No key
+        0,        // No key length
+        0,        // Use current timestamp
+        reinterpret_cast<void*>(static_cast<intptr_t>(entries))  // Returned in the delivery report
+    );
+
+    if (err != RdKafka::ERR_NO_ERROR) {
+        produce_failures_.fetch_add(1, std::memory_order_relaxed);
+        LOG(ERROR, "Failed to produce message: {}", RdKafka::err2str(err));
+        return false;
+    }
+    delivery_cbs_[producer_index]->undelivered.fetch_add(entries, std::memory_order_relaxed);
     return true;
 }
 
 // Produce a protobuf message to a topic
-bool KafkaManager::produce(const std::string& topic, const google::protobuf::Message& message, int client_id) {
-    if (!producer_) {
+bool KafkaManager::produce(const std::string& topic, const google::protobuf::Message& message, int client_id, int shard_id) {
+    if (producers_.empty()) {
         LOG(ERROR, "Producer not initialized");
         return false;
     }
 
     LOG(DEBUG, "Producing message of type: {}, client_id: {}", message.GetTypeName(), client_id);
 
-    // Create a mutable copy of the message
-    std::unique_ptr<google::protobuf::Message> mutable_message(message.New());
-    mutable_message->CopyFrom(message);
-
-    // Check if the message has a client_id field and set it if present
-    const google::protobuf::FieldDescriptor* client_id_field = 
-        mutable_message->GetDescriptor()->FindFieldByName("client_id");
-    if (client_id_field) {
-        mutable_message->GetReflection()->SetInt32(mutable_message.get(), client_id_field, client_id);
-    } else {
-        LOG(ERROR, "Message type does not have a client_id field. Client ID: {} will not be set.", client_id);
+    MsgId msg_id = MsgRegistry::id_of(message);
+    if (msg_id == MSG_NONE) {
+        LOG(ERROR, "Message type {} is not registered", message.GetTypeName());
         return false;
     }
 
-    // Serialize the protobuf message with type information
-    std::string type_name = message.GetTypeName();
-    std::string serialized_content = mutable_message->SerializeAsString();
-    
-    // Combine type name, null separator, and serialized content
-    std::string serialized_message;
-    serialized_message.reserve(type_name.length() + 1 + serialized_content.length());
-    serialized_message.append(type_name);
-    serialized_message.push_back('\0');
-    serialized_message.append(serialized_content);
+    // Payload is a 2-byte big-endian message id followed by the serialized message
+    std::string serialized_message(KAFKA_MSG_TAG_SIZE, '\0');
+    put_u16(&serialized_message[0], static_cast<uint16_t>(msg_id));
+    if (!serialize_message(message, client_id, serialized_message)) {
+        return false;
+    }
 
     // Log the serialized message details for debugging
-    LOG(DEBUG, "Serialized message: type='{}', content_length={}, total_length={}",
-        type_name, serialized_content.length(), serialized_message.length());
+    LOG(DEBUG, "Serialized message: id={}, total_length={}", static_cast<int>(msg_id), serialized_message.length());
 
-    // Produce the message to Kafka
-    RdKafka::ErrorCode err = producer_->produce(
-        topic,
-        RdKafka::Topic::PARTITION_UA,
-        RdKafka::Producer::RK_MSG_COPY,
-        const_cast<char*>(serialized_message.data()),
-        serialized_message.size(),
-        nullptr,  // No key
-        0,        // No key length
-        0,        // Use current timestamp
-        nullptr   // No message headers
-    );
+    if (!produce_payload(topic, serialized_message, 1, shard_id)) {
+        return false;
+    }
 
-    if (err != RdKafka::ERR_NO_ERROR) {
-        LOG(ERROR, "Failed to produce message: {}", RdKafka::err2str(err));
+    // Delivery is reported by a later poll, waiting for it here would stall the caller
+    producers_[shard_id % producers_.size()]->poll(0);  // Trigger delivery report callbacks
+    return true;
+}
+
+// Append a message to the pending batch of a topic
+bool KafkaManager::append_batch(const std::string& topic, const google::protobuf::Message& message, int client_id, int shard_id) {
+    if (producers_.empty()) {
+        LOG(ERROR, "Producer not initialized");
         return false;
     }
 
-    producer_->poll(0);  // Trigger delivery report callbacks
-    producer_->flush(1000);  // Flush with 1s timeout to ensure message is sent
+    MsgId msg_id = MsgRegistry::id_of(message);
+    if (msg_id == MSG_NONE) {
+        LOG(ERROR, "Message type {} is not registered", message.GetTypeName());
+        return false;
+    }
+
+    std::vector<PendingBatch>& shard_batches = batches_[shard_id % batches_.size()];
+    auto it = std::find_if(shard_batches.begin(), shard_batches.end(),
+                           [&topic](const PendingBatch& batch) { return batch.topic == topic; });
+    if (it == shard_batches.end()) {
+        shard_batches.push_back(PendingBatch{topic, std::string(), 0});
+        it = shard_batches.end() - 1;
+    }
+    PendingBatch& batch = *it;
+    if (batch.payload.empty()) {
+        batch.payload.resize(KAFKA_MSG_TAG_SIZE);
+        put_u16(&batch.payload[0], KAFKA_BATCH_TAG);
+    }
+
+    // Reserve the entry head, its length is known once the body is in place
+    size_t head = batch.payload.size();
+    batch.payload.resize(head + KAFKA_BATCH_ENTRY_HEAD_SIZE);
+    if (!serialize_message(message, client_id, batch.payload)) {
+        batch.payload.resize(head);
+        return false;
+    }
+    size_t body_len = batch.payload.size() - head - KAFKA_BATCH_ENTRY_HEAD_SIZE;
+    put_u16(&batch.payload[head], static_cast<uint16_t>(msg_id));
+    put_u32(&batch.payload[head + sizeof(uint16_t)], static_cast<uint32_t>(body_len));
+    ++batch.count;
+    std::atomic<int64_t>& pending = pending_entries_[shard_id % batches_.size()];
+    pending.store(pending.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    if (batch.payload.size() >= KAFKA_BATCH_MAX_BYTES) {
+        LOG(DEBUG, "Batch for topic {} reached {} bytes, producing early", topic, batch.payload.size());
+        bool ok = produce_payload(topic, batch.payload, batch.count, shard_id);
+        pending.store(pending.load(std::memory_order_relaxed) - batch.count, std::memory_order_relaxed);
+        batch.payload.clear();
+        batch.count = 0;
+        return ok;
+    }
     return true;
 }
 
+// Produce every pending batch of a shard
+int KafkaManager::flush_batches(int shard_id) {
+    if (batches_.empty()) {
+        return 0;
+    }
+
+    int produced = 0;
+    size_t shard = shard_id % batches_.size();
+    for (PendingBatch& batch : batches_[shard]) {
+        if (batch.count == 0) {
+            continue;
+        }
+        LOG(DEBUG, "Producing batch of {} messages, {} bytes to topic {}", batch.count, batch.payload.size(), batch.topic);
+        if (produce_payload(batch.topic, batch.payload, batch.count, shard_id)) {
+            ++produced;
+        }
+        batch.payload.clear();  // Keeps its capacity for the next batch
+        batch.count = 0;
+    }
+    pending_entries_[shard].store(0, std::memory_order_relaxed);
+
+    // Reports are also polled while nothing is produced, they are what drains the ingress depth
+    if (produced > 0 || delivery_cbs_[shard % delivery_cbs_.size()]->undelivered.load(std::memory_order_relaxed) > 0) {
+        producers_[shard % producers_.size()]->poll(0);  // Trigger delivery report callbacks
+    }
+    return produced;
+}
+
+// Messages of a shard appended or produced and not yet reported
+int64_t KafkaManager::ingress_depth(int shard_id) const {
+    if (producers_.empty()) {
+        return 0;
+    }
+    return pending_entries_[shard_id % batches_.size()].load(std::memory_order_relaxed) +
+           delivery_cbs_[shard_id % delivery_cbs_.size()]->undelivered.load(std::memory_order_relaxed);
+}
+
+uint64_t KafkaManager::delivery_failures() const {
+    uint64_t failures = 0;
+    for (const auto& delivery_cb : delivery_cbs_) {
+        failures += delivery_cb->failures.load(std::memory_order_relaxed);
+    }
+    return failures;
+}
+
 // Start consuming messages from topics
-bool KafkaManager::start_consuming(const std::vector<std::string>& topics, const std::string& group_id, MessageCallback callback) {
+bool KafkaManager::start_consuming(const std::vector<std::string>& topics, const std::string& group_id,
+                                   MessageCallback callback, bool use_thread, size_t arena_block_size) {
     if (consumer_) {
         LOG(ERROR, "Consumer already running");
         return false;
     }
+    if (decode_arena_.init(arena_block_size) != 0) {
+        return false;
+    }
 
     std::string errstr;
     RdKafka::Conf* conf = RdKafka::Conf::create(RdKafka::Conf::CONF_GLOBAL);
@@ -169,9 +357,13 @@ bool KafkaManager::start_consuming(const std::vector<std::string>& topics, const
     }
 
     running_ = true;
-    consumer_thread_ = std::make_unique<std::thread>(&KafkaManager::consume_loop, this, callback);
+    if (use_thread) {
+        consumer_thread_ = std::make_unique<std::thread>(&KafkaManager::consume_loop, this, callback);
+    } else {
+        callback_ = callback;
+    }
 
-    LOG(INFO, "Started consuming from topics");
+    LOG(INFO, "Started consuming from topics, consumer thread: {}", use_thread);
     return true;
 }
 
@@ -181,7 +373,21 @@ void KafkaManager::stop_consuming() {
     if (consumer_thread_ && consumer_thread_->joinable()) {
         consumer_thread_->join();
     }
+    consumer_thread_.reset();
+    if (consumer_queue_ != nullptr) {
+        rd_kafka_queue_io_event_enable(consumer_queue_, -1, nullptr, 0);
+        rd_kafka_queue_destroy(consumer_queue_);
+        consumer_queue_ = nullptr;
+    }
+    for (int& fd : queue_event_fds_) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
     if (consumer_) {
+        // Whoever joins the group next resumes exactly after the messages consumed here
+        consumer_->commitSync();
         consumer_->close();
         consumer_.reset();
     }
@@ -190,14 +396,72 @@ void KafkaManager::stop_consuming() {
 
 // Flush all produced messages
 void KafkaManager::flush(int timeout_ms) {
-    if (producer_) {
-        producer_->flush(timeout_ms);
+    for (auto& producer : producers_) {
+        producer->flush(timeout_ms);
     }
 }
 
-// Process incoming Kafka messages
-void KafkaManager::process_messages() {
-    // This method is now empty as message processing is handled in the consumer thread
+// Route consumer queue wakeups to a non-blocking pipe
+int KafkaManager::enable_queue_event() {
+    if (!consumer_ || consumer_thread_) {
+        LOG(ERROR, "Queue events need a consumer without consumer thread");
+        return -1;
+    }
+    if (queue_event_fds_[0] >= 0) {
+        return queue_event_fds_[0];
+    }
+
+    // KafkaConsumer forwards the main queue to the group queue, consume() reads from it
+    consumer_queue_ = rd_kafka_queue_get_consumer(consumer_->c_ptr());
+    if (consumer_queue_ == nullptr) {
+        LOG(ERROR, "Kafka consumer has no consumer group queue");
+        return -1;
+    }
+    if (pipe2(queue_event_fds_, O_NONBLOCK | O_CLOEXEC) != 0) {
+        LOG(ERROR, "Failed to create queue event pipe: {}", strerror(errno));
+        rd_kafka_queue_destroy(consumer_queue_);
+        consumer_queue_ = nullptr;
+        return -1;
+    }
+
+    static const char kWakeup = 1;
+    rd_kafka_queue_io_event_enable(consumer_queue_, queue_event_fds_[1], &kWakeup, sizeof(kWakeup));
+
+    LOG(INFO, "Kafka consumer queue events enabled, fd: {}", queue_event_fds_[0]);
+    return queue_event_fds_[0];
+}
+
+// Process incoming Kafka messages on the caller's thread
+int KafkaManager::process_messages(int max_messages) {
+    if (!consumer_ || consumer_thread_ || !running_) {
+        return 0;
+    }
+
+    // Clear pending wakeups first, a message arriving after this point writes a new one
+    if (queue_event_fds_[0] >= 0) {
+        char drain[64];
+        while (read(queue_event_fds_[0], drain, sizeof(drain)) > 0) {
+        }
+    }
+
+    int processed = 0;
+    while (processed < max_messages) {
+        std::unique_ptr<RdKafka::Message> msg(consumer_->consume(0));
+        if (msg->err() != RdKafka::ERR_NO_ERROR) {
+            if (msg->err() != RdKafka::ERR__TIMED_OUT) {
+                LOG(ERROR, "Kafka consume error: {}", msg->errstr());
+            }
+            break;
+        }
+        dispatch_message(*msg, callback_);
+        ++processed;
+    }
+    decode_arena_.reset();
+
+    if (processed > 0) {
+        consumer_->commitAsync();  // Never block the caller's loop on the commit
+    }
+    return processed;
 }
 
 // Consumer thread function
@@ -214,16 +478,9 @@ void KafkaManager::consume_loop(MessageCallback callback) {
         }
 
         for (const auto& msg : messages) {
-            if (msg->len() > 0) {
-                std::string payload(static_cast<const char*>(msg->payload()), msg->len());
-                auto protobuf_message = deserialize_message(payload);
-                if (protobuf_message) {
-                    callback(*protobuf_message);
-                } else {
-                    LOG(ERROR, "Failed to deserialize message");
-                }
-            }
+            dispatch_message(*msg, callback);
         }
+        decode_arena_.reset();
 
         if (!messages.empty()) {
             consumer_->commitSync();  // Commit offsets synchronously
@@ -231,61 +488,72 @@ void KafkaManager::consume_loop(MessageCallback callback) {
     }
 }
 
+// Deserialize a consumed message and hand it to the callback
+void KafkaManager::dispatch_message(const RdKafka::Message& msg, const MessageCallback& callback) {
+    if (msg.len() > 0) {
+        if (deserialize_message(static_cast<const char*>(msg.payload()), msg.len(), callback) < 0) {
+            LOG(ERROR, "Failed to deserialize message");
+        }
+    }
+}
+
 // Delivery report callback
 void KafkaManager::DeliveryReportCb::dr_cb(RdKafka::Message& message) {
+    // Failed or not, the messages of the record have left the ingress stage
+    undelivered.fetch_sub(reinterpret_cast<intptr_t>(message.msg_opaque()), std::memory_order_relaxed);
     if (message.err()) {
+        failures.fetch_add(1, std::memory_order_relaxed);
         LOG(ERROR, "Message delivery failed: {}", message.errstr());
     } else {
-        LOG(INFO, "Message delivered to topic {} [{}] at offset {}",
+        LOG(DEBUG, "Message delivered to topic {} [{}] at offset {}",
                     message.topic_name(), message.partition(), message.offset());
     }
 }
 
-// Helper function to deserialize protobuf message
-std::unique_ptr<google::protobuf::Message> KafkaManager::deserialize_message(const std::string& payload) {
-    LOG(DEBUG, "Attempting to deserialize message of length: {}", payload.length());
+// Deserialize a single tagged message or every entry of a batch envelope
+int KafkaManager::deserialize_message(const char* payload, size_t len, const MessageCallback& callback) {
+    LOG(DEBUG, "Attempting to deserialize message of length: {}", len);
 
-    // Find the null terminator that separates the message type from the content
-    size_t null_terminator = payload.find('\0');
-    if (null_terminator == std::string::npos) {
-        LOG(ERROR, "Invalid message format: no null terminator found");
-        return nullptr;
+    if (len < KAFKA_MSG_TAG_SIZE) {
+        LOG(ERROR, "Invalid message format: payload of {} bytes has no message tag", len);
+        return -1;
     }
 
-    // Extract message type and content
-    std::string message_type(payload.data(), null_terminator);
-    std::string message_content(payload.data() + null_terminator + 1, 
-                                payload.length() - null_terminator - 1);
-
-    LOG(DEBUG, "Message type: '{}', Content length: {}", message_type, message_content.length());
-
-    // Create the appropriate message object based on the type
-    std::unique_ptr<google::protobuf::Message> message;
-    if (message_type == "cspkg.AccountLoginReq") {
-        message = std::make_unique<cspkg::AccountLoginReq>();
-    } else if (message_type == "cspkg.AccountLoginRes") {
-        message = std::make_unique<cspkg::AccountLoginRes>();
-    } else if (message_type == "cs_proto.FuturesOrder") {
-        message = std::make_unique<cs_proto::FuturesOrder>();
-    } else if (message_type == "cs_proto.OrderResponse") {
-        message = std::make_unique<cs_proto::OrderResponse>();
-    } else {
-        LOG(ERROR, "Unknown message type: '{}'", message_type);
-        return nullptr;
+    // Bodies are parsed straight from the payload, it stays valid until the Kafka message is released
+    uint16_t tag = get_u16(payload);
+    if (tag != KAFKA_BATCH_TAG) {
+        auto message = parse_body(tag, payload + KAFKA_MSG_TAG_SIZE, len - KAFKA_MSG_TAG_SIZE, decode_arena_.get());
+        if (!message) {
+            return -1;
+        }
+        callback(static_cast<MsgId>(tag), *message);
+        return 1;
     }
 
-    // Parse the message content
-    if (!message->ParseFromString(message_content)) {
-        LOG(ERROR, "Failed to parse {} message", message_type);
-        return nullptr;
-    }
+    int dispatched = 0;
+    size_t offset = KAFKA_MSG_TAG_SIZE;
+    while (offset < len) {
+        if (len - offset < KAFKA_BATCH_ENTRY_HEAD_SIZE) {
+            LOG(ERROR, "Truncated batch entry head at offset {} of {}", offset, len);
+            return -1;
+        }
+        uint16_t id = get_u16(payload + offset);
+        uint32_t body_len = get_u32(payload + offset + sizeof(uint16_t));
+        offset += KAFKA_BATCH_ENTRY_HEAD_SIZE;
+        if (body_len > len - offset) {
+            LOG(ERROR, "Truncated batch entry body at offset {}, length {} of {}", offset, body_len, len);
+            return -1;
+        }
 
-    // Parse the message content
-    if (!message->ParseFromString(message_content)) {
-        LOG(ERROR, "Failed to parse {} message", message_type);
-        return nullptr;
+        // A bad entry is skipped, its length still locates the next one
+        auto message = parse_body(id, payload + offset, body_len, decode_arena_.get());
+        if (message) {
+            callback(static_cast<MsgId>(id), *message);
+            ++dispatched;
+        }
+        offset += body_len;
     }
 
-    LOG(INFO, "Successfully deserialized {} message", message_type);
-    return message;
-}
\ No newline at end of file
+    LOG(DEBUG, "Deserialized batch of {} messages", dispatched);
+    return dispatched;
+}
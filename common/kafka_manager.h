@@ -15,30 +15,64 @@
 #include <functional>
 #include <thread>
 #include <atomic>
+#include <librdkafka/rdkafka.h>
 #include <librdkafka/rdkafkacpp.h>
 #include <google/protobuf/message.h>
-#include "role.pb.h"
-#include "futures_order.pb.h"
+#include "msg_registry.h"
+#include "decode_arena.h"
 #include "logger.h"
 
+// Size of the message id tag in front of every Kafka payload
+const size_t KAFKA_MSG_TAG_SIZE = sizeof(uint16_t);
+
+// Payload tag of a batch envelope. The envelope is followed by entries of
+// [2-byte message id][4-byte body length][body], all integers big-endian
+const uint16_t KAFKA_BATCH_TAG = 0xFFFF;
+const size_t KAFKA_BATCH_ENTRY_HEAD_SIZE = sizeof(uint16_t) + sizeof(uint32_t);
+
+// A batch is produced early once it reaches this size, well below the broker's default message.max.bytes
+const size_t KAFKA_BATCH_MAX_BYTES = 512 * 1024;
+
 class KafkaManager {
 public:
-    // Callback function type for message consumption
-    using MessageCallback = std::function<void(const google::protobuf::Message&)>;
+    // Callback function type for message consumption, the id comes from the payload tag
+    using MessageCallback = std::function<void(MsgId, const google::protobuf::Message&)>;
 
     // Singleton instance
     static KafkaManager& instance();
 
-    // Initialize Kafka manager with Oracle Cloud Streaming settings
+    // Initialize Kafka manager with Oracle Cloud Streaming settings,
+    // creating one producer per caller shard so shards never share a producer queue
     bool init(const std::string& bootstrap_servers,
               const std::string& username,
-              const std::string& password);
+              const std::string& password,
+              int producer_num = 1);
+
+    // Produce a protobuf message to a topic with additional metadata, using the producer of the given shard
+    bool produce(const std::string& topic, const google::protobuf::Message& message, int client_id, int shard_id = 0);
+
+    // Append a message to the pending batch envelope of a topic. Nothing is sent until
+    // flush_batches() is called from the same shard thread
+    bool append_batch(const std::string& topic, const google::protobuf::Message& message, int client_id, int shard_id = 0);
+
+    // Produce every pending batch of a shard as one record per topic, returns the number of records produced
+    int flush_batches(int shard_id = 0);
 
-    // Produce a protobuf message to a topic with additional metadata
-    bool produce(const std::string& topic, const google::protobuf::Message& message, int client_id);
+    // Messages of a shard not yet delivered: appended to its pending batches, or produced and
+    // still waiting for their delivery report. Readable from any thread
+    int64_t ingress_depth(int shard_id = 0) const;
 
-    // Start consuming messages from topics
-    bool start_consuming(const std::vector<std::string>& topics, const std::string& group_id, MessageCallback callback);
+    // Start consuming messages from topics. With use_thread the callback runs on an internal
+    // consumer thread, otherwise the owner drives consumption through process_messages().
+    // Messages are decoded on an arena with a first block of arena_block_size bytes, 0 for the heap,
+    // and are only valid during the callback
+    bool start_consuming(const std::vector<std::string>& topics, const std::string& group_id,
+                         MessageCallback callback, bool use_thread = true,
+                         size_t arena_block_size = DECODE_ARENA_BLOCK_SIZE);
+
+    // Route consumer queue wakeups to a pipe and return its read end, which becomes readable
+    // whenever the queue goes from empty to non-empty. Only valid without the consumer thread
+    int enable_queue_event();
 
     // Stop consuming messages
     void stop_consuming();
@@ -46,8 +80,16 @@ public:
     // Flush all produced messages
     void flush(int timeout_ms);
 
-    // Process incoming Kafka messages (now handled in consume_loop)
-    void process_messages();
+    // Consume and dispatch up to max_messages queued messages without blocking, returns the
+    // number dispatched. Does nothing when the consumer thread is running
+    int process_messages(int max_messages = 1000);
+
+    // Arena consumed messages are decoded on, released after every batch
+    const DecodeArena& decode_arena() const { return decode_arena_; }
+
+    // Records the producers refused, and records the brokers failed to take, since startup
+    uint64_t produce_failures() const { return produce_failures_.load(std::memory_order_relaxed); }
+    uint64_t delivery_failures() const;
 
 private:
     KafkaManager();
@@ -60,22 +102,55 @@ private:
     std::string username_;
     std::string password_;
 
-    // Kafka producer
-    std::unique_ptr<RdKafka::Producer> producer_;
+    // Kafka producers, one per shard
+    std::vector<std::unique_ptr<RdKafka::Producer>> producers_;
+
+    // Batch envelope being filled for a topic
+    struct PendingBatch {
+        std::string topic;
+        std::string payload;  // Envelope tag followed by the entries appended so far
+        int count;            // Number of entries
+    };
+
+    // Pending batches of each shard, only touched by the thread owning the shard
+    std::vector<std::vector<PendingBatch>> batches_;
+
+    // Entries in the pending batches of each shard, written by the thread owning the shard
+    std::unique_ptr<std::atomic<int64_t>[]> pending_entries_;
 
     // Kafka consumer
     std::unique_ptr<RdKafka::KafkaConsumer> consumer_;
 
+    // Consumer queue with IO events enabled, and the pipe they are written to. The C++ API
+    // has no handle on the consumer group queue, so it is taken through the C one
+    rd_kafka_queue_t* consumer_queue_;
+    int queue_event_fds_[2];
+
+    // Callback used by process_messages()
+    MessageCallback callback_;
+
+    // Messages of one consumed batch, only touched by the consuming thread
+    DecodeArena decode_arena_;
+
     // Flag to control consumption loop
     std::atomic<bool> running_;
 
-    // Delivery report callback
+    // produce() calls that returned an error, from any shard thread
+    std::atomic<uint64_t> produce_failures_;
+
+    // Delivery report callback, one per producer so reports are counted against their shard.
+    // The msg_opaque of every record is the number of messages it carries
     class DeliveryReportCb : public RdKafka::DeliveryReportCb {
     public:
+        DeliveryReportCb() : failures(0), undelivered(0) {}
         void dr_cb(RdKafka::Message& message) override;
+
+        std::atomic<uint64_t> failures;     // Reports carrying an error
+        std::atomic<int64_t> undelivered;   // Messages in records produced and not reported yet
     };
 
-    DeliveryReportCb delivery_cb_;
+    // Same index as producers_, the destructor releases the producers first
+    std::vector<std::unique_ptr<DeliveryReportCb>> delivery_cbs_;
 
     // Consumer polling thread
     std::unique_ptr<std::thread> consumer_thread_;
@@ -83,8 +158,18 @@ private:
     // Consumer thread function
     void consume_loop(MessageCallback callback);
 
-    // Helper function to deserialize protobuf message
-    std::unique_ptr<google::protobuf::Message> deserialize_message(const std::string& payload);
+    // Deserialize a consumed message and hand it to the callback
+    void dispatch_message(const RdKafka::Message& msg, const MessageCallback& callback);
+
+    // Serialize a message with its client_id field set and append it to out
+    bool serialize_message(const google::protobuf::Message& message, int client_id, std::string& out);
+
+    // Produce one record carrying entries messages on the producer of a shard, without blocking
+    bool produce_payload(const std::string& topic, const std::string& payload, int entries, int shard_id);
+
+    // Deserialize a tagged payload, a single message or a batch envelope, and hand each
+    // message to the callback. Returns the number of messages dispatched, -1 on a malformed payload
+    int deserialize_message(const char* payload, size_t len, const MessageCallback& callback);
 };
 
 #endif // _COMMON_KAFKA_MANAGER_H_
\ No newline at end of file
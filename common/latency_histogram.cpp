@@ -0,0 +1,63 @@
+#include "latency_histogram.h"
+
+void LatencyCounts::merge(const LatencyCounts& other) {
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum_ns += other.sum_ns;
+}
+
+void LatencyCounts::subtract(const LatencyCounts& base) {
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        buckets[i] -= base.buckets[i];
+    }
+    count -= base.count;
+    sum_ns -= base.sum_ns;
+}
+
+uint64_t LatencyCounts::percentile(double q) const {
+    // A sample recorded while the buckets were read may be missing from count, rank by the buckets
+    uint64_t total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        total += buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(q * total + 0.5);
+    rank = rank == 0 ? 1 : (rank > total ? total : rank);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return LatencyHistogram::bucket_high(i);
+        }
+    }
+    return max();
+}
+
+uint64_t LatencyCounts::max() const {
+    for (int i = LATENCY_BUCKETS - 1; i >= 0; --i) {
+        if (buckets[i] != 0) {
+            return LatencyHistogram::bucket_high(i);
+        }
+    }
+    return 0;
+}
+
+uint64_t LatencyCounts::count_at_most(uint64_t ns) const {
+    uint64_t total = 0;
+    for (int i = 0; i < LATENCY_BUCKETS && LatencyHistogram::bucket_high(i) <= ns; ++i) {
+        total += buckets[i];
+    }
+    return total;
+}
+
+void LatencyHistogram::read(LatencyCounts& out) const {
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        out.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+    out.count = count_.load(std::memory_order_relaxed);
+    out.sum_ns = sum_ns_.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,101 @@
+/*************************************************************************
+ * @file    latency_histogram.h
+ * @brief   Log-linear latency histogram with a single writer and lock-free readers
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_LATENCY_HISTOGRAM_H_
+#define _TRADING_PLATFORM_COMMON_LATENCY_HISTOGRAM_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Sub-buckets per power of two, 32 keeps every bucket within about 3% of its values
+const int LATENCY_SUB_BITS = 5;
+const int LATENCY_SUB_COUNT = 1 << LATENCY_SUB_BITS;
+// Largest recorded value is 2^36 ns, about 68 s, longer latencies land in the last bucket
+const int LATENCY_MAX_EXPONENT = 36;
+const int LATENCY_BUCKETS = (LATENCY_MAX_EXPONENT - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT;
+
+// Monotonic nanoseconds used for every latency sample
+inline uint64_t latency_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Plain bucket counts, either cumulative or the difference between two readings
+struct LatencyCounts {
+    uint64_t buckets[LATENCY_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+
+    // Add the counts of another histogram, used to roll shards up
+    void merge(const LatencyCounts& other);
+
+    // Keep only what was recorded after base
+    void subtract(const LatencyCounts& base);
+
+    // Highest value of the bucket holding quantile q in [0, 1], 0 when empty
+    uint64_t percentile(double q) const;
+
+    // Highest value of the last non-empty bucket
+    uint64_t max() const;
+
+    // Samples in buckets whose highest value is at most ns, for cumulative le buckets
+    uint64_t count_at_most(uint64_t ns) const;
+
+    uint64_t mean() const { return count > 0 ? sum_ns / count : 0; }
+};
+
+// Buckets are linear up to 2 * LATENCY_SUB_COUNT ns and then split every power of two into
+// LATENCY_SUB_COUNT equal parts, as in HDR histograms. Only the owning reactor thread records,
+// so a relaxed load and store replace atomic increments. Readers take cumulative counts at any
+// time and subtract an earlier reading for an interval, nothing is ever reset under the writer
+class LatencyHistogram {
+public:
+    LatencyHistogram() : buckets_{}, count_(0), sum_ns_(0) {}
+
+    void record(uint64_t ns) {
+        std::atomic<uint64_t>& bucket = buckets_[bucket_index(ns)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum_ns_.store(sum_ns_.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Record the time elapsed since start_ns
+    void record_since(uint64_t start_ns, uint64_t now_ns) { record(now_ns > start_ns ? now_ns - start_ns : 0); }
+
+    // Cumulative counts since construction
+    void read(LatencyCounts& out) const;
+
+    static int bucket_index(uint64_t ns) {
+        if (ns < static_cast<uint64_t>(2 * LATENCY_SUB_COUNT)) {
+            return static_cast<int>(ns);
+        }
+        int exponent = 63 - __builtin_clzll(ns);
+        if (exponent >= LATENCY_MAX_EXPONENT) {
+            return LATENCY_BUCKETS - 1;
+        }
+        int shift = exponent - LATENCY_SUB_BITS;
+        return (shift + 1) * LATENCY_SUB_COUNT + static_cast<int>(ns >> shift) - LATENCY_SUB_COUNT;
+    }
+
+    // Highest value counted in a bucket
+    static uint64_t bucket_high(int index) {
+        if (index < 2 * LATENCY_SUB_COUNT) {
+            return index;
+        }
+        int shift = index / LATENCY_SUB_COUNT - 1;
+        return ((static_cast<uint64_t>(index % LATENCY_SUB_COUNT + LATENCY_SUB_COUNT + 1)) << shift) - 1;
+    }
+
+private:
+    std::atomic<uint64_t> buckets_[LATENCY_BUCKETS];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_ns_;
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_LATENCY_HISTOGRAM_H_
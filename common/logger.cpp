@@ -16,6 +16,10 @@ void Logger::init(const std::string& logFilePath) {
     }
 }
 
+void Logger::set_level(LogLevel level) {
+    logger->set_level(getSpdlogLevel(level));
+}
+
 spdlog::level::level_enum Logger::getSpdlogLevel(LogLevel level) {
     switch (level) {
         case INFO:
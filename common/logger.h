@@ -24,6 +24,9 @@ class Logger {
  public:
     static void init(const std::string& logFilePath);
 
+    // Lowest level written, DEBUG writes everything
+    static void set_level(LogLevel level);
+
     template<typename... Args>
     static void log(LogLevel level, const char* file, int line, const char* fmt, const Args&... args);
 
@@ -37,8 +40,13 @@ void Logger::log(LogLevel level, const char* file, int line, const char* fmt, co
     if (!logger) {
         throw std::runtime_error("Logger not initialized. Call Logger::init() first.");
     }
+    // Filtered out before anything is formatted, a disabled hot path log costs a compare
+    spdlog::level::level_enum spdlog_level = getSpdlogLevel(level);
+    if (!logger->should_log(spdlog_level)) {
+        return;
+    }
     std::string format = fmt::format("[{}:{}] {}", file, line, fmt);
-    logger->log(getSpdlogLevel(level), format, args...);
+    logger->log(spdlog_level, format, args...);
 }
 
 #define LOG(level, ...) Logger::log(level, __FILE__, __LINE__, __VA_ARGS__)
@@ -0,0 +1,154 @@
+/*************************************************************************
+ * @file    md_subscriptions.cpp
+ * @brief   Market data subscribers per symbol and pending conflated updates per connection
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#include "md_subscriptions.h"
+#include "logger.h"
+
+MdSubscriptions::~MdSubscriptions() {
+    for (SlotState& slot : slots_) {
+        for (MdConflated& pending : slot.conflated) {
+            pending.buf->release();
+        }
+    }
+}
+
+void MdSubscriptions::resize(size_t slots) {
+    if (slots > slots_.size()) {
+        slots_.resize(slots);
+    }
+}
+
+bool MdSubscriptions::subscribe(int index, const std::string& symbol) {
+    SlotState& slot = slots_[index];
+    if (slot.symbols.size() >= static_cast<size_t>(MD_MAX_SYMBOLS_PER_CONN)) {
+        return false;
+    }
+
+    int id = symbol_id(symbol);
+    if (id < 0) {
+        if (!free_ids_.empty()) {
+            id = free_ids_.back();
+            free_ids_.pop_back();
+            symbol_names_[id] = symbol;
+        } else if (symbol_names_.size() < static_cast<size_t>(MD_MAX_SYMBOLS)) {
+            id = static_cast<int>(symbol_names_.size());
+            symbol_names_.push_back(symbol);
+            subscribers_.emplace_back();
+        } else {
+            LOG(ERROR, "Market data symbol table is full, refusing {}", symbol);
+            return false;
+        }
+        symbol_ids_.emplace(symbol, id);
+    }
+    for (const SymbolRef& ref : slot.symbols) {
+        if (ref.symbol_id == id) {
+            return false;
+        }
+    }
+
+    std::vector<int>& list = subscribers_[id];
+    slot.symbols.push_back(SymbolRef{id, static_cast<int>(list.size())});
+    list.push_back(index);
+    return true;
+}
+
+bool MdSubscriptions::unsubscribe(int index, const std::string& symbol) {
+    int id = symbol_id(symbol);
+    SlotState& slot = slots_[index];
+    for (size_t i = 0; i < slot.symbols.size(); ++i) {
+        if (slot.symbols[i].symbol_id == id) {
+            erase_subscriber(index, slot.symbols[i]);
+            slot.symbols[i] = slot.symbols.back();
+            slot.symbols.pop_back();
+            // A freed id may be reused, so no pending update may keep its key
+            size_t kept = 0;
+            for (MdConflated& pending : slot.conflated) {
+                if (static_cast<int>(pending.key >> 16) == id) {
+                    pending.buf->release();
+                } else {
+                    slot.conflated[kept++] = pending;
+                }
+            }
+            slot.conflated.resize(kept);
+            return true;
+        }
+    }
+    return false;
+}
+
+void MdSubscriptions::remove(int index) {
+    if (static_cast<size_t>(index) >= slots_.size()) {
+        return;
+    }
+    SlotState& slot = slots_[index];
+    for (const SymbolRef& ref : slot.symbols) {
+        erase_subscriber(index, ref);
+    }
+    slot.symbols.clear();
+    for (MdConflated& pending : slot.conflated) {
+        pending.buf->release();
+    }
+    slot.conflated.clear();
+}
+
+void MdSubscriptions::erase_subscriber(int index, const SymbolRef& ref) {
+    std::vector<int>& list = subscribers_[ref.symbol_id];
+    int moved = list.back();
+    list[ref.position] = moved;
+    list.pop_back();
+    if (list.empty()) {
+        symbol_ids_.erase(symbol_names_[ref.symbol_id]);
+        symbol_names_[ref.symbol_id].clear();
+        free_ids_.push_back(ref.symbol_id);
+    }
+    if (moved == index) {
+        return;
+    }
+    for (SymbolRef& moved_ref : slots_[moved].symbols) {
+        if (moved_ref.symbol_id == ref.symbol_id) {
+            moved_ref.position = ref.position;
+            break;
+        }
+    }
+}
+
+int MdSubscriptions::symbol_id(const std::string& symbol) const {
+    auto it = symbol_ids_.find(symbol);
+    return it != symbol_ids_.end() ? it->second : -1;
+}
+
+std::string MdSubscriptions::symbols_of(int index) const {
+    std::string symbols;
+    if (static_cast<size_t>(index) >= slots_.size()) {
+        return symbols;
+    }
+    for (const SymbolRef& ref : slots_[index].symbols) {
+        symbols.append(symbol_names_[ref.symbol_id]);
+        symbols.push_back('\n');
+    }
+    return symbols;
+}
+
+bool MdSubscriptions::conflate(int index, uint32_t key, SharedBuf* buf) {
+    buf->add_ref();
+    for (MdConflated& pending : slots_[index].conflated) {
+        if (pending.key == key) {
+            pending.buf->release();
+            pending.buf = buf;
+            return true;
+        }
+    }
+    slots_[index].conflated.push_back(MdConflated{key, buf});
+    return false;
+}
+
+void MdSubscriptions::take_conflated(int index, std::vector<MdConflated>& out) {
+    std::vector<MdConflated>& conflated = slots_[index].conflated;
+    out.insert(out.end(), conflated.begin(), conflated.end());
+    conflated.clear();
+}
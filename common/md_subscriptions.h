@@ -0,0 +1,92 @@
+/*************************************************************************
+ * @file    md_subscriptions.h
+ * @brief   Market data subscribers per symbol and pending conflated updates per connection
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_MD_SUBSCRIPTIONS_H_
+#define _TRADING_PLATFORM_COMMON_MD_SUBSCRIPTIONS_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "shared_buf.h"
+
+// Symbols one connection may subscribe to
+const int MD_MAX_SYMBOLS_PER_CONN = 64;
+// Distinct symbols with subscribers a reactor tracks, the id of a symbol is reused once it has none
+const int MD_MAX_SYMBOLS = 65536;
+
+// Latest update of one symbol and message type that a slow subscriber has not been sent yet
+struct MdConflated {
+    uint32_t key;    // Symbol id << 16 | message id
+    SharedBuf* buf;  // One reference held
+};
+
+// Subscriber lists are dense vectors of slot indexes, each connection remembers where it sits
+// in them so subscribing and unsubscribing never scan a list
+class MdSubscriptions {
+public:
+    MdSubscriptions() {}
+    ~MdSubscriptions();
+
+    // Make room for slots connection slots
+    void resize(size_t slots);
+
+    // Subscribe a connection slot to a symbol, false if it already is or holds too many symbols
+    bool subscribe(int index, const std::string& symbol);
+
+    // Unsubscribe a connection slot from a symbol and drop its pending updates of it, false if it was not subscribed
+    bool unsubscribe(int index, const std::string& symbol);
+
+    // Drop every subscription and pending update of a released slot
+    void remove(int index);
+
+    // Id of a symbol, -1 if nobody is subscribed to it
+    int symbol_id(const std::string& symbol) const;
+
+    // Slot indexes subscribed to a symbol id
+    const std::vector<int>& subscribers(int symbol_id) const { return subscribers_[symbol_id]; }
+
+    // Symbols of a slot separated by newlines, for hot upgrade
+    std::string symbols_of(int index) const;
+
+    // Keep buf as the pending update of key for a slow slot, releasing an older one. Takes a reference
+    // and returns whether an older update was replaced
+    bool conflate(int index, uint32_t key, SharedBuf* buf);
+
+    bool has_conflated(int index) const { return !slots_[index].conflated.empty(); }
+
+    // Move the pending updates of a slot into out, their references go with them
+    void take_conflated(int index, std::vector<MdConflated>& out);
+
+    static uint32_t make_key(int symbol_id, int msg_id) {
+        return (static_cast<uint32_t>(symbol_id) << 16) | static_cast<uint32_t>(msg_id);
+    }
+
+private:
+    struct SymbolRef {
+        int symbol_id;
+        int position;  // Position of the slot in the subscriber list of the symbol
+    };
+
+    struct SlotState {
+        std::vector<SymbolRef> symbols;
+        std::vector<MdConflated> conflated;
+    };
+
+    // Remove one subscription, moving the last subscriber of the symbol into its position.
+    // The id of a symbol left without subscribers is freed
+    void erase_subscriber(int index, const SymbolRef& ref);
+
+    std::unordered_map<std::string, int> symbol_ids_;
+    std::vector<std::string> symbol_names_;      // By symbol id, empty for a free id
+    std::vector<int> free_ids_;                  // Ids of symbols that lost their last subscriber
+    std::vector<std::vector<int>> subscribers_;  // By symbol id
+    std::vector<SlotState> slots_;               // By slot index
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_MD_SUBSCRIPTIONS_H_
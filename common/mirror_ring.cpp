@@ -0,0 +1,59 @@
+#include "mirror_ring.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "logger.h"
+
+int MirrorRing::create(size_t capacity) {
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    if (capacity == 0 || capacity % page_size != 0) {
+        LOG(ERROR, "Mirror ring capacity {} is not a multiple of the page size {}", capacity, page_size);
+        return -1;
+    }
+
+    int fd = memfd_create("recv_ring", MFD_CLOEXEC);
+    if (fd < 0) {
+        LOG(ERROR, "memfd_create failed: {}", strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, capacity) != 0) {
+        LOG(ERROR, "ftruncate of mirror ring failed: {}", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // Reserve both halves first so the two mappings are guaranteed to be adjacent
+    void* reserved = mmap(nullptr, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        LOG(ERROR, "Failed to reserve mirror ring address space: {}", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    char* base = static_cast<char*>(reserved);
+    if (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+        mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        LOG(ERROR, "Failed to map mirror ring: {}", strerror(errno));
+        munmap(base, 2 * capacity);
+        close(fd);
+        return -1;
+    }
+    close(fd);  // The mappings keep the pages alive
+
+    base_ = base;
+    capacity_ = capacity;
+    read_pos_ = 0;
+    data_len_ = 0;
+    return 0;
+}
+
+void MirrorRing::destroy() {
+    if (base_ != nullptr) {
+        munmap(base_, 2 * capacity_);
+    }
+    base_ = nullptr;
+    capacity_ = 0;
+    read_pos_ = 0;
+    data_len_ = 0;
+}
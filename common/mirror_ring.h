@@ -0,0 +1,60 @@
+/*************************************************************************
+ * @file    mirror_ring.h
+ * @brief   Receive ring buffer whose pages are mapped twice back to back
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_MIRROR_RING_H_
+#define _TRADING_PLATFORM_COMMON_MIRROR_RING_H_
+
+#include <cstddef>
+
+// The same physical pages are mapped at base and base + capacity, so any
+// readable or writable region is contiguous in memory even when it crosses
+// the end of the ring. Frames can then be parsed in place and reads can
+// always be given the whole free space.
+//
+// The ring is a plain value so it can live in SocketConnData slots: create()
+// and destroy() manage the mapping explicitly.
+class MirrorRing {
+public:
+    MirrorRing() : base_(nullptr), capacity_(0), read_pos_(0), data_len_(0) {}
+
+    // Map a ring of capacity bytes, capacity must be a multiple of the page size
+    int create(size_t capacity);
+
+    // Unmap the ring, safe to call on a ring that was never created
+    void destroy();
+
+    bool valid() const { return base_ != nullptr; }
+    size_t capacity() const { return capacity_; }
+
+    // Contiguous readable data
+    const char* read_ptr() const { return base_ + read_pos_; }
+    size_t readable() const { return data_len_; }
+
+    // Contiguous free space
+    char* write_ptr() { return base_ + (read_pos_ + data_len_) % capacity_; }
+    size_t writable() const { return capacity_ - data_len_; }
+
+    // Account for len bytes written at write_ptr()
+    void commit(size_t len) { data_len_ += len; }
+
+    // Drop len bytes from the front
+    void consume(size_t len);
+
+private:
+    char* base_;         // Start of the first mapping, the second one follows it
+    size_t capacity_;    // Size of one mapping
+    size_t read_pos_;    // Offset of the first readable byte, always below capacity_
+    size_t data_len_;    // Readable bytes
+};
+
+inline void MirrorRing::consume(size_t len) {
+    data_len_ -= len;
+    read_pos_ = data_len_ == 0 ? 0 : (read_pos_ + len) % capacity_;
+}
+
+#endif  // _TRADING_PLATFORM_COMMON_MIRROR_RING_H_
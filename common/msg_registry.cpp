@@ -0,0 +1,84 @@
+/*************************************************************************
+ * @file    msg_registry.cpp
+ * @brief   Message id table and registry lookups
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#include "msg_registry.h"
+#include <array>
+#include "logger.h"
+
+namespace {
+
+typedef google::protobuf::Message* (*MsgFactory)(google::protobuf::Arena* arena);
+
+template <typename T>
+google::protobuf::Message* new_message(google::protobuf::Arena* arena) {
+    return google::protobuf::Arena::CreateMessage<T>(arena);
+}
+
+template <typename T>
+const google::protobuf::Descriptor* descriptor_of() {
+    return T::descriptor();
+}
+
+struct MsgEntry {
+    MsgFactory factory;
+    const google::protobuf::Descriptor* (*descriptor)();
+};
+
+template <typename T>
+constexpr void register_entry(std::array<MsgEntry, MSG_ID_MAX>& table) {
+    table[MsgTraits<T>::id] = MsgEntry{&new_message<T>, &descriptor_of<T>};
+}
+
+constexpr std::array<MsgEntry, MSG_ID_MAX> build_table() {
+    std::array<MsgEntry, MSG_ID_MAX> table{};
+    register_entry<cspkg::AccountLoginReq>(table);
+    register_entry<cspkg::AccountLoginRes>(table);
+    register_entry<cs_proto::FuturesOrder>(table);
+    register_entry<cs_proto::OrderResponse>(table);
+    register_entry<cs_proto::MarketDataSubscribe>(table);
+    register_entry<cs_proto::BookUpdate>(table);
+    register_entry<cs_proto::TradeUpdate>(table);
+    register_entry<cs_proto::OrderResponseBatch>(table);
+    return table;
+}
+
+// Indexed by MsgId, built at compile time from MsgTraits
+constexpr std::array<MsgEntry, MSG_ID_MAX> MSG_TABLE = build_table();
+
+}  // namespace
+
+google::protobuf::Message* MsgRegistry::create_message(MsgId id, google::protobuf::Arena* arena) {
+    if (!is_valid(id)) {
+        LOG(ERROR, "Unknown message id: {}", static_cast<int>(id));
+        return nullptr;
+    }
+    return MSG_TABLE[id].factory(arena);
+}
+
+MsgId MsgRegistry::id_of(const google::protobuf::Message& message) {
+    const google::protobuf::Descriptor* descriptor = message.GetDescriptor();
+    for (int id = MSG_NONE + 1; id < MSG_ID_MAX; ++id) {
+        if (MSG_TABLE[id].descriptor() == descriptor) {
+            return static_cast<MsgId>(id);
+        }
+    }
+    return MSG_NONE;
+}
+
+MsgId MsgRegistry::id_of_name(const std::string& type_name) {
+    return id_of_name(type_name.data(), type_name.size());
+}
+
+MsgId MsgRegistry::id_of_name(const char* type_name, size_t len) {
+    for (int id = MSG_NONE + 1; id < MSG_ID_MAX; ++id) {
+        if (MSG_TABLE[id].descriptor()->full_name().compare(0, std::string::npos, type_name, len) == 0) {
+            return static_cast<MsgId>(id);
+        }
+    }
+    return MSG_NONE;
+}
@@ -0,0 +1,113 @@
+/*************************************************************************
+ * @file    msg_registry.h
+ * @brief   Compile-time registry of protobuf message types, their numeric ids, factories and handler slots
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_MSG_REGISTRY_H_
+#define _TRADING_PLATFORM_COMMON_MSG_REGISTRY_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <google/protobuf/message.h>
+#include "role.pb.h"
+#include "futures_order.pb.h"
+
+// Numeric ids of every message exchanged between client, gateway and order server.
+// Ids are part of the Kafka payload format: append new ones, never renumber
+enum MsgId : uint16_t {
+    MSG_NONE = 0,
+    MSG_ACCOUNT_LOGIN_REQ = 1,
+    MSG_ACCOUNT_LOGIN_RES = 2,
+    MSG_FUTURES_ORDER = 3,
+    MSG_ORDER_RESPONSE = 4,
+    MSG_MARKET_DATA_SUBSCRIBE = 5,
+    MSG_BOOK_UPDATE = 6,
+    MSG_TRADE_UPDATE = 7,
+    MSG_ORDER_RESPONSE_BATCH = 8,
+    MSG_ID_MAX
+};
+
+// Maps a message type to its id, only registered types have a specialization
+template <typename T>
+struct MsgTraits;
+
+#define REGISTER_MSG(type, msg_id)                          \
+    template <>                                             \
+    struct MsgTraits<type> {                                \
+        static constexpr MsgId id = msg_id;                 \
+    }
+
+REGISTER_MSG(cspkg::AccountLoginReq, MSG_ACCOUNT_LOGIN_REQ);
+REGISTER_MSG(cspkg::AccountLoginRes, MSG_ACCOUNT_LOGIN_RES);
+REGISTER_MSG(cs_proto::FuturesOrder, MSG_FUTURES_ORDER);
+REGISTER_MSG(cs_proto::OrderResponse, MSG_ORDER_RESPONSE);
+REGISTER_MSG(cs_proto::MarketDataSubscribe, MSG_MARKET_DATA_SUBSCRIBE);
+REGISTER_MSG(cs_proto::BookUpdate, MSG_BOOK_UPDATE);
+REGISTER_MSG(cs_proto::TradeUpdate, MSG_TRADE_UPDATE);
+REGISTER_MSG(cs_proto::OrderResponseBatch, MSG_ORDER_RESPONSE_BATCH);
+
+#undef REGISTER_MSG
+
+// Owner of a decoded message: heap messages are deleted, arena messages are left to their arena
+struct MsgDeleter {
+    void operator()(google::protobuf::Message* message) const {
+        if (message->GetArena() == nullptr) {
+            delete message;
+        }
+    }
+};
+typedef std::unique_ptr<google::protobuf::Message, MsgDeleter> MsgPtr;
+
+class MsgRegistry {
+public:
+    // Create an empty message for an id, nullptr for unknown ids. A message created on an
+    // arena belongs to it and is never deleted
+    static google::protobuf::Message* create_message(MsgId id, google::protobuf::Arena* arena = nullptr);
+
+    // Id of a message instance, MSG_NONE if its type is not registered
+    static MsgId id_of(const google::protobuf::Message& message);
+
+    // Id of a protobuf full type name, MSG_NONE if it is not registered
+    static MsgId id_of_name(const std::string& type_name);
+    static MsgId id_of_name(const char* type_name, size_t len);
+
+    static bool is_valid(uint32_t id) { return id > MSG_NONE && id < MSG_ID_MAX; }
+};
+
+// Table of handlers indexed by message id. A handler is a member function of Owner
+// taking the concrete message type followed by Args, bound once with bind<T, &Owner::method>()
+template <typename Owner, typename... Args>
+class MsgDispatcher {
+public:
+    MsgDispatcher() : handlers_() {}
+
+    template <typename T, void (Owner::*Method)(const T&, Args...)>
+    void bind() {
+        handlers_[MsgTraits<T>::id] = &invoke<T, Method>;
+    }
+
+    // Call the handler bound for id, false if there is none
+    bool dispatch(Owner* owner, MsgId id, const google::protobuf::Message& message, Args... args) const {
+        if (!MsgRegistry::is_valid(id) || handlers_[id] == nullptr) {
+            return false;
+        }
+        handlers_[id](owner, message, args...);
+        return true;
+    }
+
+private:
+    typedef void (*Handler)(Owner*, const google::protobuf::Message&, Args...);
+
+    template <typename T, void (Owner::*Method)(const T&, Args...)>
+    static void invoke(Owner* owner, const google::protobuf::Message& message, Args... args) {
+        (owner->*Method)(static_cast<const T&>(message), args...);
+    }
+
+    Handler handlers_[MSG_ID_MAX];
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_MSG_REGISTRY_H_
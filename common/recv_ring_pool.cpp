@@ -0,0 +1,88 @@
+#include "recv_ring_pool.h"
+#include <unistd.h>
+#include "logger.h"
+
+RecvRingPool::RecvRingPool()
+    : cache_num_(RECV_RING_CACHE_NUM), in_use_(0), in_use_bytes_(0), cached_bytes_(0) {
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    for (int i = 0; i < RECV_RING_CLASS_NUM; ++i) {
+        class_size_[i] = (RECV_RING_CLASS_SIZE[i] + page_size - 1) / page_size * page_size;
+    }
+}
+
+RecvRingPool::~RecvRingPool() {
+    for (int i = 0; i < RECV_RING_CLASS_NUM; ++i) {
+        for (MirrorRing& ring : free_rings_[i]) {
+            ring.destroy();
+        }
+    }
+}
+
+void RecvRingPool::init(int cache_num) {
+    cache_num_ = cache_num > 0 ? cache_num : 0;
+    for (int i = 0; i < RECV_RING_CLASS_NUM; ++i) {
+        free_rings_[i].reserve(cache_num_);
+    }
+    LOG(INFO, "Receive ring pool initialized, cached rings per class: {}, class sizes: {} and {} bytes",
+        cache_num_, class_size_[0], class_size_[RECV_RING_CLASS_NUM - 1]);
+}
+
+int RecvRingPool::size_class_of(size_t size) const {
+    for (int i = 0; i < RECV_RING_CLASS_NUM; ++i) {
+        if (class_size_[i] >= size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int RecvRingPool::acquire(MirrorRing& ring, size_t min_size) {
+    int size_class = size_class_of(min_size);
+    if (size_class < 0) {
+        LOG(ERROR, "Receive ring size {} exceeds the largest class", min_size);
+        return -1;
+    }
+
+    std::vector<MirrorRing>& free_rings = free_rings_[size_class];
+    if (!free_rings.empty()) {
+        ring = free_rings.back();
+        free_rings.pop_back();
+        cached_bytes_.fetch_sub(ring.capacity(), std::memory_order_relaxed);
+    } else if (ring.create(class_size_[size_class]) != 0) {
+        return -1;
+    }
+
+    in_use_.fetch_add(1, std::memory_order_relaxed);
+    in_use_bytes_.fetch_add(ring.capacity(), std::memory_order_relaxed);
+    return 0;
+}
+
+int RecvRingPool::grow(MirrorRing& ring, size_t min_size) {
+    MirrorRing larger;
+    if (acquire(larger, min_size) != 0) {
+        return -1;
+    }
+    memcpy(larger.write_ptr(), ring.read_ptr(), ring.readable());
+    larger.commit(ring.readable());
+    release(ring);
+    ring = larger;
+    return 0;
+}
+
+void RecvRingPool::release(MirrorRing& ring) {
+    if (!ring.valid()) {
+        return;
+    }
+    in_use_.fetch_sub(1, std::memory_order_relaxed);
+    in_use_bytes_.fetch_sub(ring.capacity(), std::memory_order_relaxed);
+
+    int size_class = size_class_of(ring.capacity());
+    if (size_class >= 0 && free_rings_[size_class].size() < cache_num_) {
+        ring.consume(ring.readable());
+        cached_bytes_.fetch_add(ring.capacity(), std::memory_order_relaxed);
+        free_rings_[size_class].push_back(ring);
+        ring = MirrorRing();
+    } else {
+        ring.destroy();
+    }
+}
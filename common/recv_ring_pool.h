@@ -0,0 +1,67 @@
+/*************************************************************************
+ * @file    recv_ring_pool.h
+ * @brief   Size-classed cache of mirrored receive rings shared by the connections of a shard
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_RECV_RING_POOL_H_
+#define _TRADING_PLATFORM_COMMON_RECV_RING_POOL_H_
+
+#include <atomic>
+#include <vector>
+#include "mirror_ring.h"
+#include "tcp_comm.h"
+
+// Number of receive ring size classes
+const int RECV_RING_CLASS_NUM = 2;
+
+// Smallest capacity of each size class, the largest holds a maximum size CS package.
+// Rings are mapped in whole pages, so on 16 or 64 KB page kernels the classes grow to the page size
+const size_t RECV_RING_CLASS_SIZE[RECV_RING_CLASS_NUM] = {4096, RECV_BUF_LEN};
+
+// Default number of free rings kept mapped per size class
+const int RECV_RING_CACHE_NUM = 1024;
+
+// A connection takes a ring of the smallest class on its first read, moves to a
+// larger class only when a frame does not fit, and returns the ring as soon as
+// everything received has been processed.
+class RecvRingPool {
+public:
+    RecvRingPool();
+    ~RecvRingPool();
+
+    // Set how many free rings are kept mapped per size class
+    void init(int cache_num);
+
+    // Give ring, which must not be valid, a mapping of at least min_size bytes
+    int acquire(MirrorRing& ring, size_t min_size);
+
+    // Move the readable data of ring into a ring of at least min_size bytes
+    int grow(MirrorRing& ring, size_t min_size);
+
+    // Take the mapping of ring back, ring is left invalid
+    void release(MirrorRing& ring);
+
+    // Occupancy metrics, readable from other threads
+    uint64_t in_use() const { return in_use_.load(std::memory_order_relaxed); }
+    uint64_t in_use_bytes() const { return in_use_bytes_.load(std::memory_order_relaxed); }
+    uint64_t cached_bytes() const { return cached_bytes_.load(std::memory_order_relaxed); }
+
+private:
+    RecvRingPool(const RecvRingPool&) = delete;
+    RecvRingPool& operator=(const RecvRingPool&) = delete;
+
+    // Smallest size class holding size bytes, -1 if none does
+    int size_class_of(size_t size) const;
+
+    size_t class_size_[RECV_RING_CLASS_NUM];  // RECV_RING_CLASS_SIZE rounded up to the page size
+    std::vector<MirrorRing> free_rings_[RECV_RING_CLASS_NUM];  // Mapped rings waiting for a connection
+    size_t cache_num_;                     // Free rings kept per class
+    std::atomic<uint64_t> in_use_;         // Rings held by connections
+    std::atomic<uint64_t> in_use_bytes_;   // Capacity held by connections
+    std::atomic<uint64_t> cached_bytes_;   // Capacity of the free rings
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_RECV_RING_POOL_H_
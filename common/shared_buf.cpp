@@ -0,0 +1,42 @@
+/*************************************************************************
+ * @file    shared_buf.cpp
+ * @brief   Reference-counted encoded package written to many connections
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#include "shared_buf.h"
+#include <cstdlib>
+#include <new>
+#include "tcp_code.h"
+#include "logger.h"
+
+SharedBuf* SharedBuf::encode(const google::protobuf::Message& message, WireFormat format) {
+    bool binary = format == WIRE_FORMAT_BINARY;
+    int len = binary ? TcpCode::binary_encoded_size(message) : TcpCode::encoded_size(message);
+    void* mem = malloc(sizeof(SharedBuf) + len);
+    if (mem == nullptr) {
+        LOG(ERROR, "Failed to allocate shared buffer of {} bytes", len);
+        return nullptr;
+    }
+
+    SharedBuf* buf = new (mem) SharedBuf(len);
+    int encoded = binary ? TcpCode::encode_binary_sized_to(message, MsgRegistry::id_of(message), BIN_FLAG_SHARED, 0,
+                                                           buf->data(), len) :
+                           TcpCode::encode_sized_to(message, buf->data(), len);
+    if (encoded != len) {
+        LOG(ERROR, "Failed to encode {} into a shared buffer", message.GetTypeName());
+        buf->~SharedBuf();
+        free(mem);
+        return nullptr;
+    }
+    return buf;
+}
+
+void SharedBuf::release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        this->~SharedBuf();
+        free(this);
+    }
+}
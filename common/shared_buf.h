@@ -0,0 +1,48 @@
+/*************************************************************************
+ * @file    shared_buf.h
+ * @brief   Reference-counted encoded package written to many connections
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_SHARED_BUF_H_
+#define _TRADING_PLATFORM_COMMON_SHARED_BUF_H_
+
+#include <array>
+#include <atomic>
+#include <google/protobuf/message.h>
+#include "tcp_comm.h"
+
+// A package encoded once and queued on every subscriber without copying. Each send queue
+// entry and each pending conflated update holds one reference, the payload follows the
+// object in the same allocation. References may be taken and dropped on any thread
+class SharedBuf {
+public:
+    // Encode a message in a client framing into a new buffer holding one reference, nullptr on failure.
+    // Binary frames are marked BIN_FLAG_SHARED with sequence 0, the same bytes go to every subscriber
+    static SharedBuf* encode(const google::protobuf::Message& message, WireFormat format);
+
+    void add_ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+    // Drop a reference, the last one frees the buffer
+    void release();
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+    int len() const { return len_; }
+
+private:
+    explicit SharedBuf(int len) : refs_(1), len_(len) {}
+    ~SharedBuf() {}
+
+    SharedBuf(const SharedBuf&) = delete;
+    SharedBuf& operator=(const SharedBuf&) = delete;
+
+    std::atomic<int> refs_;
+    int len_;
+};
+
+// One broadcast package in every client framing, indexed by WireFormat
+typedef std::array<SharedBuf*, WIRE_FORMAT_NUM> SharedFrames;
+
+#endif  // _TRADING_PLATFORM_COMMON_SHARED_BUF_H_
@@ -7,53 +7,89 @@
 
 std::string TcpCode::encode(const google::protobuf::Message& message)
 {
-    std::string result;
-    result.resize(PKGHEAD_FIELD_SIZE);  // Reserve the first four bytes for the message header
-
-    // Add message type length and specific content of message type
-    const std::string& type_name = message.GetTypeName();
-    int name_len = static_cast<int>(type_name.size()+1);
-    int be32 = ::htonl(name_len);
-    result.append(reinterpret_cast<char*>(&be32), sizeof(be32));
-    result.append(type_name.c_str(), name_len);
-
-    // Append protobuf message protocol data to result
-    bool succeed = message.AppendToString(&result);
-    if (succeed) {
-        // Calculate the total length of the message body and add it to the top of the message header
-        int len = ::htonl(result.size());
-        std::copy(reinterpret_cast<char*>(&len), reinterpret_cast<char*>(&len) + sizeof(len), result.begin());
-        LOG(INFO, "Encoded message successfully, name={0:s}", type_name);
-    } else {
-        LOG(ERROR, "Failed to encode message, name={0:s}", type_name);
+    // Measured once and written in place, the string never grows
+    std::string result(encoded_size(message), '\0');
+    if (encode_sized_to(message, &result[0], static_cast<int>(result.size())) < 0) {
         result.clear();
     }
-
     return result;
 }
 
+int TcpCode::encoded_size(const google::protobuf::Message& message) {
+    int name_len = static_cast<int>(message.GetDescriptor()->full_name().size() + 1);
+    return 2*PKGHEAD_FIELD_SIZE + name_len + static_cast<int>(message.ByteSizeLong());
+}
+
+int TcpCode::encode_to(const google::protobuf::Message& message, char* buffer, int capacity) {
+    // The descriptor holds the name, GetTypeName() would return a heap-allocated copy
+    const std::string& type_name = message.GetDescriptor()->full_name();
+    int name_len = static_cast<int>(type_name.size() + 1);
+    int body_len = static_cast<int>(message.ByteSizeLong());
+    int total_len = 2*PKGHEAD_FIELD_SIZE + name_len + body_len;
+    if (total_len > capacity) {
+        LOG(ERROR, "Buffer too small to encode message, name={0:s}, need={1:d}, capacity={2:d}",
+            type_name, total_len, capacity);
+        return -1;
+    }
+    write_package(message, type_name, total_len, buffer);
+    return total_len;
+}
+
+int TcpCode::encode_sized_to(const google::protobuf::Message& message, char* buffer, int len) {
+    const std::string& type_name = message.GetDescriptor()->full_name();
+    int body_len = len - 2*PKGHEAD_FIELD_SIZE - static_cast<int>(type_name.size() + 1);
+    // A message changed since it was measured no longer matches its cached size
+    if (body_len < 0 || message.GetCachedSize() != body_len) {
+        LOG(ERROR, "Failed to encode message, name={0:s}, len={1:d} does not match its size", type_name, len);
+        return -1;
+    }
+    write_package(message, type_name, len, buffer);
+    return len;
+}
+
+void TcpCode::write_package(const google::protobuf::Message& message, const std::string& type_name,
+                            int total_len, char* buffer) {
+    int name_len = static_cast<int>(type_name.size() + 1);
+    int be32 = ::htonl(total_len);
+    ::memcpy(buffer, &be32, sizeof(be32));
+    be32 = ::htonl(name_len);
+    ::memcpy(buffer + PKGHEAD_FIELD_SIZE, &be32, sizeof(be32));
+    ::memcpy(buffer + 2*PKGHEAD_FIELD_SIZE, type_name.c_str(), name_len);
+    // Sizes were cached by the measurement, serializing does not take them again
+    char* body = buffer + 2*PKGHEAD_FIELD_SIZE + name_len;
+    message.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(body));
+}
+
 google::protobuf::Message* TcpCode::decode(const std::string& buf) {
+    return decode(buf.data(), static_cast<int>(buf.size()));
+}
+
+google::protobuf::Message* TcpCode::decode(const char* buf, int len, MsgId* msg_id, google::protobuf::Arena* arena) {
     google::protobuf::Message* result = NULL;
-    int len = static_cast<int>(buf.size());  // Total length of the message package
-    LOG(INFO, "Decoding message info, pkglen={0:d}", len);
+    LOG(DEBUG, "Decoding message info, pkglen={0:d}", len);
 
     if (len >= 2*PKGHEAD_FIELD_SIZE) {
-        int name_len = convert_int32(buf.c_str()+PKGHEAD_FIELD_SIZE);
-        LOG(INFO, "Decoding message info, namelen={0:d}", name_len);
+        int name_len = convert_int32(buf+PKGHEAD_FIELD_SIZE);
+        LOG(DEBUG, "Decoding message info, namelen={0:d}", name_len);
 
         if (name_len >= 2 && name_len <= len - 2*PKGHEAD_FIELD_SIZE) {
-            std::string type_name(buf.begin() + 2*PKGHEAD_FIELD_SIZE, buf.begin() + 2*PKGHEAD_FIELD_SIZE + name_len-1);
-            google::protobuf::Message* message = create_message(type_name);
+            // The name is looked up in place, a copy would allocate for most type names
+            std::string_view type_name(buf + 2*PKGHEAD_FIELD_SIZE, name_len-1);
+            MsgId id = MsgRegistry::id_of_name(type_name.data(), type_name.size());
+            google::protobuf::Message* message = id != MSG_NONE ? MsgRegistry::create_message(id, arena) : NULL;
             if (message != NULL) {
-                const char* data = buf.c_str() + 2*PKGHEAD_FIELD_SIZE + name_len;
+                const char* data = buf + 2*PKGHEAD_FIELD_SIZE + name_len;
                 int data_len = len - name_len - 2*PKGHEAD_FIELD_SIZE;
                 if (message->ParseFromArray(data, data_len)) {
                     result = message;
-                    LOG(INFO, "Decoded message successfully, name={0:s}", type_name);
+                    if (msg_id != nullptr) {
+                        *msg_id = id;
+                    }
+                    LOG(DEBUG, "Decoded message successfully, name={0:s}", type_name);
                 } else {
-                    // Failed to parse protobuf message
+                    // Failed to parse protobuf message, one on an arena goes with the arena
                     LOG(ERROR, "Failed to decode message, name={0:s}", type_name);
-                    delete message;
+                    MsgDeleter()(message);
                 }
             } else {
                 // Failed to create protobuf message
@@ -68,22 +104,85 @@ google::protobuf::Message* TcpCode::decode(const std::string& buf) {
     return result;
 }
 
+int TcpCode::binary_encoded_size(const google::protobuf::Message& message) {
+    return BIN_HEAD_SIZE + static_cast<int>(message.ByteSizeLong());
+}
+
+int TcpCode::encode_binary_to(const google::protobuf::Message& message, MsgId msg_id, uint16_t flags,
+                              uint16_t seq, char* buffer, int capacity) {
+    int body_len = static_cast<int>(message.ByteSizeLong());
+    int total_len = BIN_HEAD_SIZE + body_len;
+    if (total_len > capacity || total_len > MAX_CSPKG_LEN || !MsgRegistry::is_valid(msg_id)) {
+        LOG(ERROR, "Can't encode binary frame, name={0:s}, id={1:d}, need={2:d}, capacity={3:d}",
+            message.GetDescriptor()->full_name(), static_cast<int>(msg_id), total_len, capacity);
+        return -1;
+    }
+    write_binary_frame(message, msg_id, flags, seq, total_len, buffer);
+    return total_len;
+}
+
+int TcpCode::encode_binary_sized_to(const google::protobuf::Message& message, MsgId msg_id, uint16_t flags,
+                                    uint16_t seq, char* buffer, int len) {
+    if (len < BIN_HEAD_SIZE || len > MAX_CSPKG_LEN || message.GetCachedSize() != len - BIN_HEAD_SIZE ||
+        !MsgRegistry::is_valid(msg_id)) {
+        LOG(ERROR, "Can't encode binary frame, name={0:s}, id={1:d}, len={2:d} does not match its size",
+            message.GetDescriptor()->full_name(), static_cast<int>(msg_id), len);
+        return -1;
+    }
+    write_binary_frame(message, msg_id, flags, seq, len, buffer);
+    return len;
+}
+
+void TcpCode::write_binary_frame(const google::protobuf::Message& message, MsgId msg_id, uint16_t flags,
+                                 uint16_t seq, int total_len, char* buffer) {
+    uint16_t head[BIN_HEAD_SIZE / sizeof(uint16_t)] = {
+        ::htons(static_cast<uint16_t>(total_len)), ::htons(msg_id), ::htons(flags), ::htons(seq)};
+    ::memcpy(buffer, head, BIN_HEAD_SIZE);
+    message.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(buffer + BIN_HEAD_SIZE));
+}
+
+google::protobuf::Message* TcpCode::decode_binary(const char* buf, int len, MsgId* msg_id,
+                                                  google::protobuf::Arena* arena) {
+    if (len < BIN_HEAD_SIZE || convert_uint16(buf) != len) {
+        LOG(ERROR, "Failed to decode binary frame, invalid length {0:d}", len);
+        return NULL;
+    }
+
+    uint16_t id = convert_uint16(buf + sizeof(uint16_t));
+    google::protobuf::Message* message =
+        MsgRegistry::is_valid(id) ? MsgRegistry::create_message(static_cast<MsgId>(id), arena) : NULL;
+    if (message == NULL) {
+        LOG(ERROR, "Failed to decode binary frame, unknown message id {0:d}", id);
+        return NULL;
+    }
+    if (!message->ParseFromArray(buf + BIN_HEAD_SIZE, len - BIN_HEAD_SIZE)) {
+        LOG(ERROR, "Failed to decode message, name={0:s}", message->GetTypeName());
+        MsgDeleter()(message);
+        return NULL;
+    }
+    if (msg_id != nullptr) {
+        *msg_id = static_cast<MsgId>(id);
+    }
+    return message;
+}
+
 google::protobuf::Message* TcpCode::create_message(const std::string& type_name) {
-    if (type_name == "cspkg.AccountLoginReq") {
-        return new cspkg::AccountLoginReq();
-    } else if (type_name == "cspkg.AccountLoginRes") {
-        return new cspkg::AccountLoginRes();
-    } else if (type_name == "cs_proto.FuturesOrder") {
-        return new cs_proto::FuturesOrder();
-    } else if (type_name == "cs_proto.OrderResponse") {
-        return new cs_proto::OrderResponse();
+    MsgId id = MsgRegistry::id_of_name(type_name);
+    if (id == MSG_NONE) {
+        LOG(ERROR, "Unknown message type: {}", type_name);
+        return nullptr;
     }
-    LOG(ERROR, "Unknown message type: {}", type_name);
-    return nullptr;
+    return MsgRegistry::create_message(id);
 }
 
 int TcpCode::convert_int32(const char* buf) {
     int be32 = 0;
     ::memmove(&be32, buf, sizeof(be32));
     return ::ntohl(be32);
+}
+
+uint16_t TcpCode::convert_uint16(const char* buf) {
+    uint16_t be16 = 0;
+    ::memmove(&be16, buf, sizeof(be16));
+    return ::ntohs(be16);
 }
\ No newline at end of file
@@ -12,7 +12,9 @@
 #include <google/protobuf/descriptor.h>
 #include <google/protobuf/message.h>
 #include <string>
+#include <string_view>
 #include <arpa/inet.h>
+#include "msg_registry.h"
 
 /********************Proto transmission format description*****************************/
 // Total package length + protobuf message name length + message name + protobuf data
@@ -28,16 +30,59 @@ public:
     // Encode protobuf message
     static std::string encode(const google::protobuf::Message& message);
 
+    // Size of the package encode_to() produces for a message. Measuring caches the size of
+    // the message and its submessages, which encode_sized_to() writes from
+    static int encoded_size(const google::protobuf::Message& message);
+
+    // Encode protobuf message into a caller-supplied buffer, returns the package length or -1 if it does not fit
+    static int encode_to(const google::protobuf::Message& message, char* buffer, int capacity);
+
+    // Encode a message into exactly len bytes, len being what encoded_size() returned for it
+    // unchanged since. The message is not measured again, returns len or -1
+    static int encode_sized_to(const google::protobuf::Message& message, char* buffer, int len);
+
     // Decode protobuf message
     static google::protobuf::Message* decode(const std::string& buf);
 
+    // Decode protobuf message from a complete package in place, optionally reporting its registry id.
+    // With an arena the message is created on it and must not be deleted, MsgPtr handles both
+    static google::protobuf::Message* decode(const char* buf, int len, MsgId* msg_id = nullptr,
+                                             google::protobuf::Arena* arena = nullptr);
+
     // Create message based on protobuf message typename
     static google::protobuf::Message* create_message(const std::string& type_name);
 
+    // Size of the binary frame encode_binary_to() produces for a message
+    static int binary_encoded_size(const google::protobuf::Message& message);
+
+    // Encode a message as a binary frame into a caller-supplied buffer, returns the frame length or -1
+    static int encode_binary_to(const google::protobuf::Message& message, MsgId msg_id, uint16_t flags,
+                                uint16_t seq, char* buffer, int capacity);
+
+    // Encode a binary frame into exactly len bytes, len being what binary_encoded_size() returned
+    // for the message unchanged since. The message is not measured again, returns len or -1
+    static int encode_binary_sized_to(const google::protobuf::Message& message, MsgId msg_id, uint16_t flags,
+                                      uint16_t seq, char* buffer, int len);
+
+    // Decode a complete binary frame, the message id comes from the header instead of a type name.
+    // With an arena the message is created on it, as for decode()
+    static google::protobuf::Message* decode_binary(const char* buf, int len, MsgId* msg_id = nullptr,
+                                                    google::protobuf::Arena* arena = nullptr);
+
     // Convert the first four bytes of the message stream to int data in host byte order
     static int convert_int32(const char* buf);
 
+    // Convert the first two bytes of the message stream to host byte order
+    static uint16_t convert_uint16(const char* buf);
+
 private:
+    // Write the package head and the body of a measured message, total_len bytes in all
+    static void write_package(const google::protobuf::Message& message, const std::string& type_name,
+                              int total_len, char* buffer);
+
+    // Write the binary frame head and the body of a measured message, total_len bytes in all
+    static void write_binary_frame(const google::protobuf::Message& message, MsgId msg_id, uint16_t flags,
+                                   uint16_t seq, int total_len, char* buffer);
 };
 
 #endif  // _TRADING_PLATFORM_COMMON_TCP_CODE_H_
\ No newline at end of file
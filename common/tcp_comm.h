@@ -28,6 +28,8 @@
 #include <sys/ioctl.h>
 #include <cstdint>
 #include <uv.h>
+#include "mirror_ring.h"
+#include "token_bucket.h"
 
 // System type definitions
 typedef unsigned char UCHAR;
@@ -38,7 +40,7 @@ typedef std::uint64_t ULONG;
 // System macro definitions
 #define INVALID_SOCKET    -1        // Invalid socket handle
 #define IP_LENGTH         20        // IP address length
-#define RECV_BUF_LEN      16384     // Buffer size for receiving client information
+#define RECV_BUF_LEN      16384     // Buffer size for receiving client information, receive rings round it up to the page size
 
 
 // Number of test connections for tcpclient
@@ -46,9 +48,22 @@ const int MAX_CLIENT_CONN = 10000;
 
 const size_t MAX_BUFFER_SIZE = 65536;  // Maximum buffer size for reading and writing
 
-// Maximum number of connections handled by tcpsvr
+// Default maximum number of connections handled by tcpsvr, GATEWAY_MAX_CONNECTIONS overrides it
 const int MAX_SOCKET_NUM = 10000;
 
+// Maximum number of gateway reactors (event loops sharing the listen port)
+const int MAX_REACTOR_NUM = 16;
+
+// Layout of the client id carried through Kafka:
+// | 0 | generation (7 bits) | shard (4 bits) | slot index (20 bits) |
+// The generation changes every time a slot is released, so responses addressed
+// to a previous occupant of the slot are recognized and dropped.
+const int CLIENT_ID_SHARD_SHIFT = 20;
+const int CLIENT_ID_GEN_SHIFT = 24;
+const int CLIENT_ID_INDEX_MASK = (1 << CLIENT_ID_SHARD_SHIFT) - 1;
+const int CLIENT_ID_SHARD_MASK = MAX_REACTOR_NUM - 1;
+const int CLIENT_ID_GEN_MASK = 0x7F;
+
 const int SOCK_RECV_BUFFER = 512*1024;
 const int SOCK_SEND_BUFFER = 512*1024;
 const int STR_COMM_LEN = 128;
@@ -66,14 +81,93 @@ const int MAX_CSPKG_LEN = RECV_BUF_LEN;
 // Temporary buffer size for CS packaging
 const int CSPKG_OPT_BUFFSIZE = RECV_BUF_LEN*2;
 
+// Framings of client packages. A connection starts with WIRE_FORMAT_TCPCODE and switches
+// both directions to WIRE_FORMAT_BINARY after an AccountLoginReq with binary_frames set
+enum WireFormat : uint8_t {
+    WIRE_FORMAT_TCPCODE = 0,  // Length, type name length, NUL-terminated type name, body
+    WIRE_FORMAT_BINARY = 1,   // Fixed binary header, body
+    WIRE_FORMAT_NUM
+};
+
+// Binary frame header, every field big-endian:
+// | length (16 bits) | message id (16 bits) | flags (16 bits) | sequence (16 bits) |
+// The length includes the header. The sequence counts frames per direction and connection,
+// skipping 0 when it wraps. Frames shared by many connections carry sequence 0 and BIN_FLAG_SHARED
+const int BIN_HEAD_SIZE = 8;
+const uint16_t BIN_FLAG_SHARED = 0x1;
+
 // Maximum number of message packages retrieved from the message queue at once by tcpsvr
 const int MAX_SEND_PKGNUM = 512;
 
+// Default send queue water marks per connection: reading pauses above the high mark and
+// resumes below the low mark, a queue that would grow past the limit disconnects the client
+const int SEND_QUEUE_HIGH_WATER = 256*1024;
+const int SEND_QUEUE_LOW_WATER = 64*1024;
+const int SEND_QUEUE_LIMIT = 4*1024*1024;
+
+// Default memory budget per connection: the largest receive ring plus a full send queue
+const int CONN_MEMORY_BUDGET = SEND_QUEUE_LIMIT + RECV_BUF_LEN;
+
+// Default order admission limits in orders per second and burst size. Each reactor gets
+// an equal share of the global budget, a rate of 0 disables a limit
+const int CONN_ORDER_RATE = 200;
+const int CONN_ORDER_BURST = 400;
+const int ACCOUNT_ORDER_RATE = 500;
+const int ACCOUNT_ORDER_BURST = 1000;
+const int GLOBAL_ORDER_RATE = 0;
+const int GLOBAL_ORDER_BURST = 0;
+
+// Default depth of the ingress stage of a reactor: requests decoded but not yet delivered to
+// Kafka. Orders beyond it are answered BUSY and reading resumes once it is back to half. 0 disables it
+const int INGRESS_QUEUE_DEPTH = 20000;
+
+// Encoded bytes of order responses combined into one OrderResponseBatch, well below MAX_CSPKG_LEN
+const int ORDER_ACK_BATCH_BYTES = 8*1024;
+
+// Default SO_BUSY_POLL of accepted sockets in busy-poll mode, in microseconds
+const int SO_BUSY_POLL_US = 50;
+
 // Client timeout in seconds
 const int CLIENT_TIMEOUT = 600;  // 10 minutes
 
+// Idle timeout wheel: one slot per second, sized to cover CLIENT_TIMEOUT in one revolution
+const int TIMEOUT_WHEEL_TICK_MS = 1000;
+const int TIMEOUT_WHEEL_SLOTS = 1024;
+
+// Default time an order waits for its response before the gateway rejects it, in milliseconds
+const int ORDER_RESPONSE_TIMEOUT_MS = 5000;
+// Default number of orders a reactor tracks while they wait for their response
+const int MAX_INFLIGHT_ORDERS = 65536;
+// In-flight order wheel: 100 ms ticks, one revolution covers about 100 seconds
+const int ORDER_TIMEOUT_TICK_MS = 100;
+const int ORDER_TIMEOUT_SLOTS = 1024;
+
+// Build the client id of a connection from its reactor shard, slot index and slot generation
+inline int make_client_id(int shard_id, int index, int generation) {
+    return ((generation & CLIENT_ID_GEN_MASK) << CLIENT_ID_GEN_SHIFT) |
+           ((shard_id & CLIENT_ID_SHARD_MASK) << CLIENT_ID_SHARD_SHIFT) | (index & CLIENT_ID_INDEX_MASK);
+}
+
+// Get the reactor shard that owns a client id
+inline int client_id_shard(int client_id) {
+    return (client_id >> CLIENT_ID_SHARD_SHIFT) & CLIENT_ID_SHARD_MASK;
+}
+
+// Get the slot index of a client id inside its shard
+inline int client_id_index(int client_id) {
+    return client_id & CLIENT_ID_INDEX_MASK;
+}
+
+// Get the slot generation a client id was issued for
+inline int client_id_generation(int client_id) {
+    return (client_id >> CLIENT_ID_GEN_SHIFT) & CLIENT_ID_GEN_MASK;
+}
+
 // System common data structure definitions
 
+// Pooled send buffer, see write_buf_pool.h
+struct WriteBuf;
+
 // Mode for creating shared memory
 enum ShmMode {
     MODE_NONE = -1,
@@ -93,18 +187,42 @@ enum SocketErrors {
     ERROR_PACKET_INVALID  =     -5,   // Invalid package sent by client
 };
 
-// Socket structure for communication between tcpsvr and client
+// Socket structure for communication between tcpsvr and client. Only the fields read
+// by routing and idle timeouts live here so the table stays dense, the IO state of a
+// connection is kept in SocketConnData at the same index
 struct SocketConnInfo {
     uv_tcp_t* handle;  // libuv handle
-    ULONG uin;         // User account
-    int recv_bytes;    // Number of bytes received
-    char recv_buf[RECV_BUF_LEN];  // Buffer for received client request package
-    int buf_start;     // Start position of data in the circular buffer
-    ULONG client_ip;   // Client IP address
+    int client_id;     // Client id issued for this connection
     time_t create_Time;  // Socket creation time
     time_t recv_data_time;  // Timestamp of received data package
 };
 
+// Reasons for reading from a connection to be stopped, it resumes once none is left
+enum ReadPauseReason {
+    READ_PAUSE_SEND_QUEUE = 1,  // Send queue above the high water mark
+    READ_PAUSE_INGRESS = 2,     // Among the heaviest senders while the ingress stage is full
+};
+
+// Per connection IO and session state
+struct SocketConnData {
+    ULONG uin;         // User account
+    ULONG client_ip;   // Client IP address
+    MirrorRing recv_ring;  // Received bytes of partial request packages, taken from the pool while non-empty
+    WriteBuf* send_head;  // First pooled buffer of encoded packages waiting to be written
+    WriteBuf* send_tail;  // Last queued buffer, new packages are appended while it has room
+    size_t send_queue_bytes;  // Bytes queued or in flight
+    bool send_inflight;  // A batched write is in flight
+    bool send_pending;   // Connection is on the flush list
+    UCHAR read_paused;   // ReadPauseReason bits, reading is stopped while any is set
+    TokenBucket order_bucket;  // Order admission limit of this connection
+    UINT ingress_epoch;  // Ingress epoch ingress_orders was counted in
+    int ingress_orders;  // Orders queued since the ingress stage last drained
+    ULONG max_client_seq;  // Highest client_seq accepted, orders at or below it are duplicates
+    UCHAR wire_format;   // WireFormat of packages in both directions
+    USHORT send_seq;     // Sequence of the last binary frame sent
+    USHORT recv_seq;     // Sequence of the last binary frame received
+};
+
 // Package header for communication between tcpsvr and gamesvr
 struct CSPkgHead {
     int pkg_size;    // Total CS package length
@@ -1,436 +1,1822 @@
-#include "tcp_connect_mgr.h"
-#include <algorithm>
-#include "shm_mgr.h"
-#include "tcp_code.h"
-#include "kafka_manager.h"
-#include "logger.h"
-#include "config_manager.h"
-
-// Implementation of StatisticsManager
-
-StatisticsManager::StatisticsManager()
-    : sent_packages_(0), received_packages_(0), active_connections_(0),
-      total_connections_(0), total_connection_time_(0), total_processing_time_(0),
-      last_reset_time_(std::chrono::steady_clock::now()) {}
-
-void StatisticsManager::increment_sent_packages() {
-    sent_packages_++;
-}
-
-void StatisticsManager::increment_received_packages() {
-    received_packages_++;
-}
-
-void StatisticsManager::increment_active_connections() {
-    active_connections_++;
-    total_connections_++;
-}
-
-void StatisticsManager::decrement_active_connections() {
-    if (active_connections_ > 0) {
-        active_connections_--;
-    }
-}
-
-void StatisticsManager::update_connection_time(double time_ms) {
-    double old_value = total_connection_time_.load(std::memory_order_relaxed);
-    double new_value = old_value + time_ms;
-    while (!total_connection_time_.compare_exchange_weak(old_value, new_value,
-                                                         std::memory_order_release,
-                                                         std::memory_order_relaxed)) {
-        new_value = old_value + time_ms;
-    }
-}
-
-void StatisticsManager::update_processing_time(double time_ms) {
-    double old_value = total_processing_time_.load(std::memory_order_relaxed);
-    double new_value = old_value + time_ms;
-    while (!total_processing_time_.compare_exchange_weak(old_value, new_value,
-                                                         std::memory_order_release,
-                                                         std::memory_order_relaxed)) {
-        new_value = old_value + time_ms;
-    }
-}
-
-void StatisticsManager::reset() {
-    sent_packages_ = 0;
-    received_packages_ = 0;
-    total_connections_ = active_connections_.load();
-    total_connection_time_ = 0;
-    total_processing_time_ = 0;
-    last_reset_time_ = std::chrono::steady_clock::now();
-}
-
-double StatisticsManager::calculate_rate(uint64_t count, double elapsed_seconds) const {
-    return elapsed_seconds > 0 ? count / elapsed_seconds : 0;
-}
-
-void StatisticsManager::log_statistics() {
-    auto now = std::chrono::steady_clock::now();
-    double elapsed_seconds = std::chrono::duration<double>(now - last_reset_time_).count();
-
-    double sent_rate = calculate_rate(sent_packages_, elapsed_seconds);
-    double received_rate = calculate_rate(received_packages_, elapsed_seconds);
-    double avg_connection_time = total_connections_ > 0 ? total_connection_time_ / total_connections_ : 0;
-    double avg_processing_time = received_packages_ > 0 ? total_processing_time_ / received_packages_ : 0;
-
-    LOG(INFO, "Gateway Server Statistics:");
-    LOG(INFO, "  Elapsed time: {:.2f} seconds", elapsed_seconds);
-    LOG(INFO, "  Sent packages: {} (Rate: {:.2f} pkg/s)", sent_packages_.load(), sent_rate);
-    LOG(INFO, "  Received packages: {} (Rate: {:.2f} pkg/s)", received_packages_.load(), received_rate);
-    LOG(INFO, "  Active connections: {}", active_connections_.load());
-    LOG(INFO, "  Total connections: {}", total_connections_.load());
-    LOG(INFO, "  Average connection time: {:.2f} ms", avg_connection_time);
-    LOG(INFO, "  Average processing time: {:.2f} ms", avg_processing_time);
-}
-
-// Implementation of TcpConnectMgr
-
-char* TcpConnectMgr::current_shmptr_ = nullptr;
-
-TcpConnectMgr::TcpConnectMgr() :
-    cur_conn_num_(0),
-    laststat_time_(0),
-    next_index_(0) {
-}
-
-TcpConnectMgr::~TcpConnectMgr() {
-    LOG(INFO, "TcpConnectMgr destroyed");
-}
-
-int TcpConnectMgr::add_new_connection(uv_tcp_t* client) {
-    if (cur_conn_num_ >= MAX_SOCKET_NUM) {
-        return -1;  // No more slots available
-    }
-    int index = next_index_++;
-    if (next_index_ >= MAX_SOCKET_NUM) {
-        next_index_ = 0;  // Wrap around to reuse slots
-    }
-    client_to_index_[client] = index;
-    ++cur_conn_num_;
-    return index;
-}
-
-void TcpConnectMgr::handle_new_connection(uv_tcp_t* client) {
-    // Add a new connection and get its index
-    int index = add_new_connection(client);
-    if (index == -1) {
-        LOG(ERROR, "Maximum number of connections reached or no available slot");
-        uv_close((uv_handle_t*)client, [](uv_handle_t* handle) { free(handle); });
-        return;
-    }
-
-    // Initialize client information
-    client_sockconn_list_[index].handle = client;
-    time(&client_sockconn_list_[index].create_Time);
-    client_sockconn_list_[index].recv_bytes = 0;
-    client_sockconn_list_[index].buf_start = 0;  // Initialize buffer start position
-    client_sockconn_list_[index].recv_data_time = 0;
-    client_sockconn_list_[index].uin = 0;
-
-    // Get peer address
-    struct sockaddr_storage peer_addr;
-    int addr_len = sizeof(peer_addr);
-    char addr[32] = {'\0'};
-    if (uv_tcp_getpeername(client, (struct sockaddr*)&peer_addr, &addr_len) == 0) {
-        uv_ip4_name((struct sockaddr_in*)&peer_addr, addr, sizeof(addr));
-        client_sockconn_list_[index].client_ip = inet_addr(addr);
-    } else {
-        LOG(ERROR, "Failed to get peer name");
-    }
-
-    // Set the data pointer of the uv_tcp_t to the index in our array
-    client->data = (void*)(intptr_t)index;
-
-    // Start reading from the client
-    int read_start_result = uv_read_start((uv_stream_t*)client, alloc_buffer, on_read);
-    if (read_start_result != 0) {
-        LOG(ERROR, "Failed to start reading from client: {}", uv_strerror(read_start_result));
-        uv_close((uv_handle_t*)client, [](uv_handle_t* handle) { free(handle); });
-        return;
-    }
-
-    // Increment active connections count
-    stats_manager_.increment_active_connections();
-
-    LOG(INFO, "Handle new connection, index:{}, client ip:{}, total connections: {}",
-            index, addr, cur_conn_num_);
-}
-
-void TcpConnectMgr::alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
-    // Get the TcpConnectMgr instance
-    TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(handle->loop->data);
-
-    // Get the index from the handle's data
-    int index = (int)(intptr_t)handle->data;
-    SocketConnInfo& conn = mgr->client_sockconn_list_[index];
-
-    // Calculate the end position of data in the circular buffer
-    int buf_end = (conn.buf_start + conn.recv_bytes) % RECV_BUF_LEN;
-
-    // Calculate available space
-    size_t available_space;
-    if (buf_end >= conn.buf_start) {
-        available_space = RECV_BUF_LEN - buf_end;
-    } else {
-        available_space = conn.buf_start - buf_end;
-    }
-
-    // Allocate buffer based on available space and suggested size
-    size_t alloc_size = std::min(available_space, suggested_size);
-
-    if (alloc_size > 0) {
-        buf->base = conn.recv_buf + buf_end;
-        buf->len = alloc_size;
-    } else {
-        buf->base = (char*)malloc(1);
-        buf->len = 0;
-    }
-
-    LOG(DEBUG, "Buffer allocated for client {}: size {}", index, buf->len);
-}
-
-TcpConnectMgr* TcpConnectMgr::create_instance() {
-    int shm_key = ConfigManager::instance().get_int("SOCKET_SHM_KEY");
-    int shm_size = count_size();
-    int assign_size = shm_size;
-    current_shmptr_ = static_cast<char*>(ShmMgr::instance().create_shm(shm_key, shm_size, assign_size));
-
-    return new TcpConnectMgr();
-}
-
-int TcpConnectMgr::count_size() {
-    return sizeof(TcpConnectMgr);
-}
-
-void* TcpConnectMgr::operator new(size_t size) {
-    (void)size;  // Unused
-    return static_cast<void*>(current_shmptr_);
-}
-
-void TcpConnectMgr::operator delete(void* mem) {
-    (void)mem;
-    // Do nothing, as memory is managed in shared memory
-}
-
-int TcpConnectMgr::init() {
-    // Initialize connection-related variables
-    laststat_time_ = 0;
-    cur_conn_num_ = 0;
-
-    client_sockconn_list_.resize(MAX_SOCKET_NUM);
-    for (int i = 0; i < MAX_SOCKET_NUM; ++i) {
-        client_sockconn_list_[i].handle = nullptr;
-        client_sockconn_list_[i].recv_bytes = 0;
-        client_sockconn_list_[i].buf_start = 0;
-    }
-
-    gateway_to_order_topic_ = ConfigManager::instance().get_string("GATEWAY_TO_ORDER_TOPIC");
-
-    LOG(INFO, "TcpConnectMgr initialized successfully");
-    return 0;
-}
-
-void TcpConnectMgr::on_read(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf) {
-    TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(client->loop->data);
-    int index = (int)(intptr_t)client->data;
-
-    if (index < 0 || index >= MAX_SOCKET_NUM) {
-        LOG(ERROR, "Invalid client index: {}", index);
-        uv_close((uv_handle_t*)client, [](uv_handle_t* handle) { free(handle); });
-        return;
-    }
-
-    SocketConnInfo& conn = mgr->client_sockconn_list_[index];
-
-    if (nread > 0) {
-        LOG(DEBUG, "Read {} bytes from client {}", nread, index);
-        
-        // Update the received bytes count
-        conn.recv_bytes += nread;
-        
-        // Process the received data
-        mgr->process_client_data(client, nread);
-    } else if (nread < 0) {
-        if (nread != UV_EOF) {
-            LOG(ERROR, "Read error for client {}: {}", index, uv_strerror(nread));
-        } else {
-            LOG(INFO, "Client {} disconnected", index);
-        }
-
-        // Close the client connection
-        uv_close((uv_handle_t*)client, [](uv_handle_t* handle) {
-            TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(handle->loop->data);
-            int index = (int)(intptr_t)handle->data;
-            LOG(INFO, "Connection closed. Client index{}, Total connections: {}", index, mgr->cur_conn_num_);
-            mgr->remove_connection((uv_tcp_t*)handle);
-            free(handle);
-        });
-    }
-
-    // Free the buffer if it was dynamically allocated
-    if (buf->base && buf->len == 0) {
-        free(buf->base);
-    }
-}
-
-int TcpConnectMgr::process_client_data(uv_stream_t* client, ssize_t nread) {
-    int index = get_index_for_client((uv_tcp_t*)client);
-    if (index < 0 || index >= MAX_SOCKET_NUM) {
-        LOG(ERROR, "Invalid client index: {}", index);
-        uv_close((uv_handle_t*)client, [](uv_handle_t* handle) {
-            free(handle);
-        });
-        return -1;
-    }
-
-    // Start processing time
-    auto start_time = std::chrono::steady_clock::now();
-
-    LOG(DEBUG, "Processing {} bytes from client {}", nread, index);
-
-    SocketConnInfo& cur_conn = client_sockconn_list_[index];
-
-    // Update receive time
-    time(&cur_conn.recv_data_time);
-
-    // Process complete packets
-    int total_processed = 0;
-    while (cur_conn.recv_bytes >= PKGHEAD_FIELD_SIZE) {
-        int header_pos = (cur_conn.buf_start + total_processed) % RECV_BUF_LEN;
-        int packet_size = TcpCode::convert_int32(cur_conn.recv_buf + header_pos);
-
-        LOG(INFO, "Header pos:{}, Packet size: {}", header_pos, packet_size);
-
-        if (packet_size <= 0 || packet_size > MAX_CSPKG_LEN) {
-            LOG(ERROR, "Invalid packet size {} for client {}", packet_size, index);
-            uv_close((uv_handle_t*)client, [](uv_handle_t* handle) {
-                free(handle);
-            });
-            return -1;
-        }
-
-        if (cur_conn.recv_bytes >= packet_size) {
-            std::string message(cur_conn.recv_buf + header_pos, packet_size);
-            
-            std::unique_ptr<google::protobuf::Message> parsed_message(TcpCode::decode(message));
-            if (parsed_message) {
-                if (const auto* login_req = dynamic_cast<const cspkg::AccountLoginReq*>(parsed_message.get())) {
-                    // Handle login request
-                    LOG(INFO, "Received AccountLoginReq from client {}, account {}", index, login_req->account());
-                    handle_login_request(client, *login_req, index);
-                } else if (const auto* order = dynamic_cast<const cs_proto::FuturesOrder*>(parsed_message.get())) {
-                    // Handle futures order
-                    LOG(INFO, "Received FuturesOrder from client {}", index);
-                    handle_futures_order(client, *order, index);
-                } else {
-                    LOG(ERROR, "Unknown message type for client {}", index);
-                }
-            } else {
-                LOG(ERROR, "Failed to parse client message for client {}", index);
-            }
-
-            total_processed += packet_size;
-            cur_conn.recv_bytes -= packet_size;
-        } else {
-            LOG(DEBUG, "Incomplete packet, waiting for more data");
-            break;
-        }
-    }
-
-    cur_conn.buf_start = (cur_conn.buf_start + total_processed) % RECV_BUF_LEN;
-
-    // Update statistics
-    auto end_time = std::chrono::steady_clock::now();
-    double processing_time = std::chrono::duration<double, std::milli>(end_time - start_time).count();
-    stats_manager_.update_processing_time(processing_time);
-    stats_manager_.increment_received_packages();
-
-    LOG(INFO, "Processed {} bytes from client {}", total_processed, index);
-    return 0;
-}
-
-void TcpConnectMgr::handle_login_request(uv_stream_t* client, const cspkg::AccountLoginReq& login_req, int client_index) {
-    (void)client;  // Unused
-    // Store the account to index mapping
-    account_to_index_[login_req.account()] = client_index;
-
-    // Forward the login request to order_server via Kafka
-    if (KafkaManager::instance().produce(gateway_to_order_topic_, login_req, client_index)) {
-        LOG(INFO, "Sent AccountLoginReq to Kafka for client:{}, topic:{}", client_index, gateway_to_order_topic_);
-    } else {
-        LOG(ERROR, "Failed to send AccountLoginReq to Kafka for client {}", client_index);
-    }
-}
-
-void TcpConnectMgr::handle_futures_order(uv_stream_t* client, const cs_proto::FuturesOrder& order, int client_index) {
-    (void)client;  // Unused
-    if (KafkaManager::instance().produce(gateway_to_order_topic_, order, client_index)) {
-        LOG(INFO, "Sent FuturesOrder to Kafka for client {}, topic {}", client_index, gateway_to_order_topic_);
-    } else {
-        LOG(ERROR, "Failed to send FuturesOrder to Kafka for client {}", client_index);
-    }
-}
-
-int TcpConnectMgr::tcp_send_data(uv_stream_t* client, const char* databuf, int len) {
-    uv_buf_t buffer = uv_buf_init((char*)databuf, len);
-    uv_write_t* req = (uv_write_t*)malloc(sizeof(uv_write_t));
-    req->data = client->data;  // Store client index in write request
-    
-    return uv_write(req, client, &buffer, 1, on_write);
-}
-
-void TcpConnectMgr::on_write(uv_write_t* req, int status) {
-    TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(req->handle->loop->data);
-    int client_index = (int)(intptr_t)req->data;
-
-    if (status < 0) {
-        LOG(ERROR, "Write error for client {}: {}", client_index, uv_strerror(status));
-    }
-    else {
-        LOG(DEBUG, "Write successful for client {}", client_index);
-        // Update statistics
-        mgr->stats_manager_.increment_sent_packages();
-    }
-    free(req);
-}
-
-void TcpConnectMgr::check_wait_send_data() {
-    // TODO: Implement logic to check for data waiting to be sent
-    // This might involve checking a queue or buffer of outgoing messages
-}
-
-void TcpConnectMgr::check_timeout() {
-    static const int STATS_INTERVAL = 300;  // Log statistics every 300 seconds
-    static time_t last_stats_time = 0;
-
-    time_t current_time = time(NULL);
-    
-    // Update statistics
-    if (current_time >= last_stats_time + STATS_INTERVAL) {
-        stats_manager_.log_statistics();
-        stats_manager_.reset();
-        last_stats_time = current_time;
-    }
-
-    // Check for timed-out connections
-    for (int i = 0; i < MAX_SOCKET_NUM; ++i) {
-        if (client_sockconn_list_[i].handle != nullptr) {
-            time_t last_activity = std::max(client_sockconn_list_[i].create_Time, 
-                                            client_sockconn_list_[i].recv_data_time);
-            if (current_time - last_activity > CLIENT_TIMEOUT) {
-                LOG(INFO, "Client {} timed out", i);
-                uv_handle_t* handle = (uv_handle_t*)client_sockconn_list_[i].handle;
-                if (!uv_is_closing(handle)) {
-                    uv_close(handle, [](uv_handle_t* handle) {
-                        TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(handle->loop->data);
-                        int index = (int)(intptr_t)handle->data;
-                        LOG(INFO, "Closed handle for client {}", index);
-                        mgr->remove_connection((uv_tcp_t*)handle);
-                        free(handle);
-                    });
-                }
-            }
-        }
-    }
-}
\ No newline at end of file
+#include "tcp_connect_mgr.h"
+#include <fcntl.h>
+#include <algorithm>
+#include <new>
+#include "tcp_code.h"
+#include "kafka_manager.h"
+#include "logger.h"
+#include "config_manager.h"
+
+namespace {
+
+// Operation in the high half of io_uring user data, the client id of the connection in the low half
+enum UringOp : uint64_t {
+    URING_OP_RECV = 1,
+    URING_OP_SEND = 2,
+    URING_OP_CANCEL = 3,
+};
+
+inline uint64_t uring_user_data(UringOp op, int client_id) {
+    return (static_cast<uint64_t>(op) << 32) | static_cast<uint32_t>(client_id);
+}
+
+}  // namespace
+
+void StatisticsSnapshot::merge(const StatisticsSnapshot& other) {
+    sent_packages += other.sent_packages;
+    received_packages += other.received_packages;
+    sent_bytes += other.sent_bytes;
+    received_bytes += other.received_bytes;
+    active_connections += other.active_connections;
+    total_connections += other.total_connections;
+    send_queue_bytes += other.send_queue_bytes;
+    max_send_queue_bytes = std::max(max_send_queue_bytes, other.max_send_queue_bytes);
+    write_calls += other.write_calls;
+    slow_consumer_disconnects += other.slow_consumer_disconnects;
+    orders_admitted += other.orders_admitted;
+    for (int scope = 0; scope < ORDER_REJECT_SCOPE_NUM; ++scope) {
+        orders_rejected[scope] += other.orders_rejected[scope];
+    }
+    orders_duplicate += other.orders_duplicate;
+    orders_timed_out += other.orders_timed_out;
+    orders_untracked += other.orders_untracked;
+    order_responses_unmatched += other.order_responses_unmatched;
+    ingress_pauses += other.ingress_pauses;
+    order_ack_batches += other.order_ack_batches;
+    order_acks_batched += other.order_acks_batched;
+    loop_iterations += other.loop_iterations;
+    loop_iteration_ns += other.loop_iteration_ns;
+    max_loop_iteration_ns = std::max(max_loop_iteration_ns, other.max_loop_iteration_ns);
+    md_updates += other.md_updates;
+    md_queued += other.md_queued;
+    md_conflated += other.md_conflated;
+    for (int stage = 0; stage < LATENCY_STAGE_NUM; ++stage) {
+        latency[stage].merge(other.latency[stage]);
+    }
+    elapsed_seconds = std::max(elapsed_seconds, other.elapsed_seconds);
+}
+
+void StatisticsSnapshot::subtract(const StatisticsSnapshot& base) {
+    sent_packages -= base.sent_packages;
+    received_packages -= base.received_packages;
+    sent_bytes -= base.sent_bytes;
+    received_bytes -= base.received_bytes;
+    total_connections = total_connections - base.total_connections + base.active_connections;
+    write_calls -= base.write_calls;
+    slow_consumer_disconnects -= base.slow_consumer_disconnects;
+    orders_admitted -= base.orders_admitted;
+    for (int scope = 0; scope < ORDER_REJECT_SCOPE_NUM; ++scope) {
+        orders_rejected[scope] -= base.orders_rejected[scope];
+    }
+    orders_duplicate -= base.orders_duplicate;
+    orders_timed_out -= base.orders_timed_out;
+    orders_untracked -= base.orders_untracked;
+    order_responses_unmatched -= base.order_responses_unmatched;
+    ingress_pauses -= base.ingress_pauses;
+    order_ack_batches -= base.order_ack_batches;
+    order_acks_batched -= base.order_acks_batched;
+    loop_iterations -= base.loop_iterations;
+    loop_iteration_ns -= base.loop_iteration_ns;
+    md_updates -= base.md_updates;
+    md_queued -= base.md_queued;
+    md_conflated -= base.md_conflated;
+    for (int stage = 0; stage < LATENCY_STAGE_NUM; ++stage) {
+        latency[stage].subtract(base.latency[stage]);
+    }
+    elapsed_seconds -= base.elapsed_seconds;
+}
+
+// Implementation of StatisticsManager
+
+StatisticsManager::StatisticsManager()
+    : sent_packages_(0), received_packages_(0), sent_bytes_(0), received_bytes_(0), active_connections_(0),
+      total_connections_(0),
+      send_queue_bytes_(0), max_send_queue_bytes_(0), write_calls_(0), slow_consumer_disconnects_(0),
+      orders_admitted_(0), orders_rejected_{}, orders_duplicate_(0),
+      orders_timed_out_(0), orders_untracked_(0), order_responses_unmatched_(0), order_ack_batches_(0), order_acks_batched_(0),
+      loop_iterations_(0), loop_iteration_ns_(0), max_loop_iteration_ns_(0),
+      md_updates_(0), md_queued_(0), md_conflated_(0), start_time_(std::chrono::steady_clock::now()) {}
+
+void StatisticsManager::increment_sent_packages(uint64_t count) {
+    sent_packages_ += count;
+}
+
+void StatisticsManager::increment_received_packages() {
+    received_packages_++;
+}
+
+void StatisticsManager::add_sent_bytes(uint64_t bytes) {
+    sent_bytes_ += bytes;
+}
+
+void StatisticsManager::add_received_bytes(uint64_t bytes) {
+    received_bytes_ += bytes;
+}
+
+void StatisticsManager::increment_active_connections() {
+    active_connections_++;
+    total_connections_++;
+}
+
+void StatisticsManager::decrement_active_connections() {
+    if (active_connections_ > 0) {
+        active_connections_--;
+    }
+}
+
+void StatisticsManager::add_send_queue_bytes(int64_t delta, uint64_t conn_queue_bytes) {
+    send_queue_bytes_ += delta;
+    uint64_t old_max = max_send_queue_bytes_.load(std::memory_order_relaxed);
+    while (conn_queue_bytes > old_max &&
+           !max_send_queue_bytes_.compare_exchange_weak(old_max, conn_queue_bytes, std::memory_order_relaxed)) {
+    }
+}
+
+void StatisticsManager::increment_write_calls() {
+    write_calls_++;
+}
+
+void StatisticsManager::increment_slow_consumer_disconnects() {
+    slow_consumer_disconnects_++;
+}
+
+void StatisticsManager::increment_orders_admitted() {
+    orders_admitted_++;
+}
+
+void StatisticsManager::increment_orders_rejected(OrderRejectScope scope) {
+    orders_rejected_[scope]++;
+}
+
+void StatisticsManager::increment_orders_duplicate() {
+    orders_duplicate_++;
+}
+
+void StatisticsManager::increment_orders_timed_out() {
+    orders_timed_out_++;
+}
+
+void StatisticsManager::increment_orders_untracked() {
+    orders_untracked_++;
+}
+
+void StatisticsManager::increment_order_responses_unmatched() {
+    order_responses_unmatched_++;
+}
+
+void StatisticsManager::increment_ingress_pauses() {
+    ingress_pauses_++;
+}
+
+void StatisticsManager::record_order_ack_batch(uint64_t acks) {
+    order_ack_batches_++;
+    order_acks_batched_ += acks;
+}
+
+void StatisticsManager::record_loop_iteration(uint64_t ns) {
+    // Only the reactor thread writes, so plain load and store are enough
+    loop_iterations_.store(loop_iterations_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    loop_iteration_ns_.store(loop_iteration_ns_.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    // The maximum is also cleared by end_interval() on another thread
+    uint64_t old_max = max_loop_iteration_ns_.load(std::memory_order_relaxed);
+    while (ns > old_max &&
+           !max_loop_iteration_ns_.compare_exchange_weak(old_max, ns, std::memory_order_relaxed)) {
+    }
+}
+
+void StatisticsManager::record_md_broadcast(uint64_t queued, uint64_t conflated) {
+    md_updates_++;
+    md_queued_ += queued;
+    md_conflated_ += conflated;
+}
+
+double StatisticsManager::calculate_rate(uint64_t count, double elapsed_seconds) const {
+    return elapsed_seconds > 0 ? count / elapsed_seconds : 0;
+}
+
+StatisticsSnapshot StatisticsManager::snapshot() const {
+    StatisticsSnapshot snap;
+    snap.sent_packages = sent_packages_.load();
+    snap.received_packages = received_packages_.load();
+    snap.sent_bytes = sent_bytes_.load();
+    snap.received_bytes = received_bytes_.load();
+    snap.active_connections = active_connections_.load();
+    snap.total_connections = total_connections_.load();
+    snap.send_queue_bytes = std::max<int64_t>(send_queue_bytes_.load(), 0);
+    snap.max_send_queue_bytes = max_send_queue_bytes_.load();
+    snap.write_calls = write_calls_.load();
+    snap.slow_consumer_disconnects = slow_consumer_disconnects_.load();
+    snap.orders_admitted = orders_admitted_.load();
+    for (int scope = 0; scope < ORDER_REJECT_SCOPE_NUM; ++scope) {
+        snap.orders_rejected[scope] = orders_rejected_[scope].load();
+    }
+    snap.orders_duplicate = orders_duplicate_.load();
+    snap.orders_timed_out = orders_timed_out_.load();
+    snap.orders_untracked = orders_untracked_.load();
+    snap.order_responses_unmatched = order_responses_unmatched_.load();
+    snap.ingress_pauses = ingress_pauses_.load();
+    snap.order_ack_batches = order_ack_batches_.load();
+    snap.order_acks_batched = order_acks_batched_.load();
+    snap.loop_iterations = loop_iterations_.load();
+    snap.loop_iteration_ns = loop_iteration_ns_.load();
+    snap.max_loop_iteration_ns = max_loop_iteration_ns_.load();
+    snap.md_updates = md_updates_.load();
+    snap.md_queued = md_queued_.load();
+    snap.md_conflated = md_conflated_.load();
+    for (int stage = 0; stage < LATENCY_STAGE_NUM; ++stage) {
+        latency_[stage].read(snap.latency[stage]);
+    }
+    snap.elapsed_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time_).count();
+    return snap;
+}
+
+StatisticsSnapshot StatisticsManager::end_interval() {
+    StatisticsSnapshot snap = snapshot();
+    // Cleared with an exchange, so a maximum recorded after the read above is not lost
+    snap.max_send_queue_bytes = std::max(snap.max_send_queue_bytes, max_send_queue_bytes_.exchange(0));
+    snap.max_loop_iteration_ns = std::max(snap.max_loop_iteration_ns, max_loop_iteration_ns_.exchange(0));
+    return snap;
+}
+
+// Log the counters of this shard since startup
+void StatisticsManager::log_statistics() {
+    auto now = std::chrono::steady_clock::now();
+    double elapsed_seconds = std::chrono::duration<double>(now - start_time_).count();
+
+    double sent_rate = calculate_rate(sent_packages_, elapsed_seconds);
+    double received_rate = calculate_rate(received_packages_, elapsed_seconds);
+
+    LOG(INFO, "Gateway Server Statistics:");
+    LOG(INFO, "  Elapsed time: {:.2f} seconds", elapsed_seconds);
+    LOG(INFO, "  Sent packages: {} (Rate: {:.2f} pkg/s)", sent_packages_.load(), sent_rate);
+    LOG(INFO, "  Received packages: {} (Rate: {:.2f} pkg/s)", received_packages_.load(), received_rate);
+    LOG(INFO, "  Active connections: {}", active_connections_.load());
+    LOG(INFO, "  Total connections: {}", total_connections_.load());
+    LOG(INFO, "  Send queue: {} bytes, deepest connection {} bytes, {} writes, {} slow consumer disconnects",
+        send_queue_bytes_.load(), max_send_queue_bytes_.load(), write_calls_.load(), slow_consumer_disconnects_.load());
+    LOG(INFO, "  Orders admitted: {}, rejected by connection limit: {}, account limit: {}, global limit: {}",
+        orders_admitted_.load(), orders_rejected_[ORDER_REJECT_CONNECTION].load(),
+        orders_rejected_[ORDER_REJECT_ACCOUNT].load(), orders_rejected_[ORDER_REJECT_GLOBAL].load());
+    LOG(INFO, "  Duplicate orders: {}, order response batches: {} carrying {} responses",
+        orders_duplicate_.load(), order_ack_batches_.load(), order_acks_batched_.load());
+    LOG(INFO, "  Orders timed out: {}, untracked: {}, unmatched responses: {}",
+        orders_timed_out_.load(), orders_untracked_.load(), order_responses_unmatched_.load());
+    LOG(INFO, "  Orders shed while busy: {}, connections paused: {}",
+        orders_rejected_[ORDER_REJECT_INGRESS].load(), ingress_pauses_.load());
+    if (loop_iterations_ > 0) {
+        LOG(INFO, "  Busy-poll iterations: {}, average {} ns, max {} ns", loop_iterations_.load(),
+            loop_iteration_ns_ / loop_iterations_, max_loop_iteration_ns_.load());
+    }
+    if (md_updates_ > 0) {
+        LOG(INFO, "  Market data updates: {}, queued on {} subscribers, {} conflated",
+            md_updates_.load(), md_queued_.load(), md_conflated_.load());
+    }
+    log_latency(snapshot().latency);
+}
+
+void StatisticsManager::log_latency(const LatencyCounts (&latency)[LATENCY_STAGE_NUM]) {
+    static const char* const STAGE_NAMES[LATENCY_STAGE_NUM] = {
+        "accept", "receive to decode", "decode to Kafka", "response to write", "order to response",
+    };
+    for (int stage = 0; stage < LATENCY_STAGE_NUM; ++stage) {
+        const LatencyCounts& counts = latency[stage];
+        if (counts.count == 0) {
+            continue;
+        }
+        LOG(INFO, "  Latency {}: {} samples, p50 {:.1f} us, p99 {:.1f} us, p99.9 {:.1f} us, max {:.1f} us",
+            STAGE_NAMES[stage], counts.count, counts.percentile(0.5) / 1000.0, counts.percentile(0.99) / 1000.0,
+            counts.percentile(0.999) / 1000.0, counts.max() / 1000.0);
+    }
+}
+
+// Implementation of TcpConnectMgr
+
+TcpConnectMgr::TcpConnectMgr() :
+    shard_id_(0),
+    cur_conn_num_(0),
+    laststat_time_(0),
+    max_connections_(MAX_SOCKET_NUM),
+    handing_over_(false),
+    md_conflate_bytes_(SEND_QUEUE_LOW_WATER),
+    decoded_ns_(0),
+    send_high_water_(SEND_QUEUE_HIGH_WATER),
+    send_low_water_(SEND_QUEUE_LOW_WATER),
+    send_queue_limit_(SEND_QUEUE_LIMIT),
+    conn_memory_budget_(CONN_MEMORY_BUDGET),
+    busy_poll_us_(0),
+    conn_order_limit_{0, 0},
+    account_order_limit_{0, 0},
+    ingress_depth_limit_(INGRESS_QUEUE_DEPTH),
+    ingress_resume_depth_(INGRESS_QUEUE_DEPTH / 2),
+    ingress_epoch_(0),
+    inflight_gauge_(0),
+    ingress_paused_gauge_(0) {
+}
+
+TcpConnectMgr::~TcpConnectMgr() {
+    LOG(INFO, "TcpConnectMgr destroyed");
+}
+
+int TcpConnectMgr::add_new_connection(uv_tcp_t* client) {
+    if (free_slots_.empty() && grow_slots() != 0) {
+        return -1;  // No more slots available
+    }
+    int index = free_slots_.back();
+    free_slots_.pop_back();
+
+    SocketConnInfo& conn = client_sockconn_list_[index];
+    conn.handle = client;
+    conn.client_id = make_client_id(shard_id_, index, slot_generations_[index]);
+    client->data = (void*)(intptr_t)index;
+    ++cur_conn_num_;
+    return index;
+}
+
+void TcpConnectMgr::handle_new_connection(uv_tcp_t* client) {
+    // Add a new connection and get its index
+    int index = add_new_connection(client);
+    if (index == -1) {
+        LOG(ERROR, "Maximum number of connections reached or no available slot");
+        uv_close((uv_handle_t*)client, [](uv_handle_t* handle) { free(handle); });
+        return;
+    }
+
+    // Initialize client information, the receive ring is taken on the first read
+    time(&client_sockconn_list_[index].create_Time);
+    client_sockconn_list_[index].recv_data_time = 0;
+    client_conn_data_[index] = SocketConnData();
+    client_conn_data_[index].order_bucket.init(conn_order_limit_, uv_now(client->loop));
+
+    // Get peer address
+    struct sockaddr_storage peer_addr;
+    int addr_len = sizeof(peer_addr);
+    char addr[32] = {'\0'};
+    if (uv_tcp_getpeername(client, (struct sockaddr*)&peer_addr, &addr_len) == 0) {
+        uv_ip4_name((struct sockaddr_in*)&peer_addr, addr, sizeof(addr));
+        client_conn_data_[index].client_ip = inet_addr(addr);
+    } else {
+        LOG(ERROR, "Failed to get peer name");
+    }
+
+    // The identity of the connection survives a hot upgrade in the shared state table
+    ConnStateRecord& record = state_table_[index];
+    record.client_id = client_sockconn_list_[index].client_id;
+    record.generation = slot_generations_[index];
+    record.uin = 0;
+    record.client_ip = client_conn_data_[index].client_ip;
+    record.create_time = client_sockconn_list_[index].create_Time;
+    record.recv_data_time = 0;
+    record.max_client_seq = 0;
+    record.wire_format = WIRE_FORMAT_TCPCODE;
+    record.send_seq = 0;
+
+    if (start_connection(client, index) != 0) {
+        return;
+    }
+
+    LOG(INFO, "Handle new connection, index:{}, client ip:{}, total connections: {}",
+            index, addr, cur_conn_num_);
+}
+
+int TcpConnectMgr::start_connection(uv_tcp_t* client, int index) {
+    // Latency-sensitive mode: no Nagle delay, and let the kernel spin on the NIC queue for reads
+    if (busy_poll_us_ > 0) {
+        uv_tcp_nodelay(client, 1);
+        uv_os_fd_t fd;
+        if (uv_fileno((uv_handle_t*)client, &fd) == 0 &&
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us_, sizeof(busy_poll_us_)) != 0) {
+            LOG(ERROR, "Failed to set SO_BUSY_POLL on client {}: {}", index, strerror(errno));
+        }
+    }
+
+    // Increment active connections count, close_connection() below releases the slot again
+    stats_manager_.increment_active_connections();
+
+    // Receiving data does not touch the timer, it is re-armed lazily when it fires
+    const SocketConnInfo& conn = client_sockconn_list_[index];
+    timeout_wheel_.schedule(index, std::max(conn.create_Time, conn.recv_data_time) + CLIENT_TIMEOUT + 1);
+
+    // Start reading from the client
+    int read_start_result = uring_ != nullptr ? arm_recv(index) : uv_read_start((uv_stream_t*)client, alloc_buffer, on_read);
+    if (read_start_result != 0) {
+        LOG(ERROR, "Failed to start reading from client: {}", uv_strerror(read_start_result));
+        close_connection(client);
+        return -1;
+    }
+    return 0;
+}
+
+void TcpConnectMgr::alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+    // Get the TcpConnectMgr instance
+    TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(handle->loop->data);
+
+    // Get the index from the handle's data
+    int index = (int)(intptr_t)handle->data;
+    MirrorRing& ring = mgr->client_conn_data_[index].recv_ring;
+
+    (void)suggested_size;  // The mirrored ring hands out all of its free space in one piece
+
+    // A missing or full ring yields an empty buffer, which libuv reports to on_read as UV_ENOBUFS
+    if (!ring.valid() && mgr->recv_pool_.acquire(ring, RECV_RING_CLASS_SIZE[0]) != 0) {
+        LOG(ERROR, "No receive ring for client {}", index);
+        buf->base = nullptr;
+        buf->len = 0;
+        return;
+    }
+    buf->base = ring.write_ptr();
+    buf->len = ring.writable();
+
+    LOG(DEBUG, "Buffer allocated for client {}: size {}", index, buf->len);
+}
+
+TcpConnectMgr* TcpConnectMgr::create_instance(int shard_id) {
+    (void)shard_id;  // Shards only differ once init() is called
+    return new (std::nothrow) TcpConnectMgr();
+}
+
+int TcpConnectMgr::init(int shard_id, int max_connections, bool resume) {
+    // Initialize connection-related variables
+    shard_id_ = shard_id;
+    laststat_time_ = 0;
+    cur_conn_num_ = 0;
+
+    if (max_connections <= 0 || max_connections > CLIENT_ID_INDEX_MASK + 1) {
+        LOG(ERROR, "Invalid connection capacity {} for shard {}, must be in [1, {}]",
+            max_connections, shard_id_, CLIENT_ID_INDEX_MASK + 1);
+        return -1;
+    }
+    max_connections_ = max_connections;
+
+    // The tables start with one chunk and grow on demand up to max_connections_
+    client_sockconn_list_.clear();
+    client_conn_data_.clear();
+    slot_generations_.clear();
+    free_slots_.clear();
+    account_to_index_.clear();
+    account_prev_.clear();
+    account_next_.clear();
+    handing_over_ = false;
+
+    // State table keys start past the keys reserved for MAX_REACTOR_NUM shards, as in previous releases
+    int state_shm_key = ConfigManager::instance().get_int("SOCKET_SHM_KEY") + MAX_REACTOR_NUM + shard_id;
+    if (state_table_.init(state_shm_key, shard_id, max_connections, resume) != 0) {
+        return -1;
+    }
+    if (timeout_wheel_.init(1, TIMEOUT_WHEEL_SLOTS, time(NULL)) != 0 || grow_slots() != 0) {
+        return -1;
+    }
+
+    gateway_to_order_topic_ = ConfigManager::instance().get_string("GATEWAY_TO_ORDER_TOPIC");
+
+    // Requests a client may send
+    client_dispatcher_.bind<cspkg::AccountLoginReq, &TcpConnectMgr::handle_login_request>();
+    client_dispatcher_.bind<cs_proto::FuturesOrder, &TcpConnectMgr::handle_futures_order>();
+    client_dispatcher_.bind<cs_proto::MarketDataSubscribe, &TcpConnectMgr::handle_md_subscribe>();
+
+    send_high_water_ = ConfigManager::instance().get_int("GATEWAY_SEND_HIGH_WATER", SEND_QUEUE_HIGH_WATER);
+    send_low_water_ = ConfigManager::instance().get_int("GATEWAY_SEND_LOW_WATER", SEND_QUEUE_LOW_WATER);
+    send_queue_limit_ = ConfigManager::instance().get_int("GATEWAY_SEND_QUEUE_LIMIT", SEND_QUEUE_LIMIT);
+
+    // The memory budget of a connection covers its largest receive ring and its send queue
+    conn_memory_budget_ = ConfigManager::instance().get_int("GATEWAY_CONN_MEMORY_BUDGET", CONN_MEMORY_BUDGET);
+    if (conn_memory_budget_ <= RECV_BUF_LEN) {
+        LOG(ERROR, "Connection memory budget {} must exceed the receive ring size {}",
+            conn_memory_budget_, RECV_BUF_LEN);
+        return -1;
+    }
+    send_queue_limit_ = std::min(send_queue_limit_, conn_memory_budget_ - RECV_BUF_LEN);
+
+    if (send_low_water_ > send_high_water_ || send_high_water_ > send_queue_limit_) {
+        LOG(ERROR, "Invalid send queue water marks: low={}, high={}, limit={}",
+            send_low_water_, send_high_water_, send_queue_limit_);
+        return -1;
+    }
+    // Market data stops queueing well before reads pause, so a slow subscriber is never disconnected for it
+    md_conflate_bytes_ = ConfigManager::instance().get_int("GATEWAY_MD_CONFLATE_BYTES", send_low_water_);
+    if (md_conflate_bytes_ > send_high_water_) {
+        LOG(ERROR, "Market data conflation threshold {} must not exceed the send high water mark {}",
+            md_conflate_bytes_, send_high_water_);
+        return -1;
+    }
+    send_iov_.reserve(MAX_SEND_PKGNUM);
+    write_pool_.init(ConfigManager::instance().get_int("GATEWAY_WRITE_POOL_MAX_BYTES", WRITE_POOL_MAX_BYTES));
+    recv_pool_.init(ConfigManager::instance().get_int("GATEWAY_RECV_RING_CACHE", RECV_RING_CACHE_NUM));
+
+    ConfigManager& config = ConfigManager::instance();
+    busy_poll_us_ = config.get_bool("GATEWAY_BUSY_POLL", false) ?
+        config.get_int("GATEWAY_SO_BUSY_POLL_US", SO_BUSY_POLL_US) : 0;
+
+    // Order admission limits, the global budget is shared equally by the reactors
+    int reactor_num = std::max(config.get_int("GATEWAY_REACTOR_NUM", 1), 1);
+    conn_order_limit_ = {static_cast<double>(config.get_int("GATEWAY_CONN_ORDER_RATE", CONN_ORDER_RATE)),
+                         static_cast<double>(config.get_int("GATEWAY_CONN_ORDER_BURST", CONN_ORDER_BURST))};
+    account_order_limit_ = {static_cast<double>(config.get_int("GATEWAY_ACCOUNT_ORDER_RATE", ACCOUNT_ORDER_RATE)),
+                            static_cast<double>(config.get_int("GATEWAY_ACCOUNT_ORDER_BURST", ACCOUNT_ORDER_BURST))};
+    TokenBucketConfig global_limit = {
+        static_cast<double>(config.get_int("GATEWAY_GLOBAL_ORDER_RATE", GLOBAL_ORDER_RATE)) / reactor_num,
+        static_cast<double>(config.get_int("GATEWAY_GLOBAL_ORDER_BURST", GLOBAL_ORDER_BURST)) / reactor_num};
+    global_order_bucket_ = TokenBucket();
+    if (global_limit.rate > 0) {
+        global_order_bucket_.init(global_limit, 0);
+    }
+    account_order_buckets_.clear();
+    account_order_buckets_.reserve(max_connections_);
+
+    int order_timeout_ms = std::max(config.get_int("GATEWAY_ORDER_TIMEOUT_MS", ORDER_RESPONSE_TIMEOUT_MS), 0);
+    if (inflight_orders_.init(config.get_int("GATEWAY_MAX_INFLIGHT_ORDERS", MAX_INFLIGHT_ORDERS),
+                              order_timeout_ms, 0) != 0) {
+        return -1;
+    }
+    int arena_block = config.get_int("GATEWAY_DECODE_ARENA_BLOCK", static_cast<int>(DECODE_ARENA_BLOCK_SIZE));
+    if (decode_arena_.init(std::max(arena_block, 0)) != 0) {
+        return -1;
+    }
+    ingress_depth_limit_ = std::max(config.get_int("GATEWAY_INGRESS_QUEUE_DEPTH", INGRESS_QUEUE_DEPTH), 0);
+    ingress_resume_depth_ = ingress_depth_limit_ / 2;
+    ingress_paused_.clear();
+    LOG(INFO, "Order admission of shard {}: connection {}/s burst {}, account {}/s burst {}, shard share {:.1f}/s, "
+        "ingress depth {}", shard_id_, conn_order_limit_.rate, conn_order_limit_.burst, account_order_limit_.rate,
+        account_order_limit_.burst, global_limit.rate, ingress_depth_limit_);
+
+    LOG(INFO, "TcpConnectMgr initialized successfully, shard: {}, capacity: {}, memory budget: {} bytes per "
+        "connection, {} bytes worst case", shard_id_, max_connections_, conn_memory_budget_,
+        static_cast<uint64_t>(conn_memory_budget_) * max_connections_);
+    return 0;
+}
+
+int TcpConnectMgr::init_io(uv_loop_t* loop) {
+    ConfigManager& config = ConfigManager::instance();
+    std::string backend = config.get_string("GATEWAY_IO_BACKEND", "libuv");
+    if (backend != "io_uring") {
+        if (backend != "libuv") {
+            LOG(ERROR, "Unknown GATEWAY_IO_BACKEND {}, shard {} uses libuv", backend, shard_id_);
+        }
+        return 0;
+    }
+
+    std::unique_ptr<UringIo> uring(new UringIo());
+    if (uring->init(config.get_int("GATEWAY_URING_ENTRIES", URING_ENTRIES),
+                    config.get_int("GATEWAY_URING_RECV_BUF_NUM", URING_RECV_BUF_NUM),
+                    config.get_int("GATEWAY_URING_RECV_BUF_SIZE", URING_RECV_BUF_SIZE)) != 0) {
+        LOG(ERROR, "io_uring is not available to shard {}, falling back to libuv", shard_id_);
+        return 0;
+    }
+
+    // The loop still accepts connections and runs timers, it only learns from the ring fd that completions wait
+    if (uv_poll_init(loop, &uring_poll_, uring->fd()) != 0) {
+        LOG(ERROR, "Failed to watch the io_uring of shard {}, falling back to libuv", shard_id_);
+        return 0;
+    }
+    uring_poll_.data = this;
+    uv_poll_start(&uring_poll_, UV_READABLE, on_uring_ready);
+    uring_ = std::move(uring);
+    while (uring_conns_.size() < client_conn_data_.size()) {
+        uring_conns_.grow();
+    }
+    LOG(INFO, "Shard {} reads and writes connections through io_uring", shard_id_);
+    return 0;
+}
+
+void TcpConnectMgr::submit_io() {
+    if (uring_ != nullptr) {
+        uring_->submit();
+    }
+}
+
+int TcpConnectMgr::grow_slots() {
+    size_t old_size = client_sockconn_list_.size();
+    if (old_size >= static_cast<size_t>(max_connections_)) {
+        return -1;
+    }
+
+    client_sockconn_list_.grow();
+    client_conn_data_.grow();
+    if (uring_ != nullptr) {
+        uring_conns_.grow();
+    }
+    size_t new_size = std::min(client_sockconn_list_.size(), static_cast<size_t>(max_connections_));
+    // Generations continue from the state table, so ids issued by a previous process stay unique
+    slot_generations_.resize(new_size, 0);
+    for (size_t i = old_size; i < new_size; ++i) {
+        slot_generations_[i] = state_table_[static_cast<int>(i)].generation;
+    }
+    timeout_wheel_.resize(new_size);
+    account_to_index_.reserve(new_size);
+    account_prev_.resize(new_size, -1);
+    account_next_.resize(new_size, -1);
+    md_subscriptions_.resize(new_size);
+
+    // Lowest indexes are handed out first
+    for (size_t i = new_size; i > old_size; --i) {
+        free_slots_.push_back(static_cast<int>(i - 1));
+    }
+
+    LOG(INFO, "Connection table of shard {} grown to {} slots", shard_id_, new_size);
+    return 0;
+}
+
+void TcpConnectMgr::on_read(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf) {
+    TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(client->loop->data);
+    int index = mgr->get_index_for_client((uv_tcp_t*)client);
+
+    if (index < 0) {
+        LOG(ERROR, "Invalid client index: {}", index);
+        mgr->close_connection((uv_tcp_t*)client);
+        return;
+    }
+
+    MirrorRing& ring = mgr->client_conn_data_[index].recv_ring;
+
+    if (nread > 0) {
+        LOG(DEBUG, "Read {} bytes from client {}", nread, index);
+        
+        // Update the received bytes count
+        ring.commit(nread);
+
+        // Process the received data
+        if (mgr->process_client_data(client, nread) == 0 && ring.readable() == 0) {
+            mgr->recv_pool_.release(ring);  // Nothing partial left, give the ring back
+        }
+    } else if (nread == 0) {
+        // EAGAIN, the ring taken by alloc_buffer may still be empty
+        if (ring.valid() && ring.readable() == 0) {
+            mgr->recv_pool_.release(ring);
+        }
+    } else if (nread < 0) {
+        if (nread != UV_EOF) {
+            LOG(ERROR, "Read error for client {}: {}", index, uv_strerror(nread));
+        } else {
+            LOG(INFO, "Client {} disconnected", index);
+        }
+
+        // Close the client connection
+        mgr->close_connection((uv_tcp_t*)client);
+    }
+
+    (void)buf;  // Points into the receive ring
+}
+
+int TcpConnectMgr::process_client_data(uv_stream_t* client, ssize_t nread) {
+    int index = get_index_for_client((uv_tcp_t*)client);
+    if (index < 0) {
+        LOG(ERROR, "Invalid client index: {}", index);
+        close_connection((uv_tcp_t*)client);
+        return -1;
+    }
+
+    // Frames of this read are timed from here to their decode
+    uint64_t recv_ns = latency_now_ns();
+
+    LOG(DEBUG, "Processing {} bytes from client {}", nread, index);
+
+    SocketConnInfo& cur_conn = client_sockconn_list_[index];
+    stats_manager_.add_received_bytes(nread);
+
+    // Update receive time
+    time(&cur_conn.recv_data_time);
+
+    // Messages of the previous read were handled by now, this read decodes into the same blocks
+    decode_arena_.reset();
+
+    // Process complete packets, the mirrored ring keeps every package contiguous.
+    // The framing is read per package, a login request switches it for the packages after it
+    SocketConnData& conn_data = client_conn_data_[index];
+    MirrorRing& ring = conn_data.recv_ring;
+    int total_processed = 0;
+    for (;;) {
+        bool binary = conn_data.wire_format == WIRE_FORMAT_BINARY;
+        if (ring.readable() < static_cast<size_t>(binary ? BIN_HEAD_SIZE : PKGHEAD_FIELD_SIZE)) {
+            break;
+        }
+        const char* package = ring.read_ptr();
+        int packet_size = binary ? TcpCode::convert_uint16(package) : TcpCode::convert_int32(package);
+        if (binary && packet_size < BIN_HEAD_SIZE) {
+            packet_size = 0;  // Rejected below
+        }
+
+        LOG(DEBUG, "Packet size: {}", packet_size);
+
+        if (packet_size <= 0 || packet_size > MAX_CSPKG_LEN) {
+            LOG(ERROR, "Invalid packet size {} for client {}", packet_size, index);
+            close_connection((uv_tcp_t*)client);
+            return -1;
+        }
+
+        // Move to a larger size class for frames that cannot fit the current ring
+        if (static_cast<size_t>(packet_size) > ring.capacity()) {
+            if (recv_pool_.grow(ring, packet_size) != 0) {
+                LOG(ERROR, "Failed to grow receive ring to {} bytes for client {}", packet_size, index);
+                close_connection((uv_tcp_t*)client);
+                return -1;
+            }
+            LOG(DEBUG, "Receive ring of client {} grown to {} bytes", index, ring.capacity());
+            break;  // The frame is still incomplete, the next read fills the larger ring
+        }
+
+        if (ring.readable() >= static_cast<size_t>(packet_size)) {
+            MsgId msg_id = MSG_NONE;
+            MsgPtr parsed_message;
+            if (binary) {
+                parsed_message.reset(TcpCode::decode_binary(package, packet_size, &msg_id, decode_arena_.get()));
+                uint16_t seq = TcpCode::convert_uint16(package + 3 * sizeof(uint16_t));
+                uint16_t expected = conn_data.recv_seq == 0xFFFF ? 1 : conn_data.recv_seq + 1;
+                if (seq != expected) {
+                    LOG(DEBUG, "Client {} frame sequence {} after {}", index, seq, conn_data.recv_seq);
+                }
+                conn_data.recv_seq = seq;
+            } else {
+                parsed_message.reset(TcpCode::decode(package, packet_size, &msg_id, decode_arena_.get()));
+            }
+            decoded_ns_ = latency_now_ns();
+            stats_manager_.record_latency(LATENCY_RECV_DECODE, decoded_ns_ - recv_ns);
+            if (parsed_message) {
+                if (!client_dispatcher_.dispatch(this, msg_id, *parsed_message, client, index)) {
+                    LOG(ERROR, "Unexpected message {} from client {}", parsed_message->GetTypeName(), index);
+                }
+            } else {
+                LOG(ERROR, "Failed to parse client message for client {}", index);
+            }
+
+            stats_manager_.increment_received_packages();
+            total_processed += packet_size;
+            ring.consume(packet_size);
+        } else {
+            LOG(DEBUG, "Incomplete packet, waiting for more data");
+            break;
+        }
+    }
+
+    LOG(DEBUG, "Processed {} bytes from client {}", total_processed, index);
+    return 0;
+}
+
+void TcpConnectMgr::handle_login_request(const cspkg::AccountLoginReq& login_req, uv_stream_t* client, int client_index) {
+    (void)client;  // Unused
+    LOG(INFO, "Received AccountLoginReq from client {}, account {}", client_index, login_req.account());
+    // Route the account to this connection, leaving the account of an earlier login on it.
+    // Other sessions of the account stay linked and take over the route when this one closes
+    SocketConnData& conn_data = client_conn_data_[client_index];
+    if (conn_data.uin != login_req.account()) {
+        unlink_account(client_index);
+        conn_data.uin = login_req.account();
+        link_account(client_index);
+    }
+    state_table_[client_index].uin = conn_data.uin;
+
+    // Packages after this one use the binary framing in both directions, the response included
+    if (login_req.binary_frames() && conn_data.wire_format != WIRE_FORMAT_BINARY) {
+        conn_data.wire_format = WIRE_FORMAT_BINARY;
+        state_table_[client_index].wire_format = WIRE_FORMAT_BINARY;
+        LOG(INFO, "Client {} switched to binary frames", client_index);
+    }
+
+    // Forward the login request to order_server via Kafka, tagged with the client id of this connection.
+    // It joins the batch the reactor produces at the end of this loop iteration
+    int client_id = client_sockconn_list_[client_index].client_id;
+    if (KafkaManager::instance().append_batch(gateway_to_order_topic_, login_req, client_id, shard_id_)) {
+        kafka_queued_ns_.push_back(decoded_ns_);
+        LOG(INFO, "Queued AccountLoginReq to Kafka for client:{}, topic:{}", client_index, gateway_to_order_topic_);
+    } else {
+        LOG(ERROR, "Failed to send AccountLoginReq to Kafka for client {}", client_index);
+    }
+}
+
+void TcpConnectMgr::handle_futures_order(const cs_proto::FuturesOrder& order, uv_stream_t* client, int client_index) {
+    LOG(DEBUG, "Received FuturesOrder from client {}", client_index);
+
+    // A pipelined client may resend an order it is unsure about, only the first copy goes on.
+    // The sequence is taken even if the order is rejected below, a retry needs a new one
+    SocketConnData& conn_data = client_conn_data_[client_index];
+    if (order.client_seq() != 0) {
+        if (order.client_seq() <= conn_data.max_client_seq) {
+            stats_manager_.increment_orders_duplicate();
+            LOG(DEBUG, "Dropped duplicate order {} seq {} from client {}, highest seq {}",
+                order.order_id(), order.client_seq(), client_index, conn_data.max_client_seq);
+            return;
+        }
+        conn_data.max_client_seq = order.client_seq();
+    }
+
+    // While the ingress stage is full orders are answered BUSY before taking any token, rather
+    // than piling up behind a slow Kafka. The heaviest senders also stop being read
+    if (ingress_depth_limit_ > 0 && KafkaManager::instance().ingress_depth(shard_id_) >= ingress_depth_limit_) {
+        reject_order(order, client, client_index, ORDER_REJECT_INGRESS);
+        pause_heavy_sender(client_index);
+        return;
+    }
+
+    // Orders over a limit are answered here and never reach Kafka
+    OrderRejectScope scope;
+    if (!admit_order(client_index, uv_now(client->loop), scope)) {
+        reject_order(order, client, client_index, scope);
+        return;
+    }
+    stats_manager_.increment_orders_admitted();
+
+    int client_id = client_sockconn_list_[client_index].client_id;
+    if (KafkaManager::instance().append_batch(gateway_to_order_topic_, order, client_id, shard_id_)) {
+        kafka_queued_ns_.push_back(decoded_ns_);
+        if (conn_data.ingress_epoch != ingress_epoch_) {
+            conn_data.ingress_epoch = ingress_epoch_;
+            conn_data.ingress_orders = 0;
+        }
+        ++conn_data.ingress_orders;
+        if (inflight_orders_.enabled() &&
+            !inflight_orders_.add(client_id, order.order_id(), order.client_seq(), decoded_ns_, uv_now(client->loop))) {
+            stats_manager_.increment_orders_untracked();
+        }
+        LOG(DEBUG, "Queued FuturesOrder to Kafka for client {}, topic {}", client_index, gateway_to_order_topic_);
+    } else {
+        LOG(ERROR, "Failed to send FuturesOrder to Kafka for client {}", client_index);
+    }
+}
+
+void TcpConnectMgr::handle_md_subscribe(const cs_proto::MarketDataSubscribe& req, uv_stream_t* client, int client_index) {
+    (void)client;  // Unused
+    // Only logged in clients may subscribe, every subscribed symbol takes an entry in the symbol table
+    if (client_conn_data_[client_index].uin == 0) {
+        LOG(DEBUG, "Dropped market data subscription from client {} before login", client_index);
+        return;
+    }
+    int changed = 0;
+    for (const std::string& symbol : req.symbols()) {
+        bool done = req.unsubscribe() ? md_subscriptions_.unsubscribe(client_index, symbol) :
+                                        md_subscriptions_.subscribe(client_index, symbol);
+        changed += done ? 1 : 0;
+    }
+    LOG(DEBUG, "Client {} {} {} of {} market data symbols", client_index,
+        req.unsubscribe() ? "unsubscribed from" : "subscribed to", changed, req.symbols_size());
+}
+
+void TcpConnectMgr::link_account(int index) {
+    uint32_t account = static_cast<uint32_t>(client_conn_data_[index].uin);
+    const int* head = account_to_index_.find(account);
+    account_prev_[index] = -1;
+    account_next_[index] = head != nullptr ? *head : -1;
+    if (head != nullptr) {
+        account_prev_[*head] = index;
+    }
+    account_to_index_.insert_or_assign(account, index);
+}
+
+void TcpConnectMgr::unlink_account(int index) {
+    ULONG uin = client_conn_data_[index].uin;
+    if (uin == 0) {
+        return;
+    }
+    int prev = account_prev_[index];
+    int next = account_next_[index];
+    if (next >= 0) {
+        account_prev_[next] = prev;
+    }
+    if (prev >= 0) {
+        account_next_[prev] = next;
+    } else if (next >= 0) {
+        account_to_index_.insert_or_assign(static_cast<uint32_t>(uin), next);
+    } else {
+        // The last session of the account closed, a new login starts with a full bucket
+        account_to_index_.erase(static_cast<uint32_t>(uin));
+        account_order_buckets_.erase(uin);
+    }
+    account_prev_[index] = -1;
+    account_next_[index] = -1;
+}
+
+bool TcpConnectMgr::admit_order(int index, uint64_t now_ms, OrderRejectScope& scope) {
+    SocketConnData& conn_data = client_conn_data_[index];
+    TokenBucket& conn_bucket = conn_data.order_bucket;
+    conn_bucket.refill(now_ms);
+    if (!conn_bucket.available()) {
+        scope = ORDER_REJECT_CONNECTION;
+        return false;
+    }
+
+    // Orders sent before login have no account bucket
+    TokenBucket* account_bucket = nullptr;
+    if (conn_data.uin != 0 && account_order_limit_.rate > 0) {
+        account_bucket = account_order_buckets_.find(conn_data.uin);
+        if (account_bucket == nullptr) {
+            TokenBucket bucket;
+            bucket.init(account_order_limit_, now_ms);
+            account_order_buckets_.insert_or_assign(conn_data.uin, bucket);
+            account_bucket = account_order_buckets_.find(conn_data.uin);
+        }
+        account_bucket->refill(now_ms);
+        if (!account_bucket->available()) {
+            scope = ORDER_REJECT_ACCOUNT;
+            return false;
+        }
+    }
+
+    global_order_bucket_.refill(now_ms);
+    if (!global_order_bucket_.available()) {
+        scope = ORDER_REJECT_GLOBAL;
+        return false;
+    }
+
+    // Tokens are only taken once every limit has one
+    conn_bucket.take();
+    if (account_bucket != nullptr) {
+        account_bucket->take();
+    }
+    global_order_bucket_.take();
+    return true;
+}
+
+void TcpConnectMgr::reject_order(const cs_proto::FuturesOrder& order, uv_stream_t* client, int client_index,
+                                 OrderRejectScope scope) {
+    static const char* const REJECT_REASONS[ORDER_REJECT_SCOPE_NUM] = {
+        "Rate limited: connection order limit exceeded",
+        "Rate limited: account order limit exceeded",
+        "Rate limited: gateway busy",
+        "Gateway busy: order queue full",
+    };
+
+    stats_manager_.increment_orders_rejected(scope);
+    LOG(DEBUG, "Rejected order {} from client {}: {}", order.order_id(), client_index, REJECT_REASONS[scope]);
+
+    cs_proto::OrderResponse response;
+    response.set_order_id(order.order_id());
+    response.set_status(scope == ORDER_REJECT_INGRESS ? cs_proto::BUSY : cs_proto::REJECTED);
+    response.set_message(REJECT_REASONS[scope]);
+    response.set_client_id(client_sockconn_list_[client_index].client_id);
+    response.set_client_seq(order.client_seq());
+    send_order_ack((uv_tcp_t*)client, response);
+}
+
+void TcpConnectMgr::pause_heavy_sender(int index) {
+    SocketConnData& conn_data = client_conn_data_[index];
+    if (conn_data.read_paused & READ_PAUSE_INGRESS) {
+        return;
+    }
+    // The share splits the bound evenly over the open connections, lighter senders keep being read
+    int orders = conn_data.ingress_epoch == ingress_epoch_ ? conn_data.ingress_orders : 0;
+    int64_t share = std::max<int64_t>(ingress_depth_limit_ / std::max(cur_conn_num_, 1), 1);
+    if (orders < share) {
+        return;
+    }
+    set_read_pause(index, READ_PAUSE_INGRESS);
+    ingress_paused_.push_back(client_sockconn_list_[index].client_id);
+    stats_manager_.increment_ingress_pauses();
+    LOG(INFO, "Paused reading from client {}, it queued {} orders while the ingress stage filled", index, orders);
+}
+
+void TcpConnectMgr::check_ingress() {
+    if (ingress_depth_limit_ == 0 || KafkaManager::instance().ingress_depth(shard_id_) > ingress_resume_depth_) {
+        return;
+    }
+    ++ingress_epoch_;
+    if (ingress_paused_.empty()) {
+        return;
+    }
+
+    int resumed = 0;
+    for (int client_id : ingress_paused_) {
+        uv_tcp_t* client = get_client_by_id(client_id);
+        if (client != nullptr && !uv_is_closing((uv_handle_t*)client)) {
+            resumed += clear_read_pause(get_index_for_client(client), READ_PAUSE_INGRESS) ? 1 : 0;
+        }
+    }
+    LOG(INFO, "Ingress stage of shard {} drained, resumed reading from {} of {} paused clients",
+        shard_id_, resumed, ingress_paused_.size());
+    ingress_paused_.clear();
+}
+
+void TcpConnectMgr::publish_gauges() {
+    inflight_gauge_.store(inflight_orders_.size(), std::memory_order_relaxed);
+    ingress_paused_gauge_.store(ingress_paused_.size(), std::memory_order_relaxed);
+}
+
+void TcpConnectMgr::send_order_ack(uv_tcp_t* client, const cs_proto::OrderResponse& response) {
+    // Clients that never sent a sequence number only understand single OrderResponse frames
+    int index = get_index_for_client(client);
+    if (index < 0 || response.client_seq() == 0 || client_conn_data_[index].max_client_seq == 0) {
+        tcp_send_message((uv_stream_t*)client, response);
+        return;
+    }
+    pending_acks_.push_back(PendingAck{index, client_sockconn_list_[index].client_id, response});
+}
+
+void TcpConnectMgr::flush_order_acks() {
+    if (pending_acks_.empty()) {
+        return;
+    }
+
+    // Group by connection, keeping the order of each connection's responses
+    std::stable_sort(pending_acks_.begin(), pending_acks_.end(),
+                     [](const PendingAck& a, const PendingAck& b) { return a.index < b.index; });
+    size_t begin = 0;
+    size_t batch_bytes = 0;
+    for (size_t i = 0; i < pending_acks_.size(); ++i) {
+        // Start a new frame for the next connection or when the frame would outgrow a send buffer
+        size_t ack_bytes = pending_acks_[i].response.ByteSizeLong() + 4;
+        if (i > begin && (pending_acks_[i].index != pending_acks_[begin].index ||
+                          batch_bytes + ack_bytes > static_cast<size_t>(ORDER_ACK_BATCH_BYTES))) {
+            send_ack_batch(begin, i);
+            begin = i;
+            batch_bytes = 0;
+        }
+        batch_bytes += ack_bytes;
+    }
+    send_ack_batch(begin, pending_acks_.size());
+    pending_acks_.clear();
+}
+
+void TcpConnectMgr::record_kafka_produced() {
+    if (kafka_queued_ns_.empty()) {
+        return;
+    }
+    uint64_t now_ns = latency_now_ns();
+    for (uint64_t decoded_ns : kafka_queued_ns_) {
+        stats_manager_.record_latency(LATENCY_DECODE_ENQUEUE, now_ns - decoded_ns);
+    }
+    kafka_queued_ns_.clear();
+}
+
+void TcpConnectMgr::send_ack_batch(size_t begin, size_t end) {
+    const PendingAck& first = pending_acks_[begin];
+    const SocketConnInfo& conn = client_sockconn_list_[first.index];
+    if (conn.handle == nullptr || conn.client_id != first.client_id) {
+        return;  // Closed since the responses were held
+    }
+    if (end - begin == 1) {
+        tcp_send_message((uv_stream_t*)conn.handle, first.response);
+        return;
+    }
+
+    ack_batch_.Clear();
+    ack_batch_.set_client_id(first.client_id);
+    for (size_t i = begin; i < end; ++i) {
+        ack_batch_.add_responses()->Swap(&pending_acks_[i].response);
+    }
+    if (tcp_send_message((uv_stream_t*)conn.handle, ack_batch_) == ERROR_OK) {
+        stats_manager_.record_order_ack_batch(end - begin);
+    }
+}
+
+int TcpConnectMgr::tcp_send_data(uv_stream_t* client, const char* databuf, int len) {
+    TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(client->loop->data);
+    int index = mgr->get_index_for_client((uv_tcp_t*)client);
+    if (index < 0 || uv_is_closing((uv_handle_t*)client)) {
+        LOG(ERROR, "Drop {} bytes for closed client {}", len, index);
+        return ERROR_CLIENT_CLOSE;
+    }
+
+    char* space = mgr->reserve_send_space(index, len);
+    if (space == nullptr) {
+        return ERROR_WRITE_BUFFOVER;
+    }
+    memcpy(space, databuf, len);
+    mgr->commit_send_space(index, len);
+    return ERROR_OK;
+}
+
+int TcpConnectMgr::tcp_send_message(uv_stream_t* client, const google::protobuf::Message& message) {
+    TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(client->loop->data);
+    int index = mgr->get_index_for_client((uv_tcp_t*)client);
+    if (index < 0 || uv_is_closing((uv_handle_t*)client)) {
+        LOG(ERROR, "Drop {} for closed client {}", message.GetTypeName(), index);
+        return ERROR_CLIENT_CLOSE;
+    }
+
+    SocketConnData& conn_data = mgr->client_conn_data_[index];
+    bool binary = conn_data.wire_format == WIRE_FORMAT_BINARY;
+    int len = binary ? TcpCode::binary_encoded_size(message) : TcpCode::encoded_size(message);
+    if (binary && len > MAX_CSPKG_LEN) {
+        LOG(ERROR, "{} of {} bytes does not fit a binary frame", message.GetTypeName(), len);
+        return ERROR_PACKET_INVALID;
+    }
+    char* space = mgr->reserve_send_space(index, len);
+    if (space == nullptr) {
+        return ERROR_WRITE_BUFFOVER;
+    }
+    if (binary) {
+        uint16_t seq = conn_data.send_seq == 0xFFFF ? 1 : conn_data.send_seq + 1;
+        if (TcpCode::encode_binary_sized_to(message, MsgRegistry::id_of(message), 0, seq, space, len) != len) {
+            return ERROR_PACKET_INVALID;
+        }
+        conn_data.send_seq = seq;
+    } else if (TcpCode::encode_sized_to(message, space, len) != len) {
+        // Nothing was committed, the reserved space is reused by the next package
+        return ERROR_PACKET_INVALID;
+    }
+    mgr->commit_send_space(index, len);
+    return ERROR_OK;
+}
+
+char* TcpConnectMgr::reserve_send_space(int index, int len) {
+    SocketConnInfo& conn = client_sockconn_list_[index];
+    SocketConnData& conn_data = client_conn_data_[index];
+    if (conn_data.send_queue_bytes + len > send_queue_limit_) {
+        LOG(ERROR, "Send queue of client {} would exceed {} bytes, disconnecting slow consumer",
+            index, send_queue_limit_);
+        stats_manager_.increment_slow_consumer_disconnects();
+        close_connection(conn.handle);
+        return nullptr;
+    }
+
+    // Coalesce small packages into the tail buffer while it has room, shared entries have none
+    WriteBuf* tail = conn_data.send_tail;
+    if (tail != nullptr && tail->capacity >= tail->len + static_cast<UINT>(len)) {
+        return tail->data + tail->len;
+    }
+
+    WriteBuf* buf = write_pool_.acquire(len);
+    if (buf == nullptr) {
+        LOG(ERROR, "No send buffer for {} bytes to client {}, disconnecting", len, index);
+        close_connection(conn.handle);
+        return nullptr;
+    }
+    buf->index = index;
+    buf->queued_ns = latency_now_ns();
+    if (tail != nullptr) {
+        tail->next = buf;
+    } else {
+        conn_data.send_head = buf;
+    }
+    conn_data.send_tail = buf;
+    return buf->data;
+}
+
+void TcpConnectMgr::commit_send_space(int index, int len) {
+    SocketConnData& conn_data = client_conn_data_[index];
+    conn_data.send_tail->len += len;
+    conn_data.send_tail->frames++;
+    queue_send_bytes(index, len);
+}
+
+void TcpConnectMgr::queue_send_bytes(int index, int len) {
+    SocketConnData& conn_data = client_conn_data_[index];
+    conn_data.send_queue_bytes += len;
+    stats_manager_.add_send_queue_bytes(len, conn_data.send_queue_bytes);
+    if (!conn_data.send_pending) {
+        conn_data.send_pending = true;
+        send_pending_list_.push_back(index);
+    }
+
+    // Stop taking requests from a client that does not read its responses
+    if (!(conn_data.read_paused & READ_PAUSE_SEND_QUEUE) && conn_data.send_queue_bytes > send_high_water_) {
+        set_read_pause(index, READ_PAUSE_SEND_QUEUE);
+        LOG(INFO, "Paused reading from client {}, send queue {} bytes", index, conn_data.send_queue_bytes);
+    }
+}
+
+int TcpConnectMgr::broadcast(const std::string& symbol, MsgId msg_id, const SharedFrames& frames) {
+    int symbol_id = md_subscriptions_.symbol_id(symbol);
+    if (symbol_id < 0) {
+        stats_manager_.record_md_broadcast(0, 0);
+        return 0;
+    }
+
+    // Closing a connection only starts uv_close, so the subscriber list does not change while iterating
+    uint32_t key = MdSubscriptions::make_key(symbol_id, msg_id);
+    uint64_t queued = 0;
+    uint64_t conflated = 0;
+    for (int index : md_subscriptions_.subscribers(symbol_id)) {
+        uv_tcp_t* client = client_sockconn_list_[index].handle;
+        if (client == nullptr || uv_is_closing((uv_handle_t*)client)) {
+            continue;
+        }
+        SharedBuf* buf = frames[client_conn_data_[index].wire_format];
+
+        // A slow subscriber gets the latest state once its queue drains instead of a growing backlog.
+        // Updates also wait while older ones do, so a symbol's updates are never reordered
+        if (client_conn_data_[index].send_queue_bytes > md_conflate_bytes_ || md_subscriptions_.has_conflated(index)) {
+            conflated += md_subscriptions_.conflate(index, key, buf) ? 1 : 0;
+        } else if (queue_shared(index, buf)) {
+            ++queued;
+        }
+    }
+    stats_manager_.record_md_broadcast(queued, conflated);
+    return static_cast<int>(queued);
+}
+
+bool TcpConnectMgr::queue_shared(int index, SharedBuf* buf) {
+    SocketConnData& conn_data = client_conn_data_[index];
+    WriteBuf* entry = write_pool_.acquire_shared(buf);
+    if (entry == nullptr) {
+        LOG(ERROR, "No send queue entry for market data to client {}, disconnecting", index);
+        close_connection(client_sockconn_list_[index].handle);
+        return false;
+    }
+    entry->index = index;
+    entry->queued_ns = latency_now_ns();
+    if (conn_data.send_tail != nullptr) {
+        conn_data.send_tail->next = entry;
+    } else {
+        conn_data.send_head = entry;
+    }
+    conn_data.send_tail = entry;
+    queue_send_bytes(index, buf->len());
+    return true;
+}
+
+void TcpConnectMgr::flush_conflated(int index) {
+    md_scratch_.clear();
+    md_subscriptions_.take_conflated(index, md_scratch_);
+    for (MdConflated& pending : md_scratch_) {
+        uv_tcp_t* client = client_sockconn_list_[index].handle;
+        if (client != nullptr && !uv_is_closing((uv_handle_t*)client)) {
+            queue_shared(index, pending.buf);
+        }
+        pending.buf->release();
+    }
+    md_scratch_.clear();
+}
+
+void TcpConnectMgr::check_wait_send_data() {
+    if (send_pending_list_.empty()) {
+        return;
+    }
+
+    // Completions re-add connections to the pending list, so flush from a separate list
+    send_flush_list_.swap(send_pending_list_);
+    for (int index : send_flush_list_) {
+        SocketConnInfo& conn = client_sockconn_list_[index];
+        SocketConnData& conn_data = client_conn_data_[index];
+        conn_data.send_pending = false;
+        if (conn.handle == nullptr || conn_data.send_inflight || conn_data.send_head == nullptr ||
+            uv_is_closing((uv_handle_t*)conn.handle)) {
+            continue;
+        }
+        // The iovecs of the slot still belong to a batch of the previous occupant, its completion re-adds the slot
+        if (uring_ != nullptr && uring_conns_[index].send_batch != nullptr) {
+            continue;
+        }
+        flush_send_queue(index);
+    }
+    send_flush_list_.clear();
+}
+
+void TcpConnectMgr::flush_send_queue(int index) {
+    SocketConnInfo& conn = client_sockconn_list_[index];
+    SocketConnData& conn_data = client_conn_data_[index];
+
+    // Detach up to MAX_SEND_PKGNUM buffers, the head carries the write request of the batch
+    WriteBuf* batch = conn_data.send_head;
+    WriteBuf* last = batch;
+    send_iov_.clear();
+    send_iov_.push_back(uv_buf_init(batch->data, batch->len));
+    while (last->next != nullptr && send_iov_.size() < static_cast<size_t>(MAX_SEND_PKGNUM)) {
+        last = last->next;
+        send_iov_.push_back(uv_buf_init(last->data, last->len));
+    }
+    conn_data.send_head = last->next;
+    if (conn_data.send_head == nullptr) {
+        conn_data.send_tail = nullptr;
+    }
+    last->next = nullptr;
+
+    int result = 0;
+    if (uring_ != nullptr) {
+        result = queue_uring_send(index, batch);
+    } else {
+        batch->req.data = batch;
+        result = uv_write(&batch->req, (uv_stream_t*)conn.handle, send_iov_.data(), send_iov_.size(), on_write);
+    }
+    if (result != 0) {
+        LOG(ERROR, "Failed to write to client {}: {}", index, uv_strerror(result));
+        size_t bytes = 0;
+        for (WriteBuf* buf = batch; buf != nullptr; buf = buf->next) {
+            bytes += buf->len;
+        }
+        conn_data.send_queue_bytes -= bytes;
+        stats_manager_.add_send_queue_bytes(-static_cast<int64_t>(bytes), 0);
+        write_pool_.release_chain(batch);
+        close_connection(conn.handle);
+        return;
+    }
+
+    conn_data.send_inflight = true;
+    stats_manager_.increment_write_calls();
+    LOG(DEBUG, "Batched write to client {}: {} buffers", index, send_iov_.size());
+}
+
+void TcpConnectMgr::on_write(uv_write_t* req, int status) {
+    TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(req->handle->loop->data);
+    WriteBuf* batch = static_cast<WriteBuf*>(req->data);
+    mgr->complete_send_batch(batch, (uv_tcp_t*)req->handle, status);
+    mgr->write_pool_.release_chain(batch);
+}
+
+void TcpConnectMgr::complete_send_batch(WriteBuf* batch, uv_tcp_t* client, int status) {
+    int index = batch->index;
+    size_t bytes = 0;
+    uint64_t frames = 0;
+    for (WriteBuf* buf = batch; buf != nullptr; buf = buf->next) {
+        bytes += buf->len;
+        frames += buf->frames;
+    }
+
+    SocketConnInfo& conn = client_sockconn_list_[index];
+    SocketConnData& conn_data = client_conn_data_[index];
+    if (conn.handle != client) {
+        return;  // Slot was released, its queued bytes were already accounted
+    }
+    stats_manager_.add_send_queue_bytes(-static_cast<int64_t>(bytes), 0);
+    conn_data.send_inflight = false;
+    conn_data.send_queue_bytes -= bytes;
+
+    if (status < 0) {
+        LOG(ERROR, "Write error for client {}: {}", index, uv_strerror(status));
+        return;
+    }
+    LOG(DEBUG, "Write successful for client {}", index);
+    stats_manager_.increment_sent_packages(frames);
+    stats_manager_.add_sent_bytes(bytes);
+    uint64_t now_ns = latency_now_ns();
+    for (WriteBuf* buf = batch; buf != nullptr; buf = buf->next) {
+        stats_manager_.record_latency(LATENCY_RESPONSE_WRITE, now_ns - buf->queued_ns);
+    }
+
+    if (md_subscriptions_.has_conflated(index) && conn_data.send_queue_bytes <= md_conflate_bytes_ &&
+        !uv_is_closing((uv_handle_t*)client)) {
+        flush_conflated(index);
+    }
+
+    // Packages queued while this write was in flight go out with the next flush
+    if (conn_data.send_head != nullptr && !conn_data.send_pending) {
+        conn_data.send_pending = true;
+        send_pending_list_.push_back(index);
+    }
+
+    if ((conn_data.read_paused & READ_PAUSE_SEND_QUEUE) && conn_data.send_queue_bytes <= send_low_water_ &&
+        !uv_is_closing((uv_handle_t*)client) && clear_read_pause(index, READ_PAUSE_SEND_QUEUE)) {
+        LOG(INFO, "Resumed reading from client {}, send queue {} bytes", index, conn_data.send_queue_bytes);
+    }
+}
+
+void TcpConnectMgr::pause_reading(int index) {
+    if (uring_ == nullptr) {
+        uv_read_stop((uv_stream_t*)client_sockconn_list_[index].handle);
+        return;
+    }
+    // The receive ends with a final completion, which re-arms it only if reading was resumed meanwhile
+    if (uring_conns_[index].recv_armed) {
+        int client_id = client_sockconn_list_[index].client_id;
+        uring_->queue_cancel(uring_user_data(URING_OP_RECV, client_id), uring_user_data(URING_OP_CANCEL, client_id));
+    }
+}
+
+void TcpConnectMgr::set_read_pause(int index, ReadPauseReason reason) {
+    SocketConnData& conn_data = client_conn_data_[index];
+    bool reading = conn_data.read_paused == 0;
+    conn_data.read_paused |= reason;
+    if (reading) {
+        pause_reading(index);
+    }
+}
+
+bool TcpConnectMgr::clear_read_pause(int index, ReadPauseReason reason) {
+    SocketConnData& conn_data = client_conn_data_[index];
+    conn_data.read_paused &= ~reason;
+    // Connections being handed over stay stopped whatever paused them
+    if (conn_data.read_paused != 0 || handing_over_) {
+        return false;
+    }
+    resume_reading(index);
+    return true;
+}
+
+void TcpConnectMgr::resume_reading(int index) {
+    if (uring_ == nullptr) {
+        uv_read_start((uv_stream_t*)client_sockconn_list_[index].handle, alloc_buffer, on_read);
+        return;
+    }
+    if (!uring_conns_[index].recv_armed && arm_recv(index) != 0) {
+        LOG(ERROR, "Failed to resume reading from client {}", index);
+        close_connection(client_sockconn_list_[index].handle);
+    }
+}
+
+int TcpConnectMgr::arm_recv(int index) {
+    const SocketConnInfo& conn = client_sockconn_list_[index];
+    uv_os_fd_t fd;
+    int result = uv_fileno((uv_handle_t*)conn.handle, &fd);
+    if (result != 0) {
+        return result;
+    }
+    if (uring_->queue_recv_multishot(fd, uring_user_data(URING_OP_RECV, conn.client_id)) != 0) {
+        return UV_ENOBUFS;
+    }
+    uring_conns_[index].recv_armed = true;
+    return 0;
+}
+
+int TcpConnectMgr::queue_uring_send(int index, WriteBuf* batch) {
+    const SocketConnInfo& conn = client_sockconn_list_[index];
+    UringConn& uring_conn = uring_conns_[index];
+    uv_os_fd_t fd;
+    int result = uv_fileno((uv_handle_t*)conn.handle, &fd);
+    if (result != 0) {
+        return result;
+    }
+
+    // uv_buf_t has the layout of struct iovec on Unix
+    uring_conn.send_iov.resize(send_iov_.size());
+    memcpy(uring_conn.send_iov.data(), send_iov_.data(), send_iov_.size() * sizeof(struct iovec));
+    uring_conn.send_remaining = 0;
+    for (const uv_buf_t& buf : send_iov_) {
+        uring_conn.send_remaining += buf.len;
+    }
+    memset(&uring_conn.send_msg, 0, sizeof(uring_conn.send_msg));
+    uring_conn.send_msg.msg_iov = uring_conn.send_iov.data();
+    uring_conn.send_msg.msg_iovlen = uring_conn.send_iov.size();
+    if (uring_->queue_sendmsg(fd, &uring_conn.send_msg, uring_user_data(URING_OP_SEND, conn.client_id)) != 0) {
+        return UV_ENOBUFS;
+    }
+    uring_conn.send_batch = batch;
+    uring_conn.send_client_id = conn.client_id;
+    return 0;
+}
+
+void TcpConnectMgr::on_uring_ready(uv_poll_t* handle, int status, int events) {
+    (void)status;
+    (void)events;
+    TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(handle->data);
+    mgr->uring_->reap([mgr](const struct io_uring_cqe& cqe) {
+        switch (static_cast<UringOp>(cqe.user_data >> 32)) {
+            case URING_OP_RECV:
+                mgr->on_uring_recv(cqe);
+                break;
+            case URING_OP_SEND:
+                mgr->on_uring_send(cqe);
+                break;
+            default:
+                break;  // Cancellations are seen through the completion of the request they ended
+        }
+    });
+}
+
+void TcpConnectMgr::on_uring_recv(const struct io_uring_cqe& cqe) {
+    int client_id = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+    int index = client_id_index(client_id);
+    bool has_buf = (cqe.flags & IORING_CQE_F_BUFFER) != 0;
+    uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+
+    // Completions of a closed occupant only give their buffer back
+    SocketConnInfo& conn = client_sockconn_list_[index];
+    bool current = conn.client_id == client_id && conn.handle != nullptr;
+    if (current && !(cqe.flags & IORING_CQE_F_MORE)) {
+        uring_conns_[index].recv_armed = false;
+    }
+    current = current && !uv_is_closing((uv_handle_t*)conn.handle);
+
+    if (current && cqe.res > 0 && has_buf) {
+        feed_client_data(index, uring_->recv_buf(bid), cqe.res);
+    }
+    if (has_buf) {
+        uring_->recycle_recv_buf(bid);
+    }
+    if (!current || uv_is_closing((uv_handle_t*)conn.handle)) {
+        return;
+    }
+
+    if (cqe.res == 0) {
+        LOG(INFO, "Client {} disconnected", index);
+        close_connection(conn.handle);
+        return;
+    }
+    // ENOBUFS ends the receive while every provided buffer is taken, they are back after this reap
+    if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+        LOG(ERROR, "Read error for client {}: {}", index, uv_strerror(cqe.res));
+        close_connection(conn.handle);
+        return;
+    }
+    if (!uring_conns_[index].recv_armed && !client_conn_data_[index].read_paused && !handing_over_ &&
+        arm_recv(index) != 0) {
+        LOG(ERROR, "Failed to re-arm the receive of client {}", index);
+        close_connection(conn.handle);
+    }
+}
+
+void TcpConnectMgr::on_uring_send(const struct io_uring_cqe& cqe) {
+    int client_id = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+    int index = client_id_index(client_id);
+    UringConn& uring_conn = uring_conns_[index];
+    if (uring_conn.send_batch == nullptr || uring_conn.send_client_id != client_id) {
+        return;
+    }
+
+    SocketConnInfo& conn = client_sockconn_list_[index];
+    bool current = conn.client_id == client_id && conn.handle != nullptr;
+    int status = cqe.res < 0 ? cqe.res : (static_cast<size_t>(cqe.res) < uring_conn.send_remaining ? UV_ECANCELED : 0);
+
+    // A short send continues from the first byte the kernel did not take
+    if (current && cqe.res > 0 && status != 0 && !uv_is_closing((uv_handle_t*)conn.handle)) {
+        size_t sent = cqe.res;
+        uring_conn.send_remaining -= sent;
+        struct msghdr& msg = uring_conn.send_msg;
+        while (sent >= msg.msg_iov->iov_len) {
+            sent -= msg.msg_iov->iov_len;
+            ++msg.msg_iov;
+            --msg.msg_iovlen;
+        }
+        msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + sent;
+        msg.msg_iov->iov_len -= sent;
+        uv_os_fd_t fd;
+        if (uv_fileno((uv_handle_t*)conn.handle, &fd) == 0 &&
+            uring_->queue_sendmsg(fd, &msg, uring_user_data(URING_OP_SEND, client_id)) == 0) {
+            return;
+        }
+        LOG(ERROR, "Failed to continue the write to client {}", index);
+    }
+
+    WriteBuf* batch = uring_conn.send_batch;
+    uring_conn.send_batch = nullptr;
+    uring_conn.send_client_id = 0;
+    if (current) {
+        complete_send_batch(batch, conn.handle, status);
+        if (status < 0) {
+            close_connection(conn.handle);
+        }
+    } else if (conn.handle != nullptr && client_conn_data_[index].send_head != nullptr &&
+               !client_conn_data_[index].send_pending) {
+        // The next occupant of the slot waited for these iovecs
+        client_conn_data_[index].send_pending = true;
+        send_pending_list_.push_back(index);
+    }
+    write_pool_.release_chain(batch);
+}
+
+void TcpConnectMgr::feed_client_data(int index, const char* data, size_t len) {
+    uv_tcp_t* client = client_sockconn_list_[index].handle;
+    MirrorRing& ring = client_conn_data_[index].recv_ring;
+    for (size_t offset = 0; offset < len;) {
+        if (!ring.valid() && recv_pool_.acquire(ring, RECV_RING_CLASS_SIZE[0]) != 0) {
+            LOG(ERROR, "No receive ring for client {}", index);
+            close_connection(client);
+            return;
+        }
+        size_t chunk = std::min(ring.writable(), len - offset);
+        if (chunk == 0) {
+            // Only possible while handing over, when nothing is processed
+            LOG(ERROR, "Receive ring of client {} is full", index);
+            close_connection(client);
+            return;
+        }
+        memcpy(ring.write_ptr(), data + offset, chunk);
+        ring.commit(chunk);
+        offset += chunk;
+
+        // Bytes arriving during a handover are passed to the new process unprocessed
+        if (!handing_over_ && process_client_data((uv_stream_t*)client, chunk) != 0) {
+            return;
+        }
+    }
+    if (ring.valid() && ring.readable() == 0) {
+        recv_pool_.release(ring);
+    }
+}
+
+void TcpConnectMgr::close_connection(uv_tcp_t* client) {
+    uv_handle_t* handle = (uv_handle_t*)client;
+    if (handle == nullptr || uv_is_closing(handle)) {
+        return;
+    }
+
+    // Requests in the ring hold the socket open until they are cancelled, their completions are
+    // told apart from those of a later occupant of the slot by the client id
+    int index = get_index_for_client(client);
+    if (uring_ != nullptr && index >= 0) {
+        const UringConn& uring_conn = uring_conns_[index];
+        int client_id = client_sockconn_list_[index].client_id;
+        if (uring_conn.recv_armed) {
+            uring_->queue_cancel(uring_user_data(URING_OP_RECV, client_id), uring_user_data(URING_OP_CANCEL, client_id));
+        }
+        if (uring_conn.send_batch != nullptr && uring_conn.send_client_id == client_id) {
+            uring_->queue_cancel(uring_user_data(URING_OP_SEND, client_id), uring_user_data(URING_OP_CANCEL, client_id));
+        }
+    }
+    uv_close(handle, on_close);
+}
+
+void TcpConnectMgr::on_close(uv_handle_t* handle) {
+    TcpConnectMgr* mgr = static_cast<TcpConnectMgr*>(handle->loop->data);
+    int index = (int)(intptr_t)handle->data;
+    mgr->remove_connection((uv_tcp_t*)handle);
+    LOG(INFO, "Connection closed. Client index {}, Total connections: {}", index, mgr->cur_conn_num_);
+    free(handle);
+}
+
+void TcpConnectMgr::begin_handover() {
+    handing_over_ = true;
+    for (size_t index = 0; index < slot_generations_.size(); ++index) {
+        uv_tcp_t* client = client_sockconn_list_[index].handle;
+        if (client != nullptr && !uv_is_closing((uv_handle_t*)client)) {
+            pause_reading(static_cast<int>(index));
+        }
+    }
+    LOG(INFO, "Shard {} stopped reading for handover, {} connections", shard_id_, cur_conn_num_);
+}
+
+bool TcpConnectMgr::handover_drained() const {
+    for (size_t index = 0; index < slot_generations_.size(); ++index) {
+        if (client_sockconn_list_[index].handle == nullptr) {
+            continue;
+        }
+        // A receive being cancelled may still deliver bytes, they must land before the export
+        if (client_conn_data_[index].send_inflight || (uring_ != nullptr && uring_conns_[index].recv_armed)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TcpConnectMgr::export_connections(HandoverShard& shard) {
+    shard.shard_id = shard_id_;
+    for (size_t i = 0; i < slot_generations_.size(); ++i) {
+        int index = static_cast<int>(i);
+        SocketConnInfo& conn = client_sockconn_list_[index];
+        SocketConnData& conn_data = client_conn_data_[index];
+        if (conn.handle == nullptr || uv_is_closing((uv_handle_t*)conn.handle)) {
+            continue;
+        }
+
+        // How much of a batch still in flight reached the client is unknown, so it can't move
+        uv_os_fd_t fd;
+        int dup_fd = -1;
+        if (conn_data.send_inflight) {
+            LOG(ERROR, "Client {} still has a write in flight, closing it instead of handing over", index);
+        } else if (uv_fileno((uv_handle_t*)conn.handle, &fd) != 0 || (dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+            LOG(ERROR, "Failed to duplicate the socket of client {}: {}", index, strerror(errno));
+        }
+        if (dup_fd < 0) {
+            state_table_[index].client_id = 0;
+            close_connection(conn.handle);
+            continue;
+        }
+
+        HandoverConn handover_conn{index, dup_fd, std::string(), std::string(), md_subscriptions_.symbols_of(index)};
+        if (conn_data.recv_ring.valid() && conn_data.recv_ring.readable() > 0) {
+            handover_conn.recv_data.assign(conn_data.recv_ring.read_ptr(), conn_data.recv_ring.readable());
+        }
+        for (WriteBuf* buf = conn_data.send_head; buf != nullptr; buf = buf->next) {
+            handover_conn.send_data.append(buf->data, buf->len);
+        }
+        state_table_[index].recv_data_time = conn.recv_data_time;
+        state_table_[index].max_client_seq = conn_data.max_client_seq;
+        state_table_[index].send_seq = conn_data.send_seq;
+        shard.conns.push_back(std::move(handover_conn));
+
+        // Closing the handle closes only this process's descriptor, the duplicate keeps the connection open
+        close_connection(conn.handle);
+    }
+    LOG(INFO, "Shard {} exported {} connections", shard_id_, shard.conns.size());
+}
+
+int TcpConnectMgr::restore_connections(uv_loop_t* loop, HandoverShard& shard) {
+    int restored = 0;
+    for (HandoverConn& handover_conn : shard.conns) {
+        int index = handover_conn.index;
+        int fd = handover_conn.fd;
+        handover_conn.fd = -1;  // The handle or the error path below owns it now
+
+        const ConnStateRecord& record = state_table_[index];
+        while (static_cast<size_t>(index) >= slot_generations_.size() && grow_slots() == 0) {
+        }
+        if (static_cast<size_t>(index) >= slot_generations_.size() || record.client_id == 0 ||
+            client_id_index(record.client_id) != index || client_id_shard(record.client_id) != shard_id_ ||
+            client_sockconn_list_[index].handle != nullptr) {
+            LOG(ERROR, "No valid state record for handed over client {} of shard {}", index, shard_id_);
+            close(fd);
+            continue;
+        }
+
+        uv_tcp_t* client = (uv_tcp_t*)malloc(sizeof(uv_tcp_t));
+        if (uv_tcp_init(loop, client) != 0 || uv_tcp_open(client, fd) != 0) {
+            LOG(ERROR, "Failed to adopt the socket of client {}", index);
+            close(fd);
+            free(client);
+            continue;
+        }
+
+        // Same slot, same client id, so responses already in flight still reach the client
+        SocketConnInfo& conn = client_sockconn_list_[index];
+        SocketConnData& conn_data = client_conn_data_[index];
+        conn.handle = client;
+        conn.client_id = record.client_id;
+        conn.create_Time = record.create_time;
+        conn.recv_data_time = record.recv_data_time;
+        client->data = (void*)(intptr_t)index;
+        slot_generations_[index] = client_id_generation(record.client_id);
+        ++cur_conn_num_;
+
+        conn_data = SocketConnData();
+        conn_data.uin = record.uin;
+        conn_data.client_ip = record.client_ip;
+        conn_data.max_client_seq = record.max_client_seq;
+        conn_data.wire_format = record.wire_format < WIRE_FORMAT_NUM ? record.wire_format : static_cast<uint8_t>(WIRE_FORMAT_TCPCODE);
+        conn_data.send_seq = record.send_seq;
+        conn_data.order_bucket.init(conn_order_limit_, uv_now(loop));
+        if (conn_data.uin != 0) {
+            link_account(index);
+        }
+
+        // An incomplete request package goes back into a receive ring, the next read completes it
+        if (!handover_conn.recv_data.empty()) {
+            MirrorRing& ring = conn_data.recv_ring;
+            if (recv_pool_.acquire(ring, handover_conn.recv_data.size()) == 0) {
+                memcpy(ring.write_ptr(), handover_conn.recv_data.data(), handover_conn.recv_data.size());
+                ring.commit(handover_conn.recv_data.size());
+            } else {
+                LOG(ERROR, "No receive ring for the pending bytes of client {}", index);
+            }
+        }
+
+        // Unsent packages are queued again, in pieces no larger than the biggest send buffer
+        const std::string& send_data = handover_conn.send_data;
+        for (size_t offset = 0; offset < send_data.size() && conn.handle != nullptr;) {
+            int len = static_cast<int>(std::min(send_data.size() - offset, static_cast<size_t>(MAX_CSPKG_LEN)));
+            char* space = reserve_send_space(index, len);
+            if (space == nullptr) {
+                break;
+            }
+            memcpy(space, send_data.data() + offset, len);
+            commit_send_space(index, len);
+            offset += len;
+        }
+
+        // Market data subscriptions carry over, updates conflated for a slow client are not
+        const std::string& symbols = handover_conn.md_symbols;
+        for (size_t begin = 0, end; begin < symbols.size(); begin = end + 1) {
+            end = symbols.find('\n', begin);
+            if (end == std::string::npos) {
+                end = symbols.size();
+            }
+            md_subscriptions_.subscribe(index, symbols.substr(begin, end - begin));
+        }
+
+        if (start_connection(client, index) == 0) {
+            ++restored;
+        }
+    }
+
+    // Slots taken above must not be handed out again
+    free_slots_.clear();
+    for (size_t i = slot_generations_.size(); i > 0; --i) {
+        if (client_sockconn_list_[i - 1].handle == nullptr) {
+            free_slots_.push_back(static_cast<int>(i - 1));
+        }
+    }
+
+    LOG(INFO, "Shard {} restored {} of {} handed over connections", shard_id_, restored, shard.conns.size());
+    return restored;
+}
+
+void TcpConnectMgr::check_timeout() {
+    // Statistics are rolled up across shards by TcpServer on its own timer
+    time_t current_time = time(NULL);
+    timeout_wheel_.advance(current_time, [this, current_time](int index) {
+        on_idle_timer(index, current_time);
+    });
+}
+
+void TcpConnectMgr::expire_orders(uint64_t now_ms) {
+    inflight_orders_.expire(now_ms, [this](const InflightOrder& order) {
+        stats_manager_.increment_orders_timed_out();
+        uv_tcp_t* client = get_client_by_id(order.client_id);
+        if (client == nullptr) {
+            return;  // Closed since, nobody is waiting
+        }
+        LOG(ERROR, "Order {} of client {} got no response in time, rejecting it", order.order_id, order.client_id);
+
+        // The order server may still act on the order, a late response is forwarded as it is
+        cs_proto::OrderResponse response;
+        response.set_order_id(order.order_id);
+        response.set_status(cs_proto::REJECTED);
+        response.set_message("Timed out waiting for the order server");
+        response.set_client_id(order.client_id);
+        response.set_client_seq(order.client_seq);
+        send_order_ack(client, response);
+    });
+}
+
+void TcpConnectMgr::match_order_response(const cs_proto::OrderResponse& response) {
+    if (!inflight_orders_.enabled()) {
+        return;
+    }
+    uint64_t submit_ns = 0;
+    if (inflight_orders_.complete(response.client_id(), response.order_id(), submit_ns)) {
+        stats_manager_.record_latency(LATENCY_ORDER_RESPONSE, latency_now_ns() - submit_ns);
+    } else {
+        stats_manager_.increment_order_responses_unmatched();
+        LOG(DEBUG, "Response to order {} of client {} matches no order in flight",
+            response.order_id(), response.client_id());
+    }
+}
+
+void TcpConnectMgr::on_idle_timer(int index, time_t now) {
+    SocketConnInfo& conn = client_sockconn_list_[index];
+    if (conn.handle == nullptr) {
+        return;
+    }
+
+    time_t last_activity = std::max(conn.create_Time, conn.recv_data_time);
+    if (now - last_activity > CLIENT_TIMEOUT) {
+        LOG(INFO, "Client {} timed out", index);
+        close_connection(conn.handle);
+    } else {
+        timeout_wheel_.schedule(index, last_activity + CLIENT_TIMEOUT + 1);
+    }
+}
@@ -1,181 +1,561 @@
-/*************************************************************************
- * @file   tcp_connect_mgr.h
- * @brief  TCP connection manager class declaration
- * @author stanjiang
- * @date   2024-07-17
- * @copyright
-***/
-
-#ifndef _TRADING_PLATFORM_COMMON_TCP_CONNECT_MGR_H_
-#define _TRADING_PLATFORM_COMMON_TCP_CONNECT_MGR_H_
-
-#include <uv.h>
-#include <unordered_map>
-#include <vector>
-#include <string>
-#include <chrono>
-#include <atomic>
-#include "tcp_comm.h"
-#include "role.pb.h"
-#include "futures_order.pb.h"
-
-// Class to manage and log statistics for the TCP connection manager
-class StatisticsManager {
-public:
-    StatisticsManager();
-
-    void increment_sent_packages();
-    void increment_received_packages();
-    void increment_active_connections();
-    void decrement_active_connections();
-    void update_connection_time(double time_ms);
-    void update_processing_time(double time_ms);
-
-    void reset();
-    void log_statistics();
-
-private:
-    std::atomic<uint64_t> sent_packages_;
-    std::atomic<uint64_t> received_packages_;
-    std::atomic<uint64_t> active_connections_;
-    std::atomic<uint64_t> total_connections_;
-    std::atomic<double> total_connection_time_;
-    std::atomic<double> total_processing_time_;
-    std::chrono::steady_clock::time_point last_reset_time_;
-
-    // Helper function to calculate rate
-    double calculate_rate(uint64_t count, double elapsed_seconds) const;
-};
-
-// Main TCP connection manager class
-class TcpConnectMgr {
-public:
-    TcpConnectMgr();
-    ~TcpConnectMgr();
-
-    // Create an instance of TcpConnectMgr
-    static TcpConnectMgr* create_instance();
-
-    // Calculate the size needed for the connection manager
-    static int count_size();
-
-    // Overload new operator to allocate memory in shared memory
-    static void* operator new(size_t size);
-
-    // Overload delete operator to free memory in shared memory
-    static void operator delete(void* mem);
-
-    // Initialize the TCP connection manager
-    int init();
-
-    // Handle a new connection
-    void handle_new_connection(uv_tcp_t* client);
-
-    // Process received client data
-    int process_client_data(uv_stream_t* client, ssize_t nread);
-
-    // Check for data waiting to be sent
-    void check_wait_send_data();
-
-    // Check for timed-out connections
-    void check_timeout();
-
-    // Get the index for a given client handle
-    int get_index_for_client(uv_tcp_t* client);
-
-    // Get the client handle for a given index
-    uv_tcp_t* get_client_by_index(int index);
-
-    // Get the client handle for a given account
-    uv_tcp_t* get_client_by_account(uint32_t account);
-
-    // Remove a client connection
-    void remove_connection(uv_tcp_t* client);
-
-    // Get the current number of connections
-    size_t get_connection_count() const;
-
-    // Static callback for reading data from a client
-    static void on_read(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf);
-
-    // Static callback for allocating buffer for reading
-    static void alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
-
-    // Static callback for write completion
-    static void on_write(uv_write_t* req, int status);
-
-    // Send data to a client
-    static int tcp_send_data(uv_stream_t* client, const char* databuf, int len);
-
-    // Get the statistics manager
-    StatisticsManager& get_statistics_manager() { return stats_manager_; }
-
-private:
-    // Handle login request
-    void handle_login_request(uv_stream_t* client, const cspkg::AccountLoginReq& login_req, int client_index);
-
-    // Handle futures order
-    void handle_futures_order(uv_stream_t* client, const cs_proto::FuturesOrder& order, int client_index);
-
-    // Add a new client connection
-    int add_new_connection(uv_tcp_t* client);
-
-    static char* current_shmptr_;  // Pointer to the shared memory
-
-    char send_client_buf_[SOCK_SEND_BUFFER];  // Buffer for sending messages to clients
-    int cur_conn_num_;   // Current number of connections
-    time_t laststat_time_;   // Last statistics time
-
-    // Map to store client handle to index mapping
-    std::unordered_map<uv_tcp_t*, int> client_to_index_;
-    // Map to store account to index mapping
-    std::unordered_map<uint32_t, int> account_to_index_;
-    // Vector to store client connection information
-    std::vector<SocketConnInfo> client_sockconn_list_;
-    // Next available index for new connections
-    int next_index_;
-    // Kafka topic for gateway to order messages
-    std::string gateway_to_order_topic_;
-
-    // Statistics manager
-    StatisticsManager stats_manager_;
-};
-
-// Implementation of inline methods
-
-inline int TcpConnectMgr::get_index_for_client(uv_tcp_t* client) {
-    auto it = client_to_index_.find(client);
-    return (it != client_to_index_.end()) ? it->second : -1;
-}
-
-inline uv_tcp_t* TcpConnectMgr::get_client_by_index(int index) {
-    if (index >= 0 && index < MAX_SOCKET_NUM) {
-        return client_sockconn_list_[index].handle;
-    }
-    return nullptr;
-}
-
-inline void TcpConnectMgr::remove_connection(uv_tcp_t* client) {
-    auto it = client_to_index_.find(client);
-    if (it != client_to_index_.end()) {
-        client_sockconn_list_[it->second] = SocketConnInfo();  // Reset the slot
-        client_to_index_.erase(it);
-        --cur_conn_num_;
-        stats_manager_.decrement_active_connections();
-    }
-}
-
-inline size_t TcpConnectMgr::get_connection_count() const {
-    return cur_conn_num_;
-}
-
-inline uv_tcp_t* TcpConnectMgr::get_client_by_account(uint32_t account) {
-    auto it = account_to_index_.find(account);
-    if (it != account_to_index_.end()) {
-        int index = it->second;
-        return client_sockconn_list_[index].handle;
-    }
-    return nullptr;
-}
-
+/*************************************************************************
+ * @file   tcp_connect_mgr.h
+ * @brief  TCP connection manager class declaration
+ * @author stanjiang
+ * @date   2024-07-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_TCP_CONNECT_MGR_H_
+#define _TRADING_PLATFORM_COMMON_TCP_CONNECT_MGR_H_
+
+#include <uv.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include "tcp_comm.h"
+#include "write_buf_pool.h"
+#include "timer_wheel.h"
+#include "recv_ring_pool.h"
+#include "chunked_table.h"
+#include "flat_hash_map.h"
+#include "conn_state_table.h"
+#include "fd_handover.h"
+#include "md_subscriptions.h"
+#include "msg_registry.h"
+#include "uring_io.h"
+#include "latency_histogram.h"
+#include "inflight_orders.h"
+#include "decode_arena.h"
+#include "role.pb.h"
+#include "futures_order.pb.h"
+
+// Limit that rejected an order at admission
+enum OrderRejectScope {
+    ORDER_REJECT_CONNECTION = 0,
+    ORDER_REJECT_ACCOUNT = 1,
+    ORDER_REJECT_GLOBAL = 2,
+    ORDER_REJECT_INGRESS = 3,  // Ingress stage full, answered BUSY
+    ORDER_REJECT_SCOPE_NUM
+};
+
+// Pipeline stages with a latency histogram
+enum LatencyStage {
+    LATENCY_ACCEPT = 0,          // Accept callback until the first read is armed
+    LATENCY_RECV_DECODE = 1,     // Read completion until a frame of it is decoded
+    LATENCY_DECODE_ENQUEUE = 2,  // Decode until the Kafka batch holding the request is produced
+    LATENCY_RESPONSE_WRITE = 3,  // Package queued until the write carrying it completes
+    LATENCY_ORDER_RESPONSE = 4,  // Order decoded until its response arrives from the order server
+    LATENCY_STAGE_NUM
+};
+
+// Point-in-time copy of the statistics counters, used for cross-shard rollups
+struct StatisticsSnapshot {
+    uint64_t sent_packages;
+    uint64_t received_packages;
+    uint64_t sent_bytes;
+    uint64_t received_bytes;
+    uint64_t active_connections;
+    uint64_t total_connections;
+    uint64_t send_queue_bytes;
+    uint64_t max_send_queue_bytes;
+    uint64_t write_calls;
+    uint64_t slow_consumer_disconnects;
+    uint64_t orders_admitted;
+    uint64_t orders_rejected[ORDER_REJECT_SCOPE_NUM];
+    uint64_t orders_duplicate;
+    uint64_t orders_timed_out;
+    uint64_t orders_untracked;
+    uint64_t order_responses_unmatched;
+    uint64_t ingress_pauses;
+    uint64_t order_ack_batches;
+    uint64_t order_acks_batched;
+    uint64_t loop_iterations;
+    uint64_t loop_iteration_ns;
+    uint64_t max_loop_iteration_ns;
+    uint64_t md_updates;
+    uint64_t md_queued;
+    uint64_t md_conflated;
+    LatencyCounts latency[LATENCY_STAGE_NUM];  // Recorded since startup
+    double elapsed_seconds;
+
+    // Add the counters of another snapshot, keeping the larger maximums and elapsed time
+    void merge(const StatisticsSnapshot& other);
+
+    // Keep only what was counted after an earlier snapshot of the same shard. Gauges keep their
+    // current value, total_connections becomes the connections open at base plus those accepted since
+    void subtract(const StatisticsSnapshot& base);
+};
+
+// Class to manage and log statistics for the TCP connection manager
+class StatisticsManager {
+public:
+    StatisticsManager();
+
+    void increment_sent_packages(uint64_t count = 1);
+    void increment_received_packages();
+    void add_sent_bytes(uint64_t bytes);
+    void add_received_bytes(uint64_t bytes);
+    void increment_active_connections();
+    void decrement_active_connections();
+
+    // Latency of one pass through a pipeline stage, only called from the reactor thread
+    void record_latency(LatencyStage stage, uint64_t ns) { latency_[stage].record(ns); }
+
+    // Send queue accounting
+    void add_send_queue_bytes(int64_t delta, uint64_t conn_queue_bytes);
+    void increment_write_calls();
+    void increment_slow_consumer_disconnects();
+
+    // Order admission accounting
+    void increment_orders_admitted();
+    void increment_orders_rejected(OrderRejectScope scope);
+    void increment_orders_duplicate();
+
+    // In-flight order tracking
+    void increment_orders_timed_out();
+    void increment_orders_untracked();
+    void increment_order_responses_unmatched();
+
+    // One connection paused while the ingress stage was full
+    void increment_ingress_pauses();
+
+    // One OrderResponseBatch frame carrying acks responses
+    void record_order_ack_batch(uint64_t acks);
+
+    // Duration of one busy-poll loop iteration
+    void record_loop_iteration(uint64_t ns);
+
+    // One market data update queued on queued subscribers, replacing conflated pending updates
+    void record_md_broadcast(uint64_t queued, uint64_t conflated);
+
+    void log_statistics();
+
+    // Take a snapshot of the counters since startup, with the maximums of the current interval.
+    // Counters are never reset under the reactor, readers subtract an earlier snapshot instead
+    StatisticsSnapshot snapshot() const;
+
+    // Take a snapshot and start a new interval for the maximums
+    StatisticsSnapshot end_interval();
+
+    // Log p50, p99, p99.9 and max of every stage
+    static void log_latency(const LatencyCounts (&latency)[LATENCY_STAGE_NUM]);
+
+private:
+    std::atomic<uint64_t> sent_packages_;
+    std::atomic<uint64_t> received_packages_;
+    std::atomic<uint64_t> sent_bytes_;              // Bytes written to clients
+    std::atomic<uint64_t> received_bytes_;          // Bytes read from clients
+    std::atomic<uint64_t> active_connections_;
+    std::atomic<uint64_t> total_connections_;
+    std::atomic<int64_t> send_queue_bytes_;         // Bytes queued on all connections
+    std::atomic<uint64_t> max_send_queue_bytes_;    // Deepest single connection queue in the interval
+    std::atomic<uint64_t> write_calls_;             // Batched writes issued
+    std::atomic<uint64_t> slow_consumer_disconnects_;
+    std::atomic<uint64_t> orders_admitted_;         // Orders forwarded to Kafka
+    std::atomic<uint64_t> orders_rejected_[ORDER_REJECT_SCOPE_NUM];  // Orders rejected locally, by limit
+    std::atomic<uint64_t> orders_duplicate_;        // Orders dropped for a client_seq already seen
+    std::atomic<uint64_t> orders_timed_out_;        // Orders rejected by the gateway for a missing response
+    std::atomic<uint64_t> orders_untracked_;        // Orders forwarded without a timeout, the table was full
+    std::atomic<uint64_t> order_responses_unmatched_;  // Responses to orders not in flight, late ones included
+    std::atomic<uint64_t> ingress_pauses_;          // Connections paused while the ingress stage was full
+    std::atomic<uint64_t> order_ack_batches_;       // OrderResponseBatch frames sent
+    std::atomic<uint64_t> order_acks_batched_;      // Responses inside them
+    std::atomic<uint64_t> loop_iterations_;         // Busy-poll loop iterations
+    std::atomic<uint64_t> loop_iteration_ns_;       // Time spent in them
+    std::atomic<uint64_t> max_loop_iteration_ns_;   // Slowest iteration in the interval
+    std::atomic<uint64_t> md_updates_;              // Market data updates broadcast
+    std::atomic<uint64_t> md_queued_;               // Updates queued on subscribers
+    std::atomic<uint64_t> md_conflated_;            // Pending updates replaced by a newer one
+    LatencyHistogram latency_[LATENCY_STAGE_NUM];   // Cumulative, never reset under the writer
+    std::chrono::steady_clock::time_point start_time_;
+
+    // Helper function to calculate rate
+    double calculate_rate(uint64_t count, double elapsed_seconds) const;
+};
+
+// Main TCP connection manager class
+class TcpConnectMgr {
+public:
+    TcpConnectMgr();
+    ~TcpConnectMgr();
+
+    // Create an instance of TcpConnectMgr for a reactor shard. It lives on the heap of this
+    // process, only the connection state table is kept in shared memory
+    static TcpConnectMgr* create_instance(int shard_id);
+
+    // Initialize the TCP connection manager with room for up to max_connections clients.
+    // With resume the connection state table of the previous gateway process is kept
+    int init(int shard_id, int max_connections, bool resume = false);
+
+    // Set up the IO backend chosen by GATEWAY_IO_BACKEND on the loop, before any connection starts.
+    // io_uring falls back to libuv if the kernel refuses it
+    int init_io(uv_loop_t* loop);
+
+    // Hand the IO queued during this loop iteration to the kernel, called after check_wait_send_data()
+    void submit_io();
+
+    // Handle a new connection
+    void handle_new_connection(uv_tcp_t* client);
+
+    // Process received client data
+    int process_client_data(uv_stream_t* client, ssize_t nread);
+
+    // Flush queued packages, one batched write per connection, called once per loop iteration
+    void check_wait_send_data();
+
+    // Answer an order. Responses to sequenced orders are held until flush_order_acks(), which
+    // combines those of one connection into one OrderResponseBatch. Others are sent right away
+    void send_order_ack(uv_tcp_t* client, const cs_proto::OrderResponse& response);
+
+    // Send the held order responses, called once per loop iteration before check_wait_send_data()
+    void flush_order_acks();
+
+    // Record the decode to Kafka latency of the requests queued this iteration, called after
+    // KafkaManager::flush_batches() produced them
+    void record_kafka_produced();
+
+    // Resume the connections paused for a full ingress stage once it drained to half, called
+    // after KafkaManager::flush_batches() polled the delivery reports
+    void check_ingress();
+
+    // Copy the gauges read by other threads into atomics, called once per loop iteration
+    void publish_gauges();
+
+    // Connections paused for a full ingress stage, as of the last publish_gauges()
+    uint64_t ingress_paused_count() const { return ingress_paused_gauge_.load(std::memory_order_relaxed); }
+
+    // Close connections whose idle timer expired, called every TIMEOUT_WHEEL_TICK_MS
+    void check_timeout();
+
+    // Reject the orders whose response did not arrive in time, called every ORDER_TIMEOUT_TICK_MS
+    // with the loop time in ms
+    void expire_orders(uint64_t now_ms);
+
+    // Match a response of the order server with the order waiting for it, before it is sent on
+    void match_order_response(const cs_proto::OrderResponse& response);
+
+    // Orders waiting for their response, as of the last publish_gauges()
+    uint64_t inflight_order_count() const { return inflight_gauge_.load(std::memory_order_relaxed); }
+
+    // Get the index for a given client handle
+    int get_index_for_client(uv_tcp_t* client);
+
+    // Get the client handle for a given client id, nullptr if the slot was released since the id was issued
+    uv_tcp_t* get_client_by_id(int client_id);
+
+    // Get the client handle for a given account
+    uv_tcp_t* get_client_by_account(uint32_t account);
+
+    // Remove a client connection
+    void remove_connection(uv_tcp_t* client);
+
+    // Get the current number of connections
+    size_t get_connection_count() const;
+
+    // Static callback for reading data from a client
+    static void on_read(uv_stream_t* client, ssize_t nread, const uv_buf_t* buf);
+
+    // Static callback for allocating buffer for reading
+    static void alloc_buffer(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
+
+    // Static callback for write completion
+    static void on_write(uv_write_t* req, int status);
+
+    // Queue data for a client, it is written by the next check_wait_send_data()
+    static int tcp_send_data(uv_stream_t* client, const char* databuf, int len);
+
+    // Encode a message straight into the send queue of a client, no intermediate copy
+    static int tcp_send_message(uv_stream_t* client, const google::protobuf::Message& message);
+
+    // Queue an encoded market data package on every subscriber of a symbol, without copying it,
+    // in the framing of each subscriber. Subscribers with a deep send queue keep only the latest
+    // update per symbol and message type until it drains. Returns the number of subscribers it was queued on
+    int broadcast(const std::string& symbol, MsgId msg_id, const SharedFrames& frames);
+
+    // Close a client connection and release its slot once the handle is closed
+    void close_connection(uv_tcp_t* client);
+
+    // Get the statistics manager
+    StatisticsManager& get_statistics_manager() { return stats_manager_; }
+
+    // Get the reactor shard this manager belongs to
+    int get_shard_id() const { return shard_id_; }
+
+    // Get the pool backing the send queues
+    const WriteBufPool& get_write_pool() const { return write_pool_; }
+
+    // Get the pool backing the receive rings
+    const RecvRingPool& get_recv_pool() const { return recv_pool_; }
+
+    // Get the arena requests are decoded on
+    const DecodeArena& get_decode_arena() const { return decode_arena_; }
+
+    // Hot upgrade, old process: stop reading from every client so nothing more is queued
+    void begin_handover();
+
+    // Whether no batched write is in flight, so every queued byte can be handed over
+    bool handover_drained() const;
+
+    // Hot upgrade, old process: duplicate the client sockets into shard, together with their
+    // unprocessed and unsent bytes, then close the connections without touching their state records
+    void export_connections(HandoverShard& shard);
+
+    // Hot upgrade, new process: adopt the sockets of the previous process into their old slots
+    int restore_connections(uv_loop_t* loop, HandoverShard& shard);
+
+private:
+    // Handle login request
+    void handle_login_request(const cspkg::AccountLoginReq& login_req, uv_stream_t* client, int client_index);
+
+    // Handle futures order
+    void handle_futures_order(const cs_proto::FuturesOrder& order, uv_stream_t* client, int client_index);
+
+    // Handle market data subscription changes
+    void handle_md_subscribe(const cs_proto::MarketDataSubscribe& req, uv_stream_t* client, int client_index);
+
+    // Route the account of a logged in connection to it, older sessions stay linked behind it
+    void link_account(int index);
+
+    // Drop a connection from the sessions of its account. With the last one the account
+    // loses its route and its order bucket
+    void unlink_account(int index);
+
+    // Take an order token from the connection, account and global buckets, or none of them
+    bool admit_order(int index, uint64_t now_ms, OrderRejectScope& scope);
+
+    // Answer an order that was not admitted without going through Kafka
+    void reject_order(const cs_proto::FuturesOrder& order, uv_stream_t* client, int client_index, OrderRejectScope scope);
+
+    // Pause a connection that had an order shed, if it queued more than its share of the ingress stage
+    void pause_heavy_sender(int index);
+
+    // Send held responses pending_acks_[begin, end) of one connection
+    void send_ack_batch(size_t begin, size_t end);
+
+    // Take a free slot for a new client connection
+    int add_new_connection(uv_tcp_t* client);
+
+    // Add a chunk of free slots, -1 once the capacity is reached
+    int grow_slots();
+
+    // Get room for a package of len bytes at the end of the send queue of a connection
+    char* reserve_send_space(int index, int len);
+
+    // Account for a package written into the space returned by reserve_send_space()
+    void commit_send_space(int index, int len);
+
+    // Account for len bytes appended to the send queue of a connection
+    void queue_send_bytes(int index, int len);
+
+    // Append a reference to a shared package to the send queue of a connection
+    bool queue_shared(int index, SharedBuf* buf);
+
+    // Queue the conflated market data of a connection whose send queue drained
+    void flush_conflated(int index);
+
+    // Issue one batched write for the queued buffers of a connection
+    void flush_send_queue(int index);
+
+    // Account for a finished batched write and return its buffers to the pool
+    void complete_send_batch(WriteBuf* batch, uv_tcp_t* client, int status);
+
+    // Close an idle connection, or re-arm its timer if it received data since the timer was armed
+    void on_idle_timer(int index, time_t now);
+
+    // Socket options, idle timer and first read of a connection placed in its slot
+    int start_connection(uv_tcp_t* client, int index);
+
+    // Stop and restart taking requests from a connection, through whichever backend reads it
+    void pause_reading(int index);
+    void resume_reading(int index);
+
+    // Add and remove a reason to stop reading from a connection, reading stops with the first
+    // and resumes with the last. clear_read_pause() returns whether reading resumed
+    void set_read_pause(int index, ReadPauseReason reason);
+    bool clear_read_pause(int index, ReadPauseReason reason);
+
+    // io_uring backend: arm the multishot receive of a connection, returns a libuv error code
+    int arm_recv(int index);
+
+    // io_uring backend: queue a sendmsg for a detached batch, returns a libuv error code
+    int queue_uring_send(int index, WriteBuf* batch);
+
+    // io_uring backend: handle every waiting completion
+    static void on_uring_ready(uv_poll_t* handle, int status, int events);
+    void on_uring_recv(const struct io_uring_cqe& cqe);
+    void on_uring_send(const struct io_uring_cqe& cqe);
+
+    // io_uring backend: copy received bytes into the receive ring of a connection and process them
+    void feed_client_data(int index, const char* data, size_t len);
+
+    // Static callback for closed client handles
+    static void on_close(uv_handle_t* handle);
+
+    char send_client_buf_[SOCK_SEND_BUFFER];  // Buffer for sending messages to clients
+    int shard_id_;       // Reactor shard owning this manager
+    int cur_conn_num_;   // Current number of connections
+    time_t laststat_time_;   // Last statistics time
+
+    // Account to slot index of its latest logged in connection, sized with the connection table.
+    // The other sessions of the account are linked from it, so closing one reroutes to the next
+    FlatHashMap<uint32_t, int> account_to_index_;
+    std::vector<int> account_prev_;  // Previous session of the same account, -1 for the routed one
+    std::vector<int> account_next_;  // Next older session of the same account, -1 for the last
+    // Table to store client connection information, routing and timeout fields only
+    ChunkedTable<SocketConnInfo> client_sockconn_list_;
+    // IO and session state of each connection, same index as client_sockconn_list_
+    ChunkedTable<SocketConnData> client_conn_data_;
+    // Upper bound of slots in the tables
+    int max_connections_;
+    // Stack of free slot indexes, the client handle keeps its index in handle->data
+    std::vector<int> free_slots_;
+    // Generation of each slot, bumped when the slot is released
+    std::vector<UCHAR> slot_generations_;
+    // Identity of every slot in shared memory, read back by the next process on hot upgrade
+    ConnStateTable state_table_;
+    // Connections are being handed over, closing them must keep their state records
+    bool handing_over_;
+    // Market data subscribers and the conflated updates of slow ones
+    MdSubscriptions md_subscriptions_;
+    std::vector<MdConflated> md_scratch_;
+    // Send queue bytes above which market data is conflated instead of queued
+    size_t md_conflate_bytes_;
+    // Idle timers keyed by slot index, in seconds
+    TimerWheel timeout_wheel_;
+    // Kafka topic for gateway to order messages
+    std::string gateway_to_order_topic_;
+    // Handlers of client requests by message id
+    MsgDispatcher<TcpConnectMgr, uv_stream_t*, int> client_dispatcher_;
+
+    // Order response held for the batch of its connection
+    struct PendingAck {
+        int index;
+        int client_id;  // Client the response was for, the slot may have been reused since
+        cs_proto::OrderResponse response;
+    };
+    std::vector<PendingAck> pending_acks_;
+    cs_proto::OrderResponseBatch ack_batch_;
+
+    // Requests decoded from one read, released when the next read is processed
+    DecodeArena decode_arena_;
+
+    // Decode time of the frame being dispatched, and of the requests waiting in a Kafka batch
+    uint64_t decoded_ns_;
+    std::vector<uint64_t> kafka_queued_ns_;
+
+    // Connections with queued packages, and the list being flushed
+    std::vector<int> send_pending_list_;
+    std::vector<int> send_flush_list_;
+    // Scratch buffers for batched writes
+    std::vector<uv_buf_t> send_iov_;
+
+    // Per-connection state of the io_uring backend, same index as client_conn_data_
+    struct UringConn {
+        bool recv_armed;        // A multishot receive of the occupant is live in the kernel
+        int send_client_id;     // Client whose batch is in flight, the slot may have been reused since
+        WriteBuf* send_batch;   // Batch in flight, returned to the pool on its completion
+        size_t send_remaining;  // Bytes of the batch not sent yet
+        struct msghdr send_msg; // The kernel reads the header and its iovecs until the completion
+        std::vector<struct iovec> send_iov;
+    };
+    // io_uring ring of this shard, null while connections are read and written through libuv
+    std::unique_ptr<UringIo> uring_;
+    uv_poll_t uring_poll_;
+    ChunkedTable<UringConn> uring_conns_;
+
+    // Send buffers and their write requests
+    WriteBufPool write_pool_;
+    // Receive rings, held by a connection only while it has unprocessed bytes
+    RecvRingPool recv_pool_;
+    // Send queue water marks in bytes
+    size_t send_high_water_;
+    size_t send_low_water_;
+    size_t send_queue_limit_;
+    // Bytes one connection may hold in its receive ring and send queue
+    size_t conn_memory_budget_;
+    // SO_BUSY_POLL of accepted sockets in microseconds, 0 unless the gateway runs in busy-poll mode
+    int busy_poll_us_;
+    // Order admission limits, an account bucket lives while the account has a logged in session
+    TokenBucketConfig conn_order_limit_;
+    TokenBucketConfig account_order_limit_;
+    FlatHashMap<ULONG, TokenBucket> account_order_buckets_;
+    TokenBucket global_order_bucket_;
+    // Orders forwarded to Kafka and waiting for their response
+    InflightOrders inflight_orders_;
+    // Bound of the ingress stage in messages, 0 when unbounded, and the depth reading resumes at
+    int64_t ingress_depth_limit_;
+    int64_t ingress_resume_depth_;
+    // Bumped whenever the ingress stage drains, per-connection order counts start over
+    UINT ingress_epoch_;
+    // Client ids of the connections paused for a full ingress stage
+    std::vector<int> ingress_paused_;
+    // Sizes of the containers above, published for the metrics scrape on the main thread
+    std::atomic<uint64_t> inflight_gauge_;
+    std::atomic<uint64_t> ingress_paused_gauge_;
+
+    // Statistics manager
+    StatisticsManager stats_manager_;
+};
+
+// Implementation of inline methods
+
+inline int TcpConnectMgr::get_index_for_client(uv_tcp_t* client) {
+    int index = (int)(intptr_t)client->data;
+    if (index >= 0 && static_cast<size_t>(index) < slot_generations_.size() &&
+        client_sockconn_list_[index].handle == client) {
+        return index;
+    }
+    return -1;
+}
+
+inline uv_tcp_t* TcpConnectMgr::get_client_by_id(int client_id) {
+    int index = client_id_index(client_id);
+    if (client_id_shard(client_id) == shard_id_ && static_cast<size_t>(index) < slot_generations_.size() &&
+        client_sockconn_list_[index].client_id == client_id) {
+        return client_sockconn_list_[index].handle;
+    }
+    return nullptr;
+}
+
+inline void TcpConnectMgr::remove_connection(uv_tcp_t* client) {
+    int index = get_index_for_client(client);
+    if (index < 0) {
+        return;
+    }
+
+    SocketConnData& conn_data = client_conn_data_[index];
+    stats_manager_.add_send_queue_bytes(-static_cast<int64_t>(conn_data.send_queue_bytes), 0);
+    // Buffers of a write still in flight are returned by on_write
+    write_pool_.release_chain(conn_data.send_head);
+    recv_pool_.release(conn_data.recv_ring);
+    md_subscriptions_.remove(index);
+    timeout_wheel_.cancel(index);
+    unlink_account(index);
+    conn_data = SocketConnData();  // Reset the slot
+    client_sockconn_list_[index] = SocketConnInfo();
+
+    // A new generation invalidates client ids issued for this occupant
+    slot_generations_[index] = (slot_generations_[index] + 1) & CLIENT_ID_GEN_MASK;
+    if (!handing_over_) {
+        ConnStateRecord& record = state_table_[index];
+        record = ConnStateRecord();
+        record.generation = slot_generations_[index];
+    }
+    free_slots_.push_back(index);
+    --cur_conn_num_;
+    stats_manager_.decrement_active_connections();
+}
+
+inline size_t TcpConnectMgr::get_connection_count() const {
+    return cur_conn_num_;
+}
+
+inline uv_tcp_t* TcpConnectMgr::get_client_by_account(uint32_t account) {
+    const int* index = account_to_index_.find(account);
+    return index != nullptr ? client_sockconn_list_[*index].handle : nullptr;
+}
+
 #endif // _TRADING_PLATFORM_COMMON_TCP_CONNECT_MGR_H_
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "timer_wheel.h"
+#include <algorithm>
+#include "logger.h"
+
+TimerWheel::TimerWheel() : slot_mask_(0), current_tick_(0), size_(0) {}
+
+int TimerWheel::init(int key_num, int slot_num, uint64_t now_tick) {
+    if (key_num <= 0 || slot_num <= 0) {
+        LOG(ERROR, "Invalid timer wheel size, keys: {}, slots: {}", key_num, slot_num);
+        return -1;
+    }
+
+    size_t slots = 1;
+    while (slots < static_cast<size_t>(slot_num)) {
+        slots <<= 1;
+    }
+
+    nodes_.assign(key_num, Node{-1, -1, -1, 0});
+    slots_.assign(slots, -1);
+    slot_mask_ = slots - 1;
+    current_tick_ = now_tick;
+    size_ = 0;
+    return 0;
+}
+
+void TimerWheel::resize(int key_num) {
+    if (static_cast<size_t>(key_num) > nodes_.size()) {
+        nodes_.resize(key_num, Node{-1, -1, -1, 0});
+    }
+}
+
+void TimerWheel::schedule(int key, uint64_t expire_tick) {
+    if (nodes_[key].slot >= 0) {
+        unlink(key);
+    }
+    // A timer already due fires on the next advance()
+    if (expire_tick <= current_tick_) {
+        expire_tick = current_tick_ + 1;
+    }
+    nodes_[key].expire_tick = expire_tick;
+    link(key, static_cast<int>(expire_tick & slot_mask_));
+}
+
+void TimerWheel::cancel(int key) {
+    if (nodes_[key].slot >= 0) {
+        unlink(key);
+    }
+}
+
+void TimerWheel::advance(uint64_t now_tick, const ExpireCallback& callback) {
+    if (now_tick <= current_tick_) {
+        return;
+    }
+
+    // After a full revolution every slot has been visited, later ticks add nothing
+    uint64_t ticks = std::min<uint64_t>(now_tick - current_tick_, slot_mask_ + 1);
+    uint64_t first_tick = now_tick - ticks + 1;
+    current_tick_ = now_tick;
+
+    for (uint64_t tick = first_tick; tick <= now_tick; ++tick) {
+        int slot = static_cast<int>(tick & slot_mask_);
+
+        // Detach the slot so callbacks can reschedule into it safely
+        int key = slots_[slot];
+        slots_[slot] = -1;
+        while (key >= 0) {
+            Node& node = nodes_[key];
+            int next = node.next;
+            node.prev = -1;
+            node.next = -1;
+            node.slot = -1;
+            --size_;
+            if (node.expire_tick <= now_tick) {
+                callback(key);
+            } else {
+                link(key, slot);  // Due in a later revolution
+            }
+            key = next;
+        }
+    }
+}
+
+void TimerWheel::link(int key, int slot) {
+    Node& node = nodes_[key];
+    node.slot = slot;
+    node.prev = -1;
+    node.next = slots_[slot];
+    if (node.next >= 0) {
+        nodes_[node.next].prev = key;
+    }
+    slots_[slot] = key;
+    ++size_;
+}
+
+void TimerWheel::unlink(int key) {
+    Node& node = nodes_[key];
+    if (node.prev >= 0) {
+        nodes_[node.prev].next = node.next;
+    } else {
+        slots_[node.slot] = node.next;
+    }
+    if (node.next >= 0) {
+        nodes_[node.next].prev = node.prev;
+    }
+    node.prev = -1;
+    node.next = -1;
+    node.slot = -1;
+    --size_;
+}
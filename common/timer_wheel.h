@@ -0,0 +1,64 @@
+/*************************************************************************
+ * @file    timer_wheel.h
+ * @brief   Hashed timer wheel keyed by small integer ids
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_TIMER_WHEEL_H_
+#define _TRADING_PLATFORM_COMMON_TIMER_WHEEL_H_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Each key in [0, key_num) has at most one pending timer. Timers hash into
+// slot (expire_tick % slot_num) and timers more than one revolution away stay
+// in their slot until their tick comes round, so the cost of advance() depends
+// on the ticks elapsed and the timers in the visited slots, not on key_num.
+class TimerWheel {
+public:
+    typedef std::function<void(int key)> ExpireCallback;
+
+    TimerWheel();
+
+    // Size the wheel, slot_num is rounded up to a power of two
+    int init(int key_num, int slot_num, uint64_t now_tick);
+
+    // Make room for keys up to key_num, existing timers are kept
+    void resize(int key_num);
+
+    // Arm the timer of key to fire at expire_tick, replacing any pending one
+    void schedule(int key, uint64_t expire_tick);
+
+    // Disarm the timer of key
+    void cancel(int key);
+
+    // Whether key has a pending timer
+    bool is_scheduled(int key) const { return nodes_[key].slot >= 0; }
+
+    // Fire every timer due at or before now_tick. The callback may reschedule the key it is given
+    void advance(uint64_t now_tick, const ExpireCallback& callback);
+
+    size_t size() const { return size_; }
+
+private:
+    struct Node {
+        int prev;
+        int next;
+        int slot;             // Slot the node is linked into, -1 when idle
+        uint64_t expire_tick;
+    };
+
+    void link(int key, int slot);
+    void unlink(int key);
+
+    std::vector<Node> nodes_;     // One node per key
+    std::vector<int> slots_;      // Head key of each slot, -1 when empty
+    uint64_t slot_mask_;
+    uint64_t current_tick_;       // Last tick processed by advance()
+    size_t size_;                 // Pending timers
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_TIMER_WHEEL_H_
@@ -0,0 +1,61 @@
+/*************************************************************************
+ * @file    token_bucket.h
+ * @brief   Token bucket used for request admission control
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_TOKEN_BUCKET_H_
+#define _TRADING_PLATFORM_COMMON_TOKEN_BUCKET_H_
+
+#include <algorithm>
+#include <cstdint>
+
+// Rate and burst of a bucket, a rate of 0 disables the limit
+struct TokenBucketConfig {
+    double rate;   // Tokens added per second
+    double burst;  // Bucket capacity
+};
+
+// Refilled lazily from the loop time on each check, so an idle bucket costs nothing.
+// A default constructed bucket is unlimited.
+class TokenBucket {
+public:
+    TokenBucket() : rate_(0), burst_(0), tokens_(0), last_ms_(0) {}
+
+    // Start full at now_ms
+    void init(const TokenBucketConfig& config, uint64_t now_ms) {
+        rate_ = config.rate;
+        burst_ = std::max(config.burst, 1.0);
+        tokens_ = burst_;
+        last_ms_ = now_ms;
+    }
+
+    // Add the tokens earned since the last refill
+    void refill(uint64_t now_ms) {
+        if (now_ms > last_ms_) {
+            tokens_ = std::min(burst_, tokens_ + (now_ms - last_ms_) * rate_ / 1000.0);
+            last_ms_ = now_ms;
+        }
+    }
+
+    bool enabled() const { return rate_ > 0; }
+
+    // Whether a token is available, call refill() first
+    bool available() const { return !enabled() || tokens_ >= 1.0; }
+
+    void take() {
+        if (enabled()) {
+            tokens_ -= 1.0;
+        }
+    }
+
+private:
+    double rate_;
+    double burst_;
+    double tokens_;
+    uint64_t last_ms_;
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_TOKEN_BUCKET_H_
@@ -0,0 +1,270 @@
+#include "uring_io.h"
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "logger.h"
+
+namespace {
+
+int uring_setup(unsigned entries, struct io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+}  // namespace
+
+UringIo::UringIo() :
+    ring_fd_(-1), sq_map_(MAP_FAILED), sq_map_len_(0),
+    sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)), sqes_len_(0),
+    sq_tail_(nullptr), sq_head_(nullptr), sq_flags_(nullptr), sq_mask_(0), sq_entries_(0),
+    sq_local_tail_(0), sq_submitted_(0),
+    cq_head_(nullptr), cq_tail_(nullptr), cq_mask_(0), cqes_(nullptr),
+    buf_ring_(static_cast<struct io_uring_buf_ring*>(MAP_FAILED)), buf_ring_len_(0),
+    recv_bufs_(static_cast<char*>(MAP_FAILED)), recv_bufs_len_(0), recv_buf_num_(0), recv_buf_size_(0),
+    buf_local_tail_(0), enter_calls_(0) {
+}
+
+UringIo::~UringIo() {
+    destroy();
+}
+
+int UringIo::init(unsigned entries, unsigned buf_num, unsigned buf_size) {
+    if (buf_num == 0 || buf_num > 32768 || (buf_num & (buf_num - 1)) != 0 || buf_size == 0) {
+        LOG(ERROR, "Invalid io_uring receive buffers: {} of {} bytes, the number must be a power of two up to 32768",
+            buf_num, buf_size);
+        return -1;
+    }
+
+    // A multishot receive posts one completion per read, leave room for bursts between reaps
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    ring_fd_ = uring_setup(entries, &params);
+    if (ring_fd_ < 0) {
+        LOG(ERROR, "io_uring_setup failed: {}", strerror(errno));
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        LOG(ERROR, "Kernel io_uring lacks required features, features=0x{:x}", params.features);
+        destroy();
+        return -1;
+    }
+
+    // Submission and completion rings share one mapping, the SQE array has its own
+    sq_map_len_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                           params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+    sq_map_ = mmap(nullptr, sq_map_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    sqes_len_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<struct io_uring_sqe*>(
+        mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+    if (sq_map_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+        LOG(ERROR, "Failed to map io_uring rings: {}", strerror(errno));
+        destroy();
+        return -1;
+    }
+
+    char* sq = static_cast<char*>(sq_map_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_flags_ = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    sq_local_tail_ = *sq_tail_;
+    sq_submitted_ = sq_local_tail_;
+    // SQE i always sits in slot i, so the index array is filled once
+    unsigned* sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries_; ++i) {
+        sq_array[i] = i;
+    }
+
+    cq_head_ = reinterpret_cast<unsigned*>(sq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(sq + params.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(sq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(sq + params.cq_off.cqes);
+
+    // Receive buffers: the ring of buffer descriptors is shared with the kernel, the buffers follow
+    recv_buf_num_ = buf_num;
+    recv_buf_size_ = buf_size;
+    buf_ring_len_ = buf_num * sizeof(struct io_uring_buf);
+    recv_bufs_len_ = static_cast<size_t>(buf_num) * buf_size;
+    buf_ring_ = static_cast<struct io_uring_buf_ring*>(
+        mmap(nullptr, buf_ring_len_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    recv_bufs_ = static_cast<char*>(
+        mmap(nullptr, recv_bufs_len_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0));
+    if (buf_ring_ == MAP_FAILED || recv_bufs_ == MAP_FAILED) {
+        LOG(ERROR, "Failed to map io_uring receive buffers: {}", strerror(errno));
+        destroy();
+        return -1;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(buf_ring_);
+    reg.ring_entries = buf_num;
+    reg.bgid = URING_RECV_BUF_GROUP;
+    if (uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        LOG(ERROR, "Failed to register io_uring receive buffer ring: {}", strerror(errno));
+        destroy();
+        return -1;
+    }
+    buf_local_tail_ = 0;
+    for (unsigned bid = 0; bid < buf_num; ++bid) {
+        recycle_recv_buf(static_cast<uint16_t>(bid));
+    }
+    publish_recv_bufs();
+
+    LOG(INFO, "io_uring ready: {} SQEs, {} CQEs, {} receive buffers of {} bytes",
+        params.sq_entries, params.cq_entries, buf_num, buf_size);
+    return 0;
+}
+
+void UringIo::destroy() {
+    if (recv_bufs_ != MAP_FAILED) {
+        munmap(recv_bufs_, recv_bufs_len_);
+        recv_bufs_ = static_cast<char*>(MAP_FAILED);
+    }
+    if (buf_ring_ != MAP_FAILED) {
+        munmap(buf_ring_, buf_ring_len_);
+        buf_ring_ = static_cast<struct io_uring_buf_ring*>(MAP_FAILED);
+    }
+    if (sqes_ != MAP_FAILED) {
+        munmap(sqes_, sqes_len_);
+        sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+    }
+    if (sq_map_ != MAP_FAILED) {
+        munmap(sq_map_, sq_map_len_);
+        sq_map_ = MAP_FAILED;
+    }
+    // Closing the ring cancels whatever is still in flight
+    if (ring_fd_ >= 0) {
+        close(ring_fd_);
+        ring_fd_ = -1;
+    }
+}
+
+struct io_uring_sqe* UringIo::get_sqe() {
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sq_local_tail_ - head >= sq_entries_) {
+        if (submit() < 0) {
+            return nullptr;
+        }
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (sq_local_tail_ - head >= sq_entries_) {
+            LOG(ERROR, "io_uring submission queue is full");
+            return nullptr;
+        }
+    }
+    struct io_uring_sqe* sqe = &sqes_[sq_local_tail_ & sq_mask_];
+    memset(sqe, 0, sizeof(*sqe));
+    ++sq_local_tail_;
+    return sqe;
+}
+
+int UringIo::queue_recv_multishot(int fd, uint64_t user_data) {
+    struct io_uring_sqe* sqe = get_sqe();
+    if (sqe == nullptr) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_RECV_BUF_GROUP;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int UringIo::queue_sendmsg(int fd, const struct msghdr* msg, uint64_t user_data) {
+    struct io_uring_sqe* sqe = get_sqe();
+    if (sqe == nullptr) {
+        return -1;
+    }
+    // MSG_WAITALL keeps retrying inside the kernel, short sends are still handled by the caller
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(msg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int UringIo::queue_cancel(uint64_t target, uint64_t user_data) {
+    struct io_uring_sqe* sqe = get_sqe();
+    if (sqe == nullptr) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = target;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int UringIo::flush_overflow() {
+    ++enter_calls_;
+    if (uring_enter(ring_fd_, 0, 0, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+        LOG(ERROR, "Failed to flush overflowed io_uring completions: {}", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int UringIo::submit() {
+    unsigned pending = sq_local_tail_ - sq_submitted_;
+    if (pending == 0) {
+        return 0;
+    }
+    // A receive re-armed during a reap must see the buffers recycled so far, or it ends with
+    // ENOBUFS at once, is re-armed again and the reap never finishes
+    publish_recv_bufs();
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    int submitted = 0;
+    while (pending > 0) {
+        ++enter_calls_;
+        int ret = uring_enter(ring_fd_, pending, 0, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // EBUSY means the completion queue is backed up, the next reap makes room
+            if (errno != EBUSY && errno != EAGAIN) {
+                LOG(ERROR, "io_uring_enter failed: {}", strerror(errno));
+            }
+            return submitted > 0 ? submitted : -1;
+        }
+        if (ret == 0) {
+            break;
+        }
+        sq_submitted_ += ret;
+        submitted += ret;
+        pending -= ret;
+    }
+    return submitted;
+}
+
+void UringIo::recycle_recv_buf(uint16_t bid) {
+    // Entries are addressed from the ring base: in C++ the empty struct inside the header's flexible
+    // array declaration is one byte, which moves buf_ring_->bufs off the offset the kernel uses
+    struct io_uring_buf* buf =
+        reinterpret_cast<struct io_uring_buf*>(buf_ring_) + (buf_local_tail_ & (recv_buf_num_ - 1));
+    buf->addr = reinterpret_cast<uint64_t>(recv_buf(bid));
+    buf->len = recv_buf_size_;
+    buf->bid = bid;
+    ++buf_local_tail_;
+}
+
+void UringIo::publish_recv_bufs() {
+    __atomic_store_n(&buf_ring_->tail, buf_local_tail_, __ATOMIC_RELEASE);
+}
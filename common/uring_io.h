@@ -0,0 +1,134 @@
+/*************************************************************************
+ * @file    uring_io.h
+ * @brief   Minimal io_uring ring with a provided receive buffer ring, driven through raw syscalls
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_URING_IO_H_
+#define _TRADING_PLATFORM_COMMON_URING_IO_H_
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <cstddef>
+#include <cstdint>
+
+// Default submission queue entries per reactor, the completion queue gets four times as many
+const unsigned URING_ENTRIES = 4096;
+// Default number of provided receive buffers per reactor, a power of two
+const unsigned URING_RECV_BUF_NUM = 4096;
+// Default size of one provided receive buffer
+const unsigned URING_RECV_BUF_SIZE = 4096;
+// Buffer group of the provided receive buffers
+const uint16_t URING_RECV_BUF_GROUP = 0;
+
+// One ring per reactor, used only by its loop thread. SQEs are queued without a syscall and
+// go to the kernel together in submit(), normally once per loop iteration. Completions are
+// read straight from the mapped completion queue. Multishot receives pick their buffers from
+// a ring of provided buffers registered with the kernel, so no buffer is reserved for a
+// connection until data arrives for it.
+class UringIo {
+public:
+    UringIo();
+    ~UringIo();
+
+    // Create the ring and register buf_num receive buffers of buf_size bytes
+    int init(unsigned entries, unsigned buf_num, unsigned buf_size);
+
+    // Unmap everything and close the ring
+    void destroy();
+
+    // Ring descriptor, readable while completions are waiting
+    int fd() const { return ring_fd_; }
+
+    // Queue a multishot receive into the provided buffers
+    int queue_recv_multishot(int fd, uint64_t user_data);
+
+    // Queue a sendmsg, msg and its iovecs must stay valid until the completion
+    int queue_sendmsg(int fd, const struct msghdr* msg, uint64_t user_data);
+
+    // Queue the cancellation of the request carrying target, its own completion carries user_data
+    int queue_cancel(uint64_t target, uint64_t user_data);
+
+    // Hand the queued SQEs to the kernel, returns the number submitted or -1
+    int submit();
+
+    // Call handler for every waiting completion, returns how many there were
+    template <typename F>
+    unsigned reap(F&& handler);
+
+    // Data of a provided buffer named by a receive completion, and its return to the ring
+    const char* recv_buf(uint16_t bid) const { return recv_bufs_ + static_cast<size_t>(bid) * recv_buf_size_; }
+    void recycle_recv_buf(uint16_t bid);
+
+    // Syscalls made by submit(), for comparing against one read or write per connection
+    uint64_t enter_calls() const { return enter_calls_; }
+
+private:
+    UringIo(const UringIo&) = delete;
+    UringIo& operator=(const UringIo&) = delete;
+
+    // Next free SQE, submitting the queued ones first when the queue is full
+    struct io_uring_sqe* get_sqe();
+
+    // Make recycled buffers visible to the kernel
+    void publish_recv_bufs();
+
+    // Move completions the kernel held back while the completion queue was full into it
+    int flush_overflow();
+
+    int ring_fd_;
+    void* sq_map_;      // Submission and completion rings
+    size_t sq_map_len_;
+    struct io_uring_sqe* sqes_;
+    size_t sqes_len_;
+
+    unsigned* sq_tail_;
+    unsigned* sq_head_;
+    unsigned* sq_flags_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned sq_local_tail_;  // SQEs queued, published to the kernel on submit
+    unsigned sq_submitted_;   // SQEs published so far
+
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe* cqes_;
+
+    struct io_uring_buf_ring* buf_ring_;
+    size_t buf_ring_len_;
+    char* recv_bufs_;
+    size_t recv_bufs_len_;
+    unsigned recv_buf_num_;
+    unsigned recv_buf_size_;
+    uint16_t buf_local_tail_;  // Buffers returned, published after each reap
+
+    uint64_t enter_calls_;
+};
+
+template <typename F>
+unsigned UringIo::reap(F&& handler) {
+    unsigned count = 0;
+    unsigned head = *cq_head_;
+    for (;;) {
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            // With more completions than queue entries the rest wait in the kernel until asked for
+            if (!(__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) || flush_overflow() != 0) {
+                break;
+            }
+            continue;
+        }
+        // The handler may queue new SQEs, the completion queue is only advanced after it
+        for (; head != tail; ++head, ++count) {
+            handler(cqes_[head & cq_mask_]);
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+    publish_recv_bufs();
+    return count;
+}
+
+#endif  // _TRADING_PLATFORM_COMMON_URING_IO_H_
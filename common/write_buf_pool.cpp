@@ -0,0 +1,135 @@
+#include "write_buf_pool.h"
+#include <algorithm>
+#include <new>
+#include "logger.h"
+
+namespace {
+
+const size_t CACHE_LINE = 64;
+
+size_t align_up(size_t size) {
+    return (size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+}
+
+}  // namespace
+
+WriteBufPool::WriteBufPool()
+    : max_bytes_(0), slab_bytes_(0), in_use_(0), in_use_bytes_(0), exhausted_(0) {
+    for (int i = 0; i <= WRITE_BUF_SHARED_CLASS; ++i) {
+        free_lists_[i] = nullptr;
+    }
+}
+
+WriteBufPool::~WriteBufPool() {
+    for (char* slab : slabs_) {
+        free(slab);
+    }
+}
+
+void WriteBufPool::init(size_t max_bytes) {
+    max_bytes_ = max_bytes;
+    LOG(INFO, "Write buffer pool initialized, max bytes: {}", max_bytes_);
+}
+
+WriteBuf* WriteBufPool::acquire(UINT size) {
+    int size_class = 0;
+    while (size_class < WRITE_BUF_CLASS_NUM && WRITE_BUF_CLASS_SIZE[size_class] < size) {
+        ++size_class;
+    }
+    if (size_class == WRITE_BUF_CLASS_NUM) {
+        LOG(ERROR, "Write buffer size {} exceeds the largest class {}", size,
+            WRITE_BUF_CLASS_SIZE[WRITE_BUF_CLASS_NUM - 1]);
+        return nullptr;
+    }
+
+    if (free_lists_[size_class] == nullptr && !grow(size_class)) {
+        exhausted_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    WriteBuf* buf = free_lists_[size_class];
+    free_lists_[size_class] = buf->next;
+    buf->next = nullptr;
+    buf->len = 0;
+    buf->frames = 0;
+    buf->index = -1;
+    in_use_.fetch_add(1, std::memory_order_relaxed);
+    in_use_bytes_.fetch_add(buf->capacity, std::memory_order_relaxed);
+    return buf;
+}
+
+WriteBuf* WriteBufPool::acquire_shared(SharedBuf* shared) {
+    if (free_lists_[WRITE_BUF_SHARED_CLASS] == nullptr && !grow(WRITE_BUF_SHARED_CLASS)) {
+        exhausted_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    WriteBuf* buf = free_lists_[WRITE_BUF_SHARED_CLASS];
+    free_lists_[WRITE_BUF_SHARED_CLASS] = buf->next;
+    shared->add_ref();
+    buf->next = nullptr;
+    buf->data = shared->data();
+    buf->len = shared->len();
+    buf->frames = 1;
+    buf->index = -1;
+    buf->shared = shared;
+    in_use_.fetch_add(1, std::memory_order_relaxed);
+    return buf;
+}
+
+void WriteBufPool::release(WriteBuf* buf) {
+    if (buf->shared != nullptr) {
+        buf->shared->release();
+        buf->shared = nullptr;
+        buf->data = nullptr;
+    }
+    in_use_.fetch_sub(1, std::memory_order_relaxed);
+    in_use_bytes_.fetch_sub(buf->capacity, std::memory_order_relaxed);
+    buf->next = free_lists_[buf->size_class];
+    free_lists_[buf->size_class] = buf;
+}
+
+void WriteBufPool::release_chain(WriteBuf* head) {
+    while (head != nullptr) {
+        WriteBuf* next = head->next;
+        release(head);
+        head = next;
+    }
+}
+
+bool WriteBufPool::grow(int size_class) {
+    if (max_bytes_ > 0 && slab_bytes_.load(std::memory_order_relaxed) + WRITE_BUF_SLAB_SIZE > max_bytes_) {
+        LOG(ERROR, "Write buffer pool reached its bound of {} bytes", max_bytes_);
+        return false;
+    }
+
+    // Shared entries are only the header
+    size_t header_size = align_up(sizeof(WriteBuf));
+    UINT capacity = size_class == WRITE_BUF_SHARED_CLASS ? 0 : WRITE_BUF_CLASS_SIZE[size_class];
+    size_t unit_size = header_size + align_up(capacity);
+    size_t unit_num = std::max<size_t>(WRITE_BUF_SLAB_SIZE / unit_size, 1);
+    size_t slab_size = unit_size * unit_num;
+
+    char* slab = static_cast<char*>(aligned_alloc(CACHE_LINE, slab_size));
+    if (slab == nullptr) {
+        LOG(ERROR, "Failed to allocate write buffer slab of {} bytes", slab_size);
+        return false;
+    }
+    slabs_.push_back(slab);
+    slab_bytes_.fetch_add(slab_size, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < unit_num; ++i) {
+        char* unit = slab + i * unit_size;
+        WriteBuf* buf = new (unit) WriteBuf();
+        buf->data = capacity > 0 ? unit + header_size : nullptr;
+        buf->capacity = capacity;
+        buf->size_class = size_class;
+        buf->shared = nullptr;
+        buf->next = free_lists_[size_class];
+        free_lists_[size_class] = buf;
+    }
+
+    LOG(INFO, "Write buffer pool grew class {} by {} buffers, slab bytes: {}",
+        capacity, unit_num, slab_bytes_.load());
+    return true;
+}
@@ -0,0 +1,91 @@
+/*************************************************************************
+ * @file    write_buf_pool.h
+ * @brief   Slab-backed pool of write requests with embedded, size-classed send buffers
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _TRADING_PLATFORM_COMMON_WRITE_BUF_POOL_H_
+#define _TRADING_PLATFORM_COMMON_WRITE_BUF_POOL_H_
+
+#include <atomic>
+#include <vector>
+#include "tcp_comm.h"
+#include "shared_buf.h"
+
+// Number of buffer size classes
+const int WRITE_BUF_CLASS_NUM = 4;
+
+// Payload capacity of each size class, the largest holds a maximum size CS package
+const UINT WRITE_BUF_CLASS_SIZE[WRITE_BUF_CLASS_NUM] = {256, 1024, 4096, MAX_CSPKG_LEN};
+
+// Bytes carved into buffers each time a size class runs out
+const size_t WRITE_BUF_SLAB_SIZE = 256*1024;
+
+// Default bound of slab memory per reactor shard
+const int WRITE_POOL_MAX_BYTES = 64*1024*1024;
+
+// Size class index of payload-less entries that point into a SharedBuf
+const int WRITE_BUF_SHARED_CLASS = WRITE_BUF_CLASS_NUM;
+
+// A send buffer with its embedded write request. Packages are encoded straight into
+// data, and the buffer stays owned by the pool until the write using it completes.
+// Shared entries have no payload of their own and capacity 0, so nothing is coalesced into them
+struct WriteBuf {
+    uv_write_t req;     // Write request, only used on the first buffer of a batch
+    WriteBuf* next;     // Next buffer on a free list, a send queue or a write batch
+    char* data;         // Payload area inside the slab
+    UINT capacity;      // Payload capacity of the size class
+    UINT len;           // Payload bytes in use
+    UINT frames;        // Number of packages in the payload
+    int size_class;     // Size class index
+    int index;          // Connection slot the buffer is queued on
+    SharedBuf* shared;  // Broadcast package data points into, a reference held until release
+    uint64_t queued_ns; // When the first package was queued, for the write latency
+};
+
+class WriteBufPool {
+public:
+    WriteBufPool();
+    ~WriteBufPool();
+
+    // Set the upper bound of slab memory in bytes, 0 means unbounded
+    void init(size_t max_bytes);
+
+    // Get an empty buffer able to hold size bytes, nullptr if size exceeds the largest
+    // class or the memory bound is reached
+    WriteBuf* acquire(UINT size);
+
+    // Get an entry holding one package of a shared buffer, takes a reference to it
+    WriteBuf* acquire_shared(SharedBuf* shared);
+
+    // Return a buffer to its size class, dropping its shared buffer reference if any
+    void release(WriteBuf* buf);
+
+    // Return a chain of buffers linked through next
+    void release_chain(WriteBuf* head);
+
+    // Occupancy metrics, readable from other threads
+    uint64_t slab_bytes() const { return slab_bytes_.load(std::memory_order_relaxed); }
+    uint64_t in_use() const { return in_use_.load(std::memory_order_relaxed); }
+    uint64_t in_use_bytes() const { return in_use_bytes_.load(std::memory_order_relaxed); }
+    uint64_t exhausted() const { return exhausted_.load(std::memory_order_relaxed); }
+
+private:
+    WriteBufPool(const WriteBufPool&) = delete;
+    WriteBufPool& operator=(const WriteBufPool&) = delete;
+
+    // Carve a new slab into buffers of a size class
+    bool grow(int size_class);
+
+    std::vector<char*> slabs_;                      // Slabs owned by the pool
+    WriteBuf* free_lists_[WRITE_BUF_CLASS_NUM + 1];  // Free buffers per size class, then shared entries
+    size_t max_bytes_;                              // Slab memory bound
+    std::atomic<uint64_t> slab_bytes_;              // Slab memory allocated
+    std::atomic<uint64_t> in_use_;                  // Buffers handed out
+    std::atomic<uint64_t> in_use_bytes_;            // Payload capacity handed out
+    std::atomic<uint64_t> exhausted_;               // Acquires refused by the memory bound
+};
+
+#endif  // _TRADING_PLATFORM_COMMON_WRITE_BUF_POOL_H_
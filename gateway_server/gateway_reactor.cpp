@@ -0,0 +1,400 @@
+#include "gateway_reactor.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include "logger.h"
+#include "config_manager.h"
+#include "kafka_manager.h"
+#include "role.pb.h"
+#include "futures_order.pb.h"
+
+// Time a reactor waits for in-flight writes before handing its connections over, in milliseconds
+const uint64_t HANDOVER_DRAIN_MS = 2000;
+
+GatewayReactor::GatewayReactor(int shard_id)
+    : shard_id_(shard_id), conn_mgr_(nullptr), loop_inited_(false), busy_poll_(false), cpu_(-1), stopping_(false),
+      handover_state_(HANDOVER_NONE), handover_done_(nullptr), handover_deadline_(0) {
+    dispatcher_.bind<cspkg::AccountLoginRes, &GatewayReactor::handle_login_response>();
+    dispatcher_.bind<cs_proto::OrderResponse, &GatewayReactor::handle_order_response>();
+}
+
+GatewayReactor::~GatewayReactor() {
+    stop();
+    join();
+    for (BroadcastItem& item : broadcast_inbox_) {
+        for (SharedBuf* buf : item.frames) {
+            buf->release();
+        }
+    }
+    if (conn_mgr_) {
+        delete conn_mgr_;
+    }
+    if (loop_inited_) {
+        uv_loop_close(&loop_);
+    }
+}
+
+int GatewayReactor::init(const std::string& ip, int port, int max_connections, HandoverShard* handover) {
+    if (uv_loop_init(&loop_) != 0) {
+        LOG(ERROR, "Failed to initialize uv loop for shard {}", shard_id_);
+        return -1;
+    }
+    loop_inited_ = true;
+
+    uv_async_init(&loop_, &wakeup_handle_, on_wakeup);
+    wakeup_handle_.data = this;
+
+    // Initialize connection manager shard
+    conn_mgr_ = TcpConnectMgr::create_instance(shard_id_);
+    if (conn_mgr_ == nullptr) {
+        LOG(ERROR, "Failed to create TcpConnectMgr instance for shard {}", shard_id_);
+        return -1;
+    }
+    if (conn_mgr_->init(shard_id_, max_connections, handover != nullptr) != 0) {
+        LOG(ERROR, "Failed to initialize TcpConnectMgr for shard {}", shard_id_);
+        return -1;
+    }
+
+    // Store connection manager in loop data for easy access in callbacks
+    loop_.data = conn_mgr_;
+    if (conn_mgr_->init_io(&loop_) != 0) {
+        return -1;
+    }
+
+    // Every reactor binds its own listener, the kernel balances accepts between them.
+    // A handed over listener keeps the connections queued while no process was accepting
+    int listen_fd = -1;
+    if (handover != nullptr) {
+        listen_fd = handover->listen_fd;
+        handover->listen_fd = -1;
+    } else {
+        listen_fd = create_listen_socket(ip, port);
+    }
+    if (listen_fd < 0) {
+        return -1;
+    }
+    if (uv_tcp_init(&loop_, &server_) != 0 || uv_tcp_open(&server_, listen_fd) != 0) {
+        LOG(ERROR, "Failed to initialize TCP server for shard {}", shard_id_);
+        close(listen_fd);
+        return -1;
+    }
+    if (uv_listen((uv_stream_t*)&server_, SOMAXCONN, on_new_connection) != 0) {
+        LOG(ERROR, "Failed to start listening for shard {}", shard_id_);
+        return -1;
+    }
+
+    // Start the idle timeout timer, one tick of the timeout wheel per run
+    uv_timer_init(&loop_, &check_timer_);
+    check_timer_.data = this;
+    uv_timer_start(&check_timer_, on_timer, TIMEOUT_WHEEL_TICK_MS, TIMEOUT_WHEEL_TICK_MS);
+
+    // Orders without a response in time are rejected, one tick of the in-flight order wheel per run
+    uv_timer_init(&loop_, &order_timer_);
+    order_timer_.data = this;
+    uv_timer_start(&order_timer_, on_order_timer, ORDER_TIMEOUT_TICK_MS, ORDER_TIMEOUT_TICK_MS);
+
+    // Everything queued for clients during an iteration goes out in one write per connection
+    uv_check_init(&loop_, &flush_check_);
+    flush_check_.data = this;
+    uv_check_start(&flush_check_, on_check);
+
+    if (handover != nullptr) {
+        conn_mgr_->restore_connections(&loop_, *handover);
+        conn_mgr_->submit_io();
+    }
+
+    // Busy-poll mode, reactor i is pinned to the i-th CPU of the list
+    busy_poll_ = ConfigManager::instance().get_bool("GATEWAY_BUSY_POLL", false);
+    if (busy_poll_) {
+        std::stringstream cpus(ConfigManager::instance().get_string("GATEWAY_BUSY_POLL_CPUS"));
+        std::string cpu;
+        for (int i = 0; std::getline(cpus, cpu, ','); ++i) {
+            if (i == shard_id_ && !cpu.empty()) {
+                cpu_ = std::stoi(cpu);
+                break;
+            }
+        }
+        if (cpu_ < 0) {
+            LOG(INFO, "Reactor {} busy-polls without a CPU in GATEWAY_BUSY_POLL_CPUS", shard_id_);
+        }
+    }
+
+    LOG(INFO, "Reactor {} listening on {}:{}, busy poll: {}, cpu: {}", shard_id_, ip, port, busy_poll_, cpu_);
+    return 0;
+}
+
+int GatewayReactor::create_listen_socket(const std::string& ip, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        LOG(ERROR, "Failed to create listen socket: {}", strerror(errno));
+        return -1;
+    }
+
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+        LOG(ERROR, "Failed to set SO_REUSEPORT on listen socket: {}", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    uv_ip4_addr(ip.c_str(), port, &addr);
+    if (bind(fd, (const struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        LOG(ERROR, "Failed to bind server {}:{}: {}", ip, port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int GatewayReactor::start_thread() {
+    thread_ = std::make_unique<std::thread>([this]() {
+        LOG(INFO, "Reactor {} loop started", shard_id_);
+        bind_cpu();
+        while (!stopping_) {
+            int result = run_loop();
+            if (result < 0) {
+                LOG(ERROR, "uv_run returned with error on shard {}: {}", shard_id_, uv_strerror(result));
+            }
+        }
+        LOG(INFO, "Reactor {} loop ended", shard_id_);
+    });
+    return 0;
+}
+
+int GatewayReactor::run_loop() {
+    if (!busy_poll_) {
+        return uv_run(&loop_, UV_RUN_DEFAULT);
+    }
+
+    // Each pass polls with a zero timeout, so IO is picked up as soon as it lands at the
+    // cost of a fully busy CPU. Stopping goes through stop(), uv_stop() only ends one pass
+    StatisticsManager& stats = conn_mgr_->get_statistics_manager();
+    int result = 0;
+    while (!stopping_) {
+        uint64_t start = uv_hrtime();
+        result = uv_run(&loop_, UV_RUN_NOWAIT);
+        stats.record_loop_iteration(uv_hrtime() - start);
+        if (result < 0) {
+            break;
+        }
+    }
+    return result;
+}
+
+void GatewayReactor::bind_cpu() {
+    if (cpu_ < 0) {
+        return;
+    }
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu_, &cpuset);
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (ret != 0) {
+        LOG(ERROR, "Failed to pin reactor {} to CPU {}: {}", shard_id_, cpu_, strerror(ret));
+        return;
+    }
+    LOG(INFO, "Reactor {} pinned to CPU {}", shard_id_, cpu_);
+}
+
+void GatewayReactor::stop() {
+    if (!loop_inited_ || stopping_.exchange(true)) {
+        return;
+    }
+    uv_async_send(&wakeup_handle_);
+}
+
+void GatewayReactor::join() {
+    if (thread_ && thread_->joinable()) {
+        thread_->join();
+    }
+}
+
+void GatewayReactor::post_message(MsgId msg_id, const google::protobuf::Message& message) {
+    std::unique_ptr<google::protobuf::Message> copy(message.New());
+    copy->CopyFrom(message);
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        inbox_.emplace_back(msg_id, std::move(copy));
+    }
+    uv_async_send(&wakeup_handle_);
+}
+
+void GatewayReactor::post_broadcast(const std::string& symbol, MsgId msg_id, const SharedFrames& frames) {
+    for (SharedBuf* buf : frames) {
+        buf->add_ref();
+    }
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        broadcast_inbox_.push_back(BroadcastItem{symbol, msg_id, frames});
+    }
+    uv_async_send(&wakeup_handle_);
+}
+
+void GatewayReactor::on_wakeup(uv_async_t* handle) {
+    GatewayReactor* reactor = static_cast<GatewayReactor*>(handle->data);
+    reactor->drain_inbox();
+    if (reactor->handover_state_ == HANDOVER_REQUESTED) {
+        reactor->begin_handover();
+    }
+    if (reactor->stopping_) {
+        uv_timer_stop(&reactor->check_timer_);
+        uv_timer_stop(&reactor->order_timer_);
+        uv_check_stop(&reactor->flush_check_);
+        uv_stop(&reactor->loop_);
+    }
+}
+
+void GatewayReactor::drain_inbox() {
+    std::vector<std::pair<MsgId, std::unique_ptr<google::protobuf::Message>>> messages;
+    std::vector<BroadcastItem> broadcasts;
+    {
+        std::lock_guard<std::mutex> lock(inbox_mutex_);
+        messages.swap(inbox_);
+        broadcasts.swap(broadcast_inbox_);
+    }
+    for (const auto& message : messages) {
+        dispatch_message(message.first, *message.second);
+    }
+    for (BroadcastItem& item : broadcasts) {
+        broadcast(item.symbol, item.msg_id, item.frames);
+        for (SharedBuf* buf : item.frames) {
+            buf->release();
+        }
+    }
+}
+
+void GatewayReactor::broadcast(const std::string& symbol, MsgId msg_id, const SharedFrames& frames) {
+    int queued = conn_mgr_->broadcast(symbol, msg_id, frames);
+    LOG(DEBUG, "Reactor {} queued {} update of {} on {} subscribers", shard_id_, static_cast<int>(msg_id), symbol, queued);
+}
+
+void GatewayReactor::dispatch_message(MsgId msg_id, const google::protobuf::Message& message) {
+    if (!dispatcher_.dispatch(this, msg_id, message)) {
+        LOG(ERROR, "Reactor {} received unexpected message {}", shard_id_, message.GetTypeName());
+    }
+}
+
+void GatewayReactor::handle_login_response(const cspkg::AccountLoginRes& login_res) {
+    uv_tcp_t* client = conn_mgr_->get_client_by_id(login_res.client_id());
+    if (client) {
+        int result = TcpConnectMgr::tcp_send_message((uv_stream_t*)client, login_res);
+        LOG(INFO, "Sent login response to client for account: {}, result: {}, client: {}",
+            login_res.account(), result, login_res.client_id());
+    } else {
+        LOG(ERROR, "Client {} for account {} is gone, dropping login response",
+            login_res.client_id(), login_res.account());
+    }
+}
+
+void GatewayReactor::handle_order_response(const cs_proto::OrderResponse& order_res) {
+    conn_mgr_->match_order_response(order_res);
+    uv_tcp_t* client = conn_mgr_->get_client_by_id(order_res.client_id());
+    if (client) {
+        conn_mgr_->send_order_ack(client, order_res);
+        LOG(DEBUG, "Sent order response to client: {}, seq: {}", order_res.client_id(), order_res.client_seq());
+    } else {
+        LOG(ERROR, "Client {} is gone, dropping order response", order_res.client_id());
+    }
+}
+
+void GatewayReactor::on_timer(uv_timer_t* handle) {
+    GatewayReactor* reactor = static_cast<GatewayReactor*>(handle->data);
+    reactor->perform_periodic_checks();
+}
+
+void GatewayReactor::on_order_timer(uv_timer_t* handle) {
+    GatewayReactor* reactor = static_cast<GatewayReactor*>(handle->data);
+    reactor->conn_mgr_->expire_orders(uv_now(&reactor->loop_));
+}
+
+void GatewayReactor::on_check(uv_check_t* handle) {
+    GatewayReactor* reactor = static_cast<GatewayReactor*>(handle->data);
+    reactor->conn_mgr_->flush_order_acks();
+    reactor->conn_mgr_->check_wait_send_data();
+    // With io_uring the receives armed and sends queued this iteration go out in one syscall
+    reactor->conn_mgr_->submit_io();
+
+    // Everything decoded during this iteration goes out as one Kafka record per topic
+    KafkaManager::instance().flush_batches(reactor->shard_id_);
+    reactor->conn_mgr_->record_kafka_produced();
+    reactor->conn_mgr_->check_ingress();
+    reactor->conn_mgr_->publish_gauges();
+
+    if (reactor->handover_state_ == HANDOVER_DRAINING) {
+        reactor->check_handover();
+    }
+}
+
+void GatewayReactor::request_handover(uv_async_t* done) {
+    handover_done_ = done;
+    int expected = HANDOVER_NONE;
+    if (handover_state_.compare_exchange_strong(expected, HANDOVER_REQUESTED)) {
+        uv_async_send(&wakeup_handle_);
+    }
+}
+
+void GatewayReactor::begin_handover() {
+    handover_state_ = HANDOVER_DRAINING;
+
+    // Keep the listen socket open through a duplicate, pending connections wait in its backlog
+    uv_os_fd_t fd;
+    if (uv_fileno((uv_handle_t*)&server_, &fd) == 0) {
+        handover_.listen_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    }
+    if (handover_.listen_fd < 0) {
+        LOG(ERROR, "Failed to duplicate the listen socket of shard {}: {}", shard_id_, strerror(errno));
+    }
+    uv_close((uv_handle_t*)&server_, nullptr);
+    // Responses to the orders in flight go to the new process, which does not track them
+    uv_timer_stop(&order_timer_);
+
+    conn_mgr_->begin_handover();
+    handover_deadline_ = uv_now(&loop_) + HANDOVER_DRAIN_MS;
+}
+
+void GatewayReactor::check_handover() {
+    if (!conn_mgr_->handover_drained() && uv_now(&loop_) < handover_deadline_) {
+        return;
+    }
+
+    conn_mgr_->export_connections(handover_);
+    handover_state_ = HANDOVER_READY;
+    uv_async_send(handover_done_);
+}
+
+void GatewayReactor::perform_periodic_checks() {
+    conn_mgr_->check_timeout();
+}
+
+void GatewayReactor::on_new_connection(uv_stream_t* server, int status) {
+    if (status < 0) {
+        LOG(ERROR, "New connection error: {}", uv_strerror(status));
+        return;
+    }
+
+    uint64_t accept_ns = latency_now_ns();
+    TcpConnectMgr* conn_mgr = static_cast<TcpConnectMgr*>(server->loop->data);
+    LOG(INFO, "New connection received on shard {}", conn_mgr->get_shard_id());
+
+    uv_tcp_t* client = (uv_tcp_t*)malloc(sizeof(uv_tcp_t));
+    if (uv_tcp_init(server->loop, client) != 0) {
+        LOG(ERROR, "Failed to initialize client connection");
+        free(client);
+        return;
+    }
+
+    if (uv_accept(server, (uv_stream_t*)client) == 0) {
+        conn_mgr->handle_new_connection(client);
+        conn_mgr->get_statistics_manager().record_latency(LATENCY_ACCEPT, latency_now_ns() - accept_ns);
+    } else {
+        LOG(ERROR, "Failed to accept new connection");
+        uv_close((uv_handle_t*)client, [](uv_handle_t* handle) {
+            free(handle);
+        });
+    }
+}
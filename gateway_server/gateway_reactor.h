@@ -0,0 +1,157 @@
+/*************************************************************************
+ * @file    gateway_reactor.h
+ * @brief   GatewayReactor class declaration, one event loop shard of the gateway
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _GATEWAY_SERVER_GATEWAY_REACTOR_H_
+#define _GATEWAY_SERVER_GATEWAY_REACTOR_H_
+
+#include <uv.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <google/protobuf/message.h>
+#include "tcp_connect_mgr.h"
+#include "msg_registry.h"
+
+// A reactor owns one uv loop, one SO_REUSEPORT listener on the gateway port,
+// and the connection table shard of every client accepted on that listener.
+// Responses consumed from Kafka are routed back to the owning reactor by the
+// shard bits of their client id.
+class GatewayReactor {
+public:
+    explicit GatewayReactor(int shard_id);
+    ~GatewayReactor();
+
+    // Initialize the loop, the connection manager shard and the listener. With handover the
+    // listener and client sockets of the previous gateway process are adopted instead
+    int init(const std::string& ip, int port, int max_connections, HandoverShard* handover = nullptr);
+
+    // Run the loop on a dedicated thread until stop() is called
+    int start_thread();
+
+    // Run the loop on the calling thread until it is stopped. In busy-poll mode the loop
+    // spins without blocking, otherwise it sleeps in epoll until there is work
+    int run_loop();
+
+    // Pin the calling thread to the CPU configured for this reactor, if any
+    void bind_cpu();
+
+    // Request the loop to stop, safe to call from any thread
+    void stop();
+
+    // Wait for the reactor thread to exit
+    void join();
+
+    // Queue a Kafka response for this shard, safe to call from any thread
+    void post_message(MsgId msg_id, const google::protobuf::Message& message);
+
+    // Handle a Kafka response on the loop thread
+    void dispatch_message(MsgId msg_id, const google::protobuf::Message& message);
+
+    // Queue a market data package for the subscribers of this shard, safe to call from any thread.
+    // The reactor takes its own references to the frames
+    void post_broadcast(const std::string& symbol, MsgId msg_id, const SharedFrames& frames);
+
+    // Write a market data package to the subscribers of this shard on the loop thread
+    void broadcast(const std::string& symbol, MsgId msg_id, const SharedFrames& frames);
+
+    // Periodic checks on the connection table
+    void perform_periodic_checks();
+
+    // Hot upgrade: stop accepting and reading, drain in-flight writes and export every
+    // connection on the loop thread, then signal done. Safe to call from any thread
+    void request_handover(uv_async_t* done);
+
+    // Whether the export requested by request_handover() has finished
+    bool handover_ready() const { return handover_state_ == HANDOVER_READY; }
+
+    // Listener and connections exported for the new process, valid once handover_ready()
+    HandoverShard& get_handover() { return handover_; }
+
+    int shard_id() const { return shard_id_; }
+    uv_loop_t* get_loop() { return &loop_; }
+    TcpConnectMgr* get_conn_mgr() { return conn_mgr_; }
+
+private:
+    // Market data package waiting in the inbox, holding one reference to each frame
+    struct BroadcastItem {
+        std::string symbol;
+        MsgId msg_id;
+        SharedFrames frames;
+    };
+
+    enum HandoverState {
+        HANDOVER_NONE = 0,
+        HANDOVER_REQUESTED = 1,
+        HANDOVER_DRAINING = 2,
+        HANDOVER_READY = 3,
+    };
+
+    GatewayReactor(const GatewayReactor&) = delete;
+    GatewayReactor& operator=(const GatewayReactor&) = delete;
+
+    // Create a non-blocking listen socket bound with SO_REUSEPORT
+    static int create_listen_socket(const std::string& ip, int port);
+
+    // Callback for new connections
+    static void on_new_connection(uv_stream_t* server, int status);
+
+    // Callback for queued messages and stop requests
+    static void on_wakeup(uv_async_t* handle);
+
+    // Timer handler
+    static void on_timer(uv_timer_t* handle);
+
+    // In-flight order timeout handler
+    static void on_order_timer(uv_timer_t* handle);
+
+    // Runs once per loop iteration after IO, flushes the send queues and the Kafka batches
+    static void on_check(uv_check_t* handle);
+
+    // Drain the message inbox on the loop thread
+    void drain_inbox();
+
+    // Hot upgrade steps on the loop thread
+    void begin_handover();
+    void check_handover();
+
+    // Handle login response
+    void handle_login_response(const cspkg::AccountLoginRes& login_res);
+
+    // Handle order response
+    void handle_order_response(const cs_proto::OrderResponse& order_res);
+
+    int shard_id_;              // Shard index, also encoded in client ids
+    uv_loop_t loop_;            // Event loop of this shard
+    uv_tcp_t server_;           // Listener bound with SO_REUSEPORT
+    uv_async_t wakeup_handle_;  // Wakes the loop for inbox and stop requests
+    uv_timer_t check_timer_;    // Timer for checking connections
+    uv_timer_t order_timer_;    // Expires orders waiting for their response
+    uv_check_t flush_check_;    // Flushes queued responses every loop iteration
+    TcpConnectMgr* conn_mgr_;   // Connection table shard
+    bool loop_inited_;          // Whether loop_ needs closing
+    bool busy_poll_;            // Spin on UV_RUN_NOWAIT instead of blocking in epoll
+    int cpu_;                   // CPU the loop thread is pinned to, -1 for none
+
+    MsgDispatcher<GatewayReactor> dispatcher_;  // Response handlers by message id
+
+    std::mutex inbox_mutex_;    // Protects inbox_
+    std::vector<std::pair<MsgId, std::unique_ptr<google::protobuf::Message>>> inbox_;  // Messages posted by other threads
+    std::vector<BroadcastItem> broadcast_inbox_;  // Market data posted by other threads
+    std::atomic<bool> stopping_;               // Stop requested
+    std::atomic<int> handover_state_;          // HandoverState of a hot upgrade
+    uv_async_t* handover_done_;                // Signalled once the export finished
+    uint64_t handover_deadline_;               // Loop time after which in-flight writes are given up
+    HandoverShard handover_;                   // Exported listener and connections
+    std::unique_ptr<std::thread> thread_;      // Reactor thread, null for the main reactor
+};
+
+#endif  // _GATEWAY_SERVER_GATEWAY_REACTOR_H_
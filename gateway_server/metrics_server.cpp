@@ -0,0 +1,169 @@
+#include "metrics_server.h"
+#include <cstring>
+#include "logger.h"
+
+namespace {
+
+const char METRICS_HEAD[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+    "Connection: close\r\n"
+    "Content-Length: ";
+
+const char NOT_FOUND_RESPONSE[] =
+    "HTTP/1.1 404 Not Found\r\n"
+    "Content-Type: text/plain\r\n"
+    "Connection: close\r\n"
+    "Content-Length: 10\r\n"
+    "\r\n"
+    "Not found\n";
+
+}  // namespace
+
+MetricsServer::MetricsServer() :
+    loop_(nullptr), listening_(false), conn_num_(0), refresh_ms_(METRICS_REFRESH_MS), cached_time_(0) {
+}
+
+int MetricsServer::init(uv_loop_t* loop, const std::string& ip, int port, int refresh_ms, Renderer renderer) {
+    if (port <= 0) {
+        return 0;
+    }
+    loop_ = loop;
+    refresh_ms_ = refresh_ms > 0 ? refresh_ms : 0;
+    renderer_ = std::move(renderer);
+
+    struct sockaddr_in addr;
+    int result = uv_ip4_addr(ip.c_str(), port, &addr);
+    if (result == 0) {
+        uv_tcp_init(loop_, &listener_);
+        listener_.data = this;
+        listening_ = true;
+        result = uv_tcp_bind(&listener_, (const struct sockaddr*)&addr, 0);
+        if (result == 0) {
+            result = uv_listen((uv_stream_t*)&listener_, METRICS_MAX_CONNECTIONS, on_connection);
+        }
+    }
+    if (result != 0) {
+        LOG(ERROR, "Failed to listen for metrics on {}:{}: {}", ip, port, uv_strerror(result));
+        close();
+        return -1;
+    }
+    LOG(INFO, "Serving metrics on http://{}:{}/metrics", ip, port);
+    return 0;
+}
+
+void MetricsServer::close() {
+    if (listening_) {
+        uv_close((uv_handle_t*)&listener_, nullptr);
+        listening_ = false;
+    }
+}
+
+void MetricsServer::on_connection(uv_stream_t* listener, int status) {
+    MetricsServer* server = static_cast<MetricsServer*>(listener->data);
+    if (status < 0) {
+        LOG(ERROR, "Metrics connection error: {}", uv_strerror(status));
+        return;
+    }
+
+    AdminConn* conn = new AdminConn();
+    conn->server = server;
+    conn->open_handles = METRICS_CONN_HANDLES;
+    uv_tcp_init(server->loop_, &conn->handle);
+    conn->handle.data = conn;
+    uv_timer_init(server->loop_, &conn->timer);
+    conn->timer.data = conn;
+    ++server->conn_num_;
+    if (uv_accept(listener, (uv_stream_t*)&conn->handle) != 0 || server->conn_num_ > METRICS_MAX_CONNECTIONS) {
+        close_conn(conn);
+        return;
+    }
+    // An idle client must not hold one of the few connection slots
+    uint64_t deadline_ms = server->refresh_ms_ > 0 ? server->refresh_ms_ : METRICS_REFRESH_MS;
+    uv_timer_start(&conn->timer, on_timeout, deadline_ms, 0);
+    uv_read_start((uv_stream_t*)&conn->handle, on_alloc, on_read);
+}
+
+void MetricsServer::on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf) {
+    (void)suggested_size;
+    MetricsServer* server = static_cast<AdminConn*>(handle->data)->server;
+    *buf = uv_buf_init(server->read_buf_, sizeof(server->read_buf_));
+}
+
+void MetricsServer::on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf) {
+    AdminConn* conn = static_cast<AdminConn*>(stream->data);
+    if (nread < 0) {
+        close_conn(conn);
+        return;
+    }
+    conn->request.append(buf->base, nread);
+    if (conn->request.find("\r\n\r\n") != std::string::npos) {
+        uv_read_stop(stream);
+        uv_timer_stop(&conn->timer);
+        conn->server->respond(conn);
+    } else if (conn->request.size() > METRICS_MAX_REQUEST) {
+        close_conn(conn);
+    }
+}
+
+void MetricsServer::respond(AdminConn* conn) {
+    const std::string& request = conn->request;
+    bool metrics = request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 13, "GET /metrics?") == 0;
+    if (metrics) {
+        conn->response = metrics_response();
+    } else {
+        static const std::shared_ptr<const std::string> not_found =
+            std::make_shared<const std::string>(NOT_FOUND_RESPONSE, sizeof(NOT_FOUND_RESPONSE) - 1);
+        conn->response = not_found;
+    }
+
+    uv_buf_t buf = uv_buf_init(const_cast<char*>(conn->response->data()), conn->response->size());
+    conn->req.data = conn;
+    if (uv_write(&conn->req, (uv_stream_t*)&conn->handle, &buf, 1, on_write) != 0) {
+        close_conn(conn);
+    }
+}
+
+std::shared_ptr<const std::string> MetricsServer::metrics_response() {
+    uint64_t now = uv_now(loop_);
+    if (cached_ != nullptr && now < cached_time_ + refresh_ms_) {
+        return cached_;
+    }
+
+    std::string body;
+    renderer_(body);
+    std::shared_ptr<std::string> response = std::make_shared<std::string>();
+    response->reserve(sizeof(METRICS_HEAD) + body.size() + 16);
+    response->append(METRICS_HEAD, sizeof(METRICS_HEAD) - 1);
+    response->append(std::to_string(body.size()));
+    response->append("\r\n\r\n");
+    response->append(body);
+    cached_ = response;
+    cached_time_ = now;
+    return cached_;
+}
+
+void MetricsServer::on_write(uv_write_t* req, int status) {
+    (void)status;
+    close_conn(static_cast<AdminConn*>(req->data));
+}
+
+void MetricsServer::on_timeout(uv_timer_t* timer) {
+    AdminConn* conn = static_cast<AdminConn*>(timer->data);
+    LOG(DEBUG, "Metrics request not complete in time, closing the connection");
+    close_conn(conn);
+}
+
+void MetricsServer::close_conn(AdminConn* conn) {
+    uv_close((uv_handle_t*)&conn->handle, on_close);
+    uv_close((uv_handle_t*)&conn->timer, on_close);
+}
+
+void MetricsServer::on_close(uv_handle_t* handle) {
+    AdminConn* conn = static_cast<AdminConn*>(handle->data);
+    if (--conn->open_handles > 0) {
+        return;
+    }
+    --conn->server->conn_num_;
+    delete conn;
+}
@@ -0,0 +1,85 @@
+/*************************************************************************
+ * @file    metrics_server.h
+ * @brief   Admin HTTP listener serving gateway metrics in Prometheus text format
+ * @author  stanjiang
+ * @date    2026-10-17
+ * @copyright
+***/
+
+#ifndef _GATEWAY_SERVER_METRICS_SERVER_H_
+#define _GATEWAY_SERVER_METRICS_SERVER_H_
+
+#include <uv.h>
+#include <functional>
+#include <memory>
+#include <string>
+
+// Admin connections served at once, further ones are closed on accept
+const int METRICS_MAX_CONNECTIONS = 16;
+// Longest request head read before the connection is dropped
+const size_t METRICS_MAX_REQUEST = 4096;
+// Default age in milliseconds after which a scrape renders the metrics again
+const int METRICS_REFRESH_MS = 1000;
+// Handles of an admin connection, its socket and its request deadline
+const int METRICS_CONN_HANDLES = 2;
+
+// Serves GET /metrics on its own port, on the loop it is given. The body comes from a renderer
+// that reads the lock-free statistics snapshots, and is rendered at most once per refresh
+// interval however often it is scraped, so scrapes cost the loop close to nothing.
+// Every response closes its connection, and so does a request head not complete within the
+// refresh interval
+class MetricsServer {
+public:
+    // Append the metrics text to out
+    using Renderer = std::function<void(std::string& out)>;
+
+    MetricsServer();
+
+    // Listen on ip:port, a port of 0 leaves the server disabled
+    int init(uv_loop_t* loop, const std::string& ip, int port, int refresh_ms, Renderer renderer);
+
+    // Stop listening, connections being served finish on their own
+    void close();
+
+private:
+    MetricsServer(const MetricsServer&) = delete;
+    MetricsServer& operator=(const MetricsServer&) = delete;
+
+    struct AdminConn {
+        uv_tcp_t handle;
+        uv_timer_t timer;  // Closes the connection if the request head is not complete in time
+        uv_write_t req;
+        MetricsServer* server;
+        int open_handles;  // Handles not closed yet, the connection is freed with the last
+        std::string request;                          // Request head read so far
+        std::shared_ptr<const std::string> response;  // Held until the write completes
+    };
+
+    static void on_connection(uv_stream_t* listener, int status);
+    static void on_alloc(uv_handle_t* handle, size_t suggested_size, uv_buf_t* buf);
+    static void on_read(uv_stream_t* stream, ssize_t nread, const uv_buf_t* buf);
+    static void on_write(uv_write_t* req, int status);
+    static void on_timeout(uv_timer_t* timer);
+    static void on_close(uv_handle_t* handle);
+
+    // Close both handles of a connection, it is freed once they are closed
+    static void close_conn(AdminConn* conn);
+
+    // Answer a complete request head
+    void respond(AdminConn* conn);
+
+    // Cached metrics response, rendered again once older than refresh_ms_
+    std::shared_ptr<const std::string> metrics_response();
+
+    uv_loop_t* loop_;
+    uv_tcp_t listener_;
+    bool listening_;
+    int conn_num_;
+    uint64_t refresh_ms_;
+    Renderer renderer_;
+    std::shared_ptr<const std::string> cached_;
+    uint64_t cached_time_;
+    char read_buf_[METRICS_MAX_REQUEST];  // Reads are copied out at once, one buffer serves every connection
+};
+
+#endif  // _GATEWAY_SERVER_METRICS_SERVER_H_
@@ -1,33 +1,52 @@
 #include "tcp_server.h"
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <iterator>
 #include <string>
 #include "tcp_code.h"
 #include "logger.h"
 #include "role.pb.h"
 #include "futures_order.pb.h"
 #include "config_manager.h"
+#include "fd_handover.h"
 
 const char* LOGFILE = "./log/tcpsvr.log";
 
+// Interval of the statistics rollup in seconds
+const int STATS_INTERVAL = 300;
+
+// Interval of the Kafka consumer housekeeping poll in milliseconds
+const int KAFKA_POLL_INTERVAL = 100;
+
+// Maximum number of Kafka messages dispatched per loop callback
+const int KAFKA_MAX_BATCH = 1000;
+
+// File descriptors kept for listeners, Kafka, logs and loop internals on top of client sockets
+const int RESERVED_FD_NUM = 1024;
+
+// Interval between attempts to take the instance lock after a handover in milliseconds
+const int LOCK_RETRY_INTERVAL = 100;
+
 using std::string;
 
 // Constructor
 TcpServer::TcpServer() 
-    : loop_(nullptr), conn_mgr_(nullptr), run_flag_(RUN_INIT),
+    : loop_(nullptr), run_flag_(RUN_INIT),
+      upgrade_listen_fd_(-1), upgrade_sock_(-1), handed_over_(false), lock_fd_(-1),
       kafka_manager_(KafkaManager::instance()) {
+    kafka_dispatcher_.bind<cspkg::AccountLoginRes, &TcpServer::route_login_response>();
+    kafka_dispatcher_.bind<cs_proto::OrderResponse, &TcpServer::route_order_response>();
+    kafka_dispatcher_.bind<cs_proto::BookUpdate, &TcpServer::route_book_update>();
+    kafka_dispatcher_.bind<cs_proto::TradeUpdate, &TcpServer::route_trade_update>();
 }
 
 // Destructor
 TcpServer::~TcpServer() {
-    // Clean up resources
-    if (loop_) {
-        uv_loop_close(loop_);
-        free(loop_);
-    }
-    if (conn_mgr_) {
-        delete conn_mgr_;
-    }
+    // Stop consuming before the reactors receiving the responses go away
     kafka_manager_.stop_consuming();
+    reactors_.clear();
     LOG(INFO, "TcpServer destroyed");
 }
 
@@ -45,6 +64,20 @@ int TcpServer::init(ServerStartModel model) {
         return -1;
     }
 
+    // Load configuration
+    if (!ConfigManager::instance().load_config(".env")) {
+        LOG(ERROR, "Failed to load configuration");
+        return -1;
+    }
+    // Per-message logs are DEBUG, only written when asked for
+    Logger::set_level(ConfigManager::instance().get_bool("LOG_DEBUG", false) ? DEBUG : INFO);
+
+    int max_connections = ConfigManager::instance().get_int("GATEWAY_MAX_CONNECTIONS", MAX_SOCKET_NUM);
+    if (max_connections <= 0) {
+        LOG(ERROR, "Invalid GATEWAY_MAX_CONNECTIONS {}", max_connections);
+        return -1;
+    }
+
     struct rlimit rl;
     if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
         LOG(INFO, "Current file descriptor limit: soft={}, hard={}", rl.rlim_cur, rl.rlim_max);
@@ -62,123 +95,149 @@ int TcpServer::init(ServerStartModel model) {
             LOG(INFO, "Updated file descriptor limit: soft={}, hard={}", rl.rlim_cur, rl.rlim_max);
         }
         
-        if (rl.rlim_cur < MAX_SOCKET_NUM) {
-            LOG(ERROR, "Current file descriptor limit ({}) is less than MAX_SOCKET_NUM ({}).", rl.rlim_cur, MAX_SOCKET_NUM);
+        rlim_t needed = static_cast<rlim_t>(max_connections) + RESERVED_FD_NUM;
+        if (rl.rlim_cur < needed) {
+            LOG(ERROR, "Current file descriptor limit ({}) is less than GATEWAY_MAX_CONNECTIONS ({}) plus {} reserved.",
+                rl.rlim_cur, max_connections, RESERVED_FD_NUM);
         }
     } else {
         LOG(ERROR, "Failed to get file descriptor limit: {}", strerror(errno));
     }
 
-    // Load configuration
-    if (!ConfigManager::instance().load_config(".env")) {
-        LOG(ERROR, "Failed to load configuration");
-        return -1;
-    }
-
     // Set up signal handlers
     signal(SIGINT, TcpServer::signal_handler);
     signal(SIGTERM, TcpServer::signal_handler);
     signal(SIGUSR1, TcpServer::sigusr1_handle);
     signal(SIGUSR2, TcpServer::sigusr2_handle);
 
-    // Initialize libuv loop
-    loop_ = (uv_loop_t*)malloc(sizeof(uv_loop_t));
-    if (!loop_) {
-        LOG(ERROR, "Failed to allocate memory for uv_loop_t");
-        return -1;
-    }
-    if (uv_loop_init(loop_) != 0) {
-        LOG(ERROR, "Failed to initialize uv loop");
+    // Initialize reactor shards, each with its own loop, listener and connection table
+    std::string ip = ConfigManager::instance().get_string("GATEWAY_SERVER_IP", "0.0.0.0");
+    int port = ConfigManager::instance().get_int("GATEWAY_SERVER_PORT", 9000);
+    int reactor_num = ConfigManager::instance().get_int("GATEWAY_REACTOR_NUM", 1);
+    if (reactor_num < 1 || reactor_num > MAX_REACTOR_NUM) {
+        LOG(ERROR, "Invalid GATEWAY_REACTOR_NUM {}, must be in [1, {}]", reactor_num, MAX_REACTOR_NUM);
         return -1;
     }
-
-    // Initialize TCP server
-    if (uv_tcp_init(loop_, &server_) != 0) {
-        LOG(ERROR, "Failed to initialize TCP server");
+    // Take over the listeners and clients of a running gateway, if there is one
+    upgrade_path_ = FdHandover::socket_path();
+    std::vector<HandoverShard> handover;
+    int handover_ret = FdHandover::receive(upgrade_path_, reactor_num, max_connections, handover);
+    if (handover_ret < 0) {
+        LOG(ERROR, "Hot upgrade from the running gateway failed");
         return -1;
     }
-
-    // Initialize connection manager
-    conn_mgr_ = TcpConnectMgr::create_instance();
-    if (conn_mgr_ == nullptr) {
-        LOG(ERROR, "Failed to create TcpConnectMgr instance");
+    // Only one gateway may touch the shared state, a handed over one waits for the old process to exit
+    if (lock_instance(handover_ret == 1) != 0) {
+        FdHandover::close_fds(handover);
         return -1;
     }
-    if (conn_mgr_->init() != 0) {
-        LOG(ERROR, "Failed to initialize TcpConnectMgr");
-        return -1;
-    }
-
-    // Store connection manager in loop data for easy access in callbacks
-    loop_->data = conn_mgr_;
-
-    // Bind server to address
-    struct sockaddr_in addr;
-    std::string ip = ConfigManager::instance().get_string("GATEWAY_SERVER_IP", "0.0.0.0");
-    int port = ConfigManager::instance().get_int("GATEWAY_SERVER_PORT", 9000);
-    uv_ip4_addr(ip.c_str(), port, &addr);
-    if (uv_tcp_bind(&server_, (const struct sockaddr*)&addr, 0) != 0) {
-        LOG(ERROR, "Failed to bind server");
-        return -1;
+    for (int i = 0; i < static_cast<int>(handover.size()); ++i) {
+        if (handover[i].shard_id != i) {
+            LOG(ERROR, "Handed over shard {} arrived as shard {}", handover[i].shard_id, i);
+            FdHandover::close_fds(handover);
+            return -1;
+        }
     }
 
-    // Start listening for connections
-    if (uv_listen((uv_stream_t*)&server_, SOMAXCONN, on_new_connection) != 0) {
-        LOG(ERROR, "Failed to start listening");
-        return -1;
+    // The kernel spreads accepts evenly over the listeners, so each shard gets an equal share
+    int shard_connections = (max_connections + reactor_num - 1) / reactor_num;
+    for (int i = 0; i < reactor_num; ++i) {
+        auto reactor = std::make_unique<GatewayReactor>(i);
+        if (reactor->init(ip, port, shard_connections, handover_ret == 1 ? &handover[i] : nullptr) != 0) {
+            LOG(ERROR, "Failed to initialize reactor {}", i);
+            FdHandover::close_fds(handover);
+            return -1;
+        }
+        reactors_.push_back(std::move(reactor));
     }
+    FdHandover::close_fds(handover);  // Sockets no reactor could adopt
+    loop_ = reactors_[0]->get_loop();
 
     // Initialize the async handle for signal processing
     uv_async_init(loop_, &async_handle_, on_async);
     async_handle_.data = this;
 
-    // Initialize the timer for periodic checks
-    uv_timer_init(loop_, &check_timer_);
-    check_timer_.data = this;
-
-    // Start the timer to run every 100ms
-    uv_timer_start(&check_timer_, on_timer, 100, 100);
+    // Initialize the timer for the statistics rollup
+    uv_timer_init(loop_, &stats_timer_);
+    stats_timer_.data = this;
+    uv_timer_start(&stats_timer_, on_stats_timer, STATS_INTERVAL * 1000, STATS_INTERVAL * 1000);
 
     // Initialize KafkaManager
     if (!kafka_manager_.init(
         ConfigManager::instance().get_string("KAFKA_BOOTSTRAP_SERVERS"),
         ConfigManager::instance().get_string("KAFKA_USERNAME"),
-        ConfigManager::instance().get_string("KAFKA_PASSWORD"))) {
+        ConfigManager::instance().get_string("KAFKA_PASSWORD"),
+        reactor_num)) {
         LOG(ERROR, "Failed to initialize Kafka manager");
         return -1;
     }
 
-    // Start consuming from the order response topic
-    if (!kafka_manager_.start_consuming({ConfigManager::instance().get_string("ORDER_TO_GATEWAY_TOPIC")}, 
+    // Start consuming from the order response topic and the optional market data topic,
+    // driven by the main loop instead of a thread
+    std::vector<std::string> topics = {ConfigManager::instance().get_string("ORDER_TO_GATEWAY_TOPIC")};
+    std::string market_data_topic = ConfigManager::instance().get_string("MARKET_DATA_TOPIC", "");
+    if (!market_data_topic.empty()) {
+        topics.push_back(market_data_topic);
+    }
+    int arena_block = ConfigManager::instance().get_int("GATEWAY_DECODE_ARENA_BLOCK",
+                                                        static_cast<int>(DECODE_ARENA_BLOCK_SIZE));
+    if (!kafka_manager_.start_consuming(topics, 
         ConfigManager::instance().get_string("GATEWAY_KAFKA_CONSUMER_GROUP_ID"), 
-        [this](const google::protobuf::Message& message) {
-            this->handle_kafka_message(message);
-        })) {
+        [this](MsgId msg_id, const google::protobuf::Message& message) {
+            this->handle_kafka_message(msg_id, message);
+        }, false, std::max(arena_block, 0))) {
         LOG(ERROR, "Failed to start consuming Kafka messages");
         return -1;
     }
 
-    LOG(INFO, "Server initialized successfully");
+    // Wake the main loop as soon as responses arrive
+    int kafka_fd = kafka_manager_.enable_queue_event();
+    if (kafka_fd < 0) {
+        LOG(ERROR, "Failed to enable Kafka queue events");
+        return -1;
+    }
+    uv_poll_init(loop_, &kafka_poll_, kafka_fd);
+    kafka_poll_.data = this;
+    uv_poll_start(&kafka_poll_, UV_READABLE, on_kafka_event);
+
+    uv_timer_init(loop_, &kafka_timer_);
+    kafka_timer_.data = this;
+    uv_timer_start(&kafka_timer_, on_kafka_timer, KAFKA_POLL_INTERVAL, KAFKA_POLL_INTERVAL);
+
+    uv_async_init(loop_, &handover_async_, on_handover_done);
+    handover_async_.data = this;
+    if (init_upgrade_listener() != 0) {
+        return -1;
+    }
+
+    // The admin port shares the main loop with reactor 0, a scrape only copies counters and a cached response
+    rollup_base_.assign(reactors_.size(), StatisticsSnapshot());
+    metrics_server_.init(loop_, ConfigManager::instance().get_string("GATEWAY_METRICS_IP", "127.0.0.1"),
+                         ConfigManager::instance().get_int("GATEWAY_METRICS_PORT", 0),
+                         ConfigManager::instance().get_int("GATEWAY_METRICS_REFRESH_MS", METRICS_REFRESH_MS),
+                         [this](std::string& out) { render_metrics(out); });
+
+    // Reactor 0 runs on the main thread in run(), the others get their own threads
+    for (int i = 1; i < reactor_num; ++i) {
+        reactors_[i]->start_thread();
+    }
+
+    LOG(INFO, "Server initialized successfully, reactors: {}", reactor_num);
     return 0;
 }
 
 // Run the server main loop
 void TcpServer::run() {
     LOG(INFO, "Starting server main loop");
+    reactors_[0]->bind_cpu();
     try {
         while (run_flag_ != TCP_EXIT) {
             try {
-                // Run the event loop
-                int result = uv_run(loop_, UV_RUN_NOWAIT);
+                // Run the main reactor loop, it returns on uv_stop, or on stop() in busy-poll mode
+                int result = reactors_[0]->run_loop();
                 if (result < 0) {
                     LOG(ERROR, "uv_run returned with error: {}", uv_strerror(result));
                 }
-
-                // Process Kafka messages
-                kafka_manager_.process_messages();
-
-                // Small sleep to prevent CPU hogging
-                std::this_thread::sleep_for(std::chrono::milliseconds(10));
             } catch (const std::exception& e) {
                 LOG(ERROR, "Exception in server loop iteration: {}", e.what());
             } catch (...) {
@@ -190,42 +249,212 @@ void TcpServer::run() {
     } catch (...) {
         LOG(ERROR, "Unknown exception in server main loop");
     }
+
+    // Wait for the other reactors to exit their loops
+    for (auto& reactor : reactors_) {
+        reactor->stop();
+        reactor->join();
+    }
     LOG(INFO, "Server main loop ended");
 }
 
-// Handle incoming Kafka messages
-void TcpServer::handle_kafka_message(const google::protobuf::Message& message) {
-    if (const auto* login_res = dynamic_cast<const cspkg::AccountLoginRes*>(&message)) {
-        handle_login_response(*login_res);
-    } else if (const auto* order_res = dynamic_cast<const cs_proto::OrderResponse*>(&message)) {
-        handle_order_response(*order_res);
-    } else {
-        LOG(ERROR, "Received unknown message type");
+// Kafka consumer queue became readable
+void TcpServer::on_kafka_event(uv_poll_t* handle, int status, int events) {
+    (void)events;
+    if (status < 0) {
+        LOG(ERROR, "Kafka queue event error: {}", uv_strerror(status));
+        return;
     }
+    TcpServer* server = static_cast<TcpServer*>(handle->data);
+    server->process_kafka_messages();
+}
+
+// Kafka housekeeping timer
+void TcpServer::on_kafka_timer(uv_timer_t* handle) {
+    TcpServer* server = static_cast<TcpServer*>(handle->data);
+    server->process_kafka_messages();
+}
+
+// Drain the consumer queue, a capped drain continues on the next loop iteration
+// because no new wakeup is written while the queue stays non-empty
+void TcpServer::process_kafka_messages() {
+    int processed = kafka_manager_.process_messages(KAFKA_MAX_BATCH);
+    int timeout = processed >= KAFKA_MAX_BATCH ? 0 : KAFKA_POLL_INTERVAL;
+    uv_timer_start(&kafka_timer_, on_kafka_timer, timeout, KAFKA_POLL_INTERVAL);
+}
+
+// Listen for a new gateway process asking to take over
+int TcpServer::init_upgrade_listener() {
+    if (upgrade_path_.empty()) {
+        return 0;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (upgrade_path_.size() >= sizeof(addr.sun_path)) {
+        LOG(ERROR, "Upgrade socket path too long: {}", upgrade_path_);
+        return -1;
+    }
+    strncpy(addr.sun_path, upgrade_path_.c_str(), sizeof(addr.sun_path) - 1);
+
+    // The path is left behind by the previous process, or by one that died
+    unlink(upgrade_path_.c_str());
+    upgrade_listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (upgrade_listen_fd_ < 0 || bind(upgrade_listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(upgrade_listen_fd_, 1) != 0) {
+        LOG(ERROR, "Failed to listen on upgrade socket {}: {}", upgrade_path_, strerror(errno));
+        return -1;
+    }
+
+    uv_poll_init(loop_, &upgrade_poll_, upgrade_listen_fd_);
+    upgrade_poll_.data = this;
+    uv_poll_start(&upgrade_poll_, UV_READABLE, on_upgrade_request);
+    LOG(INFO, "Listening for hot upgrade on {}", upgrade_path_);
+    return 0;
 }
 
-// Handle login response
-void TcpServer::handle_login_response(const cspkg::AccountLoginRes& login_res) {
-    uv_tcp_t* client = conn_mgr_->get_client_by_account(login_res.account());
-    if (client) {
-        std::string encoded_response = TcpCode::encode(login_res);
-        TcpConnectMgr::tcp_send_data((uv_stream_t*)client, encoded_response.c_str(), encoded_response.size());
-        LOG(INFO, "Sent login response to client for account: {}, length: {}, client: {}",
-            login_res.account(), encoded_response.size(), login_res.client_id());
+void TcpServer::close_upgrade_listener() {
+    if (upgrade_listen_fd_ < 0) {
+        return;
+    }
+    uv_close((uv_handle_t*)&upgrade_poll_, nullptr);
+    close(upgrade_listen_fd_);
+    upgrade_listen_fd_ = -1;
+    if (!handed_over_) {
+        unlink(upgrade_path_.c_str());
+    }
+}
+
+// A new gateway process connected to the upgrade socket
+void TcpServer::on_upgrade_request(uv_poll_t* handle, int status, int events) {
+    (void)events;
+    TcpServer* server = static_cast<TcpServer*>(handle->data);
+    if (status < 0) {
+        LOG(ERROR, "Upgrade socket error: {}", uv_strerror(status));
+        return;
+    }
+
+    int sock = accept4(server->upgrade_listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (sock < 0) {
+        return;
+    }
+    if (server->upgrade_sock_ >= 0) {
+        LOG(ERROR, "Handover already in progress, refusing another upgrade request");
+        close(sock);
+        return;
+    }
+
+    // Client ids carry the shard and the state tables are sized per shard, so both must match
+    int reactor_num = 0;
+    int max_connections = 0;
+    int own_max_connections = ConfigManager::instance().get_int("GATEWAY_MAX_CONNECTIONS", MAX_SOCKET_NUM);
+    if (FdHandover::recv_request(sock, reactor_num, max_connections) != 0) {
+        close(sock);
+        return;
+    }
+    if (reactor_num != static_cast<int>(server->reactors_.size()) || max_connections != own_max_connections) {
+        LOG(ERROR, "Refusing hot upgrade: new process has {} reactors and capacity {}, this one {} and {}",
+            reactor_num, max_connections, server->reactors_.size(), own_max_connections);
+        FdHandover::send_reject(sock);
+        close(sock);
+        return;
+    }
+
+    LOG(INFO, "Starting hot upgrade handover of {} reactors", server->reactors_.size());
+    server->upgrade_sock_ = sock;
+    uv_poll_stop(&server->upgrade_poll_);
+    // The new process binds the admin port once it has the sockets
+    server->metrics_server_.close();
+
+    // Responses not consumed yet are left to the new process, committed offsets mark where it starts
+    uv_poll_stop(&server->kafka_poll_);
+    uv_timer_stop(&server->kafka_timer_);
+    server->kafka_manager_.stop_consuming();
+
+    for (auto& reactor : server->reactors_) {
+        reactor->request_handover(&server->handover_async_);
+    }
+}
+
+// A reactor finished exporting, send everything once all of them are done
+void TcpServer::on_handover_done(uv_async_t* handle) {
+    TcpServer* server = static_cast<TcpServer*>(handle->data);
+    for (auto& reactor : server->reactors_) {
+        if (!reactor->handover_ready()) {
+            return;
+        }
+    }
+
+    std::vector<HandoverShard> shards;
+    for (auto& reactor : server->reactors_) {
+        shards.push_back(std::move(reactor->get_handover()));
+    }
+    if (FdHandover::send(server->upgrade_sock_, shards) == 0) {
+        server->handed_over_ = true;
+        LOG(INFO, "Hot upgrade handover complete, exiting");
     } else {
-        LOG(ERROR, "Client not found for account: {}", login_res.account());
+        LOG(ERROR, "Hot upgrade handover failed, the handed over clients are disconnected");
     }
+    FdHandover::close_fds(shards);
+    close(server->upgrade_sock_);
+    server->upgrade_sock_ = -1;
+    server->stop();
 }
 
-// Handle order response
-void TcpServer::handle_order_response(const cs_proto::OrderResponse& order_res) {
-    uv_tcp_t* client = conn_mgr_->get_client_by_index(order_res.client_id());
-    if (client) {
-        std::string encoded_response = TcpCode::encode(order_res);
-        TcpConnectMgr::tcp_send_data((uv_stream_t*)client, encoded_response.c_str(), encoded_response.size());
-        LOG(INFO, "Sent order response to client: {}, length: {}", order_res.client_id(), encoded_response.size());
+// Handle incoming Kafka messages, called on the main loop thread
+void TcpServer::handle_kafka_message(MsgId msg_id, const google::protobuf::Message& message) {
+    if (!kafka_dispatcher_.dispatch(this, msg_id, message, msg_id)) {
+        LOG(ERROR, "Received unexpected message type {}", message.GetTypeName());
+    }
+}
+
+void TcpServer::route_login_response(const cspkg::AccountLoginRes& login_res, MsgId msg_id) {
+    route_response(login_res.client_id(), msg_id, login_res);
+}
+
+void TcpServer::route_order_response(const cs_proto::OrderResponse& order_res, MsgId msg_id) {
+    route_response(order_res.client_id(), msg_id, order_res);
+}
+
+void TcpServer::route_response(int client_id, MsgId msg_id, const google::protobuf::Message& message) {
+    size_t shard = client_id_shard(client_id);
+    if (shard >= reactors_.size()) {
+        LOG(ERROR, "No reactor for shard {}, client: {}", shard, client_id);
+        return;
+    }
+
+    // The main reactor shares this thread, the others are handed the message through their inbox
+    if (shard == 0) {
+        reactors_[0]->dispatch_message(msg_id, message);
     } else {
-        LOG(ERROR, "Client not found for index: {}", order_res.client_id());
+        reactors_[shard]->post_message(msg_id, message);
+    }
+}
+
+void TcpServer::route_book_update(const cs_proto::BookUpdate& update, MsgId msg_id) {
+    route_market_data(update.symbol(), msg_id, update);
+}
+
+void TcpServer::route_trade_update(const cs_proto::TradeUpdate& update, MsgId msg_id) {
+    route_market_data(update.symbol(), msg_id, update);
+}
+
+void TcpServer::route_market_data(const std::string& symbol, MsgId msg_id, const google::protobuf::Message& message) {
+    SharedFrames frames;
+    frames[WIRE_FORMAT_TCPCODE] = SharedBuf::encode(message, WIRE_FORMAT_TCPCODE);
+    frames[WIRE_FORMAT_BINARY] = SharedBuf::encode(message, WIRE_FORMAT_BINARY);
+    if (frames[WIRE_FORMAT_TCPCODE] != nullptr && frames[WIRE_FORMAT_BINARY] != nullptr) {
+        // Every reactor writes the same bytes, the last reference dropped frees them
+        reactors_[0]->broadcast(symbol, msg_id, frames);
+        for (size_t shard = 1; shard < reactors_.size(); ++shard) {
+            reactors_[shard]->post_broadcast(symbol, msg_id, frames);
+        }
+    }
+    for (SharedBuf* buf : frames) {
+        if (buf != nullptr) {
+            buf->release();
+        }
     }
 }
 
@@ -247,10 +476,10 @@ void TcpServer::on_async(uv_async_t* handle) {
     server->process_run_flag();
 }
 
-// Timer handler
-void TcpServer::on_timer(uv_timer_t* handle) {
+// Statistics timer handler
+void TcpServer::on_stats_timer(uv_timer_t* handle) {
     TcpServer* server = static_cast<TcpServer*>(handle->data);
-    server->perform_periodic_checks();
+    server->log_statistics();
 }
 
 // Process server running flag
@@ -263,7 +492,14 @@ void TcpServer::process_run_flag() {
             break;
         case TCP_EXIT:
             LOG(INFO, "Exiting server...");
-            uv_timer_stop(&check_timer_);
+            uv_timer_stop(&stats_timer_);
+            uv_timer_stop(&kafka_timer_);
+            uv_poll_stop(&kafka_poll_);
+            metrics_server_.close();
+            close_upgrade_listener();
+            for (auto& reactor : reactors_) {
+                reactor->stop();
+            }
             uv_stop(loop_);
             break;
         default:
@@ -271,47 +507,218 @@ void TcpServer::process_run_flag() {
     }
 }
 
-// Perform periodic checks
-void TcpServer::perform_periodic_checks() {
-    // Perform periodic checks on TcpConnectMgr
-    conn_mgr_->check_wait_send_data();
-    conn_mgr_->check_timeout();
-}
-
-// Handle new connections
-void TcpServer::on_new_connection(uv_stream_t* server, int status) {
-    if (status < 0) {
-        LOG(ERROR, "New connection error: {}", uv_strerror(status));
-        return;
+// Log per-shard statistics and the rollup over all shards
+void TcpServer::log_statistics() {
+    StatisticsSnapshot total = {};
+    double max_shard_rate = 0;
+    uint64_t pool_slab_bytes = 0;
+    uint64_t pool_in_use = 0;
+    uint64_t pool_in_use_bytes = 0;
+    uint64_t pool_exhausted = 0;
+    uint64_t recv_rings = 0;
+    uint64_t recv_ring_bytes = 0;
+    uint64_t recv_cached_bytes = 0;
+    uint64_t arena_resets = 0;
+    uint64_t arena_used_bytes = 0;
+    uint64_t arena_overflow_bytes = 0;
+    for (auto& reactor : reactors_) {
+        // Counters only grow, the interval is the difference to the previous rollup
+        StatisticsSnapshot& base = rollup_base_[&reactor - &reactors_[0]];
+        StatisticsSnapshot current = reactor->get_conn_mgr()->get_statistics_manager().end_interval();
+        StatisticsSnapshot snap = current;
+        snap.subtract(base);
+        base = current;
+        double shard_rate = snap.elapsed_seconds > 0 ? snap.received_packages / snap.elapsed_seconds : 0;
+        max_shard_rate = std::max(max_shard_rate, shard_rate);
+        LOG(INFO, "Shard {}: received {} ({:.2f} pkg/s), sent {}, active connections {}",
+            reactor->shard_id(), snap.received_packages, shard_rate, snap.sent_packages, snap.active_connections);
+
+        total.merge(snap);
+
+        const WriteBufPool& pool = reactor->get_conn_mgr()->get_write_pool();
+        pool_slab_bytes += pool.slab_bytes();
+        pool_in_use += pool.in_use();
+        pool_in_use_bytes += pool.in_use_bytes();
+        pool_exhausted += pool.exhausted();
+
+        const RecvRingPool& recv_pool = reactor->get_conn_mgr()->get_recv_pool();
+        recv_rings += recv_pool.in_use();
+        recv_ring_bytes += recv_pool.in_use_bytes();
+        recv_cached_bytes += recv_pool.cached_bytes();
+
+        const DecodeArena& arena = reactor->get_conn_mgr()->get_decode_arena();
+        arena_resets += arena.resets();
+        arena_used_bytes += arena.used_bytes();
+        arena_overflow_bytes += arena.overflow_bytes();
     }
 
-    LOG(INFO, "New connection received");
-
-    TcpConnectMgr* conn_mgr = static_cast<TcpConnectMgr*>(server->loop->data);
+    // Scaling efficiency compares the total rate with every shard running at the busiest shard's rate
+    double total_rate = total.elapsed_seconds > 0 ? total.received_packages / total.elapsed_seconds : 0;
+    double efficiency = max_shard_rate > 0 ? total_rate / (max_shard_rate * reactors_.size()) : 0;
+    LOG(INFO, "Gateway Server Statistics ({} reactors):", reactors_.size());
+    LOG(INFO, "  Elapsed time: {:.2f} seconds", total.elapsed_seconds);
+    LOG(INFO, "  Received packages: {} (Rate: {:.2f} pkg/s, {:.2f} pkg/s per reactor)",
+        total.received_packages, total_rate, total_rate / reactors_.size());
+    LOG(INFO, "  Sent packages: {}", total.sent_packages);
+    LOG(INFO, "  Bytes received: {}, sent: {}", total.received_bytes, total.sent_bytes);
+    LOG(INFO, "  Active connections: {}", total.active_connections);
+    LOG(INFO, "  Total connections: {}", total.total_connections);
+    LOG(INFO, "  Scaling efficiency: {:.2f}", efficiency);
+    LOG(INFO, "  Send queue: {} bytes, deepest connection {} bytes", total.send_queue_bytes, total.max_send_queue_bytes);
+    LOG(INFO, "  Writes: {} ({:.2f} packages per write)", total.write_calls,
+        total.write_calls > 0 ? static_cast<double>(total.sent_packages) / total.write_calls : 0);
+    LOG(INFO, "  Slow consumer disconnects: {}", total.slow_consumer_disconnects);
+    LOG(INFO, "  Orders admitted: {}, rejected by connection limit: {}, account limit: {}, global limit: {}",
+        total.orders_admitted, total.orders_rejected[ORDER_REJECT_CONNECTION],
+        total.orders_rejected[ORDER_REJECT_ACCOUNT], total.orders_rejected[ORDER_REJECT_GLOBAL]);
+    LOG(INFO, "  Duplicate orders: {}, order response batches: {} ({:.2f} responses per batch)",
+        total.orders_duplicate, total.order_ack_batches,
+        total.order_ack_batches > 0 ? static_cast<double>(total.order_acks_batched) / total.order_ack_batches : 0);
+    LOG(INFO, "  Orders timed out: {}, untracked: {}, unmatched responses: {}",
+        total.orders_timed_out, total.orders_untracked, total.order_responses_unmatched);
+    LOG(INFO, "  Orders shed while busy: {}, connections paused: {}",
+        total.orders_rejected[ORDER_REJECT_INGRESS], total.ingress_pauses);
+    if (total.loop_iterations > 0) {
+        LOG(INFO, "  Busy-poll iterations: {}, average {} ns, max {} ns", total.loop_iterations,
+            total.loop_iteration_ns / total.loop_iterations, total.max_loop_iteration_ns);
+    }
+    if (total.md_updates > 0) {
+        LOG(INFO, "  Market data updates: {} shard deliveries, queued on {} subscribers, {} conflated",
+            total.md_updates, total.md_queued, total.md_conflated);
+    }
+    StatisticsManager::log_latency(total.latency);
+    LOG(INFO, "  Write buffer pool: {} slab bytes, {} buffers ({} bytes) in use, {} exhausted",
+        pool_slab_bytes, pool_in_use, pool_in_use_bytes, pool_exhausted);
+    LOG(INFO, "  Receive rings: {} held ({} bytes), {} bytes cached",
+        recv_rings, recv_ring_bytes, recv_cached_bytes);
+    // Cumulative since startup, blocks include the Kafka consumer's arena
+    LOG(INFO, "  Decode arenas: {} resets, {:.1f} bytes per reset, {} overflow bytes, {} blocks allocated",
+        arena_resets, arena_resets > 0 ? static_cast<double>(arena_used_bytes) / arena_resets : 0,
+        arena_overflow_bytes, DecodeArena::blocks_allocated());
+}
 
-    uv_tcp_t* client = (uv_tcp_t*)malloc(sizeof(uv_tcp_t));
-    if (uv_tcp_init(server->loop, client) != 0) {
-        LOG(ERROR, "Failed to initialize client connection");
-        free(client);
-        return;
+void TcpServer::render_metrics(std::string& out) {
+    // Latency buckets reported to Prometheus, in seconds and nanoseconds
+    static const struct {
+        const char* le;
+        uint64_t ns;
+    } LATENCY_BOUNDS[] = {
+        {"1e-06", 1000}, {"2.5e-06", 2500}, {"5e-06", 5000}, {"1e-05", 10000}, {"2.5e-05", 25000},
+        {"5e-05", 50000}, {"0.0001", 100000}, {"0.00025", 250000}, {"0.0005", 500000}, {"0.001", 1000000},
+        {"0.0025", 2500000}, {"0.005", 5000000}, {"0.01", 10000000}, {"0.025", 25000000}, {"0.05", 50000000},
+        {"0.1", 100000000}, {"0.25", 250000000}, {"0.5", 500000000}, {"1", 1000000000}, {"2.5", 2500000000},
+        {"5", 5000000000}, {"10", 10000000000},
+    };
+    static const char* const STAGE_LABELS[LATENCY_STAGE_NUM] = {
+        "accept", "recv_decode", "decode_kafka", "response_write", "order_response",
+    };
+    static const char* const REJECT_LABELS[ORDER_REJECT_SCOPE_NUM] = {"connection", "account", "global", "ingress"};
+
+    // Counters count from startup, gauges are current
+    size_t shard_num = reactors_.size();
+    std::vector<StatisticsSnapshot> current(shard_num);
+    for (size_t i = 0; i < shard_num; ++i) {
+        current[i] = reactors_[i]->get_conn_mgr()->get_statistics_manager().snapshot();
     }
 
-    if (uv_accept(server, (uv_stream_t*)client) == 0) {
-        conn_mgr->handle_new_connection(client);
-    } else {
-        LOG(ERROR, "Failed to accept new connection");
-        uv_close((uv_handle_t*)client, [](uv_handle_t* handle) {
-            free(handle);
-        });
+    auto out_it = std::back_inserter(out);
+    auto family = [&out_it](const char* name, const char* type, const char* help) {
+        fmt::format_to(out_it, "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+    };
+    auto per_shard = [&](const char* name, const char* type, const char* help, auto value) {
+        family(name, type, help);
+        for (size_t i = 0; i < shard_num; ++i) {
+            fmt::format_to(out_it, "{}{{shard=\"{}\"}} {}\n", name, reactors_[i]->shard_id(), value(i));
+        }
+    };
+
+    per_shard("gateway_connections", "gauge", "Open client connections.",
+              [&](size_t i) { return current[i].active_connections; });
+    per_shard("gateway_packets_received_total", "counter", "Packages decoded from clients.",
+              [&](size_t i) { return current[i].received_packages; });
+    per_shard("gateway_packets_sent_total", "counter", "Packages written to clients.",
+              [&](size_t i) { return current[i].sent_packages; });
+    per_shard("gateway_bytes_received_total", "counter", "Bytes read from clients.",
+              [&](size_t i) { return current[i].received_bytes; });
+    per_shard("gateway_bytes_sent_total", "counter", "Bytes written to clients.",
+              [&](size_t i) { return current[i].sent_bytes; });
+    per_shard("gateway_writes_total", "counter", "Batched socket writes.",
+              [&](size_t i) { return current[i].write_calls; });
+    per_shard("gateway_send_queue_bytes", "gauge", "Bytes queued for clients and not written yet.",
+              [&](size_t i) { return current[i].send_queue_bytes; });
+    per_shard("gateway_send_queue_max_bytes", "gauge", "Deepest send queue of one connection in the current interval.",
+              [&](size_t i) { return current[i].max_send_queue_bytes; });
+    per_shard("gateway_slow_consumer_disconnects_total", "counter", "Clients disconnected for a full send queue.",
+              [&](size_t i) { return current[i].slow_consumer_disconnects; });
+    per_shard("gateway_orders_admitted_total", "counter", "Orders forwarded to Kafka.",
+              [&](size_t i) { return current[i].orders_admitted; });
+    per_shard("gateway_orders_duplicate_total", "counter", "Orders dropped for a client sequence already seen.",
+              [&](size_t i) { return current[i].orders_duplicate; });
+    per_shard("gateway_orders_timed_out_total", "counter", "Orders rejected by the gateway after no response came in time.",
+              [&](size_t i) { return current[i].orders_timed_out; });
+    per_shard("gateway_orders_untracked_total", "counter", "Orders forwarded without a response timeout.",
+              [&](size_t i) { return current[i].orders_untracked; });
+    per_shard("gateway_order_responses_unmatched_total", "counter", "Order responses that matched no order in flight.",
+              [&](size_t i) { return current[i].order_responses_unmatched; });
+    per_shard("gateway_inflight_orders", "gauge", "Orders waiting for their response.",
+              [&](size_t i) { return reactors_[i]->get_conn_mgr()->inflight_order_count(); });
+    per_shard("gateway_ingress_depth", "gauge", "Requests decoded and not yet delivered to Kafka.",
+              [&](size_t i) { return kafka_manager_.ingress_depth(reactors_[i]->shard_id()); });
+    per_shard("gateway_ingress_paused_connections", "gauge", "Connections not read while the ingress stage drains.",
+              [&](size_t i) { return reactors_[i]->get_conn_mgr()->ingress_paused_count(); });
+    per_shard("gateway_ingress_pauses_total", "counter", "Connections paused because the ingress stage was full.",
+              [&](size_t i) { return current[i].ingress_pauses; });
+    per_shard("gateway_md_updates_total", "counter", "Market data updates broadcast.",
+              [&](size_t i) { return current[i].md_updates; });
+    per_shard("gateway_md_conflated_total", "counter", "Pending market data updates replaced by a newer one.",
+              [&](size_t i) { return current[i].md_conflated; });
+    per_shard("gateway_write_pool_bytes", "gauge", "Send buffer memory in use.",
+              [&](size_t i) { return reactors_[i]->get_conn_mgr()->get_write_pool().in_use_bytes(); });
+    per_shard("gateway_recv_ring_bytes", "gauge", "Receive ring memory held by connections.",
+              [&](size_t i) { return reactors_[i]->get_conn_mgr()->get_recv_pool().in_use_bytes(); });
+    per_shard("gateway_decode_arena_resets_total", "counter", "Reads whose decoded requests were released together.",
+              [&](size_t i) { return reactors_[i]->get_conn_mgr()->get_decode_arena().resets(); });
+    per_shard("gateway_decode_arena_bytes_total", "counter", "Arena bytes taken by decoded requests.",
+              [&](size_t i) { return reactors_[i]->get_conn_mgr()->get_decode_arena().used_bytes(); });
+    per_shard("gateway_decode_arena_overflow_bytes_total", "counter",
+              "Arena bytes allocated beyond the first block for large reads.",
+              [&](size_t i) { return reactors_[i]->get_conn_mgr()->get_decode_arena().overflow_bytes(); });
+
+    family("gateway_orders_rejected_total", "counter", "Orders rejected at admission, by the limit they exceeded.");
+    for (int scope = 0; scope < ORDER_REJECT_SCOPE_NUM; ++scope) {
+        for (size_t i = 0; i < shard_num; ++i) {
+            fmt::format_to(out_it, "gateway_orders_rejected_total{{shard=\"{}\",limit=\"{}\"}} {}\n",
+                           reactors_[i]->shard_id(), REJECT_LABELS[scope], current[i].orders_rejected[scope]);
+        }
     }
-}
 
-// Handle connection closure
-void TcpServer::on_close(uv_handle_t* handle) {
-    TcpConnectMgr* conn_mgr = static_cast<TcpConnectMgr*>(handle->loop->data);
-    conn_mgr->remove_connection((uv_tcp_t*)handle);
-    free(handle);
-    LOG(INFO, "Connection closed. Total connections: {}", conn_mgr->get_connection_count());
+    family("gateway_kafka_produce_failures_total", "counter", "Kafka records the producer refused.");
+    fmt::format_to(out_it, "gateway_kafka_produce_failures_total {}\n", kafka_manager_.produce_failures());
+    family("gateway_kafka_delivery_failures_total", "counter", "Kafka records the brokers did not take.");
+    fmt::format_to(out_it, "gateway_kafka_delivery_failures_total {}\n", kafka_manager_.delivery_failures());
+    family("gateway_kafka_decode_arena_bytes_total", "counter", "Arena bytes taken by decoded Kafka messages.");
+    fmt::format_to(out_it, "gateway_kafka_decode_arena_bytes_total {}\n", kafka_manager_.decode_arena().used_bytes());
+    family("gateway_decode_arena_blocks_total", "counter", "Arena blocks allocated beyond the reused first blocks.");
+    fmt::format_to(out_it, "gateway_decode_arena_blocks_total {}\n", DecodeArena::blocks_allocated());
+
+    family("gateway_latency_seconds", "histogram", "Latency of each gateway pipeline stage.");
+    for (int stage = 0; stage < LATENCY_STAGE_NUM; ++stage) {
+        for (size_t i = 0; i < shard_num; ++i) {
+            const LatencyCounts& counts = current[i].latency[stage];
+            int shard_id = reactors_[i]->shard_id();
+            for (const auto& bound : LATENCY_BOUNDS) {
+                fmt::format_to(out_it, "gateway_latency_seconds_bucket{{shard=\"{}\",stage=\"{}\",le=\"{}\"}} {}\n",
+                               shard_id, STAGE_LABELS[stage], bound.le, counts.count_at_most(bound.ns));
+            }
+            uint64_t count = counts.count_at_most(UINT64_MAX);
+            fmt::format_to(out_it, "gateway_latency_seconds_bucket{{shard=\"{}\",stage=\"{}\",le=\"+Inf\"}} {}\n",
+                           shard_id, STAGE_LABELS[stage], count);
+            fmt::format_to(out_it, "gateway_latency_seconds_sum{{shard=\"{}\",stage=\"{}\"}} {:.9f}\n",
+                           shard_id, STAGE_LABELS[stage], counts.sum_ns / 1e9);
+            fmt::format_to(out_it, "gateway_latency_seconds_count{{shard=\"{}\",stage=\"{}\"}} {}\n",
+                           shard_id, STAGE_LABELS[stage], count);
+        }
+    }
 }
 
 // Signal handler
@@ -336,18 +743,13 @@ void TcpServer::sigusr2_handle(int sigval) {
 
 // Initialize as daemon if required
 int TcpServer::init_daemon(ServerStartModel model) {
-    // Check if another instance is running
+    // Open the lock file before leaving the working directory, it is locked once the handover is done
     const char* lockFilePath = "./tcplock.lock";
-    int lock_fd = open(lockFilePath, O_RDWR | O_CREAT, 0640);
-    if (lock_fd < 0) {
+    lock_fd_ = open(lockFilePath, O_RDWR | O_CREAT | O_CLOEXEC, 0640);
+    if (lock_fd_ < 0) {
         LOG(ERROR, "Open lock file failed: {}", strerror(errno));
         return -1;
     }
-    if (flock(lock_fd, LOCK_EX | LOCK_NB) < 0) {
-        LOG(ERROR, "Lock file failed, another instance is running.");
-        close(lock_fd);
-        return -1;
-    }
 
     // Daemonize if requested
     if (model != SERVER_START_DAEMON) {
@@ -358,7 +760,6 @@ int TcpServer::init_daemon(ServerStartModel model) {
     pid_t pid = fork();
     if (pid < 0) {
         LOG(ERROR, "Fork failed: {}", strerror(errno));
-        close(lock_fd);
         return -1;
     } else if (pid > 0) {
         // Parent process exits
@@ -410,6 +811,20 @@ int TcpServer::init_daemon(ServerStartModel model) {
     return 0;
 }
 
+// Lock the instance lock file, waiting for the old process to exit after a handover
+int TcpServer::lock_instance(bool wait) {
+    int retries = wait ? HANDOVER_IO_TIMEOUT * 1000 / LOCK_RETRY_INTERVAL : 0;
+    while (flock(lock_fd_, LOCK_EX | LOCK_NB) < 0) {
+        if (errno != EWOULDBLOCK || retries-- <= 0) {
+            LOG(ERROR, wait ? "Lock file failed, the handing over gateway did not exit."
+                            : "Lock file failed, another instance is running.");
+            return -1;
+        }
+        usleep(LOCK_RETRY_INTERVAL * 1000);
+    }
+    return 0;
+}
+
 // Main function
 int main(int argc, char **argv) {
     (void)argc;
@@ -11,9 +11,13 @@
 
 #include <uv.h>
 #include <atomic>
+#include <memory>
 #include <string>
-#include "tcp_connect_mgr.h"
+#include <vector>
+#include "gateway_reactor.h"
+#include "metrics_server.h"
 #include "kafka_manager.h"
+#include "msg_registry.h"
 
 
 // Server start modes
@@ -49,7 +53,7 @@ public:
     // Stop the server
     void stop();
 
-    // Get the uv loop
+    // Get the uv loop of the main reactor
     uv_loop_t* get_loop() { return loop_; }
 
 private:
@@ -60,17 +64,17 @@ private:
     // Initialize the server as a daemon
     int init_daemon(ServerStartModel model);
 
+    // Take the instance lock, with wait set retry until the handing over process has exited
+    int lock_instance(bool wait);
+
     // Process the server running flag
     void process_run_flag();
 
-    // Perform periodic checks
-    void perform_periodic_checks();
-
-    // Callback for new connections
-    static void on_new_connection(uv_stream_t* server, int status);
+    // Log per-shard statistics and their rollup, then reset them
+    void log_statistics();
 
-    // Callback for connection closure
-    static void on_close(uv_handle_t* handle);
+    // Metrics in Prometheus text format, counters since startup and current gauges of every shard
+    void render_metrics(std::string& out);
 
     // Signal handlers
     static void signal_handler(int signum);
@@ -79,25 +83,63 @@ private:
 
     // Async and timer handlers
     static void on_async(uv_async_t* handle);
-    static void on_timer(uv_timer_t* handle);
+    static void on_stats_timer(uv_timer_t* handle);
+
+    // Kafka consumer queue wakeup and housekeeping handlers
+    static void on_kafka_event(uv_poll_t* handle, int status, int events);
+    static void on_kafka_timer(uv_timer_t* handle);
+
+    // Drain the Kafka consumer queue on the main loop
+    void process_kafka_messages();
+
+    // Hot upgrade: listen on the Unix socket a new gateway process connects to
+    int init_upgrade_listener();
+
+    // Hot upgrade: a new process asked for the sockets, and the reactors finished exporting them
+    static void on_upgrade_request(uv_poll_t* handle, int status, int events);
+    static void on_handover_done(uv_async_t* handle);
 
-    // Kafka message handling
-    void handle_kafka_message(const google::protobuf::Message& message);
+    // Hot upgrade: stop the listener, unlinking its path unless a new process owns it now
+    void close_upgrade_listener();
 
-    // Handle login response
-    void handle_login_response(const cspkg::AccountLoginRes& login_res);
+    // Kafka message handling, routes each response to the reactor owning its client
+    void handle_kafka_message(MsgId msg_id, const google::protobuf::Message& message);
 
-    // Handle order response
-    void handle_order_response(const cs_proto::OrderResponse& order_res);
+    // Per-type handlers, they only extract the client id used for routing
+    void route_login_response(const cspkg::AccountLoginRes& login_res, MsgId msg_id);
+    void route_order_response(const cs_proto::OrderResponse& order_res, MsgId msg_id);
+
+    // Hand a response to the reactor shard encoded in its client id
+    void route_response(int client_id, MsgId msg_id, const google::protobuf::Message& message);
+
+    // Market data goes to the subscribers of every shard, they only extract the symbol
+    void route_book_update(const cs_proto::BookUpdate& update, MsgId msg_id);
+    void route_trade_update(const cs_proto::TradeUpdate& update, MsgId msg_id);
+
+    // Encode a market data update once per framing and share the buffers with every reactor
+    void route_market_data(const std::string& symbol, MsgId msg_id, const google::protobuf::Message& message);
 
     uv_async_t async_handle_;  // Async handle for signal handling
-    uv_timer_t check_timer_;   // Timer for checking connections
+    uv_timer_t stats_timer_;   // Timer for statistics rollup
+    uv_poll_t kafka_poll_;     // Readable when the Kafka consumer queue becomes non-empty
+    uv_timer_t kafka_timer_;   // Serves consumer housekeeping and continues capped drains
 
-    uv_loop_t* loop_;   // Main event loop
-    uv_tcp_t server_;   // TCP server handle
-    TcpConnectMgr* conn_mgr_; // Connection manager
+    uv_loop_t* loop_;   // Event loop of the main reactor
+    std::vector<std::unique_ptr<GatewayReactor>> reactors_;  // Reactor shards, index 0 runs on the main thread
     std::atomic<SvrRunFlag> run_flag_;  // Server running flag
+    std::string upgrade_path_;   // Unix socket path for hot upgrade, empty if disabled
+    int upgrade_listen_fd_;      // Listening upgrade socket
+    int upgrade_sock_;           // Connection of the new process during a handover
+    bool handed_over_;           // Sockets were passed to a new process, which now owns upgrade_path_
+    int lock_fd_;                // Instance lock file, held until exit
+    uv_poll_t upgrade_poll_;     // Readable when a new process connects
+    uv_async_t handover_async_;  // Signalled by reactors that finished exporting
+
+    MetricsServer metrics_server_;  // Admin port serving render_metrics()
+    std::vector<StatisticsSnapshot> rollup_base_;  // Snapshot taken at the last rollup, per shard
+
     KafkaManager& kafka_manager_;  // Kafka message manager
+    MsgDispatcher<TcpServer, MsgId> kafka_dispatcher_;  // Routing handlers by message id
 };
 
 #endif  // _GATEWAY_SERVER_TCP_SERVER_H_
\ No newline at end of file
@@ -36,9 +36,10 @@ cs_proto::OrderResponse OrderProcessor::process_new_order(const cs_proto::Future
     cs_proto::OrderResponse response;
     response.set_order_id(order.order_id());
     response.set_client_id(order.client_id());
+    response.set_client_seq(order.client_seq());
 
     // Process the order (e.g., validate, apply business rules)
-    LOG(INFO, "Processing order: ID {}, Type {}, Quantity {}, Price {}",
+    LOG(DEBUG, "Processing order: ID {}, Type {}, Quantity {}, Price {}",
                 order.order_id(), order.type(), order.quantity(), order.price());
 
     // TODO: Implement order processing logic
@@ -58,7 +59,7 @@ cs_proto::OrderResponse OrderProcessor::process_new_order(const cs_proto::Future
 
 void OrderProcessor::send_order_to_matching(const cs_proto::FuturesOrder& order) {
     // kafka_manager_.produce("matching_orders_topic", order, order.client_id());
-    LOG(INFO, "Order sent to matching engine: Order ID {}, Client ID {}", order.order_id(), order.client_id());
+    LOG(DEBUG, "Order sent to matching engine: Order ID {}, Client ID {}", order.order_id(), order.client_id());
 }
 
 void OrderProcessor::match_orders() {
@@ -16,6 +16,8 @@ OrderServer::OrderServer()
       reload_config_(false),
       kafka_manager_(KafkaManager::instance()),
       order_processor_() {
+    dispatcher_.bind<cspkg::AccountLoginReq, &OrderServer::handle_login_request>();
+    dispatcher_.bind<cs_proto::FuturesOrder, &OrderServer::handle_futures_order>();
 }
 
 OrderServer::~OrderServer() {
@@ -38,6 +40,8 @@ int OrderServer::init(ServerStartModel model) {
         LOG(ERROR, "Failed to load configuration");
         return -1;
     }
+    // Per-message logs are DEBUG, only written when asked for
+    Logger::set_level(ConfigManager::instance().get_bool("LOG_DEBUG", false) ? DEBUG : INFO);
 
     // Set up signal handlers
     signal(SIGINT, OrderServer::signal_handler);
@@ -54,12 +58,13 @@ int OrderServer::init(ServerStartModel model) {
         return -1;
     }
 
-    // Start consuming from the new orders topic
+    // Start consuming from the new orders topic, driven by the main loop so the handlers
+    // append to the response batch on the same thread that flushes it
     if (!kafka_manager_.start_consuming({ConfigManager::instance().get_string("GATEWAY_TO_ORDER_TOPIC")}, 
         ConfigManager::instance().get_string("ORDER_KAFKA_CONSUMER_GROUP_ID"), 
-        [this](const google::protobuf::Message& message) {
-            this->handle_kafka_message(message);
-        })) {
+        [this](MsgId msg_id, const google::protobuf::Message& message) {
+            this->handle_kafka_message(msg_id, message);
+        }, false)) {
         LOG(ERROR, "Failed to start consuming Kafka messages");
         return -1;
     }
@@ -82,8 +87,9 @@ void OrderServer::run() {
         // Process run flag
         process_run_flag();
 
-        // Process incoming Kafka messages
+        // Process incoming Kafka messages, their responses go out as one batch
         kafka_manager_.process_messages();
+        kafka_manager_.flush_batches();
         
         // Process pending orders
         order_processor_.process_orders();
@@ -94,13 +100,9 @@ void OrderServer::run() {
     LOG(INFO, "Order server main loop ended");
 }
 
-void OrderServer::handle_kafka_message(const google::protobuf::Message& message) {
-    if (const auto* login_req = dynamic_cast<const cspkg::AccountLoginReq*>(&message)) {
-        handle_login_request(*login_req);
-    } else if (const auto* order = dynamic_cast<const cs_proto::FuturesOrder*>(&message)) {
-        handle_futures_order(*order);
-    } else {
-        LOG(ERROR, "Received unknown message type");
+void OrderServer::handle_kafka_message(MsgId msg_id, const google::protobuf::Message& message) {
+    if (!dispatcher_.dispatch(this, msg_id, message)) {
+        LOG(ERROR, "Received unexpected message type {}", message.GetTypeName());
     }
 }
 
@@ -109,8 +111,8 @@ void OrderServer::handle_login_request(const cspkg::AccountLoginReq& login_req)
     cspkg::AccountLoginRes login_res = order_processor_.validate_login(login_req);
 
     // Send login response back to gateway_server
-    if (kafka_manager_.produce(order_to_gateway_topic_, login_res, login_req.client_id())) {
-        LOG(INFO, "Sent AccountLoginRes to Kafka for account {}, client {}", login_req.account(), login_req.client_id());
+    if (kafka_manager_.append_batch(order_to_gateway_topic_, login_res, login_req.client_id())) {
+        LOG(INFO, "Queued AccountLoginRes to Kafka for account {}, client {}", login_req.account(), login_req.client_id());
     } else {
         LOG(ERROR, "Failed to send AccountLoginRes to Kafka for account {}, client {}", login_req.account(), login_req.client_id());
     }
@@ -126,8 +128,8 @@ void OrderServer::handle_futures_order(const cs_proto::FuturesOrder& order) {
     cs_proto::OrderResponse response = order_processor_.process_new_order(order);
     
     // Send the response back to gateway_server via Kafka
-    if (kafka_manager_.produce(order_to_gateway_topic_, response, order.client_id())) {
-        LOG(INFO, "Sent response to Kafka for client {}", order.client_id());
+    if (kafka_manager_.append_batch(order_to_gateway_topic_, response, order.client_id())) {
+        LOG(DEBUG, "Queued response to Kafka for client {}", order.client_id());
     } else {
         LOG(ERROR, "Failed to send response to Kafka for client {}", order.client_id());
     }
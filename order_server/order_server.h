@@ -53,7 +53,7 @@ private:
     void process_run_flag();
     
     // Handle incoming Kafka messages
-    void handle_kafka_message(const google::protobuf::Message& message);
+    void handle_kafka_message(MsgId msg_id, const google::protobuf::Message& message);
 
     // Handle login request
     void handle_login_request(const cspkg::AccountLoginReq& login_req);
@@ -69,6 +69,7 @@ private:
     KafkaManager& kafka_manager_;      // Kafka manager instance
     OrderProcessor order_processor_;   // Order processor instance
     std::string order_to_gateway_topic_;  // Kafka topic for order messages
+    MsgDispatcher<OrderServer> dispatcher_;  // Request handlers by message id
 };
 
 #endif // _ORDER_SERVER_ORDER_SERVER_H_
\ No newline at end of file